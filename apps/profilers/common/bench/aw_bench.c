@@ -0,0 +1,497 @@
+/*
+ * Stress test and throughput of async_writer
+ *
+ * Usage: aw_bench [--mb N] [--threads N] [--dir PATH]
+ *
+ * Writes files under --dir and reads them back, counting every mismatch:
+ *
+ *   queue        --threads producers share one writer through the buffer
+ *                interface, filling buffers with checked records of
+ *                (producer, sequence); every record must be in the file
+ *                exactly once, untorn, and each producer's in order. Run
+ *                with the write() and default (io_uring when available)
+ *                backends, without an I/O thread, and with events that
+ *                poll and return early the way memcount's DynamoRIO ones
+ *                do (aw_set_default_sync)
+ *   stream       chunks of random length through aw_write() must read
+ *                back byte for byte, with each of the above
+ *   backpressure producers on a writer of 2 buffers whose I/O thread
+ *                starts late must wait for buffers (stalls counted) and
+ *                write some on their own thread, losing nothing
+ *   stall        with the I/O thread held back, aw_write() and aw_flush()
+ *                must write everything on the caller; once released the
+ *                thread must stop and aw_close() succeed
+ *   shared       --threads producers each open, stream to and close writers
+ *                of 2 small buffers in turn, all on one shared I/O thread
+ *                (aw_io_create), as memcount's per-thread files are; each
+ *                file must read back byte for byte. With the pthread and
+ *                the polling events, then with the shared thread held back
+ *                until every producer has flushed on its own
+ *
+ * Writer stats must agree with the file. Then reports MB/s of the queue
+ * run per mode. Exits 1 on any mismatch.
+ */
+
+#include "async_writer.h"
+#include "bench_util.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+#define STALL_BUFFERS 4
+#define STALL_BUFFER_SIZE 4096
+#define STALL_BYTES (24 * STALL_BUFFER_SIZE)
+
+typedef struct {
+    uint32_t producer;
+    uint32_t check;
+    uint64_t seq;
+} record_t;
+
+typedef struct {
+    const char  *name;
+    aw_backend_t backend;
+    int          sync;
+    int          polled;       /* polling events instead of the pthread ones */
+} aw_mode_t;
+
+static const aw_mode_t modes[] = {
+    { "write",    AW_BACKEND_WRITE, 0, 0 },
+    { "default",  AW_BACKEND_AUTO,  0, 0 },
+    { "sync",     AW_BACKEND_WRITE, 1, 0 },
+    { "polled",   AW_BACKEND_WRITE, 0, 1 },
+};
+#define MODES (sizeof(modes) / sizeof(modes[0]))
+
+typedef struct {
+    async_writer_t *w;
+    uint32_t        id;
+    uint64_t        records;
+} producer_t;
+
+/* Producer of the shared runs, with writers of its own */
+typedef struct {
+    aw_io_t           *io;
+    pthread_barrier_t *flushed;   /* held runs: every file flushed */
+    const char        *dir;
+    uint32_t           id;
+    unsigned           files;
+    size_t             bytes;     /* per file */
+    uint64_t           errors;
+} shared_producer_t;
+
+/* I/O thread started by the bench's spawn hooks */
+typedef struct {
+    void (*fn)(void *);
+    void   *arg;
+    unsigned delay_ms;
+} spawn_arg_t;
+
+static int gate_open;          /* held-back I/O threads start once set */
+
+/* --- helpers --- */
+
+static const char usage_args[] = "[--mb N] [--threads N] [--dir PATH]";
+
+static void sleep_ms(unsigned ms) {
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static uint32_t record_check(uint32_t producer, uint64_t seq) {
+    return ~(producer * 0x9e3779b9u ^ (uint32_t)seq ^ (uint32_t)(seq >> 32));
+}
+
+static char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    char *data = NULL;
+    long n;
+
+    *len = 0;
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = (char*)malloc(n > 0 ? (size_t)n : 1);
+    if (data && fread(data, 1, (size_t)n, f) == (size_t)n)
+        *len = (size_t)n;
+    fclose(f);
+    return data;
+}
+
+/* Writer stats against what was written and what the file holds */
+static uint64_t check_stats(async_writer_t *w, uint64_t bytes, int threaded) {
+    aw_stats_t st;
+    aw_get_stats(w, &st);
+    return (st.bytes_written != bytes) + (st.write_errors != 0) +
+           (st.threaded != threaded);
+}
+
+/* Polling events: timed waits sleep 1 ms and return without looking,
+   untimed ones poll the flag, as events without a timed wait must */
+static void *poll_create(void) {
+    return calloc(1, sizeof(int));
+}
+
+static void poll_destroy(void *ev) {
+    free(ev);
+}
+
+static void poll_wait(void *ev, unsigned timeout_ms) {
+    if (timeout_ms) {
+        sleep_ms(1);
+        return;
+    }
+    while (!__atomic_exchange_n((int*)ev, 0, __ATOMIC_ACQ_REL))
+        sleep_ms(1);
+}
+
+static void poll_signal(void *ev) {
+    __atomic_store_n((int*)ev, 1, __ATOMIC_RELEASE);
+}
+
+static const aw_sync_t poll_sync = { poll_create, poll_destroy, poll_wait, poll_signal };
+
+static void *spawned_main(void *p) {
+    spawn_arg_t a = *(spawn_arg_t*)p;
+    free(p);
+    if (a.delay_ms)
+        sleep_ms(a.delay_ms);
+    while (!__atomic_load_n(&gate_open, __ATOMIC_ACQUIRE))
+        sleep_ms(1);
+    a.fn(a.arg);
+    return NULL;
+}
+
+static int spawn_thread(void (*fn)(void *), void *arg, unsigned delay_ms) {
+    spawn_arg_t *a = (spawn_arg_t*)malloc(sizeof(*a));
+    pthread_t t;
+
+    if (!a)
+        return -1;
+    a->fn = fn;
+    a->arg = arg;
+    a->delay_ms = delay_ms;
+    if (pthread_create(&t, NULL, spawned_main, a) != 0) {
+        free(a);
+        return -1;
+    }
+    pthread_detach(t);
+    return 0;
+}
+
+static int spawn_late(void (*fn)(void *), void *arg) {
+    return spawn_thread(fn, arg, 200);
+}
+
+static int spawn_gated(void (*fn)(void *), void *arg) {
+    return spawn_thread(fn, arg, 0);
+}
+
+static async_writer_t *open_writer(const char *path, const aw_config_t *cfg, int polled) {
+    async_writer_t *w;
+
+    aw_set_default_sync(polled ? &poll_sync : NULL);
+    w = aw_open(path, cfg);
+    aw_set_default_sync(NULL);
+    if (!w) {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        exit(1);
+    }
+    return w;
+}
+
+static void *producer_main(void *arg) {
+    producer_t *p = (producer_t*)arg;
+    uint64_t seq = 0;
+
+    while (seq < p->records) {
+        aw_buffer_t *b = aw_acquire(p->w);
+        record_t *r = (record_t*)b->data;
+        size_t n = b->cap / sizeof(record_t);
+        if (n > p->records - seq)
+            n = (size_t)(p->records - seq);
+        for (size_t i = 0; i < n; i++, seq++) {
+            r[i].producer = p->id;
+            r[i].seq = seq;
+            r[i].check = record_check(p->id, seq);
+        }
+        b->len = n * sizeof(record_t);
+        aw_submit(p->w, b);
+    }
+    return NULL;
+}
+
+/* Every record once, untorn, in order per producer */
+static uint64_t check_records(const char *path, unsigned threads, uint64_t per_thread) {
+    uint64_t next[MAX_THREADS] = { 0 }, errors = 0;
+    size_t len;
+    char *data = read_file(path, &len);
+    const record_t *r = (const record_t*)data;
+
+    if (!data)
+        return 1;
+    errors += len != threads * per_thread * sizeof(record_t);
+    for (size_t i = 0; i < len / sizeof(record_t); i++) {
+        uint32_t p = r[i].producer;
+        if (p >= threads || r[i].check != record_check(p, r[i].seq)) {
+            errors++;
+            continue;
+        }
+        errors += r[i].seq != next[p];
+        next[p] = r[i].seq + 1;
+    }
+    for (unsigned p = 0; p < threads; p++)
+        errors += next[p] != per_thread;
+    free(data);
+    return errors;
+}
+
+static uint64_t run_producers(async_writer_t *w, unsigned threads, uint64_t per_thread) {
+    pthread_t t[MAX_THREADS];
+    producer_t p[MAX_THREADS];
+
+    for (unsigned i = 0; i < threads; i++) {
+        p[i].w = w;
+        p[i].id = i;
+        p[i].records = per_thread;
+        pthread_create(&t[i], NULL, producer_main, &p[i]);
+    }
+    for (unsigned i = 0; i < threads; i++)
+        pthread_join(t[i], NULL);
+    return threads * per_thread * sizeof(record_t);
+}
+
+static uint64_t run_queue(const char *path, const aw_mode_t *m, unsigned threads,
+                          uint64_t per_thread, double *secs) {
+    aw_config_t cfg = { 64 << 10, 8, m->backend, NULL, m->sync, NULL };
+    async_writer_t *w = open_writer(path, &cfg, m->polled);
+    uint64_t errors = 0, bytes;
+    double t0 = now_sec();
+
+    bytes = run_producers(w, threads, per_thread);
+    errors += aw_flush(w) != 0;
+    *secs = now_sec() - t0;
+    errors += check_stats(w, bytes, !m->sync);
+    errors += aw_close(w) != 0;
+    errors += check_records(path, threads, per_thread);
+    unlink(path);
+    return errors;
+}
+
+static void fill_bytes(char *p, size_t n, uint64_t seed) {
+    for (size_t i = 0; i < n; i++)
+        p[i] = (char)(next_rand(&seed) >> 24);
+}
+
+/* Random-length chunks through aw_write(); with hold set the I/O thread
+   stays behind the gate, so everything is written on this thread */
+static uint64_t run_stream(const char *path, const aw_config_t *cfg, int polled,
+                           size_t bytes, int hold) {
+    char *src = (char*)xmalloc(bytes), *data;
+    uint64_t errors = 0, seed = 0x2545f4914f6cdd1dULL;
+    async_writer_t *w;
+    size_t len;
+
+    fill_bytes(src, bytes, 0x853c49e6748fea9bULL);
+    __atomic_store_n(&gate_open, !hold, __ATOMIC_RELEASE);
+    w = open_writer(path, cfg, polled);
+
+    for (size_t off = 0; off < bytes;) {
+        size_t n = 1 + (size_t)(next_rand(&seed) % (3 * cfg->buffer_size));
+        if (n > bytes - off)
+            n = bytes - off;
+        errors += aw_write(w, src + off, n) != 0;
+        off += n;
+    }
+    errors += aw_flush(w) != 0;
+    errors += check_stats(w, bytes, !cfg->sync);
+
+    /* flushed: the file is complete before close, I/O thread or not */
+    data = read_file(path, &len);
+    errors += !data || len != bytes || memcmp(data, src, bytes) != 0;
+    free(data);
+
+    __atomic_store_n(&gate_open, 1, __ATOMIC_RELEASE);
+    errors += aw_close(w) != 0;
+    unlink(path);
+    free(src);
+    return errors;
+}
+
+static void *shared_main(void *arg) {
+    shared_producer_t *p = (shared_producer_t*)arg;
+    aw_config_t cfg = { 4096, 2, AW_BACKEND_WRITE, NULL, 0, p->io };
+    char *src = (char*)xmalloc(p->bytes), *data, path[4096];
+    uint64_t seed = 0x9e3779b97f4a7c15ULL * (p->id + 1);
+    size_t len;
+
+    for (unsigned f = 0; f < p->files; f++) {
+        async_writer_t *w;
+
+        snprintf(path, sizeof(path), "%s/aw_bench_%d.s%u.%u.bin", p->dir, (int)getpid(),
+                 p->id, f);
+        fill_bytes(src, p->bytes, next_rand(&seed));
+        w = aw_open(path, &cfg);
+        if (!w) {
+            p->errors++;
+            continue;
+        }
+        for (size_t off = 0; off < p->bytes;) {
+            size_t n = 1 + (size_t)(next_rand(&seed) % (3 * cfg.buffer_size));
+            if (n > p->bytes - off)
+                n = p->bytes - off;
+            p->errors += aw_write(w, src + off, n) != 0;
+            off += n;
+        }
+        p->errors += aw_flush(w) != 0;
+        p->errors += check_stats(w, p->bytes, 1);
+        data = read_file(path, &len);
+        p->errors += !data || len != p->bytes || memcmp(data, src, p->bytes) != 0;
+        free(data);
+        if (p->flushed)
+            pthread_barrier_wait(p->flushed);
+        p->errors += aw_close(w) != 0;
+        unlink(path);
+    }
+    free(src);
+    return NULL;
+}
+
+/* Producers streaming to writers on one shared I/O thread; with hold set
+   the thread stays behind the gate until every producer has flushed its
+   (single) file on its own */
+static uint64_t run_shared(const char *dir, unsigned threads, int polled, int hold) {
+    pthread_t t[MAX_THREADS];
+    shared_producer_t p[MAX_THREADS];
+    pthread_barrier_t flushed;
+    uint64_t errors = 0;
+    aw_io_t *io;
+
+    __atomic_store_n(&gate_open, !hold, __ATOMIC_RELEASE);
+    aw_set_default_sync(polled ? &poll_sync : NULL);
+    io = aw_io_create(spawn_gated);
+    if (!io) {
+        fprintf(stderr, "Error: cannot start the shared I/O thread\n");
+        exit(1);
+    }
+    pthread_barrier_init(&flushed, NULL, threads + 1);
+    for (unsigned i = 0; i < threads; i++) {
+        memset(&p[i], 0, sizeof(p[i]));
+        p[i].io = io;
+        p[i].flushed = hold ? &flushed : NULL;
+        p[i].dir = dir;
+        p[i].id = i;
+        p[i].files = hold ? 1 : 16;
+        p[i].bytes = hold ? STALL_BYTES : 256u << 10;
+        pthread_create(&t[i], NULL, shared_main, &p[i]);
+    }
+    if (hold) {
+        pthread_barrier_wait(&flushed);
+        __atomic_store_n(&gate_open, 1, __ATOMIC_RELEASE);
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        pthread_join(t[i], NULL);
+        errors += p[i].errors;
+    }
+    errors += aw_io_destroy(io) != 0;
+    aw_set_default_sync(NULL);
+    pthread_barrier_destroy(&flushed);
+    __atomic_store_n(&gate_open, 1, __ATOMIC_RELEASE);
+    return errors;
+}
+
+static uint64_t run_backpressure(const char *path, unsigned threads) {
+    aw_config_t cfg = { 16 << 10, 2, AW_BACKEND_WRITE, spawn_late, 0, NULL };
+    uint64_t per_thread = 4 * (cfg.buffer_size / sizeof(record_t)), errors = 0, bytes;
+    async_writer_t *w = open_writer(path, &cfg, 0);
+    aw_stats_t st;
+
+    __atomic_store_n(&gate_open, 1, __ATOMIC_RELEASE);
+    bytes = run_producers(w, threads, per_thread);
+    errors += aw_flush(w) != 0;
+    aw_get_stats(w, &st);
+    errors += st.acquire_stalls == 0 || st.stall_ns == 0 || st.max_queued > cfg.num_buffers;
+    errors += check_stats(w, bytes, 1);
+    errors += aw_close(w) != 0;
+    errors += check_records(path, threads, per_thread);
+    unlink(path);
+    return errors;
+}
+
+int main(int argc, char **argv) {
+    uint64_t mb = 64;
+    unsigned threads = 4;
+    const char *dir = "/tmp";
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--mb") && i + 1 < argc) {
+            mb = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = (unsigned)atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--dir") && i + 1 < argc) {
+            dir = argv[++i];
+        } else {
+            bench_usage(argv[0], usage_args);
+            return 1;
+        }
+    }
+    if (mb == 0 || threads == 0 || threads > MAX_THREADS) {
+        bench_usage(argv[0], usage_args);
+        return 1;
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/aw_bench_%d.bin", dir, (int)getpid());
+    uint64_t per_thread = (mb << 20) / sizeof(record_t) / threads;
+    uint64_t errors = 0, e;
+    double secs[MODES];
+
+    __atomic_store_n(&gate_open, 1, __ATOMIC_RELEASE);
+    for (size_t m = 0; m < MODES; m++) {
+        aw_config_t cfg = { 64 << 10, 8, modes[m].backend, NULL, modes[m].sync, NULL };
+        char name[32];
+
+        snprintf(name, sizeof(name), "queue/%s", modes[m].name);
+        e = run_queue(path, &modes[m], threads, per_thread, &secs[m]);
+        report_errors(16, name, e);
+        errors += e;
+
+        snprintf(name, sizeof(name), "stream/%s", modes[m].name);
+        e = run_stream(path, &cfg, modes[m].polled, 8u << 20, 0);
+        report_errors(16, name, e);
+        errors += e;
+    }
+
+    e = run_backpressure(path, threads);
+    report_errors(16, "backpressure", e);
+    errors += e;
+
+    {
+        aw_config_t cfg = { STALL_BUFFER_SIZE, STALL_BUFFERS, AW_BACKEND_WRITE, spawn_gated, 0, NULL };
+        e = run_stream(path, &cfg, 0, STALL_BYTES, 1);
+        e += run_stream(path, &cfg, 1, STALL_BYTES, 1);
+        report_errors(16, "stall", e);
+        errors += e;
+    }
+
+    e = run_shared(dir, threads, 0, 0);
+    e += run_shared(dir, threads, 1, 0);
+    e += run_shared(dir, threads, 0, 1);
+    report_errors(16, "shared", e);
+    errors += e;
+
+    printf("\nqueue, %u producers (MB/s):\n", threads);
+    for (size_t m = 0; m < MODES; m++)
+        printf("  %-12s %10.1f\n", modes[m].name,
+               (double)(threads * per_thread * sizeof(record_t)) / secs[m] / 1e6);
+
+    return bench_verdict(errors, "mismatches");
+}
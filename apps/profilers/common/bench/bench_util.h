@@ -0,0 +1,70 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+/*
+ * Helpers shared by the micro-benchmarks
+ *
+ * Timing, the xorshift stream synthetic inputs are drawn from, allocation
+ * that ends the run when memory runs out, and the report of checks: one
+ * "<check> <n> errors" line per check, then bench_verdict(), whose exit
+ * status is what ctest looks at.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static inline double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static inline uint64_t next_rand(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+static inline void out_of_memory(void) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+}
+
+static inline void *xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (!p)
+        out_of_memory();
+    return p;
+}
+
+static inline void *xcalloc(size_t n, size_t size) {
+    void *p = calloc(n, size);
+    if (!p)
+        out_of_memory();
+    return p;
+}
+
+/* args: the options after the program name */
+static inline void bench_usage(const char *prog, const char *args) {
+    fprintf(stderr, "Usage: %s %s\n", prog, args);
+}
+
+static inline void report_errors(int width, const char *check, uint64_t errors) {
+    printf("%-*s %10llu errors\n", width, check, (unsigned long long)errors);
+}
+
+/* Exit status of a run: 1 and a message naming the errors (mismatches,
+   violations) if there were any */
+static inline int bench_verdict(uint64_t errors, const char *what) {
+    if (errors) {
+        fprintf(stderr, "Error: %llu %s\n", (unsigned long long)errors, what);
+        return 1;
+    }
+    return 0;
+}
+
+#endif /* BENCH_UTIL_H */
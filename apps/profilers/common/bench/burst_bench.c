@@ -0,0 +1,187 @@
+/*
+ * Accuracy of burst sampling extrapolation on a synthetic run
+ *
+ * Usage: burst_bench [--instrs N] [--on N] [--off N] [--runs N]
+ *
+ * Builds one synthetic execution -- basic blocks of a few instructions and
+ * memory references, in program phases that differ in reference density
+ * and read/write mix, with noise within each phase -- and samples it with
+ * burst_sched_t the way memcount does: period lengths in instructions,
+ * checked at block boundaries, references counted only in on periods.
+ * Every run uses a different schedule seed (the off-period jitter), and
+ * the extrapolated reference, read and write totals are compared with the
+ * true ones: mean and worst relative error, and how often the 95% interval
+ * contains the truth.
+ */
+
+#include "burst_sampler.h"
+#include "bench_util.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_METRICS 3   /* references, reads, writes */
+
+static const char *metric_names[NUM_METRICS] = { "references", "reads", "writes" };
+
+typedef struct {
+    uint8_t instrs;
+    uint8_t reads;
+    uint8_t writes;
+} block_t;
+
+/* --- helpers --- */
+
+/* Phases of 2..20M instructions; within a phase each block draws its
+   reference counts around the phase's density and read share */
+static block_t *make_run(uint64_t instrs, size_t *n_blocks, uint64_t truth[NUM_METRICS]) {
+    size_t cap = (size_t)(instrs / 2 + 16);
+    block_t *b = (block_t*)malloc(cap * sizeof(block_t));
+    uint64_t s = 0x2545f4914f6cdd1dULL;
+    uint64_t done = 0, phase_left = 0;
+    unsigned density = 0, read_pct = 0;
+    size_t n = 0;
+
+    if (!b) return NULL;
+    memset(truth, 0, NUM_METRICS * sizeof(uint64_t));
+    while (done < instrs && n < cap) {
+        if (phase_left == 0) {
+            phase_left = 2000000 + next_rand(&s) % 18000000;
+            density = 10 + (unsigned)(next_rand(&s) % 80);     /* refs per 100 instrs */
+            read_pct = 40 + (unsigned)(next_rand(&s) % 55);
+        }
+        block_t *blk = &b[n++];
+        blk->instrs = (uint8_t)(3 + next_rand(&s) % 14);
+        unsigned refs = 0;
+        for (unsigned i = 0; i < blk->instrs; i++)
+            refs += next_rand(&s) % 100 < density;
+        blk->reads = 0;
+        for (unsigned i = 0; i < refs; i++)
+            blk->reads += next_rand(&s) % 100 < read_pct;
+        blk->writes = (uint8_t)(refs - blk->reads);
+
+        truth[0] += refs;
+        truth[1] += blk->reads;
+        truth[2] += blk->writes;
+        done += blk->instrs;
+        phase_left = phase_left > blk->instrs ? phase_left - blk->instrs : 0;
+    }
+    *n_blocks = n;
+    return b;
+}
+
+/* One sampled pass; fills the estimates and returns the sampled fraction */
+static double sample_run(const block_t *b, size_t n, uint64_t on, uint64_t off,
+                         uint64_t seed, burst_estimate_t est[NUM_METRICS]) {
+    burst_sched_t sched;
+    burst_stat_t st[NUM_METRICS];
+    uint64_t x[NUM_METRICS] = { 0, 0, 0 };
+    uint64_t units = 0;
+    int64_t left;
+
+    memset(st, 0, sizeof(st));
+    burst_sched_init(&sched, on, off, seed);
+    left = (int64_t)burst_sched_first(&sched);
+
+    for (size_t i = 0; i < n; i++) {
+        /* like the client: the check runs at block entry, before the block */
+        if (left <= 0) {
+            if (sched.on) {
+                for (int m = 0; m < NUM_METRICS; m++)
+                    burst_stat_add(&st[m], (double)x[m], (double)units);
+                memset(x, 0, sizeof(x));
+            }
+            left = (int64_t)burst_sched_next(&sched, units);
+            units = 0;
+        }
+        if (sched.on) {
+            x[0] += b[i].reads + b[i].writes;
+            x[1] += b[i].reads;
+            x[2] += b[i].writes;
+        }
+        units += b[i].instrs;
+        left -= b[i].instrs;
+    }
+    if (sched.on && units) {
+        for (int m = 0; m < NUM_METRICS; m++)
+            burst_stat_add(&st[m], (double)x[m], (double)units);
+    }
+    burst_sched_finish(&sched, units);
+
+    for (int m = 0; m < NUM_METRICS; m++)
+        burst_stat_estimate(&st[m], (double)burst_sched_units(&sched), 1.96, &est[m]);
+    return burst_sched_fraction(&sched);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--instrs N] [--on N] [--off N] [--runs N]\n"
+            "  --instrs N   instructions in the synthetic run (500000000)\n"
+            "  --on N       instructions per on period (1000000)\n"
+            "  --off N      mean instructions per off period (9000000)\n"
+            "  --runs N     schedule seeds to try (50)\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    uint64_t instrs = 500000000, on = 1000000, off = 9000000;
+    int runs = 50;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--instrs") && i + 1 < argc) {
+            instrs = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--on") && i + 1 < argc) {
+            on = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--off") && i + 1 < argc) {
+            off = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--runs") && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (instrs == 0 || on == 0 || runs <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uint64_t truth[NUM_METRICS];
+    size_t n_blocks;
+    block_t *blocks = make_run(instrs, &n_blocks, truth);
+    if (!blocks) {
+        fprintf(stderr, "Error: cannot allocate the synthetic run\n");
+        return 1;
+    }
+
+    double err_sum[NUM_METRICS] = { 0 }, err_max[NUM_METRICS] = { 0 };
+    double ci_sum[NUM_METRICS] = { 0 };
+    int covered[NUM_METRICS] = { 0 };
+    double fraction = 0;
+    for (int r = 0; r < runs; r++) {
+        burst_estimate_t est[NUM_METRICS];
+        fraction += sample_run(blocks, n_blocks, on, off, (uint64_t)r, est);
+        for (int m = 0; m < NUM_METRICS; m++) {
+            double err = fabs(est[m].estimate - (double)truth[m]) / (double)truth[m];
+            err_sum[m] += err;
+            if (err > err_max[m]) err_max[m] = err;
+            ci_sum[m] += (est[m].hi - est[m].lo) / 2 / (double)truth[m];
+            covered[m] += est[m].lo <= (double)truth[m] && (double)truth[m] <= est[m].hi;
+        }
+    }
+
+    printf("%llu instructions, on %llu / off %llu (%.1f%% instrumented), %d schedules\n",
+           (unsigned long long)instrs, (unsigned long long)on, (unsigned long long)off,
+           100.0 * fraction / runs, runs);
+    for (int m = 0; m < NUM_METRICS; m++) {
+        printf("  %-10s  mean error %6.3f%%  max %6.3f%%  95%% CI +/-%6.3f%%  coverage %5.1f%%\n",
+               metric_names[m], 100.0 * err_sum[m] / runs, 100.0 * err_max[m],
+               100.0 * ci_sum[m] / runs, 100.0 * covered[m] / runs);
+    }
+
+    free(blocks);
+    return 0;
+}
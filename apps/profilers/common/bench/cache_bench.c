@@ -0,0 +1,341 @@
+/*
+ * Checks and throughput of cache_sim on synthetic traces
+ *
+ * Usage: cache_bench [--refs N] [--threads N]
+ *
+ * Runs patterns with known outcomes through small hierarchies and counts
+ * every mismatch:
+ *
+ *   lru        random references to a fully associative LRU level and,
+ *              with two ways, a PLRU one (the same policy there), against
+ *              an LRU stack: a reference hits iff fewer than `ways`
+ *              distinct lines were used since its line's last use
+ *   fit        a loop over half of L1: only the first pass misses
+ *   stream     a sequential scan far beyond the LLC: one miss per line at
+ *              every level, and the line's other words hit in L1
+ *   conflict   ways + 1 lines of one set in a cycle: LRU misses on every
+ *              reference, PLRU keeps some
+ *   scan       hot lines of one set reused between scans of the rest of
+ *              the set: RRIP keeps the hot lines that LRU loses to the scans
+ *   writes     write-back/write-allocate against write-through/no-write-
+ *              allocate on a store stream twice the cache: fills, dirty
+ *              evictions and memory writes
+ *   shared     --threads threads with private L1/L2 and one shared LLC on
+ *              disjoint random streams: every level's references must add
+ *              up to the misses of the level above
+ *
+ * then reports references per second per replacement policy over an
+ * L1/L2/LLC hierarchy, for a random stream (almost every reference goes to
+ * the LLC) and a sequential one (7 of 8 hit the last L1 line). Exits 1 on
+ * any mismatch.
+ */
+
+#include "cache_sim.h"
+#include "bench_util.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_THREADS 64
+
+typedef struct {
+    cache_hier_t *h;
+    uint64_t      refs;
+    uint64_t      seed;         /* 0 = sequential */
+} stream_arg_t;
+
+/* --- helpers --- */
+
+static const char usage_args[] = "[--refs N] [--threads N]";
+
+static cache_level_config_t level_cfg(uint64_t size, uint32_t ways, cache_repl_t repl) {
+    cache_level_config_t c;
+    c.size = size;
+    c.ways = ways;
+    c.line_size = 64;
+    c.repl = repl;
+    c.write_back = 1;
+    c.write_allocate = 1;
+    return c;
+}
+
+static uint64_t level_refs(const cache_level_stats_t *l) {
+    return l->read_hits + l->read_misses + l->write_hits + l->write_misses;
+}
+
+static uint64_t level_misses(const cache_level_stats_t *l) {
+    return l->read_misses + l->write_misses;
+}
+
+static uint64_t check(const char *what, uint64_t got, uint64_t want) {
+    if (got == want)
+        return 0;
+    fprintf(stderr, "  %s: %llu, expected %llu\n", what,
+            (unsigned long long)got, (unsigned long long)want);
+    return 1;
+}
+
+/* --- patterns --- */
+
+static uint64_t test_lru(uint64_t refs, cache_repl_t repl, uint32_t ways) {
+    cache_level_config_t cfg = level_cfg((uint64_t)ways * 64, ways, repl);
+    cache_hier_t *h = cache_hier_create(&cfg, 1, NULL);
+    uint64_t stack[64], seed = 12345, errors = 0;
+    unsigned depth = 0;
+
+    if (!h) return 1;
+    for (uint64_t i = 0; i < refs; i++) {
+        uint64_t line = next_rand(&seed) % (2 * ways);
+        unsigned pos = 0;
+        while (pos < depth && stack[pos] != line)
+            pos++;
+        int want_hit = pos < depth && pos < ways;
+        int hit = cache_hier_access(h, line * 64, 8, 0) == 0;
+        errors += hit != want_hit;
+        if (pos == depth) depth++;
+        memmove(stack + 1, stack, pos * sizeof(uint64_t));
+        stack[0] = line;
+    }
+    cache_hier_destroy(h);
+    return errors;
+}
+
+static uint64_t test_fit(void) {
+    cache_level_config_t cfg[2] = { level_cfg(32 << 10, 8, CACHE_REPL_LRU),
+                                    level_cfg(256 << 10, 8, CACHE_REPL_LRU) };
+    cache_hier_t *h = cache_hier_create(cfg, 2, NULL);
+    cache_hier_stats_t st;
+    const uint64_t lines = (16 << 10) / 64;
+    uint64_t errors = 0;
+
+    if (!h) return 1;
+    for (int pass = 0; pass < 10; pass++) {
+        for (uint64_t a = 0; a < lines * 64; a += 8)
+            cache_hier_access(h, 0x100000 + a, 8, 0);
+    }
+    cache_hier_get_stats(h, &st);
+    errors += check("fit L1 misses", level_misses(&st.level[0]), lines);
+    errors += check("fit L1 hits", st.level[0].read_hits, 10 * lines * 8 - lines);
+    errors += check("fit memory reads", st.mem_reads, lines);
+    cache_hier_destroy(h);
+    return errors;
+}
+
+static uint64_t test_stream(void) {
+    cache_level_config_t cfg[3] = { level_cfg(32 << 10, 8, CACHE_REPL_LRU),
+                                    level_cfg(256 << 10, 8, CACHE_REPL_PLRU),
+                                    level_cfg(1 << 20, 16, CACHE_REPL_RRIP) };
+    cache_hier_t *h = cache_hier_create(cfg, 3, NULL);
+    cache_hier_stats_t st;
+    const uint64_t lines = (16 << 20) / 64;
+    uint64_t errors = 0;
+
+    if (!h) return 1;
+    for (uint64_t a = 0; a < lines * 64; a += 8)
+        cache_hier_access(h, a, 8, 0);
+    cache_hier_get_stats(h, &st);
+    for (int l = 0; l < 3; l++)
+        errors += check("stream misses", level_misses(&st.level[l]), lines);
+    errors += check("stream L1 hits", st.level[0].read_hits, lines * 7);
+    errors += check("stream memory reads", st.mem_reads, lines);
+    cache_hier_destroy(h);
+    return errors;
+}
+
+static uint64_t test_conflict(cache_repl_t repl, int want_all_miss) {
+    cache_level_config_t cfg = level_cfg(32 << 10, 8, repl);
+    cache_hier_t *h = cache_hier_create(&cfg, 1, NULL);
+    cache_hier_stats_t st;
+    const uint64_t set_stride = (32 << 10) / 8;     /* same set, next tag */
+    uint64_t errors = 0;
+
+    if (!h) return 1;
+    for (int rep = 0; rep < 1000; rep++) {
+        for (uint64_t k = 0; k < 9; k++)
+            cache_hier_access(h, k * set_stride, 8, 0);
+    }
+    cache_hier_get_stats(h, &st);
+    if (want_all_miss)
+        errors += check("conflict hits", st.level[0].read_hits, 0);
+    else if (st.level[0].read_hits == 0)
+        errors += check("conflict hits", 0, 1);
+    cache_hier_destroy(h);
+    return errors;
+}
+
+/* Hits on 4 hot lines of a set, each used twice, between scans of 8 other
+   lines of the set */
+static uint64_t scan_hot_hits(cache_repl_t repl) {
+    cache_level_config_t cfg = level_cfg(32 << 10, 8, repl);
+    cache_hier_t *h = cache_hier_create(&cfg, 1, NULL);
+    const uint64_t set_stride = (32 << 10) / 8;
+    uint64_t hits = 0, scan = 100;
+
+    if (!h) return 0;
+    for (int rep = 0; rep < 1000; rep++) {
+        for (int twice = 0; twice < 2; twice++) {
+            for (uint64_t k = 0; k < 4; k++)
+                hits += cache_hier_access(h, k * set_stride, 8, 0) == 0;
+        }
+        for (uint64_t k = 0; k < 8; k++)
+            cache_hier_access(h, scan++ * set_stride, 8, 0);
+    }
+    cache_hier_destroy(h);
+    return hits;
+}
+
+static uint64_t test_scan(void) {
+    uint64_t lru = scan_hot_hits(CACHE_REPL_LRU);
+    uint64_t rrip = scan_hot_hits(CACHE_REPL_RRIP);
+
+    if (rrip > lru)
+        return 0;
+    fprintf(stderr, "  scan hot hits: RRIP %llu, LRU %llu\n",
+            (unsigned long long)rrip, (unsigned long long)lru);
+    return 1;
+}
+
+static uint64_t test_writes(void) {
+    const uint64_t size = 32 << 10, lines = 2 * size / 64;
+    cache_level_config_t cfg = level_cfg(size, 8, CACHE_REPL_LRU);
+    cache_hier_stats_t st;
+    cache_hier_t *h;
+    uint64_t errors = 0;
+
+    h = cache_hier_create(&cfg, 1, NULL);
+    if (!h) return 1;
+    for (uint64_t a = 0; a < lines * 64; a += 8)
+        cache_hier_access(h, a, 8, 1);
+    cache_hier_get_stats(h, &st);
+    errors += check("write-back misses", st.level[0].write_misses, lines);
+    errors += check("write-back fills", st.mem_reads, lines);
+    errors += check("write-back evictions", st.level[0].writebacks, lines - size / 64);
+    errors += check("write-back memory writes", st.mem_writes, lines - size / 64);
+    cache_hier_destroy(h);
+
+    cfg.write_back = 0;
+    cfg.write_allocate = 0;
+    h = cache_hier_create(&cfg, 1, NULL);
+    if (!h) return 1;
+    for (uint64_t a = 0; a < lines * 64; a += 8)
+        cache_hier_access(h, a, 8, 1);
+    cache_hier_get_stats(h, &st);
+    errors += check("write-through misses", st.level[0].write_misses, lines * 8);
+    errors += check("write-through fills", st.mem_reads, 0);
+    errors += check("write-through memory writes", st.mem_writes, lines * 8);
+    cache_hier_destroy(h);
+    return errors;
+}
+
+static void *stream_main(void *arg) {
+    stream_arg_t *a = (stream_arg_t*)arg;
+    uint64_t seed = a->seed | 1;
+
+    for (uint64_t i = 0; i < a->refs; i++) {
+        uint64_t r = next_rand(&seed);
+        /* 8 MiB per thread, a quarter of the references writes */
+        uint64_t off = a->seed ? r & ((8 << 20) - 8) : (i * 8) & ((8 << 20) - 8);
+        cache_hier_access(a->h, (a->seed << 32) + off, 8, (r >> 60) < 4);
+    }
+    return NULL;
+}
+
+static uint64_t test_shared(uint64_t refs, unsigned threads) {
+    cache_level_config_t cfg[2] = { level_cfg(32 << 10, 8, CACHE_REPL_LRU),
+                                    level_cfg(1 << 20, 16, CACHE_REPL_PLRU) };
+    cache_level_config_t llc_cfg = level_cfg(8 << 20, 16, CACHE_REPL_RRIP);
+    cache_level_t *llc = cache_level_create(&llc_cfg, 1);
+    stream_arg_t args[MAX_THREADS];
+    pthread_t tid[MAX_THREADS];
+    cache_hier_stats_t total;
+    uint64_t errors = 0;
+
+    if (!llc) return 1;
+    memset(&total, 0, sizeof(total));
+    for (unsigned t = 0; t < threads; t++) {
+        args[t].h = cache_hier_create(cfg, 2, llc);
+        args[t].refs = refs;
+        args[t].seed = t + 1;
+        if (!args[t].h) return 1;
+        pthread_create(&tid[t], NULL, stream_main, &args[t]);
+    }
+    for (unsigned t = 0; t < threads; t++) {
+        cache_hier_stats_t st;
+        pthread_join(tid[t], NULL);
+        cache_hier_get_stats(args[t].h, &st);
+        cache_hier_stats_add(&total, &st);
+        cache_hier_destroy(args[t].h);
+    }
+    cache_level_destroy(llc);
+
+    errors += check("shared L1 references", level_refs(&total.level[0]), refs * threads);
+    for (int l = 1; l < 3; l++)
+        errors += check("shared level references", level_refs(&total.level[l]),
+                        level_misses(&total.level[l - 1]));
+    errors += check("shared memory reads", total.mem_reads, level_misses(&total.level[2]));
+    errors += check("shared memory writes", total.mem_writes, total.level[2].writebacks);
+    return errors;
+}
+
+static double throughput(uint64_t refs, cache_repl_t repl, uint64_t seed) {
+    cache_level_config_t cfg[3] = { level_cfg(32 << 10, 8, repl),
+                                    level_cfg(1 << 20, 16, repl),
+                                    level_cfg(32 << 20, 16, repl) };
+    cache_hier_t *h = cache_hier_create(cfg, 3, NULL);
+    stream_arg_t a = { h, refs, seed };
+
+    if (!h) return 0.0;
+    double t0 = now_sec();
+    stream_main(&a);
+    double secs = now_sec() - t0;
+    cache_hier_destroy(h);
+    return (double)refs / secs / 1e6;
+}
+
+int main(int argc, char **argv) {
+    uint64_t refs = 4000000;
+    unsigned threads = 4;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--refs") && i + 1 < argc) {
+            refs = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = (unsigned)atoi(argv[++i]);
+        } else {
+            bench_usage(argv[0], usage_args);
+            return 1;
+        }
+    }
+    if (refs == 0 || threads == 0 || threads > MAX_THREADS) {
+        bench_usage(argv[0], usage_args);
+        return 1;
+    }
+
+    uint64_t errors = 0, e;
+    printf("%-10s %10s\n", "test", "errors");
+#define RUN(name, expr) do { e = (expr); errors += e; \
+        printf("%-10s %10llu\n", name, (unsigned long long)e); } while (0)
+    RUN("lru", test_lru(refs / 10, CACHE_REPL_LRU, 16) +
+               test_lru(refs / 10, CACHE_REPL_PLRU, 2));
+    RUN("fit", test_fit());
+    RUN("stream", test_stream());
+    RUN("conflict", test_conflict(CACHE_REPL_LRU, 1) +
+                    test_conflict(CACHE_REPL_PLRU, 0));
+    RUN("scan", test_scan());
+    RUN("writes", test_writes());
+    RUN("shared", test_shared(refs / threads, threads));
+#undef RUN
+
+    printf("\nL1 32K/8, L2 1M/16, LLC 32M/16, 8-byte refs over 8 MiB (Mrefs/s):\n");
+    printf("%-10s %10s %10s\n", "policy", "random", "sequential");
+    for (int r = CACHE_REPL_LRU; r <= CACHE_REPL_RRIP; r++) {
+        printf("%-10s %10.1f %10.1f\n", cache_repl_name((cache_repl_t)r),
+               throughput(refs, (cache_repl_t)r, 7), throughput(refs, (cache_repl_t)r, 0));
+    }
+
+    return bench_verdict(errors, "mismatches");
+}
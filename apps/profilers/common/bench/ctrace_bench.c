@@ -0,0 +1,225 @@
+/*
+ * Round-trip checks and throughput of ctrace
+ *
+ * Usage: ctrace_bench [--events N] [--threads N] [--dir PATH]
+ *
+ * Writes --events events spread over --threads interleaved threads to a
+ * .ctrace file under --dir, reads it back and compares every field of
+ * every event, per thread in order, counting every mismatch:
+ *
+ *   random      random addresses and timestamps (deltas of both signs and
+ *               every magnitude), every access size class including 0,
+ *               odd sizes, 2^30, 2^31 and UINT32_MAX, random flags
+ *   sequential  strided addresses and steady timestamps, which the LZ
+ *               codec compresses, so its matches and literals are decoded
+ *
+ * each raw and compressed, with small and default blocks. The index must
+ * count every event, find_block() must land on each thread's blocks in
+ * order, and a file read before close (no footer) must give the same
+ * events through the rebuilt index. Then reports write and read rates and
+ * bytes per event. Exits 1 on any mismatch.
+ */
+
+#include "ctrace.h"
+#include "bench_util.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+
+typedef struct {
+    double   write_secs;
+    double   read_secs;
+    uint64_t bytes;
+} run_stats_t;
+
+/* --- helpers --- */
+
+static const char usage_args[] = "[--events N] [--threads N] [--dir PATH]";
+
+static uint32_t random_size(uint64_t r) {
+    static const uint32_t odd[] = { 0, 3, 6, 12, 100, 1u << 30, 1u << 31, UINT32_MAX };
+    if (r % 4 != 0)
+        return 1u << (r >> 8) % 7;              /* 1..64 bytes */
+    return odd[(r >> 8) % 8];
+}
+
+static void make_random(ctrace_event_t *evs, size_t n, unsigned threads) {
+    uint64_t seed = 0x853c49e6748fea9bULL;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t r = next_rand(&seed);
+        evs[i].thread_id = (uint32_t)(r % threads) * 7919u;
+        evs[i].address = next_rand(&seed) >> (r >> 58);
+        evs[i].timestamp = next_rand(&seed) >> (r >> 52 & 63);
+        evs[i].size = random_size(next_rand(&seed));
+        evs[i].is_write = (uint8_t)(r >> 20 & 1);
+        evs[i].is_miss = (uint8_t)(r >> 21 & 1);
+    }
+}
+
+static void make_sequential(ctrace_event_t *evs, size_t n, unsigned threads) {
+    uint64_t addr[MAX_THREADS], ts = 1000000;
+
+    for (unsigned t = 0; t < threads; t++)
+        addr[t] = 0x7f0000000000ULL + ((uint64_t)t << 32);
+    for (size_t i = 0; i < n; i++) {
+        unsigned t = (unsigned)(i / 64 % threads);
+        evs[i].thread_id = t * 7919u;
+        evs[i].address = addr[t];
+        addr[t] += 8;
+        evs[i].timestamp = ts;
+        ts += 3;
+        evs[i].size = 8;
+        evs[i].is_write = (uint8_t)(i % 4 == 0);
+        evs[i].is_miss = (uint8_t)(i % 16 == 0);
+    }
+}
+
+static int same_event(const ctrace_event_t *a, const ctrace_event_t *b) {
+    return a->timestamp == b->timestamp && a->address == b->address &&
+           a->thread_id == b->thread_id && a->size == b->size &&
+           !a->is_write == !b->is_write && !a->is_miss == !b->is_miss;
+}
+
+/* Every block of the file, per thread in order, against the input */
+static uint64_t check_file(const char *path, const ctrace_event_t *evs, size_t n,
+                           unsigned threads, double *read_secs) {
+    size_t next[MAX_THREADS] = { 0 };   /* next input index of each thread */
+    uint64_t errors = 0, seen = 0;
+    ctrace_reader_t *r = ctrace_reader_open(path);
+    ctrace_event_t *out;
+    double t0 = now_sec();
+
+    if (!r)
+        return 1;
+    out = (ctrace_event_t*)xmalloc(ctrace_reader_block_events(r) * sizeof(ctrace_event_t));
+    errors += ctrace_reader_num_events(r) != n;
+
+    for (size_t b = 0; b < ctrace_reader_num_blocks(r); b++) {
+        int got = ctrace_reader_read_block(r, b, out);
+        if (got < 0) {
+            errors++;
+            continue;
+        }
+        for (int i = 0; i < got; i++) {
+            unsigned t = out[i].thread_id / 7919u;
+            if (t >= threads) {
+                errors++;
+                continue;
+            }
+            while (next[t] < n && evs[next[t]].thread_id != out[i].thread_id)
+                next[t]++;
+            errors += next[t] == n || !same_event(&evs[next[t]], &out[i]);
+            next[t]++;
+            seen++;
+        }
+    }
+    errors += seen != n;
+    if (read_secs)
+        *read_secs = now_sec() - t0;
+
+    /* each thread's blocks are found in order from the start */
+    for (unsigned t = 0; t < threads; t++) {
+        size_t b = ctrace_reader_find_block(r, 0, t * 7919u, 0);
+        while (b < ctrace_reader_num_blocks(r)) {
+            ctrace_block_info_t info;
+            errors += ctrace_reader_block_info(r, b, &info) != 0 || info.thread_id != t * 7919u;
+            b = ctrace_reader_find_block(r, b + 1, t * 7919u, 0);
+        }
+    }
+
+    free(out);
+    ctrace_reader_close(r);
+    return errors;
+}
+
+static uint64_t run_roundtrip(const char *path, const ctrace_event_t *evs, size_t n,
+                              unsigned threads, uint32_t block_events, unsigned flags,
+                              run_stats_t *st) {
+    uint64_t errors = 0;
+    ctrace_writer_t *w = ctrace_writer_create(path, block_events, flags);
+    double t0;
+
+    if (!w) {
+        fprintf(stderr, "Error: cannot create %s\n", path);
+        exit(1);
+    }
+    t0 = now_sec();
+    errors += ctrace_write_events(w, evs, n) != 0;
+    errors += ctrace_writer_flush(w) != 0;
+    st->write_secs = now_sec() - t0;
+
+    /* no footer yet: the reader walks the block headers */
+    errors += check_file(path, evs, n, threads, NULL);
+    errors += ctrace_writer_close(w) != 0;
+    errors += check_file(path, evs, n, threads, &st->read_secs);
+
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        st->bytes = (uint64_t)ftell(f);
+        fclose(f);
+    }
+    unlink(path);
+    return errors;
+}
+
+int main(int argc, char **argv) {
+    uint64_t events = 2000000;
+    unsigned threads = 4;
+    const char *dir = "/tmp";
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--events") && i + 1 < argc) {
+            events = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = (unsigned)atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--dir") && i + 1 < argc) {
+            dir = argv[++i];
+        } else {
+            bench_usage(argv[0], usage_args);
+            return 1;
+        }
+    }
+    if (events == 0 || threads == 0 || threads > MAX_THREADS) {
+        bench_usage(argv[0], usage_args);
+        return 1;
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/ctrace_bench_%d.ctrace", dir, (int)getpid());
+    ctrace_event_t *evs = (ctrace_event_t*)xmalloc(events * sizeof(ctrace_event_t));
+    uint64_t errors = 0;
+
+    printf("%-12s %-6s %8s %10s %10s %10s %8s\n", "stream", "codec", "block",
+           "errors", "write MB/s", "read MB/s", "B/event");
+    for (int kind = 0; kind < 2; kind++) {
+        if (kind == 0)
+            make_random(evs, events, threads);
+        else
+            make_sequential(evs, events, threads);
+        for (unsigned flags = 0; flags <= CTRACE_COMPRESS; flags++) {
+            static const uint32_t blocks[] = { 1000, 0 };
+            for (int b = 0; b < 2; b++) {
+                run_stats_t st = { 0, 0, 0 };
+                uint64_t e = run_roundtrip(path, evs, events, threads, blocks[b], flags, &st);
+                double mb = (double)events * sizeof(ctrace_event_t) / 1e6;
+                printf("%-12s %-6s %8u %10llu %10.1f %10.1f %8.2f\n",
+                       kind == 0 ? "random" : "sequential", flags ? "lz" : "raw",
+                       blocks[b] ? blocks[b] : CTRACE_DEFAULT_BLOCK_EVENTS,
+                       (unsigned long long)e, mb / st.write_secs, mb / st.read_secs,
+                       (double)st.bytes / (double)events);
+                errors += e;
+            }
+        }
+    }
+    free(evs);
+
+    return bench_verdict(errors, "mismatches");
+}
@@ -0,0 +1,362 @@
+/*
+ * Checks and throughput of the HLL register kernels, and checks of hllpp
+ *
+ * Usage: hll_bench [--bits N] [--repeat N]
+ *
+ * Checks, counting every mismatch:
+ *
+ *   sum        hll_registers_sum() against hll_registers_sum_scalar() over
+ *              random registers of every rank an hll_add() sketch can hold,
+ *              for lengths around every vector width and unaligned starts:
+ *              the sums must be bit-identical and the zero counts equal
+ *   sketches   the same on the registers of real sketches of 4 to 20 bits
+ *   max        hll_registers_max() against hll_registers_max_scalar() on
+ *              the same lengths and offsets
+ *   sparse     hllpp estimates while still sparse must be within 1% of the
+ *              true count
+ *   dense      over many independent sketches of 6, 10 and 14 bits at 1/2
+ *              to 50 times their register count, the RMS relative error
+ *              must stay within 1.5 times the standard error 1.04/sqrt(m),
+ *              and the mean error within half of it
+ *   serialize  sketches, empty, sparse and dense, must survive
+ *              serialize/deserialize with the same estimate and serialize
+ *              again to the same bytes
+ *   merge      merging sketches of two overlapping key sets, either way
+ *              round, must give the estimate of one sketch of their union
+ *
+ * then reports registers per second of both kernels, dispatched and
+ * scalar, for a sketch of --bits bits. Exits 1 on any mismatch.
+ */
+
+#include "hll.h"
+#include "hllpp.h"
+#include "bench_util.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_REGS (1u << 20)
+#define MAX_RANK 29             /* highest rank hll_add() produces */
+
+/* --- helpers --- */
+
+static const char usage_args[] = "[--bits N] [--repeat N]";
+
+/* Ranks skewed low like a real sketch's, with a share of empty registers */
+static void fill_registers(uint8_t *regs, size_t n, uint64_t *seed) {
+    for (size_t i = 0; i < n; i++) {
+        uint64_t r = next_rand(seed);
+        if (r % 5 == 0)
+            regs[i] = 0;
+        else if (r % 97 == 0)
+            regs[i] = (uint8_t)(r >> 32) % (MAX_RANK + 1);
+        else
+            regs[i] = (uint8_t)(1 + __builtin_ctzll(r >> 8 | 1ULL << 40) % 12);
+    }
+}
+
+static uint64_t check_sum(const uint8_t *regs, size_t n) {
+    uint32_t z0 = 0, z1 = 0;
+    double s0 = hll_registers_sum(regs, n, &z0);
+    double s1 = hll_registers_sum_scalar(regs, n, &z1);
+    return (memcmp(&s0, &s1, sizeof(double)) != 0) + (z0 != z1);
+}
+
+/* Lengths around every vector width, then a few large ones */
+static size_t test_length(int k) {
+    static const size_t big[] = { 1023, 1031, 4096, 16384 + 5, MAX_REGS - 64 };
+    return k < 130 ? (size_t)k : big[(k - 130) % 5];
+}
+#define TEST_LENGTHS 135
+
+static uint64_t run_sum(uint8_t *regs) {
+    uint64_t errors = 0, seed = 0x853c49e6748fea9bULL;
+
+    fill_registers(regs, MAX_REGS, &seed);
+    for (int k = 0; k < TEST_LENGTHS; k++) {
+        for (size_t off = 0; off < 4; off++)
+            errors += check_sum(regs + off, test_length(k));
+    }
+    /* every register at the top rank, and every register empty */
+    memset(regs, MAX_RANK, MAX_REGS);
+    errors += check_sum(regs, MAX_REGS);
+    memset(regs, 0, MAX_REGS);
+    errors += check_sum(regs, MAX_REGS);
+    return errors;
+}
+
+static uint64_t run_sketches(void) {
+    uint64_t errors = 0, key = 0;
+
+    for (uint8_t bits = 4; bits <= 20; bits++) {
+        struct HLL h;
+        if (hll_init(&h, bits) != 0) {
+            fprintf(stderr, "Error: hll_init(%u) failed\n", bits);
+            exit(1);
+        }
+        /* from sparse to saturated: a few keys, then ten per register */
+        for (size_t target = 16; target <= h.size * 10; target *= 4) {
+            while (key < target)
+                hll_add_u64(&h, key++ * 0x9e3779b97f4a7c15ULL);
+            errors += check_sum(h.registers, h.size);
+        }
+        key = 0;
+        hll_destroy(&h);
+    }
+    return errors;
+}
+
+static uint64_t run_max(uint8_t *a, uint8_t *b, uint8_t *c) {
+    uint64_t errors = 0, seed = 0x2545f4914f6cdd1dULL;
+
+    fill_registers(a, MAX_REGS, &seed);
+    fill_registers(b, MAX_REGS, &seed);
+    for (int k = 0; k < TEST_LENGTHS; k++) {
+        size_t n = test_length(k);
+        for (size_t off = 0; off < 4; off++) {
+            /* bytes outside [off, off + n) must be left alone */
+            memcpy(c, a, MAX_REGS);
+            hll_registers_max(a + off, b + off, n);
+            hll_registers_max_scalar(c + off, b + off, n);
+            errors += memcmp(a, c, MAX_REGS) != 0;
+        }
+    }
+    return errors;
+}
+
+/* True count n, estimate within frac of it */
+static int near(double est, uint64_t n, double frac) {
+    return fabs(est - (double)n) <= frac * (double)n;
+}
+
+static void hllpp_new(hllpp_t *h, uint8_t p) {
+    if (hllpp_init(h, p) != 0) {
+        fprintf(stderr, "Error: hllpp_init(%u) failed\n", p);
+        exit(1);
+    }
+}
+
+/* Keys of disjoint streams never collide: the stream number goes on top */
+static void hllpp_fill(hllpp_t *h, uint64_t stream, uint64_t from, uint64_t to) {
+    for (uint64_t k = from; k < to; k++)
+        hllpp_add_u64(h, stream << 40 | k);
+}
+
+static uint64_t run_sparse(void) {
+    uint64_t errors = 0;
+
+    for (uint8_t p = 8; p <= HLLPP_MAX_P; p += 5) {
+        hllpp_t h;
+        uint64_t n = 0;
+        hllpp_new(&h, p);
+        for (uint64_t next = 1; ; next = next * 5 / 4 + 1) {
+            hllpp_fill(&h, p, n, next);
+            n = next;
+            if (h.dense)
+                break;
+            errors += !near(hllpp_count(&h), n, 0.01);
+        }
+        hllpp_destroy(&h);
+    }
+    return errors;
+}
+
+static uint64_t run_dense(void) {
+    static const double load[] = { 0.5, 2, 10, 50 };
+    uint64_t errors = 0, stream = 0;
+
+    for (uint8_t p = 6; p <= 14; p += 4) {
+        double m = (double)((size_t)1 << p), sigma = 1.04 / sqrt(m);
+        for (int l = 0; l < 4; l++) {
+            uint64_t n = (uint64_t)(m * load[l]);
+            double se = 0, sum = 0;
+            int trials = 40;
+            for (int t = 0; t < trials; t++) {
+                hllpp_t h;
+                hllpp_new(&h, p);
+                hllpp_fill(&h, ++stream, 0, n);
+                double e = (hllpp_count(&h) - (double)n) / (double)n;
+                se += e * e;
+                sum += e;
+                hllpp_destroy(&h);
+            }
+            errors += sqrt(se / trials) > 1.5 * sigma;
+            errors += fabs(sum / trials) > 0.5 * sigma;
+        }
+    }
+    return errors;
+}
+
+static uint64_t check_roundtrip(hllpp_t *h) {
+    ssize_t size = hllpp_serialize(h, NULL, 0);
+    uint8_t *a, *b;
+    hllpp_t copy;
+    uint64_t errors = 0;
+
+    if (size <= 0)
+        return 1;
+    a = (uint8_t*)xmalloc((size_t)size);
+    b = (uint8_t*)xmalloc((size_t)size);
+    errors += hllpp_serialize(h, a, (size_t)size - 1) != -1;
+    errors += hllpp_serialize(h, a, (size_t)size) != size;
+    if (hllpp_deserialize(&copy, a, (size_t)size) != 0) {
+        errors++;
+    } else {
+        double e0 = hllpp_count(h), e1 = hllpp_count(&copy);
+        errors += memcmp(&e0, &e1, sizeof(double)) != 0;
+        errors += hllpp_serialize(&copy, b, (size_t)size) != size;
+        errors += memcmp(a, b, (size_t)size) != 0;
+        hllpp_destroy(&copy);
+    }
+    /* a truncated or damaged buffer must be refused */
+    errors += hllpp_deserialize(&copy, a, (size_t)size / 2) == 0 && size > 16;
+    a[0] ^= 0xff;
+    errors += hllpp_deserialize(&copy, a, (size_t)size) == 0;
+    free(a);
+    free(b);
+    return errors;
+}
+
+static uint64_t run_serialize(void) {
+    static const uint64_t sizes[] = { 0, 1, 100, 3000, 100000 };
+    uint64_t errors = 0;
+
+    for (int i = 0; i < 5; i++) {
+        hllpp_t h;
+        hllpp_new(&h, 12);
+        hllpp_fill(&h, 1, 0, sizes[i]);
+        errors += check_roundtrip(&h);
+        hllpp_destroy(&h);
+    }
+    return errors;
+}
+
+static uint64_t run_merge(void) {
+    static const uint64_t sizes[] = { 50, 500, 5000, 50000 };
+    uint64_t errors = 0;
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            /* [0, a) and [a/2, a/2 + b): overlapping by half the first */
+            uint64_t a = sizes[i], b = sizes[j];
+            hllpp_t x, y, x2, y2, all;
+            hllpp_new(&x, 12);
+            hllpp_new(&y, 12);
+            hllpp_new(&all, 12);
+            hllpp_fill(&x, 2, 0, a);
+            hllpp_fill(&y, 2, a / 2, a / 2 + b);
+            hllpp_fill(&all, 2, 0, a);
+            hllpp_fill(&all, 2, a / 2, a / 2 + b);
+            hllpp_new(&x2, 12);
+            hllpp_new(&y2, 12);
+            errors += hllpp_merge(&x2, &x) != 0 || hllpp_merge(&x2, &y) != 0;
+            errors += hllpp_merge(&y2, &y) != 0 || hllpp_merge(&y2, &x) != 0;
+
+            double want = hllpp_count(&all);
+            errors += hllpp_count(&x2) != want;
+            errors += hllpp_count(&y2) != want;
+            hllpp_destroy(&x);
+            hllpp_destroy(&y);
+            hllpp_destroy(&x2);
+            hllpp_destroy(&y2);
+            hllpp_destroy(&all);
+        }
+    }
+    return errors;
+}
+
+static void run_throughput(uint8_t *a, uint8_t *b, unsigned bits, unsigned repeat) {
+    size_t n = (size_t)1 << bits;
+    uint64_t seed = 88172645463325252ULL;
+    uint32_t zeros;
+    double sink = 0, t0, secs[4];
+
+    fill_registers(a, n, &seed);
+    fill_registers(b, n, &seed);
+
+    t0 = now_sec();
+    for (unsigned r = 0; r < repeat; r++)
+        sink += hll_registers_sum(a, n, &zeros);
+    secs[0] = now_sec() - t0;
+    t0 = now_sec();
+    for (unsigned r = 0; r < repeat; r++)
+        sink += hll_registers_sum_scalar(a, n, &zeros);
+    secs[1] = now_sec() - t0;
+    t0 = now_sec();
+    for (unsigned r = 0; r < repeat; r++) {
+        b[r % n] ^= 1;          /* keep the fold from being hoisted */
+        hll_registers_max(a, b, n);
+    }
+    secs[2] = now_sec() - t0;
+    t0 = now_sec();
+    for (unsigned r = 0; r < repeat; r++) {
+        b[r % n] ^= 1;
+        hll_registers_max_scalar(a, b, n);
+    }
+    secs[3] = now_sec() - t0;
+
+    printf("\n%u-bit sketch (Gregs/s):\n%-8s %10s %10s\n", bits, "kernel", "dispatch", "scalar");
+    printf("%-8s %10.2f %10.2f\n", "sum", (double)n * repeat / secs[0] / 1e9,
+           (double)n * repeat / secs[1] / 1e9);
+    printf("%-8s %10.2f %10.2f\n", "max", (double)n * repeat / secs[2] / 1e9,
+           (double)n * repeat / secs[3] / 1e9);
+    if (sink == -1.0)
+        printf("%f %u\n", sink, (unsigned)a[0]);
+}
+
+int main(int argc, char **argv) {
+    unsigned bits = 14, repeat = 20000;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--bits") && i + 1 < argc) {
+            bits = (unsigned)atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+            repeat = (unsigned)atoi(argv[++i]);
+        } else {
+            bench_usage(argv[0], usage_args);
+            return 1;
+        }
+    }
+    if (bits < 4 || bits > 20 || repeat == 0) {
+        bench_usage(argv[0], usage_args);
+        return 1;
+    }
+
+    uint8_t *a = (uint8_t*)xmalloc(MAX_REGS + 4);
+    uint8_t *b = (uint8_t*)xmalloc(MAX_REGS + 4);
+    uint8_t *c = (uint8_t*)xmalloc(MAX_REGS + 4);
+
+    uint64_t errors = 0, e;
+    e = run_sum(a);
+    report_errors(10, "sum", e);
+    errors += e;
+    e = run_sketches();
+    report_errors(10, "sketches", e);
+    errors += e;
+    e = run_max(a, b, c);
+    report_errors(10, "max", e);
+    errors += e;
+    e = run_sparse();
+    report_errors(10, "sparse", e);
+    errors += e;
+    e = run_dense();
+    report_errors(10, "dense", e);
+    errors += e;
+    e = run_serialize();
+    report_errors(10, "serialize", e);
+    errors += e;
+    e = run_merge();
+    report_errors(10, "merge", e);
+    errors += e;
+
+    run_throughput(a, b, bits, repeat);
+    free(a);
+    free(b);
+    free(c);
+
+    return bench_verdict(errors, "mismatches");
+}
@@ -0,0 +1,251 @@
+/*
+ * Stress test and throughput of line_union
+ *
+ * Usage: line_union_bench [--lines N] [--threads N] [--pieces N]
+ *
+ * Runs the merge memcount makes when threads exit together: 1, 2, 4, ...
+ * --threads threads, released at once, each add the line set of one
+ * source to a shared line_union in --pieces calls, the last one repeating
+ * some of the source's earlier lines (which must stay private to it). Each
+ * source has --lines distinct lines: half its own, a quarter drawn from a
+ * pool every source draws from, and a quarter shared with its neighbour
+ * source only, so lines end up private, shared by two or shared by many.
+ *
+ * A brute-force count over every (line, source) pair must give the same
+ * distinct, shared and private lines, and the source count must equal the
+ * calls made. Meanwhile a reader thread keeps reading the stats: lines and
+ * shared lines may only grow, and never more shared than distinct. Every
+ * violation (wrong count, failed add, stats going back) is counted and
+ * makes the run fail. Reports lines added per second.
+ */
+
+#include "line_union.h"
+#include "bench_util.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_THREADS 64
+
+typedef struct {
+    line_union_t      *u;
+    pthread_barrier_t *start;
+    uint32_t           source;
+    uint64_t          *keys;       /* distinct, then the repeats */
+    size_t             n;          /* distinct keys */
+    size_t             repeats;
+    unsigned           pieces;
+    uint64_t           errors;
+} source_t;
+
+typedef struct {
+    line_union_t *u;
+    volatile int  done;
+    uint64_t      calls;        /* line_union_add() calls in the run */
+    uint64_t      polls;
+    uint64_t      errors;
+} reader_t;
+
+typedef struct {
+    uint64_t key;
+    uint32_t source;
+} pair_t;
+
+/* --- helpers --- */
+
+static const char usage_args[] = "[--lines N] [--threads N] [--pieces N]";
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int cmp_pair(const void *a, const void *b) {
+    const pair_t *x = (const pair_t*)a, *y = (const pair_t*)b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->source < y->source ? -1 : x->source > y->source;
+}
+
+/* The distinct lines of source t (line addresses, 64-byte aligned),
+   shuffled, followed by repeats of an eighth of them */
+static void make_keys(source_t *s, unsigned t, size_t lines) {
+    uint64_t seed = 0x853c49e6748fea9bULL + t * 0x9e3779b97f4a7c15ULL;
+    size_t n = 0;
+
+    s->keys = (uint64_t*)xmalloc((lines + lines / 8) * sizeof(uint64_t));
+    for (size_t i = 0; i < lines; i++) {
+        uint64_t r = next_rand(&seed), line;
+        if (r % 4 < 2)
+            line = (uint64_t)(t + 1) << 40 | i;                 /* own */
+        else if (r % 4 == 2)
+            line = (r >> 8) % lines;                            /* pool */
+        else
+            line = (uint64_t)(t / 2 + 1) << 50 | (r >> 8) % lines;  /* pair */
+        s->keys[n++] = line << 6;
+    }
+    qsort(s->keys, n, sizeof(uint64_t), cmp_u64);
+    size_t d = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (d == 0 || s->keys[i] != s->keys[d - 1])
+            s->keys[d++] = s->keys[i];
+    }
+    for (size_t i = d; i > 1; i--) {
+        size_t j = next_rand(&seed) % i;
+        uint64_t k = s->keys[i - 1];
+        s->keys[i - 1] = s->keys[j];
+        s->keys[j] = k;
+    }
+    s->n = d;
+    s->repeats = d / 8;
+    for (size_t i = 0; i < s->repeats; i++)
+        s->keys[d + i] = s->keys[next_rand(&seed) % d];
+}
+
+static void *source_main(void *arg) {
+    source_t *s = (source_t*)arg;
+
+    pthread_barrier_wait(s->start);
+    for (unsigned p = 0; p + 1 < s->pieces; p++) {
+        size_t lo = s->n * p / (s->pieces - 1), hi = s->n * (p + 1) / (s->pieces - 1);
+        s->errors += line_union_add(s->u, s->source, s->keys + lo, hi - lo) != 0;
+    }
+    s->errors += line_union_add(s->u, s->source, s->keys + s->n, s->repeats) != 0;
+    return NULL;
+}
+
+static void *reader_main(void *arg) {
+    reader_t *r = (reader_t*)arg;
+    line_union_stats_t last, st;
+
+    memset(&last, 0, sizeof(last));
+    while (!__atomic_load_n(&r->done, __ATOMIC_ACQUIRE)) {
+        line_union_get_stats(r->u, &st);
+        r->errors += st.lines < last.lines || st.shared < last.shared;
+        r->errors += st.shared > st.lines || st.priv != st.lines - st.shared;
+        r->errors += st.sources < last.sources || st.sources > r->calls;
+        last = st;
+        r->polls++;
+    }
+    return NULL;
+}
+
+/* Distinct and shared lines over every (line, source) pair */
+static void brute_force(const source_t *src, unsigned threads, uint64_t *lines,
+                        uint64_t *shared) {
+    size_t n = 0, total = 0;
+
+    for (unsigned t = 0; t < threads; t++)
+        total += src[t].n;
+    pair_t *pairs = (pair_t*)xmalloc(total * sizeof(pair_t));
+    for (unsigned t = 0; t < threads; t++) {
+        for (size_t i = 0; i < src[t].n; i++) {
+            pairs[n].key = src[t].keys[i];
+            pairs[n++].source = src[t].source;
+        }
+    }
+    qsort(pairs, n, sizeof(pair_t), cmp_pair);
+
+    *lines = *shared = 0;
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && pairs[j].key == pairs[i].key)
+            j++;
+        (*lines)++;
+        *shared += pairs[j - 1].source != pairs[i].source;
+        i = j;
+    }
+    free(pairs);
+}
+
+static uint64_t run(unsigned threads, size_t lines, unsigned pieces) {
+    source_t src[MAX_THREADS];
+    pthread_t tid[MAX_THREADS];
+    pthread_t reader_tid;
+    pthread_barrier_t start;
+    reader_t reader;
+    line_union_stats_t st;
+    uint64_t errors = 0, want_lines, want_shared, added = 0;
+    line_union_t *u = line_union_create();
+
+    if (!u)
+        out_of_memory();
+    pthread_barrier_init(&start, NULL, threads + 1);
+    for (unsigned t = 0; t < threads; t++) {
+        memset(&src[t], 0, sizeof(src[t]));
+        src[t].u = u;
+        src[t].start = &start;
+        src[t].source = t + 1;
+        src[t].pieces = pieces;
+        make_keys(&src[t], t, lines);
+        added += src[t].n + src[t].repeats;
+    }
+    memset(&reader, 0, sizeof(reader));
+    reader.u = u;
+    reader.calls = (uint64_t)threads * pieces;
+
+    pthread_create(&reader_tid, NULL, reader_main, &reader);
+    for (unsigned t = 0; t < threads; t++)
+        pthread_create(&tid[t], NULL, source_main, &src[t]);
+    double t0 = now_sec();
+    pthread_barrier_wait(&start);
+    for (unsigned t = 0; t < threads; t++)
+        pthread_join(tid[t], NULL);
+    double secs = now_sec() - t0;
+    __atomic_store_n(&reader.done, 1, __ATOMIC_RELEASE);
+    pthread_join(reader_tid, NULL);
+
+    brute_force(src, threads, &want_lines, &want_shared);
+    line_union_get_stats(u, &st);
+    errors += st.lines != want_lines || st.shared != want_shared;
+    errors += st.priv != want_lines - want_shared;
+    errors += st.sources != reader.calls;
+    errors += reader.errors;
+    for (unsigned t = 0; t < threads; t++) {
+        errors += src[t].errors;
+        free(src[t].keys);
+    }
+
+    printf("%-8u %12llu %12llu %12llu %10llu %10.1f %10llu\n", threads,
+           (unsigned long long)st.lines, (unsigned long long)st.shared,
+           (unsigned long long)st.priv, (unsigned long long)reader.polls,
+           (double)added / secs / 1e6, (unsigned long long)errors);
+
+    pthread_barrier_destroy(&start);
+    line_union_destroy(u);
+    return errors;
+}
+
+int main(int argc, char **argv) {
+    uint64_t lines = 200000;
+    unsigned threads = 8, pieces = 4;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--lines") && i + 1 < argc) {
+            lines = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = (unsigned)atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--pieces") && i + 1 < argc) {
+            pieces = (unsigned)atoi(argv[++i]);
+        } else {
+            bench_usage(argv[0], usage_args);
+            return 1;
+        }
+    }
+    if (lines == 0 || threads == 0 || threads > MAX_THREADS || pieces < 2) {
+        bench_usage(argv[0], usage_args);
+        return 1;
+    }
+
+    printf("%-8s %12s %12s %12s %10s %10s %10s\n", "threads", "lines", "shared",
+           "private", "polls", "Mlines/s", "errors");
+    uint64_t errors = 0;
+    for (unsigned t = 1; t < 2 * threads; t *= 2)
+        errors += run(t < threads ? t : threads, (size_t)lines, pieces);
+
+    return bench_verdict(errors, "violations");
+}
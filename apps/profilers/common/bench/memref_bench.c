@@ -0,0 +1,331 @@
+/*
+ * Benchmark of memcount's reference-record loop
+ *
+ * Usage: memref_bench [--refs N] [--buffer N] [--ws] [--repeat N]
+ *
+ * Replays what the inline instrumentation and memtrace() do with one
+ * per-thread buffer -- fill max_mem_refs records, then walk them computing
+ * cache line keys, read/write counts and size bins -- three ways:
+ *
+ *   legacy  40-byte mem_ref_t {write, addr, size, pc, timestamp}, buffer
+ *           memset after every flush
+ *   packed  16-byte memref_t with write/size folded into the pc word, one
+ *           record at a time (no memset)
+ *   kernel  16-byte memref_t digested by memref_batch(), working-set
+ *           updates issued afterwards with ws_record_batch()
+ *
+ * --ws adds the exact working set update to every loop, to see
+ * the record handling against the rest of the per-reference work. Before
+ * timing, the SIMD kernel is checked against memref_batch_scalar(), and
+ * memref_count_batch() over a buffer in pieces, folded once, against
+ * memref_batch() of the whole.
+ */
+
+#include "memref.h"
+#include "ws_tsearch.h"
+#include "bench_util.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_SIZE_BINS MEMREF_SIZE_BINS
+#define WINDOW_REFS   1000
+#define NUM_LAYOUTS   3
+
+typedef struct {
+    bool write;
+    void *addr;
+    size_t size;
+    void *pc;
+    uint64_t timestamp;
+} legacy_ref_t;
+
+typedef struct {
+    uint64_t reads, writes;
+    uint64_t read_size[NUM_SIZE_BINS];
+    uint64_t write_size[NUM_SIZE_BINS];
+    uint64_t sample_refs;
+    uint64_t windows;
+    uint64_t key_sum;       /* keeps the line keys live */
+} counters_t;
+
+/* One synthetic access stream shared by both layouts */
+typedef struct {
+    uint64_t addr;
+    uint64_t pc;
+    uint32_t size;
+    bool     write;
+} access_t;
+
+/* --- helpers --- */
+
+/* A loop body of a few memory instructions, each with a fixed size and
+   type as in real code, walking arrays with some irregular accesses */
+static void make_accesses(access_t *a, size_t n) {
+    static const struct { uint32_t size; bool write; } body[] = {
+        { 8, false }, { 8, false }, { 4, false }, { 8, true },
+        { 16, false }, { 1, false }, { 8, false }, { 32, true },
+        { 2, false }, { 8, true }, { 64, false }, { 10, false },
+    };
+    const size_t body_len = sizeof(body) / sizeof(body[0]);
+    uint64_t s = 0x9e3779b97f4a7c15ULL;
+    uint64_t base = 0x7f0000000000ULL;
+    for (size_t i = 0; i < n; i++) {
+        size_t k = i % body_len;
+        uint64_t r = next_rand(&s);
+        a[i].addr = k % 4 == 3 ? base + (r % (1 << 26)) * 8      /* gather */
+                               : base + ((i / body_len) * 8 + k * 4096) % (1 << 28);
+        a[i].pc = 0x400000 + k * 6;
+        a[i].size = body[k].size;
+        a[i].write = body[k].write;
+    }
+}
+
+static void count_ref(counters_t *c, uint64_t key, bool write, unsigned size) {
+    c->key_sum += key;
+    if (write) {
+        c->writes++;
+        c->write_size[memref_size_bin(size)]++;
+    } else {
+        c->reads++;
+        c->read_size[memref_size_bin(size)]++;
+    }
+    if (++c->sample_refs == WINDOW_REFS) {
+        c->sample_refs = 0;
+        c->windows++;
+    }
+}
+
+static memref_t *fill_packed(memref_t *buf, const access_t *acc, size_t m) {
+    memref_t *ptr = buf;
+    for (size_t i = 0; i < m; i++, ptr++) {
+        ptr->addr = acc[i].addr;
+        ptr->info = memref_info(acc[i].pc, acc[i].size, acc[i].write);
+    }
+    return ptr;
+}
+
+/* memref_batch() against the scalar reference, and pieces counted by
+   memref_count_batch() against the whole, over awkward lengths */
+static int check_kernel(const access_t *acc, size_t n) {
+    static const size_t lens[] = { 0, 1, 2, 3, 5, 7, 255, 256, 257, 1000, 4099 };
+    size_t max = 4099 < n ? 4099 : n;
+    memref_t *buf = (memref_t*)malloc(max * sizeof(memref_t));
+    uint64_t *k0 = (uint64_t*)malloc(max * sizeof(uint64_t));
+    uint64_t *k1 = (uint64_t*)malloc(max * sizeof(uint64_t));
+    int ok = buf && k0 && k1;
+
+    for (size_t l = 0; ok && l < sizeof(lens) / sizeof(lens[0]); l++) {
+        size_t m = lens[l] < max ? lens[l] : max;
+        memref_hist_t h0, h1, h2;
+        memref_counter_t c;
+        memset(&h0, 0, sizeof(h0));
+        memset(&h1, 0, sizeof(h1));
+        memset(&h2, 0, sizeof(h2));
+        memset(&c, 0, sizeof(c));
+        fill_packed(buf, acc, m);
+        /* sizes past the table and past the 15-bit field */
+        if (m > 2) buf[1].info = memref_info(0x1234, 4096, 1);
+        if (m > 3) buf[2].info = memref_info(0x1234, 1u << 20, 0);
+        memref_batch(buf, m, ~(uint64_t)63, k0, &h0);
+        memref_batch_scalar(buf, m, ~(uint64_t)63, k1, &h1);
+        ok = !memcmp(&h0, &h1, sizeof(h0)) && !memcmp(k0, k1, m * sizeof(uint64_t)) &&
+             memref_hist_reads(&h0) + memref_hist_writes(&h0) == m;
+
+        /* pieces of 1, 2, 3, ... records; the pending count starts where
+           the counters must fold first */
+        c.pending = 1u << 31;
+        for (size_t done = 0, k = 1; done < m; done += k, k++) {
+            if (k > m - done) k = m - done;
+            memref_count_batch(buf + done, k, ~(uint64_t)63, k1 + done, &c);
+        }
+        memref_counter_take(&c, &h2);
+        ok = ok && !memcmp(&h0, &h2, sizeof(h0)) && !memcmp(k0, k1, m * sizeof(uint64_t)) &&
+             c.pending == 0;
+    }
+    free(buf);
+    free(k0);
+    free(k1);
+    return ok ? 0 : -1;
+}
+
+/* --- layouts --- */
+
+static double run_legacy(const access_t *acc, size_t n, size_t buf_refs,
+                         ws_ctx_t *ws, counters_t *c) {
+    size_t buf_size = buf_refs * sizeof(legacy_ref_t);
+    legacy_ref_t *buf = (legacy_ref_t*)calloc(buf_refs, sizeof(legacy_ref_t));
+    uint64_t *line_keys = (uint64_t*)malloc(buf_refs * sizeof(uint64_t));
+    if (!buf || !line_keys) exit(1);
+
+    double t0 = now_sec();
+    for (size_t done = 0; done < n; done += buf_refs) {
+        size_t m = n - done < buf_refs ? n - done : buf_refs;
+        legacy_ref_t *ptr = buf;
+        for (size_t i = 0; i < m; i++, ptr++) {
+            const access_t *a = &acc[done + i];
+            ptr->write = a->write;
+            ptr->addr = (void*)(uintptr_t)a->addr;
+            ptr->size = a->size;
+            ptr->pc = (void*)(uintptr_t)a->pc;
+        }
+
+        int num_refs = (int)(ptr - buf);
+        for (int i = 0; i < num_refs; i++) {
+            uint64_t key = (uintptr_t)buf[i].addr & ~(uint64_t)63;
+            if (ws) ws_record(ws, key);
+            line_keys[i] = key;
+            count_ref(c, key, buf[i].write, (unsigned)buf[i].size);
+        }
+        memset(buf, 0, buf_size);
+    }
+    double t = now_sec() - t0;
+
+    free(buf);
+    free(line_keys);
+    return t;
+}
+
+static double run_packed(const access_t *acc, size_t n, size_t buf_refs,
+                         ws_ctx_t *ws, counters_t *c) {
+    memref_t *buf = (memref_t*)malloc(buf_refs * sizeof(memref_t));
+    uint64_t *line_keys = (uint64_t*)malloc(buf_refs * sizeof(uint64_t));
+    if (!buf || !line_keys) exit(1);
+
+    double t0 = now_sec();
+    for (size_t done = 0; done < n; done += buf_refs) {
+        size_t m = n - done < buf_refs ? n - done : buf_refs;
+        memref_t *ptr = fill_packed(buf, acc + done, m);
+
+        int num_refs = (int)(ptr - buf);
+        for (int i = 0; i < num_refs; i++) {
+            uint64_t key = buf[i].addr & ~(uint64_t)63;
+            if (ws) ws_record(ws, key);
+            line_keys[i] = key;
+            count_ref(c, key, MEMREF_IS_WRITE(&buf[i]), MEMREF_SIZE(&buf[i]));
+        }
+    }
+    double t = now_sec() - t0;
+
+    free(buf);
+    free(line_keys);
+    return t;
+}
+
+static double run_kernel(const access_t *acc, size_t n, size_t buf_refs,
+                         ws_ctx_t *ws, counters_t *c) {
+    memref_t *buf = (memref_t*)malloc(buf_refs * sizeof(memref_t));
+    uint64_t *line_keys = (uint64_t*)malloc(buf_refs * sizeof(uint64_t));
+    memref_hist_t hist;
+    if (!buf || !line_keys) exit(1);
+    memset(&hist, 0, sizeof(hist));
+
+    double t0 = now_sec();
+    for (size_t done = 0; done < n; done += buf_refs) {
+        size_t m = n - done < buf_refs ? n - done : buf_refs;
+        memref_t *ptr = fill_packed(buf, acc + done, m);
+
+        size_t num_refs = (size_t)(ptr - buf);
+        memref_batch(buf, num_refs, ~(uint64_t)63, line_keys, &hist);
+        if (ws) ws_record_batch(ws, line_keys, num_refs);
+        for (size_t i = 0; i < num_refs; i++)
+            c->key_sum += line_keys[i];
+        c->sample_refs += num_refs;
+        c->windows += c->sample_refs / WINDOW_REFS;
+        c->sample_refs %= WINDOW_REFS;
+    }
+    double t = now_sec() - t0;
+
+    memcpy(c->read_size, hist.read_size, sizeof(c->read_size));
+    memcpy(c->write_size, hist.write_size, sizeof(c->write_size));
+    c->reads = memref_hist_reads(&hist);
+    c->writes = memref_hist_writes(&hist);
+    free(buf);
+    free(line_keys);
+    return t;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--refs N] [--buffer N] [--ws] [--repeat N]\n"
+            "  --refs N     references replayed per run (20000000)\n"
+            "  --buffer N   records per buffer, memcount's max_mem_refs (8192)\n"
+            "  --ws         include the exact working set update\n"
+            "  --repeat N   runs per variant, best time reported (3)\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    size_t n = 20000000, buf_refs = 8192;
+    int repeat = 3, with_ws = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--refs") && i + 1 < argc) {
+            n = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--buffer") && i + 1 < argc) {
+            buf_refs = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--ws")) {
+            with_ws = 1;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (n == 0 || buf_refs == 0 || repeat <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    access_t *acc = (access_t*)malloc(n * sizeof(access_t));
+    if (!acc) {
+        fprintf(stderr, "Error: cannot allocate %zu accesses\n", n);
+        return 1;
+    }
+    make_accesses(acc, n);
+
+    if (check_kernel(acc, n) != 0) {
+        fprintf(stderr, "Error: memref_batch disagrees with the scalar kernel\n");
+        return 1;
+    }
+
+    double best[NUM_LAYOUTS] = { 0, 0, 0 };
+    counters_t result[NUM_LAYOUTS];
+    for (int r = 0; r < repeat; r++) {
+        for (int layout = 0; layout < NUM_LAYOUTS; layout++) {
+            counters_t c;
+            memset(&c, 0, sizeof(c));
+            ws_ctx_t *ws = with_ws ? ws_create() : NULL;
+            double t = layout == 0 ? run_legacy(acc, n, buf_refs, ws, &c)
+                     : layout == 1 ? run_packed(acc, n, buf_refs, ws, &c)
+                                   : run_kernel(acc, n, buf_refs, ws, &c);
+            if (ws) ws_destroy(ws);
+            if (r == 0 || t < best[layout]) best[layout] = t;
+            result[layout] = c;
+        }
+    }
+
+    for (int layout = 1; layout < NUM_LAYOUTS; layout++) {
+        if (memcmp(&result[0], &result[layout], sizeof(counters_t)) != 0) {
+            fprintf(stderr, "Error: variants disagree\n");
+            return 1;
+        }
+    }
+
+    printf("%zu references, %zu-record buffers%s\n", n, buf_refs,
+           with_ws ? ", with exact WSS" : "");
+    printf("  legacy (%2zu B/ref + memset): %7.2f ns/ref  %8.1f Mref/s\n",
+           sizeof(legacy_ref_t), best[0] * 1e9 / n, n / best[0] / 1e6);
+    printf("  packed (%2zu B/ref):          %7.2f ns/ref  %8.1f Mref/s  %.2fx\n",
+           sizeof(memref_t), best[1] * 1e9 / n, n / best[1] / 1e6, best[0] / best[1]);
+    printf("  kernel (memref_batch):       %7.2f ns/ref  %8.1f Mref/s  %.2fx\n",
+           best[2] * 1e9 / n, n / best[2] / 1e6, best[0] / best[2]);
+
+    free(acc);
+    return 0;
+}
@@ -0,0 +1,266 @@
+/*
+ * Stress test and throughput of spsc_ring and buf_pool
+ *
+ * Usage: offload_bench [--items N] [--pairs N] [--buffers N] [--size N]
+ *                      [--consumers N] [--work N]
+ *
+ * Runs the handoff memcount's offload mode makes, in independent
+ * producer/consumer pairs running at once:
+ *
+ *   ring    the producer pushes the sequence 1..items through an spsc_ring
+ *           of --buffers slots, the consumer checks it arrives in order
+ *   pool    the producer takes a buffer from a buf_pool, fills every word
+ *           with the item's sequence number and pushes it; the consumer
+ *           checks the contents, optionally spends --work iterations on
+ *           it, and puts it back
+ *
+ * With --consumers above 1 several threads share the consumer side of each
+ * pair, taking turns under a try-lock the way an analysis thread and an
+ * exiting application thread do. Every violation (lost, repeated or
+ * reordered item, torn buffer, buffer missing from the pool at the end) is
+ * counted and makes the run fail. Reports items per second and how often
+ * each side had to wait.
+ */
+
+#include "spsc_ring.h"
+#include "buf_pool.h"
+#include "bench_util.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_CONSUMERS 8
+
+typedef struct {
+    spsc_ring_t    *ring;
+    buf_pool_t     *pool;           /* NULL in the ring test */
+    uint64_t        items;
+    size_t          words;          /* uint64 words filled per buffer */
+    unsigned        work;
+    pthread_mutex_t turn;           /* consumer side, held while popping */
+
+    /* consumer side, under turn */
+    uint64_t        next;           /* expected sequence number */
+    uint64_t        errors;
+    uint64_t        empty_spins;
+    volatile uint64_t sink;
+
+    /* producer side */
+    uint64_t        full_spins;
+} pair_t;
+
+typedef struct {
+    double   secs;
+    uint64_t errors;
+    uint64_t full_spins;
+    uint64_t empty_spins;
+    uint64_t pool_misses;
+} result_t;
+
+/* --- helpers --- */
+
+static const char usage_args[] =
+    "[--items N] [--pairs N] [--buffers N] [--size N] [--consumers N] [--work N]";
+
+static void *producer_main(void *arg) {
+    pair_t *p = (pair_t*)arg;
+
+    for (uint64_t seq = 1; seq <= p->items; seq++) {
+        void *item = (void*)(uintptr_t)seq;
+        if (p->pool) {
+            pool_buf_t *b;
+            while (!(b = buf_pool_get(p->pool)))
+                sched_yield();
+            uint64_t *w = (uint64_t*)b->data;
+            for (size_t i = 0; i < p->words; i++)
+                w[i] = seq;
+            b->len = p->words * sizeof(uint64_t);
+            b->stamp = seq;
+            item = b;
+        }
+        while (spsc_ring_push(p->ring, item) != 0) {
+            p->full_spins++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* Check one item; returns 0 or the number of violations */
+static uint64_t consume(pair_t *p, void *item) {
+    uint64_t errors = 0;
+    uint64_t seq;
+
+    if (!p->pool) {
+        seq = (uint64_t)(uintptr_t)item;
+    } else {
+        pool_buf_t *b = (pool_buf_t*)item;
+        const uint64_t *w = (const uint64_t*)b->data;
+        seq = b->stamp;
+        if (b->len != p->words * sizeof(uint64_t))
+            errors++;
+        for (size_t i = 0; i < p->words; i++)
+            errors += w[i] != seq;
+        uint64_t x = seq;
+        for (unsigned k = 0; k < p->work; k++)
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        p->sink += x;
+        buf_pool_put(p->pool, b);
+    }
+    errors += seq != p->next;
+    p->next = seq + 1;
+    return errors;
+}
+
+static void *consumer_main(void *arg) {
+    pair_t *p = (pair_t*)arg;
+
+    for (;;) {
+        if (pthread_mutex_trylock(&p->turn) != 0) {
+            sched_yield();
+            continue;
+        }
+        if (p->next > p->items) {
+            pthread_mutex_unlock(&p->turn);
+            return NULL;
+        }
+        /* drain a few, then let another consumer take its turn */
+        int got = 0;
+        for (int k = 0; k < 16; k++) {
+            void *item = spsc_ring_pop(p->ring);
+            if (!item)
+                break;
+            p->errors += consume(p, item);
+            got++;
+        }
+        if (!got)
+            p->empty_spins++;
+        pthread_mutex_unlock(&p->turn);
+        if (!got)
+            sched_yield();
+    }
+}
+
+static int run(int with_pool, uint64_t items, unsigned pairs, unsigned buffers,
+               size_t size, unsigned consumers, unsigned work, result_t *res) {
+    pair_t *p = (pair_t*)calloc(pairs, sizeof(pair_t));
+    pthread_t *threads = (pthread_t*)malloc((size_t)pairs * (1 + consumers) * sizeof(pthread_t));
+    int rc = 0;
+
+    memset(res, 0, sizeof(*res));
+    if (!p || !threads) {
+        free(p);
+        free(threads);
+        return -1;
+    }
+    for (unsigned i = 0; i < pairs; i++) {
+        p[i].ring = spsc_ring_create(buffers);
+        p[i].pool = with_pool ? buf_pool_create(buffers, size) : NULL;
+        p[i].items = items;
+        p[i].words = size / sizeof(uint64_t);
+        p[i].work = work;
+        p[i].next = 1;
+        pthread_mutex_init(&p[i].turn, NULL);
+        if (!p[i].ring || (with_pool && !p[i].pool))
+            rc = -1;
+    }
+
+    double t0 = now_sec();
+    size_t nt = 0;
+    for (unsigned i = 0; rc == 0 && i < pairs; i++) {
+        pthread_create(&threads[nt++], NULL, producer_main, &p[i]);
+        for (unsigned c = 0; c < consumers; c++)
+            pthread_create(&threads[nt++], NULL, consumer_main, &p[i]);
+    }
+    for (size_t t = 0; t < nt; t++)
+        pthread_join(threads[t], NULL);
+    res->secs = now_sec() - t0;
+
+    for (unsigned i = 0; i < pairs; i++) {
+        if (rc == 0) {
+            res->errors += p[i].errors + (p[i].next != items + 1);
+            res->errors += spsc_ring_size(p[i].ring) != 0;
+            res->full_spins += p[i].full_spins;
+            res->empty_spins += p[i].empty_spins;
+        }
+        if (p[i].pool) {
+            buf_pool_stats_t st;
+            buf_pool_get_stats(p[i].pool, &st);
+            res->pool_misses += st.misses;
+            if (rc == 0) {
+                /* every buffer must be back */
+                res->errors += st.gets != items;
+                for (unsigned b = 0; b < buffers; b++)
+                    res->errors += buf_pool_get(p[i].pool) == NULL;
+                res->errors += buf_pool_get(p[i].pool) != NULL;
+            }
+        }
+        buf_pool_destroy(p[i].pool);
+        spsc_ring_destroy(p[i].ring);
+        pthread_mutex_destroy(&p[i].turn);
+    }
+    free(p);
+    free(threads);
+    return rc;
+}
+
+static void report(const char *name, uint64_t items, unsigned pairs, const result_t *r) {
+    double total = (double)items * pairs;
+    printf("%-6s %10.2f Mitems/s %14llu %14llu %14llu %10llu\n", name,
+           total / r->secs / 1e6,
+           (unsigned long long)r->full_spins, (unsigned long long)r->empty_spins,
+           (unsigned long long)r->pool_misses, (unsigned long long)r->errors);
+}
+
+int main(int argc, char **argv) {
+    uint64_t items = 2000000;
+    unsigned pairs = 2, buffers = 4, consumers = 1, work = 0;
+    size_t size = 4096;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--items") && i + 1 < argc) {
+            items = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--pairs") && i + 1 < argc) {
+            pairs = (unsigned)atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--buffers") && i + 1 < argc) {
+            buffers = (unsigned)atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+            size = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--consumers") && i + 1 < argc) {
+            consumers = (unsigned)atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--work") && i + 1 < argc) {
+            work = (unsigned)atoi(argv[++i]);
+        } else {
+            bench_usage(argv[0], usage_args);
+            return 1;
+        }
+    }
+    if (items == 0 || pairs == 0 || buffers == 0 || size < sizeof(uint64_t) ||
+        consumers == 0 || consumers > MAX_CONSUMERS) {
+        bench_usage(argv[0], usage_args);
+        return 1;
+    }
+
+    printf("%llu items x %u pairs, %u slots/buffers of %zu bytes, %u consumer(s) per pair\n",
+           (unsigned long long)items, pairs, buffers, size, consumers);
+    printf("%-6s %19s %14s %14s %14s %10s\n", "test", "throughput",
+           "full waits", "empty waits", "pool misses", "errors");
+
+    result_t r;
+    uint64_t errors = 0;
+    if (run(0, items, pairs, buffers, size, consumers, work, &r) != 0)
+        out_of_memory();
+    report("ring", items, pairs, &r);
+    errors += r.errors;
+    if (run(1, items, pairs, buffers, size, consumers, work, &r) != 0)
+        out_of_memory();
+    report("pool", items, pairs, &r);
+    errors += r.errors;
+
+    return bench_verdict(errors, "violations");
+}
@@ -0,0 +1,373 @@
+/*
+ * Checks and throughput of pc_table
+ *
+ * Usage: pc_table_bench [--refs N]
+ *
+ * Feeds --refs references from a skewed (Zipf) pc stream, whose popular
+ * pcs change halfway through, to tables of several capacities and checks
+ * them against the exact per-pc counts, counting every mismatch:
+ *
+ *   bounds     the top list is in descending bytes without repeated pcs;
+ *              every entry's bytes are at least its true bytes and at most
+ *              true bytes plus error, with error at most total/capacity;
+ *              entries never evicted (error 0) count bytes, reads and
+ *              writes exactly, and their line estimates keep an RMS error
+ *              within 1.5 standard errors; every pc with more than
+ *              total/capacity of the bytes is tracked; the entries' bytes
+ *              sum to the total
+ *   batch      pc_table_record_batch() must build the same table as
+ *              pc_table_record()
+ *   merge      the stream recorded into four tables and merged must equal
+ *              one table when nothing is evicted, and otherwise keep the
+ *              order, the upper bounds and the total
+ *   index      every tracked pc recorded again must be found, not admitted
+ *              a second time; in the clustered case every pc hashes near
+ *              the end of the index, so its probe runs wrap around and
+ *              every eviction's backward-shift delete moves entries
+ *
+ * then reports recording throughput per table. Exits 1 on any mismatch.
+ */
+
+#include "pc_table.h"
+#include "hash64.h"
+#include "bench_util.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HLL_BITS    6
+#define LINES_RMS   (1.5 * 1.04 / 8)    /* 1.5 standard errors at HLL_BITS */
+#define LINES_MIN   100                 /* exact entries to judge the RMS */
+#define MERGE_PARTS 4
+#define PC_NONE     SIZE_MAX
+
+typedef struct {
+    const char *name;
+    size_t      cap;
+    size_t      pcs;        /* distinct pcs in the stream */
+    int         clustered;  /* pcs crowded into four index slots */
+} pc_case_t;
+
+static const pc_case_t cases[] = {
+    { "fits",      4096, 2000,  0 },
+    { "skewed",    256,  20000, 0 },
+    { "clustered", 8,    64,    1 },
+};
+#define CASES (sizeof(cases) / sizeof(cases[0]))
+
+typedef struct {
+    size_t    npcs;
+    uint64_t *pcs;          /* ascending */
+    memref_t *refs;
+    size_t    n;
+    /* exact counts per pc */
+    uint64_t *bytes;
+    uint64_t *reads;
+    uint64_t *writes;
+    uint64_t *lines;
+    uint64_t  total;
+} stream_t;
+
+/* --- helpers --- */
+
+static const char usage_args[] = "[--refs N]";
+
+static pc_table_t *pc_new(size_t cap) {
+    pc_table_t *t = pc_table_create(cap, HLL_BITS);
+    if (!t) {
+        fprintf(stderr, "Error: pc_table_create failed\n");
+        exit(1);
+    }
+    return t;
+}
+
+/* Index slots as pc_table sizes them: a power of two, at least 16 and
+   twice the capacity */
+static uint64_t index_mask(size_t cap) {
+    uint64_t slots = 16;
+    while (slots < 2 * cap)
+        slots <<= 1;
+    return slots - 1;
+}
+
+static void make_pcs(stream_t *s, const pc_case_t *c) {
+    uint64_t mask = index_mask(c->cap);
+
+    for (uint64_t k = 0, n = 0; n < c->pcs; k++) {
+        uint64_t pc = 0x400000 + 4 * k;
+        uint64_t slot = hash64_u64(pc, HASH64_SEED) & mask;
+        if (!c->clustered || slot <= 1 || slot >= mask - 1)
+            s->pcs[n++] = pc;
+    }
+}
+
+static size_t find_pc(const stream_t *s, uint64_t pc) {
+    size_t lo = 0, hi = s->npcs;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (s->pcs[mid] < pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < s->npcs && s->pcs[lo] == pc ? lo : PC_NONE;
+}
+
+/* Pc of rank r drawn with probability ~ 1/(r+1)^1.1; halfway through the
+   ranks move by half the pcs, so early heavy hitters must make room. Each
+   pc touches up to 1 + id*37 % 500 lines, cycling through them. */
+static void make_stream(stream_t *s, const pc_case_t *c, size_t n) {
+    double *cdf = (double*)xcalloc(c->pcs, sizeof(double)), sum = 0;
+    uint64_t seed = 0x853c49e6748fea9bULL;
+
+    s->npcs = c->pcs;
+    s->n = n;
+    s->pcs = (uint64_t*)xcalloc(c->pcs, sizeof(uint64_t));
+    s->refs = (memref_t*)xcalloc(n, sizeof(memref_t));
+    s->bytes = (uint64_t*)xcalloc(c->pcs, sizeof(uint64_t));
+    s->reads = (uint64_t*)xcalloc(c->pcs, sizeof(uint64_t));
+    s->writes = (uint64_t*)xcalloc(c->pcs, sizeof(uint64_t));
+    s->lines = (uint64_t*)xcalloc(c->pcs, sizeof(uint64_t));
+    s->total = 0;
+    make_pcs(s, c);
+
+    for (size_t r = 0; r < c->pcs; r++) {
+        sum += 1.0 / pow((double)(r + 1), 1.1);
+        cdf[r] = sum;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint64_t r = next_rand(&seed);
+        double u = (double)(r >> 11) * 0x1.0p-53 * sum;
+        size_t lo = 0, hi = c->pcs - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (cdf[mid] < u)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        size_t id = i < n / 2 ? lo : (lo + c->pcs / 2) % c->pcs;
+        uint32_t size = 1u << (r & 3);
+        int write = (r >> 2 & 3) == 0;
+        uint64_t span = 1 + id * 37 % 500;
+        uint64_t seen = s->reads[id] + s->writes[id];
+        uint64_t line = (uint64_t)id << 20 | seen % span;
+
+        s->refs[i].addr = line << 6 | (r >> 8 & 7);
+        s->refs[i].info = memref_info(s->pcs[id], size, write);
+        s->bytes[id] += size;
+        if (write)
+            s->writes[id]++;
+        else
+            s->reads[id]++;
+        s->lines[id] = seen + 1 < span ? seen + 1 : span;
+        s->total += size;
+    }
+    free(cdf);
+}
+
+static void free_stream(stream_t *s) {
+    free(s->pcs);
+    free(s->refs);
+    free(s->bytes);
+    free(s->reads);
+    free(s->writes);
+    free(s->lines);
+}
+
+static void record_range(pc_table_t *t, const memref_t *refs, size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++)
+        pc_table_record(t, MEMREF_PC(&refs[i]), refs[i].addr & ~63ULL,
+                        MEMREF_SIZE(&refs[i]), MEMREF_IS_WRITE(&refs[i]));
+}
+
+/* Bounds of every entry against the exact counts. A merged table only
+   keeps the upper bounds: a pc evicted from one part and not readmitted
+   loses that part's bytes. */
+static uint64_t check_bounds(const stream_t *s, const pc_table_t *t, size_t cap, int merged) {
+    pc_stat_t *out = (pc_stat_t*)xcalloc(cap, sizeof(pc_stat_t));
+    uint8_t *tracked = (uint8_t*)xcalloc(s->npcs, 1);
+    uint64_t errors = 0, sum = 0, max_error = (merged ? 2 : 1) * s->total / cap;
+    uint64_t exact = 0;
+    double sq = 0;
+    pc_table_stats_t st;
+    size_t got;
+
+    pc_table_get_stats(t, &st);
+    got = pc_table_top(t, out, cap);
+    errors += st.refs != s->n || st.bytes != s->total;
+    errors += got != st.entries || got > cap;
+
+    for (size_t k = 0; k < got; k++) {
+        size_t id = find_pc(s, out[k].pc);
+        sum += out[k].bytes;
+        errors += k > 0 && out[k].bytes > out[k - 1].bytes;
+        if (id == PC_NONE || tracked[id]) {
+            errors++;
+            continue;
+        }
+        tracked[id] = 1;
+        errors += out[k].bytes > s->bytes[id] + out[k].error;
+        errors += out[k].error > max_error;
+        errors += out[k].reads > s->reads[id] || out[k].writes > s->writes[id];
+        if (merged)
+            continue;
+        errors += out[k].bytes < s->bytes[id];
+        if (out[k].error == 0) {
+            errors += out[k].bytes != s->bytes[id];
+            errors += out[k].reads != s->reads[id] || out[k].writes != s->writes[id];
+            double rel = out[k].lines / (double)s->lines[id] - 1;
+            sq += rel * rel;
+            exact++;
+        }
+    }
+    errors += sum != s->total;
+    errors += exact >= LINES_MIN && sqrt(sq / (double)exact) > LINES_RMS;
+
+    /* Space-Saving's guarantee */
+    if (!merged) {
+        for (size_t id = 0; id < s->npcs; id++)
+            errors += s->bytes[id] * cap > s->total && !tracked[id];
+    }
+    free(out);
+    free(tracked);
+    return errors;
+}
+
+static uint64_t same_tables(const pc_table_t *a, const pc_table_t *b, size_t cap) {
+    pc_stat_t *x = (pc_stat_t*)xcalloc(cap, sizeof(pc_stat_t));
+    pc_stat_t *y = (pc_stat_t*)xcalloc(cap, sizeof(pc_stat_t));
+    pc_table_stats_t sa, sb;
+    uint64_t errors = 0;
+    size_t na, nb;
+
+    pc_table_get_stats(a, &sa);
+    pc_table_get_stats(b, &sb);
+    errors += sa.refs != sb.refs || sa.bytes != sb.bytes ||
+              sa.entries != sb.entries || sa.evictions != sb.evictions;
+    na = pc_table_top(a, x, cap);
+    nb = pc_table_top(b, y, cap);
+    errors += na != nb;
+    for (size_t k = 0; k < na && k < nb; k++) {
+        errors += x[k].pc != y[k].pc || x[k].bytes != y[k].bytes ||
+                  x[k].error != y[k].error || x[k].reads != y[k].reads ||
+                  x[k].writes != y[k].writes || x[k].lines != y[k].lines;
+    }
+    free(x);
+    free(y);
+    return errors;
+}
+
+/* Each tracked pc recorded once more must hit its entry */
+static uint64_t check_index(const stream_t *s, pc_table_t *t, size_t cap) {
+    pc_stat_t *before = (pc_stat_t*)xcalloc(cap, sizeof(pc_stat_t));
+    pc_stat_t *after = (pc_stat_t*)xcalloc(cap, sizeof(pc_stat_t));
+    uint64_t *reads = (uint64_t*)xcalloc(s->npcs, sizeof(uint64_t));
+    pc_table_stats_t s0, s1;
+    uint64_t errors = 0;
+    size_t n0, n1;
+
+    pc_table_get_stats(t, &s0);
+    n0 = pc_table_top(t, before, cap);
+    for (size_t k = 0; k < n0; k++) {
+        size_t id = find_pc(s, before[k].pc);
+        if (id != PC_NONE)
+            reads[id] = before[k].reads + 1;
+        pc_table_record(t, before[k].pc, 0, 1, 0);
+    }
+    pc_table_get_stats(t, &s1);
+    errors += s1.evictions != s0.evictions || s1.entries != s0.entries;
+
+    n1 = pc_table_top(t, after, cap);
+    errors += n1 != n0;
+    for (size_t k = 0; k < n1; k++) {
+        size_t id = find_pc(s, after[k].pc);
+        errors += id == PC_NONE || after[k].reads != reads[id];
+    }
+    free(before);
+    free(after);
+    free(reads);
+    return errors;
+}
+
+static uint64_t run_case(const pc_case_t *c, size_t n) {
+    stream_t s;
+    pc_table_t *one, *batch, *merged, *part[MERGE_PARTS];
+    pc_table_stats_t st;
+    uint64_t bounds, same, merge, index;
+    double t0, secs;
+
+    make_stream(&s, c, n);
+
+    one = pc_new(c->cap);
+    record_range(one, s.refs, 0, n);
+    pc_table_get_stats(one, &st);
+    bounds = check_bounds(&s, one, c->cap, 0);
+
+    batch = pc_new(c->cap);
+    t0 = now_sec();
+    pc_table_record_batch(batch, s.refs, n, ~63ULL);
+    secs = now_sec() - t0;
+    same = same_tables(one, batch, c->cap);
+
+    merged = pc_new(c->cap);
+    merge = 0;
+    for (int p = 0; p < MERGE_PARTS; p++) {
+        part[p] = pc_new(c->cap);
+        record_range(part[p], s.refs, n * p / MERGE_PARTS, n * (p + 1) / MERGE_PARTS);
+        merge += pc_table_merge(merged, part[p]) != 0;
+    }
+    if (st.evictions == 0)
+        merge += same_tables(one, merged, c->cap);
+    else
+        merge += check_bounds(&s, merged, c->cap, 1);
+
+    /* sketches of different sizes do not merge */
+    pc_table_t *other = pc_table_create(c->cap, HLL_BITS + 1);
+    merge += !other || pc_table_merge(other, one) != -1;
+    pc_table_destroy(other);
+
+    index = check_index(&s, one, c->cap) + check_index(&s, merged, c->cap);
+
+    printf("%-10s %6zu %6zu %10llu %8llu %8llu %8llu %8llu %10.1f\n", c->name, c->cap,
+           c->pcs, (unsigned long long)st.evictions, (unsigned long long)bounds,
+           (unsigned long long)same, (unsigned long long)merge,
+           (unsigned long long)index, (double)n / secs / 1e6);
+
+    pc_table_destroy(one);
+    pc_table_destroy(batch);
+    pc_table_destroy(merged);
+    for (int p = 0; p < MERGE_PARTS; p++)
+        pc_table_destroy(part[p]);
+    free_stream(&s);
+    return bounds + same + merge + index;
+}
+
+int main(int argc, char **argv) {
+    uint64_t refs = 2000000;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--refs") && i + 1 < argc) {
+            refs = strtoull(argv[++i], NULL, 10);
+        } else {
+            bench_usage(argv[0], usage_args);
+            return 1;
+        }
+    }
+    if (refs < MERGE_PARTS) {
+        bench_usage(argv[0], usage_args);
+        return 1;
+    }
+
+    uint64_t errors = 0;
+    printf("%-10s %6s %6s %10s %8s %8s %8s %8s %10s\n", "case", "cap", "pcs",
+           "evictions", "bounds", "batch", "merge", "index", "Mrefs/s");
+    for (size_t c = 0; c < CASES; c++)
+        errors += run_case(&cases[c], (size_t)refs);
+
+    return bench_verdict(errors, "mismatches");
+}
@@ -0,0 +1,242 @@
+/*
+ * Checks and throughput of reuse_distance
+ *
+ * Usage: rd_bench [--refs N] [--keys N]
+ *
+ * Checks, counting every mismatch:
+ *
+ *   exact      at rate 1 every distance is measured: the histogram must
+ *              equal, bucket by bucket, the distances of a brute-force LRU
+ *              stack over the same references, the cold count must equal
+ *              the distinct keys, and rd_record_batch() must agree with
+ *              rd_record(). The stream is long enough to renumber slots
+ *              (rd_compact) many times over.
+ *   sampled    on a stream of 5M references over 1M keys, miss ratio curves at SHARDS rate 0.01
+ *              and with a fixed key budget (rate halved as keys pile up)
+ *              must keep a mean absolute error below 0.025 against the
+ *              exact curve, and below 0.075 at every size (sampling moves
+ *              the knees of small working sets the most); the budget must
+ *              hold and the rate must have dropped
+ *
+ * then reports references per second for each mode on a stream of --refs
+ * references over --keys keys. Exits 1 on any mismatch.
+ */
+
+#include "reuse_distance.h"
+#include "bench_util.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EXACT_KEYS  3000
+#define EXACT_REFS  300000
+#define SAMPLED_KEYS 1000000
+#define SAMPLED_REFS 5000000
+#define MRC_SIZES   12
+#define MAX_BUCKETS 1024
+#define FIXED_KEYS  8192
+#define MRC_MAE     0.025
+#define MRC_MAX     0.075
+
+typedef struct {
+    const char *name;
+    double      rate;
+    size_t      max_keys;
+} rd_mode_t;
+
+static const rd_mode_t modes[] = {
+    { "exact",      1.0,  0 },
+    { "rate 0.01",  0.01, 0 },
+    { "fixed-size", 1.0,  FIXED_KEYS },
+};
+#define MODES (sizeof(modes) / sizeof(modes[0]))
+
+/* --- helpers --- */
+
+static const char usage_args[] = "[--refs N] [--keys N]";
+
+static rd_ctx_t *rd_new(double rate, size_t max_keys) {
+    rd_ctx_t *rd = rd_create(rate, max_keys);
+    if (!rd) {
+        fprintf(stderr, "Error: rd_create failed\n");
+        exit(1);
+    }
+    return rd;
+}
+
+/* Half the references to a hot set of keys/100, a third to a warm set of
+   keys/10, the rest scanning all keys: a curve with three knees */
+static void make_stream(uint64_t *refs, size_t n, uint64_t keys, uint64_t seed) {
+    uint64_t scan = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t r = next_rand(&seed), k;
+        if (r % 6 < 3)
+            k = (r >> 8) % (keys / 100 + 1);
+        else if (r % 6 < 5)
+            k = (r >> 8) % (keys / 10 + 1);
+        else
+            k = scan++ % keys;
+        refs[i] = k << 6;       /* line addresses */
+    }
+}
+
+static uint64_t run_exact(void) {
+    uint64_t *refs = (uint64_t*)xmalloc(EXACT_REFS * sizeof(uint64_t));
+    uint64_t *stack = (uint64_t*)xmalloc(EXACT_KEYS * sizeof(uint64_t));
+    uint64_t *dist = (uint64_t*)xcalloc(EXACT_KEYS, sizeof(uint64_t));
+    rd_bucket_t *buckets = (rd_bucket_t*)xmalloc(MAX_BUCKETS * sizeof(rd_bucket_t));
+    rd_bucket_t *batch_buckets = (rd_bucket_t*)xmalloc(MAX_BUCKETS * sizeof(rd_bucket_t));
+    rd_ctx_t *one = rd_new(1.0, 0), *batch = rd_new(1.0, 0);
+    uint64_t errors = 0, depth = 0, cold = 0;
+    rd_stats_t st;
+
+    make_stream(refs, EXACT_REFS, EXACT_KEYS, 0x853c49e6748fea9bULL);
+
+    /* brute force: an LRU stack, most recent first; the distance is the
+       key's depth in it */
+    for (size_t i = 0; i < EXACT_REFS; i++) {
+        uint64_t d = 0;
+        while (d < depth && stack[d] != refs[i])
+            d++;
+        if (d == depth) {
+            cold++;
+            depth++;
+        } else {
+            dist[d]++;
+        }
+        memmove(stack + 1, stack, d * sizeof(uint64_t));
+        stack[0] = refs[i];
+        rd_record(one, refs[i]);
+    }
+    for (size_t i = 0; i < EXACT_REFS; i += 1000)
+        rd_record_batch(batch, refs + i, EXACT_REFS - i < 1000 ? EXACT_REFS - i : 1000);
+
+    size_t nb = rd_histogram(one, buckets, MAX_BUCKETS);
+    size_t nbb = rd_histogram(batch, batch_buckets, MAX_BUCKETS);
+    errors += nb > MAX_BUCKETS || nb != nbb;
+    uint64_t covered = 0;
+    for (size_t b = 0; b < nb && b < MAX_BUCKETS; b++) {
+        uint64_t want = 0;
+        for (uint64_t d = buckets[b].lo; d < buckets[b].hi && d < EXACT_KEYS; d++)
+            want += dist[d];
+        errors += buckets[b].count != (double)want;
+        errors += b < nbb && (batch_buckets[b].lo != buckets[b].lo ||
+                              batch_buckets[b].count != buckets[b].count);
+        covered += want;
+    }
+    /* every reuse fell in some bucket */
+    errors += covered != EXACT_REFS - cold;
+
+    rd_get_stats(one, &st);
+    errors += st.cold != (double)cold || st.refs != EXACT_REFS || st.sampled != EXACT_REFS;
+    errors += st.live_keys != cold;
+
+    rd_destroy(one);
+    rd_destroy(batch);
+    free(refs);
+    free(stack);
+    free(dist);
+    free(buckets);
+    free(batch_buckets);
+    return errors;
+}
+
+static uint64_t run_sampled(void) {
+    uint64_t *refs = (uint64_t*)xmalloc(SAMPLED_REFS * sizeof(uint64_t));
+    uint64_t sizes[MRC_SIZES];
+    double curve[MODES][MRC_SIZES], mae[MODES] = { 0 };
+    uint64_t errors = 0;
+
+    make_stream(refs, SAMPLED_REFS, SAMPLED_KEYS, 0x2545f4914f6cdd1dULL);
+    for (int s = 0; s < MRC_SIZES; s++)
+        sizes[s] = (SAMPLED_KEYS / 1024 + 1) << s;
+
+    for (size_t m = 0; m < MODES; m++) {
+        rd_ctx_t *rd = rd_new(modes[m].rate, modes[m].max_keys);
+        rd_stats_t st;
+
+        rd_record_batch(rd, refs, SAMPLED_REFS);
+        rd_mrc(rd, sizes, MRC_SIZES, curve[m]);
+        rd_get_stats(rd, &st);
+        if (modes[m].max_keys) {
+            errors += st.live_keys > modes[m].max_keys;
+            errors += !(st.rate < modes[m].rate);
+        }
+        rd_destroy(rd);
+    }
+    free(refs);
+
+    printf("\nmiss ratio curves:\n%-10s", "lines");
+    for (size_t m = 0; m < MODES; m++)
+        printf(" %10s", modes[m].name);
+    printf("\n");
+    for (int s = 0; s < MRC_SIZES; s++) {
+        printf("%-10llu", (unsigned long long)sizes[s]);
+        for (size_t m = 0; m < MODES; m++) {
+            double err = fabs(curve[m][s] - curve[0][s]);
+            printf(" %10.4f", curve[m][s]);
+            errors += err > MRC_MAX;
+            mae[m] += err / MRC_SIZES;
+        }
+        printf("\n");
+    }
+    printf("%-10s", "MAE");
+    for (size_t m = 0; m < MODES; m++) {
+        printf(" %10.4f", mae[m]);
+        errors += mae[m] > MRC_MAE;
+    }
+    printf("\n");
+    return errors;
+}
+
+static void run_throughput(const uint64_t *refs, size_t n) {
+    printf("\nrecording (Mrefs/s):\n");
+    for (size_t m = 0; m < MODES; m++) {
+        rd_ctx_t *rd = rd_new(modes[m].rate, modes[m].max_keys);
+        double t0 = now_sec();
+        rd_record_batch(rd, refs, n);
+        double secs = now_sec() - t0;
+        printf("  %-12s %10.1f\n", modes[m].name, (double)n / secs / 1e6);
+        rd_destroy(rd);
+    }
+}
+
+int main(int argc, char **argv) {
+    uint64_t refs = 5000000, keys = 1000000;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--refs") && i + 1 < argc) {
+            refs = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--keys") && i + 1 < argc) {
+            keys = strtoull(argv[++i], NULL, 10);
+        } else {
+            bench_usage(argv[0], usage_args);
+            return 1;
+        }
+    }
+    if (refs == 0 || keys == 0) {
+        bench_usage(argv[0], usage_args);
+        return 1;
+    }
+
+    uint64_t errors = 0, e;
+    e = run_exact();
+    report_errors(10, "exact", e);
+    errors += e;
+
+    e = run_sampled();
+    report_errors(10, "sampled", e);
+    errors += e;
+
+    uint64_t *stream = (uint64_t*)xmalloc(refs * sizeof(uint64_t));
+    make_stream(stream, refs, keys, 0x9e3779b97f4a7c15ULL);
+    run_throughput(stream, refs);
+    free(stream);
+
+    return bench_verdict(errors, "mismatches");
+}
@@ -0,0 +1,242 @@
+/*
+ * Checks and throughput of region_map
+ *
+ * Usage: region_bench [--ops N] [--refs N] [--threads N]
+ *
+ * Checks, counting every mismatch:
+ *
+ *   model      --ops random sets and removes of ranges over a small address
+ *              space, mirrored in a plain array holding one region per
+ *              address; after each, the map must be sorted, disjoint,
+ *              without empty ranges or touching ranges of the same region,
+ *              and a lookup of every address (one at a time and in one
+ *              batch) must agree with the array
+ *   threads    --threads readers look up addresses in fixed ranges while a
+ *              writer keeps setting and removing ranges between them: no
+ *              reader may ever see a fixed range change
+ *
+ * then reports batch lookups per second for maps of 16 to 4096 ranges,
+ * for references scattered over every range and for runs of eight
+ * references in the same range (a loop over an array). Exits 1 on any
+ * mismatch.
+ */
+
+#include "region_map.h"
+#include "bench_util.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MODEL_SPACE  4096
+#define MAX_THREADS  64
+#define FIXED_RANGES 64
+#define SLOT         0x10000        /* address space per fixed range */
+
+typedef struct {
+    region_map_t *m;
+    uint64_t      refs;
+    uint64_t      seed;
+    uint64_t      errors;
+    const int    *stop;
+} reader_arg_t;
+
+/* --- helpers --- */
+
+static const char usage_args[] = "[--ops N] [--refs N] [--threads N]";
+
+/* Walk the map through lookups: every change of region or of range is a
+   boundary, so the ranges can be rebuilt from the model's point of view.
+   Checks the invariants the lookups can see and compares every address. */
+static uint64_t check_model(region_map_t *m, const uint8_t *model, memref_t *refs,
+                            uint8_t *got) {
+    uint64_t errors = 0;
+    size_t ranges = 0;
+
+    for (uint64_t a = 0; a < MODEL_SPACE; a++) {
+        errors += region_map_lookup(m, a) != model[a];
+        refs[a].addr = a;
+        refs[a].info = 0;
+    }
+    region_map_lookup_batch(m, refs, MODEL_SPACE, got);
+    for (uint64_t a = 0; a < MODEL_SPACE; a++) {
+        errors += got[a] != model[a];
+        /* touching ranges of one region merge, so each run of a region is
+           exactly one range */
+        if (model[a] != MEM_REGION_OTHER && (a == 0 || model[a - 1] != model[a]))
+            ranges++;
+    }
+    errors += region_map_size(m) != ranges;
+    return errors;
+}
+
+static uint64_t run_model(uint64_t ops, uint64_t seed) {
+    region_map_t *m = region_map_create();
+    uint8_t *model = (uint8_t*)calloc(MODEL_SPACE, 1);
+    uint8_t *got = (uint8_t*)malloc(MODEL_SPACE);
+    memref_t *refs = (memref_t*)malloc(MODEL_SPACE * sizeof(memref_t));
+    uint64_t errors = 0;
+
+    if (!m || !model || !got || !refs)
+        out_of_memory();
+    for (uint64_t op = 0; op < ops; op++) {
+        uint64_t r = next_rand(&seed);
+        /* mostly short ranges, some long ones spanning many others */
+        uint64_t len = 1 + (r % 8 == 0 ? next_rand(&seed) % 1024 : next_rand(&seed) % 32);
+        uint64_t start = next_rand(&seed) % MODEL_SPACE;
+        uint64_t end = start + len > MODEL_SPACE ? MODEL_SPACE : start + len;
+        uint8_t region = (uint8_t)((r >> 8) % MEM_REGION_COUNT);
+
+        if (region == MEM_REGION_OTHER)
+            errors += region_map_remove(m, start, end) != 0;
+        else
+            errors += region_map_set(m, start, end, region) != 0;
+        memset(model + start, region, end - start);
+        if (op % 16 == 0 || op + 1 == ops)
+            errors += check_model(m, model, refs, got);
+    }
+    region_map_destroy(m);
+    free(model);
+    free(got);
+    free(refs);
+    return errors;
+}
+
+/* Fixed range k is [k * SLOT, k * SLOT + SLOT / 2) */
+static uint8_t fixed_region(uint64_t k) {
+    return (uint8_t)(1 + k % (MEM_REGION_COUNT - 1));
+}
+
+static void *reader_main(void *arg) {
+    reader_arg_t *a = (reader_arg_t*)arg;
+    memref_t refs[256];
+    uint8_t got[256];
+    uint64_t seed = a->seed;
+
+    while (!__atomic_load_n(a->stop, __ATOMIC_ACQUIRE)) {
+        for (int i = 0; i < 256; i++) {
+            uint64_t k = next_rand(&seed) % FIXED_RANGES;
+            refs[i].addr = k * SLOT + next_rand(&seed) % (SLOT / 2);
+            refs[i].info = 0;
+        }
+        region_map_lookup_batch(a->m, refs, 256, got);
+        for (int i = 0; i < 256; i++)
+            a->errors += got[i] != fixed_region(refs[i].addr / SLOT);
+        a->refs += 256;
+    }
+    return NULL;
+}
+
+static uint64_t run_threads(unsigned threads, uint64_t ops) {
+    region_map_t *m = region_map_create();
+    pthread_t tids[MAX_THREADS];
+    reader_arg_t args[MAX_THREADS];
+    uint64_t seed = 0x9e3779b97f4a7c15ULL, errors = 0;
+    int stop = 0;
+
+    if (!m)
+        out_of_memory();
+    for (uint64_t k = 0; k < FIXED_RANGES; k++)
+        errors += region_map_set(m, k * SLOT, k * SLOT + SLOT / 2, fixed_region(k)) != 0;
+    for (unsigned t = 0; t < threads; t++) {
+        args[t].m = m;
+        args[t].refs = 0;
+        args[t].seed = 0x2545f4914f6cdd1dULL * (t + 1);
+        args[t].errors = 0;
+        args[t].stop = &stop;
+        pthread_create(&tids[t], NULL, reader_main, &args[t]);
+    }
+    /* churn the other half of every slot, growing the map past its
+       initial capacity and back */
+    for (uint64_t op = 0; op < ops; op++) {
+        uint64_t k = next_rand(&seed) % FIXED_RANGES;
+        uint64_t lo = k * SLOT + SLOT / 2 + next_rand(&seed) % (SLOT / 2);
+        uint64_t hi = lo + 1 + next_rand(&seed) % 256;
+        if (hi > (k + 1) * SLOT)
+            hi = (k + 1) * SLOT;
+        uint8_t region = (uint8_t)(next_rand(&seed) % MEM_REGION_COUNT);
+        errors += region_map_set(m, lo, hi, region) != 0;
+    }
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    for (unsigned t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+        errors += args[t].errors;
+    }
+    region_map_destroy(m);
+    return errors;
+}
+
+/* Batch lookup throughput over a map of n ranges of 64 KiB, one per
+   128 KiB; run references in a row share a range */
+static double run_throughput(size_t n, uint64_t refs_total, unsigned run) {
+    region_map_t *m = region_map_create();
+    memref_t *refs = (memref_t*)malloc(8192 * sizeof(memref_t));
+    uint8_t *got = (uint8_t*)malloc(8192);
+    uint64_t seed = 88172645463325252ULL, sink = 0;
+
+    if (!m || !refs || !got)
+        out_of_memory();
+    for (size_t k = 0; k < n; k++)
+        region_map_set(m, k << 17, (k << 17) + (1 << 16), (uint8_t)(1 + k % (MEM_REGION_COUNT - 1)));
+    for (size_t i = 0; i < 8192; i += run) {
+        uint64_t base = (next_rand(&seed) % n) << 17;
+        for (unsigned j = 0; j < run && i + j < 8192; j++) {
+            refs[i + j].addr = base + (next_rand(&seed) & 0xffff);
+            refs[i + j].info = 0;
+        }
+    }
+
+    double t0 = now_sec();
+    for (uint64_t done = 0; done < refs_total; done += 8192) {
+        region_map_lookup_batch(m, refs, 8192, got);
+        sink += got[done % 8192];
+    }
+    double secs = now_sec() - t0;
+    if (sink == UINT64_MAX)
+        printf("%llu\n", (unsigned long long)sink);
+
+    region_map_destroy(m);
+    free(refs);
+    free(got);
+    return (double)refs_total / secs / 1e6;
+}
+
+int main(int argc, char **argv) {
+    uint64_t ops = 20000, refs = 50000000;
+    unsigned threads = 4;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--ops") && i + 1 < argc) {
+            ops = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--refs") && i + 1 < argc) {
+            refs = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = (unsigned)atoi(argv[++i]);
+        } else {
+            bench_usage(argv[0], usage_args);
+            return 1;
+        }
+    }
+    if (ops == 0 || refs == 0 || threads == 0 || threads > MAX_THREADS) {
+        bench_usage(argv[0], usage_args);
+        return 1;
+    }
+
+    uint64_t errors = 0, e;
+    e = run_model(ops, 0x853c49e6748fea9bULL);
+    report_errors(8, "model", e);
+    errors += e;
+    e = run_threads(threads, ops * 10);
+    report_errors(8, "threads", e);
+    errors += e;
+
+    printf("\nbatch lookups (Mrefs/s):\n%-8s %10s %10s\n", "ranges", "scattered", "runs of 8");
+    for (size_t n = 16; n <= 4096; n *= 4)
+        printf("%-8zu %10.1f %10.1f\n", n, run_throughput(n, refs, 1),
+               run_throughput(n, refs, 8));
+
+    return bench_verdict(errors, "mismatches");
+}
@@ -0,0 +1,199 @@
+/*
+ * Checks and throughput of ws_window
+ *
+ * Usage: ws_window_bench [--refs N] [--keys N]
+ *
+ * Feeds one reference stream (a hot set of keys mixed with a scan over
+ * --keys keys, so windows see both repeats and one-off keys) to a
+ * ws_window tracking several window sizes in one pass, and to one
+ * ws_tsearch set per size, reset whenever that size's window closes, and
+ * counts every mismatch:
+ *
+ *   levels     each closed window's distinct keys, single-access keys and
+ *              total must equal the ws_tsearch set's
+ *   manual     a level without a window size, reset by hand at irregular
+ *              points, must match the same way at every reset
+ *   open       at the end, every level's open window must match
+ *
+ * then reports references per second of one ws_window pass with every
+ * level against one ws_record() per level. Exits 1 on any mismatch.
+ */
+
+#include "ws_window.h"
+#include "ws_tsearch.h"
+#include "bench_util.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LEVELS 4
+
+/* Window sizes of the tracked levels; 0 is the hand-reset level */
+static const uint64_t window_refs[LEVELS] = { 0, 1000, 4096, 65536 };
+
+typedef struct {
+    ws_ctx_t *ref[LEVELS];     /* brute force: one set per level */
+    uint64_t  windows[LEVELS];
+    uint64_t  errors;
+} check_t;
+
+/* --- helpers --- */
+
+static const char usage_args[] = "[--refs N] [--keys N]";
+
+static uint64_t stats_diff(const ws_stats_t *a, const ws_stats_t *b) {
+    return (a->distinct != b->distinct) + (a->singles != b->singles) +
+           (a->total != b->total);
+}
+
+static uint64_t compare_level(check_t *c, size_t level, const ws_stats_t *got) {
+    ws_stats_t want;
+    ws_get_stats(c->ref[level], &want);
+    return stats_diff(got, &want);
+}
+
+static void on_window(void *arg, size_t level, uint64_t window_idx, const ws_stats_t *stats) {
+    check_t *c = (check_t*)arg;
+
+    c->errors += compare_level(c, level, stats);
+    c->errors += window_idx != c->windows[level];
+    c->windows[level]++;
+    ws_reset(c->ref[level]);
+}
+
+/* 3 in 4 references hit 256 hot keys, the rest scan the key space */
+static void make_stream(uint64_t *keys, uint64_t n, uint64_t key_space) {
+    uint64_t seed = 0x853c49e6748fea9bULL, scan = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t r = next_rand(&seed);
+        if (r % 4 != 0)
+            keys[i] = (r >> 8) % 256;
+        else
+            keys[i] = 256 + scan++ % key_space;
+    }
+}
+
+static uint64_t run_checks(const uint64_t *keys, uint64_t n) {
+    check_t c;
+    ws_window_t *w;
+    uint64_t next_reset = 777, seed = 0x2545f4914f6cdd1dULL;
+
+    memset(&c, 0, sizeof(c));
+    for (int l = 0; l < LEVELS; l++) {
+        c.ref[l] = ws_create();
+        if (!c.ref[l])
+            out_of_memory();
+    }
+    w = ws_window_create(window_refs, LEVELS, on_window, &c);
+    if (!w)
+        out_of_memory();
+
+    for (uint64_t i = 0; i < n; i++) {
+        for (int l = 0; l < LEVELS; l++)
+            ws_record(c.ref[l], keys[i]);
+        ws_window_record(w, keys[i]);
+
+        if (i + 1 == next_reset) {
+            ws_stats_t s;
+            ws_window_get_stats(w, 0, &s);
+            c.errors += compare_level(&c, 0, &s);
+            c.errors += ws_window_index(w, 0) != c.windows[0];
+            ws_window_reset_level(w, 0);
+            ws_reset(c.ref[0]);
+            c.windows[0]++;
+            next_reset += 1 + next_rand(&seed) % 20000;
+        }
+    }
+    for (int l = 0; l < LEVELS; l++) {
+        ws_stats_t s;
+        ws_window_get_stats(w, l, &s);
+        c.errors += compare_level(&c, l, &s);
+    }
+    /* every size that fits the stream closed windows */
+    for (int l = 1; l < LEVELS; l++)
+        c.errors += c.windows[l] != n / window_refs[l];
+
+    ws_window_destroy(w);
+    for (int l = 0; l < LEVELS; l++)
+        ws_destroy(c.ref[l]);
+    return c.errors;
+}
+
+static void nop_window(void *arg, size_t level, uint64_t window_idx, const ws_stats_t *stats) {
+    (void)level;
+    (void)window_idx;
+    *(uint64_t*)arg += stats->distinct;
+}
+
+static void run_throughput(const uint64_t *keys, uint64_t n) {
+    ws_ctx_t *ref[LEVELS];
+    uint64_t sink = 0, fill[LEVELS] = { 0 };
+    ws_window_t *w = ws_window_create(window_refs, LEVELS, nop_window, &sink);
+    double t0, one, sets;
+
+    if (!w)
+        out_of_memory();
+    t0 = now_sec();
+    for (uint64_t i = 0; i < n; i++)
+        ws_window_record(w, keys[i]);
+    one = now_sec() - t0;
+    ws_window_destroy(w);
+
+    for (int l = 0; l < LEVELS; l++)
+        ref[l] = ws_create();
+    t0 = now_sec();
+    for (uint64_t i = 0; i < n; i++) {
+        for (int l = 0; l < LEVELS; l++) {
+            ws_record(ref[l], keys[i]);
+            if (window_refs[l] && ++fill[l] == window_refs[l]) {
+                ws_stats_t s;
+                ws_get_stats(ref[l], &s);
+                sink += s.distinct;
+                ws_reset(ref[l]);
+                fill[l] = 0;
+            }
+        }
+    }
+    sets = now_sec() - t0;
+    for (int l = 0; l < LEVELS; l++)
+        ws_destroy(ref[l]);
+
+    printf("\n%d window sizes in one pass (Mrefs/s):\n", LEVELS);
+    printf("  %-24s %10.1f\n", "ws_window", (double)n / one / 1e6);
+    printf("  %-24s %10.1f\n", "ws_tsearch per size", (double)n / sets / 1e6);
+    if (sink == UINT64_MAX)
+        printf("%llu\n", (unsigned long long)sink);
+}
+
+int main(int argc, char **argv) {
+    uint64_t refs = 2000000, key_space = 100000;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--refs") && i + 1 < argc) {
+            refs = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--keys") && i + 1 < argc) {
+            key_space = strtoull(argv[++i], NULL, 10);
+        } else {
+            bench_usage(argv[0], usage_args);
+            return 1;
+        }
+    }
+    if (refs == 0 || key_space == 0) {
+        bench_usage(argv[0], usage_args);
+        return 1;
+    }
+
+    uint64_t *keys = (uint64_t*)xmalloc(refs * sizeof(uint64_t));
+    make_stream(keys, refs, key_space);
+
+    uint64_t errors = run_checks(keys, refs);
+    report_errors(8, "levels", errors);
+    run_throughput(keys, refs);
+    free(keys);
+
+    return bench_verdict(errors, "mismatches");
+}
@@ -4,5 +4,6 @@
 #include <stdint.h>
 
 uint32_t MurmurHash3_x86_32(const void * key, uint32_t len, uint32_t seed);
+void MurmurHash3_x64_128(const void * key, uint32_t len, uint32_t seed, void * out);
 
 #endif
@@ -0,0 +1,148 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Asynchronous file writer.
+ *
+ * Producers fill fixed-size buffers and hand them to a dedicated I/O thread,
+ * so instrumented application threads never block on the disk. Buffers come
+ * from a pool of num_buffers, which bounds the memory in flight: when the
+ * disk falls behind, aw_acquire() waits for a buffer to be written back
+ * (backpressure) and the wait is counted in the stats.
+ *
+ * Free and submitted buffers travel through lock-free bounded queues; events
+ * are only used to put an idle thread to sleep or wake it. Every buffer is
+ * assigned its file offset when submitted, so buffers may be written in any
+ * order (io_uring keeps several in flight) and the file still reads in
+ * submission order.
+ *
+ * Backends: positional write() on the I/O thread, or io_uring on Linux
+ * (raw syscalls, no liburing), falling back to write() if the kernel does
+ * not support it.
+ *
+ * The I/O thread is a pthread unless a spawn hook is given: runtimes that
+ * own thread creation (DynamoRIO clients must use dr_create_client_thread)
+ * install one with aw_set_default_spawn(). Such threads may not be able to
+ * block on pthread primitives either, so the events every thread sleeps on
+ * are pthread-based unless aw_set_default_sync() installs the runtime's.
+ * If the thread cannot be started the writer degrades to writing on the
+ * submitting thread.
+ *
+ * Many small writers (one per application thread) can share one I/O thread
+ * instead: create it with aw_io_create() and open the writers with
+ * aw_config_t.io set. A writer with buffers queued is listed with the
+ * shared thread, which writes them with write() in the order the writers
+ * were listed; aw_close() waits until the thread is done with the writer.
+ */
+
+#define AW_DEFAULT_BUFFER_SIZE  (1u << 20)
+#define AW_DEFAULT_BUFFERS      8
+
+typedef enum {
+    AW_BACKEND_AUTO = 0,    /* io_uring when available, else write() */
+    AW_BACKEND_WRITE,
+    AW_BACKEND_IO_URING
+} aw_backend_t;
+
+/* Start fn(arg) on a new thread; return 0 on success */
+typedef int (*aw_spawn_fn)(void (*fn)(void *), void *arg);
+
+/* Auto-reset event. event_wait() returns once the event is signaled
+   (consuming the signal) or timeout_ms have passed (0 = no limit); it may
+   also return early, as every caller re-checks what it waits for. A signal
+   given while nobody waits is kept for the next wait. */
+typedef struct {
+    void *(*event_create)(void);          /* NULL on failure */
+    void  (*event_destroy)(void *ev);
+    void  (*event_wait)(void *ev, unsigned timeout_ms);
+    void  (*event_signal)(void *ev);
+} aw_sync_t;
+
+typedef struct aw_io aw_io_t;
+
+typedef struct {
+    size_t       buffer_size;  /* 0 = AW_DEFAULT_BUFFER_SIZE */
+    unsigned     num_buffers;  /* in-flight bound; 0 = AW_DEFAULT_BUFFERS */
+    aw_backend_t backend;
+    aw_spawn_fn  spawn;        /* NULL = default spawn hook, else pthread */
+    int          sync;         /* no I/O thread: write on the caller */
+    aw_io_t     *io;           /* shared I/O thread; NULL = one of its own */
+} aw_config_t;
+
+typedef struct {
+    char    *data;
+    size_t   len;              /* bytes filled by the producer */
+    size_t   cap;              /* buffer_size */
+    uint64_t offset;           /* file offset, set by aw_submit() */
+} aw_buffer_t;
+
+typedef struct {
+    uint64_t bytes_written;
+    uint64_t buffers_written;
+    uint64_t acquire_stalls;   /* aw_acquire() calls that had to wait */
+    uint64_t stall_ns;         /* total time producers waited */
+    uint64_t max_queued;       /* deepest submit queue seen */
+    uint64_t write_errors;
+    int      io_uring;         /* io_uring backend active */
+    int      threaded;         /* I/O thread (own or shared) running */
+} aw_stats_t;
+
+typedef struct async_writer async_writer_t;
+
+/* Used when aw_config_t.spawn is NULL; set before creating writers */
+void aw_set_default_spawn(aw_spawn_fn spawn);
+
+/* Events of the writers created from now on; NULL restores the pthread
+   ones. Set together with the spawn hook. */
+void aw_set_default_sync(const aw_sync_t *sync);
+
+/* Start a shared I/O thread (spawn NULL = default spawn hook, else
+   pthread), using the default events. Returns NULL on failure. */
+aw_io_t *aw_io_create(aw_spawn_fn spawn);
+
+/* Stop the shared thread once its writers are closed. Returns -1 if it did
+   not stop (it is then left running). */
+int aw_io_destroy(aw_io_t *io);
+
+/* Create/truncate filename. cfg NULL = defaults. Returns NULL on failure. */
+async_writer_t *aw_open(const char *filename, const aw_config_t *cfg);
+
+/* --- Buffer interface (thread-safe) --- */
+
+/* Empty buffer from the pool; waits while all buffers are in flight */
+aw_buffer_t *aw_acquire(async_writer_t *w);
+/* Non-blocking form; NULL when the pool is empty */
+aw_buffer_t *aw_try_acquire(async_writer_t *w);
+/* Queue buf->len bytes for writing; the buffer returns to the pool after */
+void         aw_submit(async_writer_t *w, aw_buffer_t *buf);
+/* Return an acquired buffer without writing it */
+void         aw_release(async_writer_t *w, aw_buffer_t *buf);
+
+/* --- Stream interface (callers serialize) --- */
+
+/* Append bytes; full buffers are submitted. Returns 0, or -1 after a write
+   error. */
+int  aw_write(async_writer_t *w, const void *data, size_t len);
+
+/* Submit the partial stream buffer and wait until every buffer submitted so
+   far has been written (not fsynced). Returns -1 if any write failed. */
+int  aw_flush(async_writer_t *w);
+
+/* Flush, stop the I/O thread and close the file. Returns -1 if any write
+   failed or the I/O thread did not stop. */
+int  aw_close(async_writer_t *w);
+
+void aw_get_stats(const async_writer_t *w, aw_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ASYNC_WRITER_H */
@@ -0,0 +1,59 @@
+#ifndef BUF_POOL_H
+#define BUF_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Fixed pool of equal-sized buffers handed between two threads.
+ *
+ * The owner takes free buffers with buf_pool_get() and passes them on
+ * (e.g. through an spsc_ring) to a consumer, which gives each back with
+ * buf_pool_put() once done with it. The free list is itself an SPSC ring
+ * running from the consumer back to the owner, so neither side locks, and
+ * the number of buffers bounds the memory in flight: when the consumer
+ * falls behind, buf_pool_get() returns NULL and the owner has to wait
+ * (backpressure), which the stats count.
+ */
+
+typedef struct {
+    void    *data;      /* buffer_size bytes, 64-byte aligned */
+    size_t   len;       /* bytes filled, for the owner and consumer to use */
+    uint64_t stamp;     /* free for the owner and consumer to use */
+} pool_buf_t;
+
+typedef struct {
+    uint64_t gets;      /* buffers handed out */
+    uint64_t misses;    /* buf_pool_get() calls that found no free buffer */
+    uint64_t min_free;  /* fewest free buffers seen by a get */
+} buf_pool_stats_t;
+
+/* Opaque context */
+typedef struct buf_pool buf_pool_t;
+
+/* Lifecycle. Returns NULL on allocation failure or a zero count or size.
+   Every buffer must be back in the pool when it is destroyed. */
+buf_pool_t *buf_pool_create(unsigned num_buffers, size_t buffer_size);
+void        buf_pool_destroy(buf_pool_t *p);
+
+/* Owner side: a free buffer, or NULL if all are out */
+pool_buf_t *buf_pool_get(buf_pool_t *p);
+
+/* Consumer side: return a buffer taken with buf_pool_get() */
+void        buf_pool_put(buf_pool_t *p, pool_buf_t *b);
+
+/* Owner side */
+void        buf_pool_get_stats(const buf_pool_t *p, buf_pool_stats_t *out_stats);
+
+unsigned    buf_pool_count(const buf_pool_t *p);
+size_t      buf_pool_buffer_size(const buf_pool_t *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BUF_POOL_H */
@@ -0,0 +1,84 @@
+#ifndef BURST_SAMPLER_H
+#define BURST_SAMPLER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Bursty sampling: alternate fully instrumented "on" periods with
+ * uninstrumented "off" periods, and extrapolate the counts seen in the on
+ * periods to the whole run.
+ *
+ * Period lengths are in units the profiler can count cheaply in both modes
+ * (instructions, or references counted statically per block). Off periods
+ * are drawn uniformly from [off/2, 3*off/2] so the sample does not lock
+ * onto a program loop of the same period; on periods have a fixed length.
+ *
+ * Each on period contributes a pair (x, u): the count of interest (e.g.
+ * references) and the units it spanned. The total is estimated with the
+ * ratio estimator X = (sum x / sum u) * U, where U is the units of the
+ * whole run, with a standard error from the spread of x - r*u across
+ * periods and the finite population correction for the sampled fraction.
+ * The per-period sums are kept, not the periods, so per-thread statistics
+ * merge by addition.
+ */
+
+typedef struct {
+    uint64_t on_len;       /* units per on period */
+    uint64_t off_len;      /* mean units per off period */
+    int      on;           /* currently in an on period */
+    uint64_t units_on;     /* units of completed on periods */
+    uint64_t units_off;    /* units of completed off periods */
+    uint64_t periods;      /* completed on periods */
+    uint64_t rng;          /* xorshift state for off lengths */
+} burst_sched_t;
+
+/* Starts in an on period. off_len == 0 means always on. */
+void     burst_sched_init(burst_sched_t *s, uint64_t on_len, uint64_t off_len,
+                          uint64_t seed);
+
+/* Length of the first period (the one burst_sched_init() starts) */
+uint64_t burst_sched_first(const burst_sched_t *s);
+
+/* End the current period after `units` units (which may overshoot its
+   planned length); switches phase and returns the next period's length */
+uint64_t burst_sched_next(burst_sched_t *s, uint64_t units);
+
+/* Account the units of a period cut short (e.g. by thread exit) */
+void     burst_sched_finish(burst_sched_t *s, uint64_t units);
+
+uint64_t burst_sched_units(const burst_sched_t *s);     /* on + off */
+double   burst_sched_fraction(const burst_sched_t *s);  /* on / (on + off) */
+
+typedef struct {
+    uint64_t n;            /* periods */
+    double   sum_x, sum_u;
+    double   sum_xx, sum_xu, sum_uu;
+} burst_stat_t;
+
+typedef struct {
+    double estimate;       /* extrapolated total */
+    double std_error;      /* 0 with fewer than two periods */
+    double lo, hi;         /* estimate -/+ z * std_error */
+} burst_estimate_t;
+
+void burst_stat_add(burst_stat_t *st, double x, double u);
+void burst_stat_merge(burst_stat_t *dst, const burst_stat_t *src);
+
+/*
+ * Extrapolate to total_units (all units of the run, on and off) with a
+ * confidence interval of z standard errors (1.96 for 95%).
+ * Returns -1 if no period with nonzero units was recorded.
+ */
+int  burst_stat_estimate(const burst_stat_t *st, double total_units, double z,
+                         burst_estimate_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BURST_SAMPLER_H */
@@ -0,0 +1,106 @@
+#ifndef CACHE_SIM_H
+#define CACHE_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "memref.h"
+
+/*
+ * Set-associative cache hierarchy simulator.
+ *
+ * A cache_level_t is one cache: sets of ways holding line tags, replaced by
+ * LRU, tree pseudo-LRU or static RRIP, with write-back or write-through and
+ * write-allocate or no-write-allocate policies. A cache_hier_t puts up to
+ * CACHE_SIM_MAX_LEVELS of them in front of memory for one thread: the
+ * private levels it creates and owns, optionally followed by a last level
+ * shared with other hierarchies. A shared level locks per group of sets,
+ * so threads touching different sets do not wait on each other.
+ *
+ * The hierarchy is non-inclusive: a miss fills the line into every level
+ * it missed in, except that a write to a no-write-allocate level is passed
+ * on down instead; a dirty victim is written into the next level; a write
+ * hit at a write-through level is passed down too. An access spanning
+ * several lines accesses each of them. Statistics are kept per hierarchy,
+ * so a shared level's counts are split by the thread that caused them and
+ * add up across hierarchies.
+ */
+
+#define CACHE_SIM_MAX_LEVELS 4
+
+typedef enum {
+    CACHE_REPL_LRU = 0,         /* least recently used */
+    CACHE_REPL_PLRU,            /* tree pseudo-LRU; ways a power of two, at most 64 */
+    CACHE_REPL_RRIP             /* static RRIP with 2-bit re-reference predictions */
+} cache_repl_t;
+
+typedef struct {
+    uint64_t     size;          /* bytes; size / (ways * line_size) sets, a power of two */
+    uint32_t     ways;
+    uint32_t     line_size;     /* power of two, the same at every level */
+    cache_repl_t repl;
+    int          write_back;    /* else write-through */
+    int          write_allocate; /* else no-write-allocate */
+} cache_level_config_t;
+
+typedef struct {
+    uint64_t read_hits;         /* reads and fills from the level above */
+    uint64_t read_misses;
+    uint64_t write_hits;        /* writes, and write-throughs from above */
+    uint64_t write_misses;
+    uint64_t writebacks;        /* dirty lines evicted to the next level */
+} cache_level_stats_t;
+
+typedef struct {
+    cache_level_stats_t level[CACHE_SIM_MAX_LEVELS];
+    uint64_t mem_reads;         /* line fills from memory */
+    uint64_t mem_writes;        /* writebacks and write-throughs reaching memory */
+} cache_hier_stats_t;
+
+/* Opaque contexts */
+typedef struct cache_level cache_level_t;
+typedef struct cache_hier  cache_hier_t;
+
+/* One cache. shared makes it safe to use from several hierarchies at once.
+   Returns NULL on an invalid geometry or allocation failure. */
+cache_level_t *cache_level_create(const cache_level_config_t *cfg, int shared);
+void           cache_level_destroy(cache_level_t *c);
+
+/* n private levels from cfg[0, n), then shared_last if not NULL (not owned
+   by the hierarchy, and outliving it). Returns NULL on an invalid or empty
+   hierarchy, differing line sizes or allocation failure. */
+cache_hier_t *cache_hier_create(const cache_level_config_t *cfg, unsigned n,
+                                cache_level_t *shared_last);
+void          cache_hier_destroy(cache_hier_t *h);
+
+/* Levels, including a shared last one; memory is level cache_hier_levels() */
+unsigned      cache_hier_levels(const cache_hier_t *h);
+
+/* Access size bytes at addr. Returns the level that served it, the slowest
+   one for an access spanning lines: 0 for the first level, ...,
+   cache_hier_levels() for memory. */
+unsigned      cache_hier_access(cache_hier_t *h, uint64_t addr, uint32_t size, int write);
+
+/* Access refs[0, n) in order; with served not NULL, served[i] = the level
+   that served refs[i] */
+void          cache_hier_access_batch(cache_hier_t *h, const memref_t *refs, size_t n,
+                                      uint8_t *served);
+
+void          cache_hier_get_stats(const cache_hier_t *h, cache_hier_stats_t *out_stats);
+
+/* dst += src, e.g. per-thread -> global */
+void          cache_hier_stats_add(cache_hier_stats_t *dst, const cache_hier_stats_t *src);
+
+/* Parse "lru", "plru" or "rrip"; returns 0, or -1 if unknown */
+int           cache_repl_parse(const char *name, cache_repl_t *out);
+const char   *cache_repl_name(cache_repl_t repl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CACHE_SIM_H */
@@ -0,0 +1,109 @@
+#ifndef CTRACE_H
+#define CTRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Compact memory trace format (.ctrace).
+ *
+ * Events are split into per-thread streams and stored in blocks of up to
+ * block_events events of one thread. Inside a block every event is an op
+ * byte (write and miss flags, log2 of the access size) followed by the
+ * zigzag varint deltas of its timestamp and address from the previous event
+ * of the block, so each block decodes on its own. Block payloads are
+ * optionally compressed with an LZ4-style byte codec, and an index of all
+ * blocks at the end of the file allows seeking without a scan.
+ *
+ * File layout (little-endian):
+ *   header  "MSCTRACE", u32 version, u32 block_events
+ *   blocks  block header (thread, event count, codec, sizes, time range)
+ *           followed by the payload, repeated
+ *   index   one entry per block (offset, thread, event count, time range)
+ *   footer  u64 index offset, u64 block count, "MSCTIDX\0"
+ * A file without a footer (writer killed before close) is still readable:
+ * the reader then rebuilds the index by walking the block headers.
+ *
+ * Neither the writer nor the reader is thread-safe; callers serialize.
+ */
+
+#define CTRACE_VERSION              1
+#define CTRACE_DEFAULT_BLOCK_EVENTS 65536
+#define CTRACE_MAX_BLOCK_EVENTS     (1u << 24)
+
+/* Writer flags */
+#define CTRACE_COMPRESS             0x1u   /* LZ-compress block payloads */
+
+/* Matches every thread in ctrace_reader_find_block() */
+#define CTRACE_ANY_THREAD           UINT32_MAX
+
+typedef struct {
+    uint64_t timestamp;
+    uint64_t address;
+    uint32_t thread_id;
+    uint32_t size;       /* access size in bytes */
+    uint8_t  is_write;
+    uint8_t  is_miss;
+} ctrace_event_t;
+
+typedef struct {
+    uint64_t offset;     /* file offset of the block header */
+    uint32_t thread_id;
+    uint32_t n_events;
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+} ctrace_block_info_t;
+
+typedef struct ctrace_writer ctrace_writer_t;
+typedef struct ctrace_reader ctrace_reader_t;
+
+/* --- Writer --- */
+
+/* block_events 0 = CTRACE_DEFAULT_BLOCK_EVENTS. Returns NULL on failure. */
+ctrace_writer_t *ctrace_writer_create(const char *filename,
+                                      uint32_t block_events, unsigned flags);
+
+/* Append events; a thread's block is written once it is full.
+   Returns 0 on success, -1 on I/O or allocation failure (sticky). */
+int  ctrace_write_event(ctrace_writer_t *w, const ctrace_event_t *ev);
+int  ctrace_write_events(ctrace_writer_t *w, const ctrace_event_t *evs, size_t n);
+
+/* Write every partially filled block and flush the file */
+int  ctrace_writer_flush(ctrace_writer_t *w);
+
+/* Flush, write the index and footer, close and free.
+   Returns 0 on success, -1 if anything failed since creation. */
+int  ctrace_writer_close(ctrace_writer_t *w);
+
+/* --- Reader --- */
+
+/* Returns NULL if the file is missing or not a ctrace file */
+ctrace_reader_t *ctrace_reader_open(const char *filename);
+void     ctrace_reader_close(ctrace_reader_t *r);
+
+/* Largest block in the file; size decode buffers with this */
+uint32_t ctrace_reader_block_events(const ctrace_reader_t *r);
+size_t   ctrace_reader_num_blocks(const ctrace_reader_t *r);
+uint64_t ctrace_reader_num_events(const ctrace_reader_t *r);
+int      ctrace_reader_block_info(const ctrace_reader_t *r, size_t block,
+                                  ctrace_block_info_t *out);
+
+/* First block at or after `from` of thread_id (or CTRACE_ANY_THREAD) whose
+   last timestamp is >= timestamp; num_blocks if there is none. */
+size_t   ctrace_reader_find_block(const ctrace_reader_t *r, size_t from,
+                                  uint32_t thread_id, uint64_t timestamp);
+
+/* Decode one block into out (room for ctrace_reader_block_events()).
+   Returns the number of events, or -1 on a corrupt block or read error. */
+int      ctrace_reader_read_block(ctrace_reader_t *r, size_t block,
+                                  ctrace_event_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CTRACE_H */
@@ -0,0 +1,47 @@
+#ifndef HASH64_H
+#define	HASH64_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fixed-width hashing for 64-bit keys (cache line / page addresses).
+ *
+ * MurmurHash3's fmix64 finalizer applied to key ^ seed: a bijection on
+ * 64-bit values with full avalanche, so no two keys collide and every output
+ * bit is usable. Much cheaper than running the byte-oriented MurmurHash3
+ * over an 8-byte buffer, and inlines into batch loops.
+ */
+
+#define HASH64_SEED	0x5f61767aULL
+
+static inline uint64_t hash64_u64(uint64_t key, uint64_t seed) {
+	uint64_t h = key ^ seed;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+/* Batch form; the independent multiplies vectorize or pipeline well. */
+static inline void hash64_u64_batch(const uint64_t *keys, uint64_t *out,
+				    size_t n, uint64_t seed) {
+	size_t i;
+
+	for(i = 0; i < n; i++)
+		out[i] = hash64_u64(keys[i], seed);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* HASH64_H */
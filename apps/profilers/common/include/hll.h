@@ -16,10 +16,25 @@ extern int hll_load(struct HLL *hll, const void *registers, size_t size);
 extern void hll_destroy(struct HLL *hll);
 extern int hll_merge(struct HLL *dst, const struct HLL *src);
 extern void hll_add(struct HLL *hll, const void *buf, size_t size);
+
+/* Fixed 64-bit keys (hash64.h). Hashes differ from hll_add(&key, 8), so use
+   one form or the other for a given sketch. */
+extern void hll_add_u64(struct HLL *hll, uint64_t key);
+extern void hll_add_u64_batch(struct HLL *hll, const uint64_t *keys, size_t n);
 extern double hll_count(const struct HLL *hll);
 
 extern uint32_t _hll_hash(const struct HLL *hll);
 
 void hll_reset(struct HLL *hll);   /* zero registers, keep bits/alloc */
 
+/* Register kernels (SSE2/AVX2/AVX-512/NEON, picked at runtime).
+   hll_registers_sum returns sum(2^-r) and the number of zero registers;
+   hll_registers_max folds src into dst with a byte-wise max. */
+extern double hll_registers_sum(const uint8_t *registers, size_t n, uint32_t *zeros);
+extern void hll_registers_max(uint8_t *dst, const uint8_t *src, size_t n);
+
+/* Plain-loop references of the two kernels, for checking them */
+extern double hll_registers_sum_scalar(const uint8_t *registers, size_t n, uint32_t *zeros);
+extern void hll_registers_max_scalar(uint8_t *dst, const uint8_t *src, size_t n);
+
 #endif	/* AVZ_HLL_H */
@@ -0,0 +1,67 @@
+#ifndef HLLPP_H
+#define	HLLPP_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * HyperLogLog++ (64-bit hash).
+ *
+ * Starts in a sparse representation (sorted list of 25-bit-precision
+ * index/rank pairs, estimated with linear counting) and switches to 2^p dense
+ * 6-bit registers once the list would outgrow them. Dense estimates use
+ * Ertl's improved raw estimator, which needs neither the 2^32 large-range
+ * correction of hll.c nor empirical bias tables.
+ */
+
+#define HLLPP_MIN_P        4
+#define HLLPP_MAX_P        18
+#define HLLPP_SPARSE_P     25
+
+typedef struct hllpp {
+	uint8_t p;
+	uint8_t dense;           /* 0 = sparse, 1 = dense */
+
+	size_t m;                /* 2^p */
+	uint8_t *registers;      /* m bytes, kept allocated across resets */
+
+	uint32_t *sparse;        /* sorted, one entry per sparse index */
+	size_t sparse_n;
+	size_t sparse_cap;
+
+	uint32_t *tmp;           /* unsorted insert buffer folded into sparse */
+	size_t tmp_n;
+	size_t tmp_cap;
+} hllpp_t;
+
+extern int hllpp_init(hllpp_t *h, uint8_t p);
+extern void hllpp_destroy(hllpp_t *h);
+extern void hllpp_reset(hllpp_t *h);   /* back to empty sparse, keep allocs */
+
+extern void hllpp_add(hllpp_t *h, const void *buf, size_t size);
+extern void hllpp_add_hash(hllpp_t *h, uint64_t hash);
+
+/* Fixed 64-bit keys (hash64.h); not interchangeable with hllpp_add(&key, 8). */
+extern void hllpp_add_u64(hllpp_t *h, uint64_t key);
+extern void hllpp_add_u64_batch(hllpp_t *h, const uint64_t *keys, size_t n);
+
+extern double hllpp_count(hllpp_t *h);
+extern int hllpp_merge(hllpp_t *dst, const hllpp_t *src);
+
+/* Serialized form (little-endian):
+     "HLPP" | u8 version | u8 p | u8 dense | u8 0 | u32 n | payload
+   payload is n register bytes (dense) or n u32 sparse entries.
+   hllpp_serialize returns the number of bytes written, the required size
+   if buf is NULL, or -1 if buf_size is too small. */
+extern ssize_t hllpp_serialize(hllpp_t *h, void *buf, size_t buf_size);
+extern int hllpp_deserialize(hllpp_t *h, const void *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* HLLPP_H */
@@ -0,0 +1,51 @@
+#ifndef LINE_UNION_H
+#define LINE_UNION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Exact union of the line sets of several sources (threads), telling lines
+ * private to one source from lines shared by two or more.
+ *
+ * Each source adds its distinct keys once, typically when the thread
+ * exits, so a thread that exits early is counted like any other. The set
+ * is split into shards by key hash, each an open-addressing table behind
+ * its own spinlock; an add buckets its keys by shard first and then takes
+ * every shard lock once, so threads exiting together merge in parallel.
+ * Per key the table keeps the first source that added it, or a shared
+ * mark once a second source does.
+ */
+
+/* Opaque context */
+typedef struct line_union line_union_t;
+
+typedef struct {
+    uint64_t lines;     /* distinct keys over all sources */
+    uint64_t shared;    /* keys added by two or more sources */
+    uint64_t priv;      /* keys added by exactly one source */
+    uint64_t sources;   /* line_union_add() calls */
+} line_union_stats_t;
+
+/* Lifecycle. Returns NULL on allocation failure. */
+line_union_t *line_union_create(void);
+void          line_union_destroy(line_union_t *u);
+
+/* Add the distinct keys of one source. source identifies the source and
+   must differ between sources (e.g. a thread sequence number, not an OS
+   thread id that can be reused). Safe to call from several threads at
+   once. Returns 0, or -1 if memory ran out and keys were dropped. */
+int           line_union_add(line_union_t *u, uint32_t source,
+                             const uint64_t *keys, size_t n);
+
+void          line_union_get_stats(line_union_t *u, line_union_stats_t *out_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LINE_UNION_H */
@@ -20,10 +20,25 @@ typedef enum {
     CACHE_MISS = 1
 } hit_miss_t;
 
+// Events per length-delimited MemoryTrace chunk
+#define MEMORY_TRACE_DEFAULT_CHUNK_EVENTS 65536
+#define MEMORY_TRACE_MAX_CHUNK_EVENTS     (1u << 22)
+
 // Opaque handle for memory trace writer
 typedef struct memory_trace_writer memory_trace_writer_t;
 
-// Create a new memory trace writer
+// Traces are written as a stream of length-delimited (4-byte little-endian
+// size) MemoryTrace chunks of up to chunk_events events each. Each chunk is
+// built in a protobuf arena that is reset once the chunk is serialized.
+
+// Create a streaming writer: full chunks go straight to filename, so memory
+// stays constant regardless of trace length. chunk_events 0 =
+// MEMORY_TRACE_DEFAULT_CHUNK_EVENTS. Returns NULL on failure.
+memory_trace_writer_t* memory_trace_open_writer(const char* filename,
+                                                size_t chunk_events);
+
+// Create an in-memory writer (use write_to_file/write_to_buffer later).
+// Full chunks are kept serialized, not as message objects.
 // Returns NULL on failure
 memory_trace_writer_t* memory_trace_create_writer(void);
 
@@ -36,24 +51,34 @@ int memory_trace_add_event(memory_trace_writer_t* writer,
                           mem_op_t mem_op,
                           hit_miss_t hit_miss);
 
-// Write the trace to a file (binary protobuf format)
+// Streaming writer: write the partial chunk and flush the file
+// Returns 0 on success, -1 on failure
+int memory_trace_flush(memory_trace_writer_t* writer);
+
+// Streaming writer: flush, close the file and destroy the writer
+// Returns 0 on success, -1 if any write failed
+int memory_trace_close_writer(memory_trace_writer_t* writer);
+
+// In-memory writer: write the trace to a file
 // Returns 0 on success, -1 on failure
 int memory_trace_write_to_file(memory_trace_writer_t* writer, const char* filename);
 
-// Write the trace to a buffer
+// In-memory writer: write the trace to a buffer
 // Returns the size of the serialized data, or -1 on failure
 // If buffer is NULL, returns the required buffer size
 int memory_trace_write_to_buffer(memory_trace_writer_t* writer, 
                                 void* buffer, 
                                 size_t buffer_size);
 
-// Get the number of events currently in the trace
+// Get the number of events added (and not cleared) so far
 size_t memory_trace_get_event_count(memory_trace_writer_t* writer);
 
-// Clear all events from the trace (but keep the writer)
+// Clear all events from the trace (but keep the writer). A streaming
+// writer only drops the events not yet written to the file.
 void memory_trace_clear(memory_trace_writer_t* writer);
 
-// Destroy the memory trace writer and free resources
+// Destroy the memory trace writer and free resources (a streaming writer
+// is closed first)
 void memory_trace_destroy_writer(memory_trace_writer_t* writer);
 
 #ifdef __cplusplus
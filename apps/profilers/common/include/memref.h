@@ -0,0 +1,119 @@
+#ifndef MEMREF_H
+#define MEMREF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Packed memory reference records and the batch kernel that digests them.
+ *
+ * Instrumentation appends one 16-byte memref_t per memory reference: the
+ * address, and the pc of the instruction with the access size and the write
+ * bit folded into its spare top bits (user-space code addresses fit in 48
+ * bits). Everything in the second word is known when the instruction is
+ * instrumented, so the inline code stores it as one immediate.
+ *
+ * memref_batch() turns a buffer of records into what the analyses consume:
+ * cache line keys for the working-set and sketch updates, which callers then
+ * issue in bulk, and a read/write x size-class histogram from which the
+ * read and write counts follow. Keys and a one-byte size/write index per
+ * record are extracted with SIMD (SSE2/AVX2 on x86-64, NEON on AArch64,
+ * picked at run time); the indices are counted into interleaved counter
+ * arrays, so runs of same-sized accesses do not serialize on one counter,
+ * and folded into size classes through a table once per call. Callers
+ * digesting a buffer in many pieces use memref_count_batch() instead,
+ * which keeps the counters across calls and folds when asked.
+ */
+
+typedef struct {
+    uint64_t addr;
+    uint64_t info;    /* MEMREF_WRITE | size << MEMREF_SIZE_SHIFT | pc */
+} memref_t;
+
+#define MEMREF_SIZE_SHIFT   48
+#define MEMREF_SIZE_MAX     0x7fffu         /* larger sizes saturate */
+#define MEMREF_PC_MASK      ((1ULL << MEMREF_SIZE_SHIFT) - 1)
+#define MEMREF_WRITE        (1ULL << 63)
+
+#define MEMREF_SIZE(ref)     ((uint32_t)((ref)->info >> MEMREF_SIZE_SHIFT) & MEMREF_SIZE_MAX)
+#define MEMREF_IS_WRITE(ref) (((ref)->info & MEMREF_WRITE) != 0)
+#define MEMREF_PC(ref)       ((ref)->info & MEMREF_PC_MASK)
+
+/* Second record word for an instruction at pc making size-byte accesses */
+static inline uint64_t memref_info(uint64_t pc, uint32_t size, int write) {
+    if (size > MEMREF_SIZE_MAX) size = MEMREF_SIZE_MAX;
+    return (pc & MEMREF_PC_MASK) | (uint64_t)size << MEMREF_SIZE_SHIFT |
+           (write ? MEMREF_WRITE : 0);
+}
+
+/* Size classes: 1, 2, 4, 8, 16, 32, 64 bytes and other (the order of the
+   time-series size histograms) */
+#define MEMREF_SIZE_BINS 8
+#define MEMREF_BIN_OTHER (MEMREF_SIZE_BINS - 1)
+
+typedef struct {
+    uint64_t read_size[MEMREF_SIZE_BINS];
+    uint64_t write_size[MEMREF_SIZE_BINS];
+} memref_hist_t;
+
+int      memref_size_bin(uint32_t size);
+uint64_t memref_hist_reads(const memref_hist_t *h);
+uint64_t memref_hist_writes(const memref_hist_t *h);
+void     memref_hist_add(memref_hist_t *dst, const memref_hist_t *src);
+
+/*
+ * Digest refs[0, n): line_keys[i] = refs[i].addr & line_mask (skipped when
+ * line_keys is NULL) and every reference counted into hist, which is added
+ * to, not cleared.
+ */
+void memref_batch(const memref_t *refs, size_t n, uint64_t line_mask,
+                  uint64_t *line_keys, memref_hist_t *hist);
+
+/* Same result without SIMD, for comparison */
+void memref_batch_scalar(const memref_t *refs, size_t n, uint64_t line_mask,
+                         uint64_t *line_keys, memref_hist_t *hist);
+
+/* Unfolded counts of one byte per record (size, write bit) over
+   MEMREF_LANES interleaved counter arrays; zero-initialize */
+#define MEMREF_LANES 4
+
+typedef struct {
+    uint32_t      cnt[MEMREF_LANES][256];
+    uint32_t      pending;     /* references in cnt */
+    memref_hist_t folded;      /* cnt folded before a counter could wrap */
+} memref_counter_t;
+
+/*
+ * memref_batch() without the fold: line keys as above, and the references
+ * counted into c, to be folded by memref_counter_take() once for any
+ * number of calls.
+ */
+void memref_count_batch(const memref_t *refs, size_t n, uint64_t line_mask,
+                        uint64_t *line_keys, memref_counter_t *c);
+
+/* Add everything counted into c since the last take to hist; c is left
+   empty */
+void memref_counter_take(memref_counter_t *c, memref_hist_t *hist);
+
+/* Coarser working-set granularities: base pages and x86-64 huge pages */
+#define MEMREF_PAGE_SIZE      4096u
+#define MEMREF_HUGE_PAGE_SIZE (2u << 20)
+
+/*
+ * Coarsen keys[0, n) to out: each key & mask, with runs of equal results
+ * written once. Returns the number written. Distinct counts and sketches
+ * are unchanged by the dropped repeats, and consecutive references mostly
+ * fall in the same page, so the page and huge-page analyses see far fewer
+ * keys than the line ones. out may be keys.
+ */
+size_t memref_coarsen(const uint64_t *keys, size_t n, uint64_t mask, uint64_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEMREF_H */
@@ -0,0 +1,79 @@
+#ifndef PC_TABLE_H
+#define PC_TABLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "memref.h"
+
+/*
+ * Per-instruction (pc) attribution of memory traffic in bounded memory.
+ *
+ * A fixed number of pcs are tracked, each with its read, write and byte
+ * counts and a small HyperLogLog of the cache lines it touched. When a new
+ * pc arrives and the table is full, the entry with the least traffic is
+ * evicted and the newcomer inherits its byte count (Space-Saving): every pc
+ * whose true share of the bytes exceeds 1/capacity is guaranteed to be in
+ * the table, and no tracked pc's bytes are underestimated by more than its
+ * error. Reads, writes and lines are counted from the moment the pc entered
+ * the table.
+ *
+ * Entries live in one array with their sketch registers beside them, found
+ * through an open-addressing index and kept in a min-heap on bytes, so an
+ * update is a probe and usually no heap movement at all.
+ */
+
+/* Opaque context */
+typedef struct pc_table pc_table_t;
+
+typedef struct {
+    uint64_t pc;
+    uint64_t bytes;      /* including any bytes inherited on admission */
+    uint64_t error;      /* upper bound of the inherited part of bytes */
+    uint64_t reads;      /* since admission */
+    uint64_t writes;
+    double   lines;      /* distinct cache lines since admission (estimate) */
+} pc_stat_t;
+
+typedef struct {
+    uint64_t refs;       /* references recorded */
+    uint64_t bytes;
+    uint64_t entries;    /* pcs currently tracked */
+    uint64_t evictions;
+} pc_table_stats_t;
+
+/* Lifecycle. capacity is the number of pcs tracked; hll_bits (4..12) sizes
+   each pc's line sketch at 2^hll_bits bytes. Returns NULL on bad arguments
+   or allocation failure. */
+pc_table_t *pc_table_create(size_t capacity, uint8_t hll_bits);
+void        pc_table_destroy(pc_table_t *t);
+
+/* Record one access of size bytes by the instruction at pc to the cache
+   line line_key */
+void        pc_table_record(pc_table_t *t, uint64_t pc, uint64_t line_key,
+                            uint32_t size, int write);
+
+/* Record refs[0, n), with line keys refs[i].addr & line_mask */
+void        pc_table_record_batch(pc_table_t *t, const memref_t *refs, size_t n,
+                                  uint64_t line_mask);
+
+/* Fold src into dst (e.g. per-thread -> global); both must have the same
+   hll_bits. Pcs present in both are summed, the rest compete for dst's
+   capacity as in record(). */
+int         pc_table_merge(pc_table_t *dst, const pc_table_t *src);
+
+void        pc_table_get_stats(const pc_table_t *t, pc_table_stats_t *out_stats);
+
+/* Copy the max entries with the most bytes, in descending order, into out;
+   returns the number copied */
+size_t      pc_table_top(const pc_table_t *t, pc_stat_t *out, size_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PC_TABLE_H */
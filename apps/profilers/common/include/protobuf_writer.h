@@ -8,14 +8,20 @@
 #ifndef PROTOBUF_WRITER_H
 #define PROTOBUF_WRITER_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "async_writer.h"
 
 #ifdef HAVE_PROTOBUF_C
 #include "memory_trace.pb-c.h"
 #include "timeseries_metrics.pb-c.h"
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Opaque handle types */
 typedef struct pb_trace_writer pb_trace_writer_t;
 typedef struct pb_timeseries_writer pb_timeseries_writer_t;
@@ -23,8 +29,27 @@ typedef struct pb_timeseries_writer pb_timeseries_writer_t;
 /*
  * Memory Trace Writer (for enable_trace feature)
  * Writes detailed per-access memory traces
+ *
+ * Events are accumulated into a preallocated chunk and each full chunk is
+ * packed as one MemoryTrace message, written length-delimited (4-byte
+ * little-endian size + data), so readers can stream it chunk by chunk.
+ * Both writers hand their output to an async_writer, so the caller never
+ * waits on the disk unless all its buffers are in flight.
  */
 
+/* Default number of events per MemoryTrace chunk */
+#define PB_TRACE_DEFAULT_CHUNK_EVENTS 8192
+
+/* One trace event, for the batch interface */
+typedef struct {
+    uint64_t timestamp;
+    uint64_t address;
+    uint32_t thread_id;
+    uint32_t size;
+    bool     is_write;
+    uint8_t  hit_level;     /* 1 + the cache level that served it, 0 = not simulated */
+} pb_trace_event_t;
+
 /**
  * Create a new memory trace writer
  * @param filename Output .pb file path
@@ -32,6 +57,27 @@ typedef struct pb_timeseries_writer pb_timeseries_writer_t;
  */
 pb_trace_writer_t* pb_trace_writer_create(const char *filename);
 
+/**
+ * Create a new memory trace writer with a given chunk size
+ * @param filename Output .pb file path
+ * @param chunk_events Events per MemoryTrace message (0 = default)
+ * @return Writer handle or NULL on error
+ */
+pb_trace_writer_t* pb_trace_writer_create_chunked(const char *filename,
+                                                  size_t chunk_events);
+
+/**
+ * Create a new memory trace writer with its own I/O settings, e.g. a small
+ * buffer pool for one of many per-thread streams
+ * @param filename Output .pb file path
+ * @param chunk_events Events per MemoryTrace message (0 = default)
+ * @param io async_writer settings (NULL = defaults)
+ * @return Writer handle or NULL on error
+ */
+pb_trace_writer_t* pb_trace_writer_create_io(const char *filename,
+                                             size_t chunk_events,
+                                             const aw_config_t *io);
+
 /**
  * Write a single memory event to trace
  * @param writer Writer handle
@@ -48,6 +94,16 @@ void pb_trace_write_event(pb_trace_writer_t *writer,
                           bool is_write,
                           uint32_t size);
 
+/**
+ * Write a batch of memory events (e.g. a per-thread buffer)
+ * @param writer Writer handle
+ * @param events Events to append
+ * @param n Number of events
+ */
+void pb_trace_write_events(pb_trace_writer_t *writer,
+                           const pb_trace_event_t *events,
+                           size_t n);
+
 /**
  * Close and finalize memory trace writer
  * @param writer Writer handle
@@ -58,10 +114,53 @@ void pb_trace_writer_close(pb_trace_writer_t *writer);
 /*
  * Time-Series Metrics Writer (for WSS sampling feature)
  * Writes windowed WSS samples
+ *
+ * File layout: "MSTS" magic, a TimeSeriesHeader record carrying the run
+ * metadata once, then SampleBatch records of up to PB_TS_BATCH_SAMPLES
+ * samples each and a TimeSeriesTrailer at close (see
+ * timeseries_metrics.proto).
  */
 
+/* Size histogram bins: 1, 2, 4, 8, 16, 32, 64 bytes and other */
+#define PB_TS_SIZE_BINS 8
+
+/* Memory region entries: other, stack, heap, global and mmap */
+#define PB_TS_REGIONS 5
+
+/* Samples per SampleBatch record */
+#define PB_TS_BATCH_SAMPLES 256
+
+/* One sample window */
+typedef struct {
+    uint64_t window_number;     /* Window index (0, 1, 2, ...) */
+    uint32_t thread_id;
+    uint64_t read_count;
+    uint64_t write_count;
+    uint64_t total_refs;        /* read_count + write_count */
+    uint64_t wss_exact;         /* Exact working set size */
+    double   wss_approx;        /* Approximate WSS (HLL) */
+    uint64_t timestamp;         /* Microseconds */
+    uint64_t read_size_hist[PB_TS_SIZE_BINS];
+    uint64_t write_size_hist[PB_TS_SIZE_BINS];
+    uint64_t wss_page_exact;    /* Same in 4 KiB pages */
+    double   wss_page_approx;
+    uint64_t wss_huge_page_exact; /* Same in 2 MiB huge pages */
+    double   wss_huge_page_approx;
+    uint64_t l1_hits;           /* Simulated cache hits and misses */
+    uint64_t l1_misses;
+    uint64_t l2_hits;
+    uint64_t l2_misses;
+    uint64_t llc_hits;
+    uint64_t llc_misses;
+    uint32_t n_regions;         /* 0, or PB_TS_REGIONS with region classification */
+    uint64_t region_reads[PB_TS_REGIONS];
+    uint64_t region_writes[PB_TS_REGIONS];
+    uint64_t region_bytes[PB_TS_REGIONS];
+    double   region_wss[PB_TS_REGIONS];   /* approximate, in lines */
+} pb_ts_sample_t;
+
 /**
- * Create a new time-series metrics writer
+ * Create a new time-series metrics writer and write the file header
  * @param filename Output .pb file path
  * @param profiler Profiler name (e.g., "dynamorio")
  * @param pid Process ID
@@ -79,47 +178,42 @@ pb_timeseries_writer_t* pb_timeseries_writer_create(
     uint32_t cache_line_size);
 
 /**
- * Write a sample window
+ * Create a time-series writer with its own I/O settings
+ * (same parameters as pb_timeseries_writer_create)
+ * @param io async_writer settings (NULL = defaults)
+ * @return Writer handle or NULL on error
+ */
+pb_timeseries_writer_t* pb_timeseries_writer_create_io(
+    const char *filename,
+    const char *profiler,
+    uint32_t pid,
+    const char *command,
+    uint32_t sample_window_refs,
+    uint32_t cache_line_size,
+    const aw_config_t *io);
+
+/**
+ * Add a sample window to the current batch
  * @param writer Writer handle
- * @param window_number Window index (0, 1, 2, ...)
- * @param thread_id Thread ID
- * @param read_count Number of reads in this window
- * @param write_count Number of writes in this window
- * @param total_refs Total references in this window (read_count + write_count)
- * @param wss_exact Exact working set size (from ws_tsearch)
- * @param wss_approx Approximate WSS (from HLL)
- * @param timestamp Sample timestamp in microseconds
- * @param read_size_1 through read_size_other - Read size histograms
- * @param write_size_1 through write_size_other - Write size histograms
+ * @param sample Sample to write (copied)
  */
 void pb_timeseries_write_sample(pb_timeseries_writer_t *writer,
-                                uint64_t window_number,
-                                uint32_t thread_id,
-                                uint64_t read_count,
-                                uint64_t write_count,
-                                uint64_t total_refs,
-                                uint64_t wss_exact,
-                                double wss_approx,
-                                uint64_t timestamp,
-                                uint64_t read_size_1, uint64_t read_size_2, uint64_t read_size_4, uint64_t read_size_8,
-                                uint64_t read_size_16, uint64_t read_size_32, uint64_t read_size_64, uint64_t read_size_other,
-                                uint64_t write_size_1, uint64_t write_size_2, uint64_t write_size_4, uint64_t write_size_8,
-                                uint64_t write_size_16, uint64_t write_size_32, uint64_t write_size_64, uint64_t write_size_other);
+                                const pb_ts_sample_t *sample);
 
 /**
- * Manually flush buffered samples to disk
+ * Write out the current partial batch and flush buffered samples to disk
  * @param writer Writer handle
  */
 void pb_timeseries_flush(pb_timeseries_writer_t *writer);
 
 /**
- * Manually flush buffered trace events to disk
+ * Write out the current partial chunk and flush buffered trace events to disk
  * @param writer Writer handle
  */
 void pb_trace_flush(pb_trace_writer_t *writer);
 
 /**
- * Set number of threads in metadata (call before closing)
+ * Set number of threads for the trailer (call before closing)
  * @param writer Writer handle
  * @param num_threads Total thread count
  */
@@ -132,4 +226,8 @@ void pb_timeseries_set_num_threads(pb_timeseries_writer_t *writer,
  */
 void pb_timeseries_writer_close(pb_timeseries_writer_t *writer);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* PROTOBUF_WRITER_H */
@@ -0,0 +1,69 @@
+#ifndef REGION_MAP_H
+#define REGION_MAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "memref.h"
+
+/*
+ * Address interval map: which class of memory (stack, heap, ...) each
+ * address range belongs to.
+ *
+ * Ranges are kept as a sorted array of disjoint [start, end) intervals, each
+ * with a one-byte region value; setting a range overwrites whatever it
+ * overlaps, splitting intervals as needed, and merges it with touching
+ * neighbours of the same region. A lookup is a binary search, and a batch
+ * lookup first tries the interval the previous reference fell in.
+ *
+ * Updates (mappings appearing and disappearing) are rare next to lookups,
+ * so the map is guarded by a reader-writer spinlock: any number of threads
+ * look up at once, taking the lock once per batch, and an update waits for
+ * them to finish while keeping new readers out.
+ */
+
+/* Region classes; MEM_REGION_OTHER is also what lookups return outside
+   every interval */
+typedef enum {
+    MEM_REGION_OTHER = 0,       /* not in any known range */
+    MEM_REGION_STACK,           /* thread stacks */
+    MEM_REGION_HEAP,            /* brk heap and anonymous mappings */
+    MEM_REGION_GLOBAL,          /* module images: static data, bss, code */
+    MEM_REGION_MMAP,            /* file-backed mappings */
+    MEM_REGION_COUNT
+} mem_region_t;
+
+/* Opaque context */
+typedef struct region_map region_map_t;
+
+/* Returns NULL on allocation failure */
+region_map_t *region_map_create(void);
+void          region_map_destroy(region_map_t *m);
+
+/* [start, end) becomes region; region MEM_REGION_OTHER removes it. Returns
+   0, or -1 on allocation failure, leaving the map unchanged. */
+int           region_map_set(region_map_t *m, uint64_t start, uint64_t end, uint8_t region);
+int           region_map_remove(region_map_t *m, uint64_t start, uint64_t end);
+
+/* Region of one address */
+uint8_t       region_map_lookup(region_map_t *m, uint64_t addr);
+
+/* regions[i] = region of refs[i].addr for refs[0, n) */
+void          region_map_lookup_batch(region_map_t *m, const memref_t *refs, size_t n,
+                                      uint8_t *regions);
+
+/* Intervals in the map */
+size_t        region_map_size(region_map_t *m);
+
+/* "other", "stack", "heap", "global" or "mmap" */
+const char   *mem_region_name(unsigned region);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REGION_MAP_H */
@@ -0,0 +1,79 @@
+#ifndef REUSE_DISTANCE_H
+#define REUSE_DISTANCE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Reuse (LRU stack) distance analyzer.
+ *
+ * The distance of an access is the number of distinct other keys touched
+ * since the previous access to the same key; in a fully-associative LRU
+ * cache of C lines the access hits iff distance < C. One histogram therefore
+ * gives the miss ratio for every cache size.
+ *
+ * Distances are counted Olken-style: each live key owns the slot of its last
+ * access in a Fenwick tree, and the distance is the number of occupied slots
+ * after it. Slots are renumbered when they run out, so memory is O(keys).
+ *
+ * SHARDS spatial sampling bounds the cost: only keys whose hash falls under
+ * a threshold are tracked (rate R), and their distances and counts are
+ * scaled by 1/R. With max_keys set, R is halved and keys above the new
+ * threshold are dropped whenever more than max_keys keys are live
+ * (SHARDS fixed-size), so memory stays bounded on any workload.
+ */
+
+/* Opaque context */
+typedef struct rd_ctx rd_ctx_t;
+
+/* Histogram bucket: estimated accesses with distance in [lo, hi) */
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+    double   count;
+} rd_bucket_t;
+
+typedef struct {
+    uint64_t refs;      /* accesses offered to the analyzer */
+    uint64_t sampled;   /* accesses that passed the SHARDS filter */
+    uint64_t live_keys; /* keys currently tracked */
+    double   rate;      /* current sampling rate */
+    double   cold;      /* estimated first-time accesses (infinite distance) */
+} rd_stats_t;
+
+/* Lifecycle. sample_rate in (0, 1]; max_keys 0 = no limit. */
+rd_ctx_t *rd_create(double sample_rate, size_t max_keys);
+void      rd_destroy(rd_ctx_t *ctx);
+
+/* Record accesses to already-canonicalized keys (e.g. line addresses).
+   Best-effort: an allocation failure drops the access. */
+void      rd_record(rd_ctx_t *ctx, uint64_t key);
+void      rd_record_batch(rd_ctx_t *ctx, const uint64_t *keys, size_t n);
+
+/* Add src's histogram and counts to dst (e.g. per-thread -> global).
+   Only the histograms are merged; distances stay per-context. */
+void      rd_merge(rd_ctx_t *dst, const rd_ctx_t *src);
+
+void      rd_get_stats(const rd_ctx_t *ctx, rd_stats_t *out_stats);
+
+/* Copy the non-empty buckets (ascending) into out; returns how many there
+   are in total, so a call with max == 0 sizes the array. */
+size_t    rd_histogram(const rd_ctx_t *ctx, rd_bucket_t *out, size_t max);
+
+/* Estimated miss ratio of a fully-associative LRU cache of cache_keys keys
+   (SHARDS-adj: the shortfall between refs and sampled/R counts as hits). */
+double    rd_miss_ratio(const rd_ctx_t *ctx, uint64_t cache_keys);
+
+/* Miss ratio curve at n cache sizes */
+void      rd_mrc(const rd_ctx_t *ctx, const uint64_t *cache_keys, size_t n,
+                 double *out_miss_ratio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REUSE_DISTANCE_H */
@@ -0,0 +1,45 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Bounded lock-free single-producer single-consumer ring of pointers.
+ *
+ * One thread pushes and one thread pops at any time; either role may pass
+ * to another thread as long as the handover itself synchronizes (a lock,
+ * or the release/acquire of a flag). The indices sit on cache lines of
+ * their own, and each side keeps a private copy of the other side's index
+ * that it refreshes only when the ring looks full (producer) or empty
+ * (consumer), so the common case touches no shared line but the slot.
+ */
+
+/* Opaque context */
+typedef struct spsc_ring spsc_ring_t;
+
+/* Lifecycle. Capacity is rounded up to a power of two. Returns NULL on
+   allocation failure or a zero capacity. */
+spsc_ring_t *spsc_ring_create(size_t capacity);
+void         spsc_ring_destroy(spsc_ring_t *r);
+
+/* Producer side. item must not be NULL. Returns 0, or -1 if the ring is
+   full. */
+int          spsc_ring_push(spsc_ring_t *r, void *item);
+
+/* Consumer side. Returns the oldest item, or NULL if the ring is empty. */
+void        *spsc_ring_pop(spsc_ring_t *r);
+
+/* Items queued; exact on either side, a snapshot from any other thread */
+size_t       spsc_ring_size(const spsc_ring_t *r);
+size_t       spsc_ring_capacity(const spsc_ring_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPSC_RING_H */
@@ -0,0 +1,53 @@
+#ifndef TRACE_MERGE_H
+#define TRACE_MERGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Merge per-thread profiler output streams into single files.
+ *
+ * Profilers may give every application thread its own trace and
+ * time-series file so that threads never share a writer or a lock. These
+ * functions combine such files after the run (at process exit or offline):
+ *
+ *   - trace_merge_files(): k-way merge of chunked memory traces (4-byte
+ *     little-endian size + MemoryTrace) by event timestamp into one chunked
+ *     trace. Each input must be time-ordered, as a per-thread stream is;
+ *     ties keep input order.
+ *   - timeseries_merge_files(): k-way merge of time-series files ("MSTS"
+ *     magic, header, SampleBatch records, trailer) by sample timestamp,
+ *     regrouped into batches of up to 256 samples. The header comes from
+ *     the first input and the trailer is rewritten with the total sample
+ *     count and the number of inputs as the thread count.
+ *
+ * Events and samples are copied as raw encoded bytes: only the timestamp
+ * is decoded, so no protobuf library is needed and every event and sample
+ * is bit-identical to what the writers produced. Inputs are streamed one
+ * chunk at a time, at most 256 at once: more are merged in passes through
+ * temporary files next to the output (<output>.merge<level>.<n>, removed
+ * afterwards), so open files and memory stay bounded however many threads
+ * wrote. A truncated input is merged up to its last complete chunk.
+ */
+
+/* Events per output MemoryTrace chunk when chunk_events is 0 */
+#define TRACE_MERGE_DEFAULT_CHUNK_EVENTS 65536
+
+/* Returns the number of events written, or -1 if an input cannot be read
+   or the output cannot be written */
+int64_t trace_merge_files(const char *output, const char *const *inputs,
+                          size_t n_inputs, size_t chunk_events);
+
+/* Returns the number of samples written, or -1 on error */
+int64_t timeseries_merge_files(const char *output, const char *const *inputs,
+                               size_t n_inputs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_MERGE_H */
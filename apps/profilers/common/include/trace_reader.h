@@ -0,0 +1,101 @@
+#ifndef TRACE_READER_H
+#define TRACE_READER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Memory-mapped random-access reader for protobuf memory traces (.pb).
+ *
+ * Reads the chunked layout written by protobuf_writer and memory_trace (a
+ * stream of 4-byte little-endian size + MemoryTrace messages) as well as
+ * older single-message files. The file is mmap'ed and chunks are decoded
+ * straight from the mapping with a small wire-format decoder, so no
+ * protobuf library or message objects are involved: every event field lands
+ * directly in caller-provided column arrays (structure of arrays).
+ *
+ * On open, the reader loads the chunk index from "<trace>.idx" or, if that
+ * is missing or stale, builds it by walking the size prefixes and saves it
+ * for the next run. A trace whose writer was killed mid-chunk is readable
+ * up to the last complete chunk.
+ *
+ * After open, the reader is read-only: any number of threads may decode
+ * chunks concurrently.
+ */
+
+#define TRACE_READER_INDEX_VERSION   1
+
+/* trace_reader_open() flags */
+#define TRACE_READER_NO_INDEX_FILE   0x1u   /* neither load nor save .idx */
+
+typedef struct {
+    uint64_t offset;        /* file offset of the MemoryTrace payload */
+    uint32_t length;        /* payload bytes */
+    uint32_t n_events;
+    uint64_t first_event;   /* global index of the chunk's first event */
+} trace_chunk_info_t;
+
+/*
+ * Output columns, one element per event. NULL columns are skipped, so
+ * callers only pay for the fields they read.
+ */
+typedef struct {
+    uint64_t *timestamp;
+    uint64_t *address;
+    uint32_t *thread_id;
+    uint32_t *size;
+    uint8_t  *is_write;
+    uint8_t  *is_miss;
+} trace_columns_t;
+
+typedef struct trace_reader trace_reader_t;
+
+/* Called once per chunk by trace_reader_for_each_chunk(), possibly from
+   several threads at once. cols holds n events and is only valid during
+   the call. Return nonzero to stop the iteration. */
+typedef int (*trace_chunk_fn)(size_t chunk, uint64_t first_event,
+                              const trace_columns_t *cols, size_t n,
+                              void *user);
+
+/* Returns NULL if the file cannot be mapped or is not a memory trace */
+trace_reader_t *trace_reader_open(const char *filename, unsigned flags);
+void     trace_reader_close(trace_reader_t *r);
+
+size_t   trace_reader_num_chunks(const trace_reader_t *r);
+uint64_t trace_reader_num_events(const trace_reader_t *r);
+/* Largest chunk; size per-chunk decode buffers with this */
+uint32_t trace_reader_max_chunk_events(const trace_reader_t *r);
+int      trace_reader_chunk_info(const trace_reader_t *r, size_t chunk,
+                                 trace_chunk_info_t *out);
+/* Chunk holding global event index `event`; num_chunks if out of range */
+size_t   trace_reader_find_chunk(const trace_reader_t *r, uint64_t event);
+
+/* Decode one chunk into cols (room for the chunk's n_events).
+   Returns the number of events, or -1 on a malformed chunk. */
+int64_t  trace_reader_decode_chunk(const trace_reader_t *r, size_t chunk,
+                                   const trace_columns_t *cols);
+
+/* Decode chunks [first, first + count) into cols, event i of the range at
+   index i, using up to num_threads threads (0 = hardware concurrency).
+   Returns the number of events, or -1 if any chunk is malformed. */
+int64_t  trace_reader_decode_chunks(const trace_reader_t *r, size_t first,
+                                    size_t count, const trace_columns_t *cols,
+                                    unsigned num_threads);
+
+/* Decode every chunk into per-thread buffers and hand each to fn, on up to
+   num_threads threads (0 = hardware concurrency). Chunks are visited in no
+   particular order. Returns 0, 1 if fn stopped the iteration, or -1 on a
+   malformed chunk or allocation failure. */
+int      trace_reader_for_each_chunk(const trace_reader_t *r,
+                                     unsigned num_threads,
+                                     trace_chunk_fn fn, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_READER_H */
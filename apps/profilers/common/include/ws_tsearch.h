@@ -30,9 +30,20 @@ void      ws_reset(ws_ctx_t *ctx);
    (e.g., 64B-aligned address, or a line index). We do NOT modify it. */
 void      ws_record(ws_ctx_t *ctx, uintptr_t key);
 
+/* Record keys[0..n) in order; same stats as n ws_record() calls. */
+void      ws_record_batch(ws_ctx_t *ctx, const uint64_t *keys, size_t n);
+
 /* Snapshot stats in O(1). No tree walk. */
 void      ws_get_stats(ws_ctx_t *ctx, ws_stats_t *out_stats);
 
+/* The distinct keys recorded so far, in first-seen order (e.g. to merge a
+   thread's set into a line_union_t). Valid until the next record/reset. */
+const uint64_t *ws_keys(const ws_ctx_t *ctx, size_t *n);
+
+/* Distinct keys missing from ws_keys() because the list could not grow
+   (out of memory); 0 when the list is complete */
+uint64_t  ws_keys_lost(const ws_ctx_t *ctx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,60 @@
+#ifndef WS_WINDOW_H
+#define WS_WINDOW_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ws_tsearch.h"   /* ws_stats_t */
+
+/*
+ * Windowed working-set tracker.
+ *
+ * Open-addressing hash table whose slots remember the reference positions of
+ * the last two accesses to each key.  A slot is live only if its last access
+ * falls inside the oldest open window, so closing a window is a counter bump:
+ * no node is freed and the table memory is reused by the next window.
+ *
+ * Several window sizes ("levels") can be tracked in the same pass; every
+ * record() updates all of them with a single table probe.
+ */
+
+/* Opaque context */
+typedef struct ws_window ws_window_t;
+
+/* Called when a level's window fills up, right before it is reset. */
+typedef void (*ws_window_cb_t)(void *arg, size_t level, uint64_t window_idx,
+                               const ws_stats_t *stats);
+
+/* Lifecycle.
+   window_refs[i] is the number of records per window for level i; 0 means the
+   level never closes on its own (use ws_window_reset()).  cb may be NULL, in
+   which case levels are only closed by ws_window_reset(). */
+ws_window_t *ws_window_create(const uint64_t *window_refs, size_t n_levels,
+                              ws_window_cb_t cb, void *cb_arg);
+void         ws_window_destroy(ws_window_t *w);
+
+/* O(1) reset of every level: zero stats, drop all keys, keep the table. */
+void         ws_window_reset(ws_window_t *w);
+
+/* O(1) reset of one level. */
+void         ws_window_reset_level(ws_window_t *w, size_t level);
+
+/* Record one access for an already-canonicalized key (see ws_record()). */
+void         ws_window_record(ws_window_t *w, uintptr_t key);
+
+/* Snapshot stats of one level's current (open) window. */
+void         ws_window_get_stats(const ws_window_t *w, size_t level,
+                                 ws_stats_t *out_stats);
+
+/* Index of one level's current window (0,1,2,...). */
+uint64_t     ws_window_index(const ws_window_t *w, size_t level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WS_WINDOW_H */
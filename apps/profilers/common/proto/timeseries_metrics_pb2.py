@@ -13,7 +13,7 @@ _sym_db = _symbol_database.Default()
 
 
 
-DESCRIPTOR = _descriptor_pool.Default().AddSerializedFile(b'\n\x18timeseries_metrics.proto\x12\x11memsys.timeseries\"t\n\x0eTimeSeriesData\x12\x30\n\x08metadata\x18\x01 \x01(\x0b\x32\x1e.memsys.timeseries.RunMetadata\x12\x30\n\x07samples\x18\x02 \x03(\x0b\x32\x1f.memsys.timeseries.SampleWindow\"\xa0\x01\n\x0bRunMetadata\x12\x10\n\x08profiler\x18\x01 \x01(\t\x12\x0b\n\x03pid\x18\x02 \x01(\r\x12\x17\n\x0fstart_timestamp\x18\x03 \x01(\x04\x12\x0f\n\x07\x63ommand\x18\x04 \x01(\t\x12\x1a\n\x12sample_window_refs\x18\x05 \x01(\r\x12\x17\n\x0f\x63\x61\x63he_line_size\x18\x06 \x01(\r\x12\x13\n\x0bnum_threads\x18\x07 \x01(\r\"\x95\x04\n\x0cSampleWindow\x12\x15\n\rwindow_number\x18\x01 \x01(\x04\x12\x11\n\tthread_id\x18\x02 \x01(\r\x12\x12\n\nread_count\x18\x03 \x01(\x04\x12\x13\n\x0bwrite_count\x18\x04 \x01(\x04\x12\x12\n\ntotal_refs\x18\x05 \x01(\x04\x12\x11\n\twss_exact\x18\x06 \x01(\x04\x12\x12\n\nwss_approx\x18\x07 \x01(\x01\x12\x11\n\ttimestamp\x18\x08 \x01(\x04\x12\x13\n\x0bread_size_1\x18\t \x01(\x04\x12\x13\n\x0bread_size_2\x18\n \x01(\x04\x12\x13\n\x0bread_size_4\x18\x0b \x01(\x04\x12\x13\n\x0bread_size_8\x18\x0c \x01(\x04\x12\x14\n\x0cread_size_16\x18\r \x01(\x04\x12\x14\n\x0cread_size_32\x18\x0e \x01(\x04\x12\x14\n\x0cread_size_64\x18\x0f \x01(\x04\x12\x17\n\x0fread_size_other\x18\x10 \x01(\x04\x12\x14\n\x0cwrite_size_1\x18\x11 \x01(\x04\x12\x14\n\x0cwrite_size_2\x18\x12 \x01(\x04\x12\x14\n\x0cwrite_size_4\x18\x13 \x01(\x04\x12\x14\n\x0cwrite_size_8\x18\x14 \x01(\x04\x12\x15\n\rwrite_size_16\x18\x15 \x01(\x04\x12\x15\n\rwrite_size_32\x18\x16 \x01(\x04\x12\x15\n\rwrite_size_64\x18\x17 \x01(\x04\x12\x18\n\x10write_size_other\x18\x18 \x01(\x04\x42\x03\xf8\x01\x01\x62\x06proto3')
+DESCRIPTOR = _descriptor_pool.Default().AddSerializedFile(b'\n\x18timeseries_metrics.proto\x12\x11memsys.timeseries\"\xbd\x01\n\x10TimeSeriesRecord\x12\x35\n\x06header\x18\x01 \x01(\x0b\x32#.memsys.timeseries.TimeSeriesHeaderH\x00\x12/\n\x05\x62\x61tch\x18\x02 \x01(\x0b\x32\x1e.memsys.timeseries.SampleBatchH\x00\x12\x37\n\x07trailer\x18\x03 \x01(\x0b\x32$.memsys.timeseries.TimeSeriesTrailerH\x00\x42\x08\n\x06record\"\x80\x01\n\x10TimeSeriesHeader\x12\x16\n\x0e\x66ormat_version\x18\x01 \x01(\r\x12\x30\n\x08metadata\x18\x02 \x01(\x0b\x32\x1e.memsys.timeseries.RunMetadata\x12\x11\n\tsize_bins\x18\x03 \x03(\t\x12\x0f\n\x07regions\x18\x04 \x03(\t\"?\n\x0bSampleBatch\x12\x30\n\x07samples\x18\x01 \x03(\x0b\x32\x1f.memsys.timeseries.SampleWindow\"=\n\x11TimeSeriesTrailer\x12\x13\n\x0bnum_threads\x18\x01 \x01(\r\x12\x13\n\x0bnum_samples\x18\x02 \x01(\x04\"t\n\x0eTimeSeriesData\x12\x30\n\x08metadata\x18\x01 \x01(\x0b\x32\x1e.memsys.timeseries.RunMetadata\x12\x30\n\x07samples\x18\x02 \x03(\x0b\x32\x1f.memsys.timeseries.SampleWindow\"\xcb\x01\n\x0bRunMetadata\x12\x10\n\x08profiler\x18\x01 \x01(\t\x12\x0b\n\x03pid\x18\x02 \x01(\r\x12\x17\n\x0fstart_timestamp\x18\x03 \x01(\x04\x12\x0f\n\x07\x63ommand\x18\x04 \x01(\t\x12\x1a\n\x12sample_window_refs\x18\x05 \x01(\r\x12\x17\n\x0f\x63\x61\x63he_line_size\x18\x06 \x01(\r\x12\x13\n\x0bnum_threads\x18\x07 \x01(\r\x12\x11\n\tpage_size\x18\x08 \x01(\r\x12\x16\n\x0ehuge_page_size\x18\t \x01(\r\"\x8f\x07\n\x0cSampleWindow\x12\x15\n\rwindow_number\x18\x01 \x01(\x04\x12\x11\n\tthread_id\x18\x02 \x01(\r\x12\x12\n\nread_count\x18\x03 \x01(\x04\x12\x13\n\x0bwrite_count\x18\x04 \x01(\x04\x12\x12\n\ntotal_refs\x18\x05 \x01(\x04\x12\x11\n\twss_exact\x18\x06 \x01(\x04\x12\x12\n\nwss_approx\x18\x07 \x01(\x01\x12\x11\n\ttimestamp\x18\x08 \x01(\x04\x12\x13\n\x0bread_size_1\x18\t \x01(\x04\x12\x13\n\x0bread_size_2\x18\n \x01(\x04\x12\x13\n\x0bread_size_4\x18\x0b \x01(\x04\x12\x13\n\x0bread_size_8\x18\x0c \x01(\x04\x12\x14\n\x0cread_size_16\x18\r \x01(\x04\x12\x14\n\x0cread_size_32\x18\x0e \x01(\x04\x12\x14\n\x0cread_size_64\x18\x0f \x01(\x04\x12\x17\n\x0fread_size_other\x18\x10 \x01(\x04\x12\x14\n\x0cwrite_size_1\x18\x11 \x01(\x04\x12\x14\n\x0cwrite_size_2\x18\x12 \x01(\x04\x12\x14\n\x0cwrite_size_4\x18\x13 \x01(\x04\x12\x14\n\x0cwrite_size_8\x18\x14 \x01(\x04\x12\x15\n\rwrite_size_16\x18\x15 \x01(\x04\x12\x15\n\rwrite_size_32\x18\x16 \x01(\x04\x12\x15\n\rwrite_size_64\x18\x17 \x01(\x04\x12\x18\n\x10write_size_other\x18\x18 \x01(\x04\x12\x1a\n\x0eread_size_hist\x18\x19 \x03(\x04\x42\x02\x10\x01\x12\x1b\n\x0fwrite_size_hist\x18\x1a \x03(\x04\x42\x02\x10\x01\x12\x16\n\x0ewss_page_exact\x18\x1b \x01(\x04\x12\x17\n\x0fwss_page_approx\x18\x1c \x01(\x01\x12\x1b\n\x13wss_huge_page_exact\x18\x1d \x01(\x04\x12\x1c\n\x14wss_huge_page_approx\x18\x1e \x01(\x01\x12\x0f\n\x07l1_hits\x18\x1f \x01(\x04\x12\x11\n\tl1_misses\x18  \x01(\x04\x12\x0f\n\x07l2_hits\x18! \x01(\x04\x12\x11\n\tl2_misses\x18\" \x01(\x04\x12\x10\n\x08llc_hits\x18# \x01(\x04\x12\x12\n\nllc_misses\x18$ \x01(\x04\x12\x18\n\x0cregion_reads\x18% \x03(\x04\x42\x02\x10\x01\x12\x19\n\rregion_writes\x18& \x03(\x04\x42\x02\x10\x01\x12\x18\n\x0cregion_bytes\x18\' \x03(\x04\x42\x02\x10\x01\x12\x16\n\nregion_wss\x18( \x03(\x01\x42\x02\x10\x01\x42\x03\xf8\x01\x01\x62\x06proto3')
 
 _builder.BuildMessageAndEnumDescriptors(DESCRIPTOR, globals())
 _builder.BuildTopDescriptorsAndMessages(DESCRIPTOR, 'timeseries_metrics_pb2', globals())
@@ -21,10 +21,30 @@ if _descriptor._USE_C_DESCRIPTORS == False:
 
   DESCRIPTOR._options = None
   DESCRIPTOR._serialized_options = b'\370\001\001'
-  _TIMESERIESDATA._serialized_start=47
-  _TIMESERIESDATA._serialized_end=163
-  _RUNMETADATA._serialized_start=166
-  _RUNMETADATA._serialized_end=326
-  _SAMPLEWINDOW._serialized_start=329
-  _SAMPLEWINDOW._serialized_end=862
+  _SAMPLEWINDOW.fields_by_name['read_size_hist']._options = None
+  _SAMPLEWINDOW.fields_by_name['read_size_hist']._serialized_options = b'\020\001'
+  _SAMPLEWINDOW.fields_by_name['write_size_hist']._options = None
+  _SAMPLEWINDOW.fields_by_name['write_size_hist']._serialized_options = b'\020\001'
+  _SAMPLEWINDOW.fields_by_name['region_reads']._options = None
+  _SAMPLEWINDOW.fields_by_name['region_reads']._serialized_options = b'\020\001'
+  _SAMPLEWINDOW.fields_by_name['region_writes']._options = None
+  _SAMPLEWINDOW.fields_by_name['region_writes']._serialized_options = b'\020\001'
+  _SAMPLEWINDOW.fields_by_name['region_bytes']._options = None
+  _SAMPLEWINDOW.fields_by_name['region_bytes']._serialized_options = b'\020\001'
+  _SAMPLEWINDOW.fields_by_name['region_wss']._options = None
+  _SAMPLEWINDOW.fields_by_name['region_wss']._serialized_options = b'\020\001'
+  _TIMESERIESRECORD._serialized_start=48
+  _TIMESERIESRECORD._serialized_end=237
+  _TIMESERIESHEADER._serialized_start=240
+  _TIMESERIESHEADER._serialized_end=368
+  _SAMPLEBATCH._serialized_start=370
+  _SAMPLEBATCH._serialized_end=433
+  _TIMESERIESTRAILER._serialized_start=435
+  _TIMESERIESTRAILER._serialized_end=496
+  _TIMESERIESDATA._serialized_start=498
+  _TIMESERIESDATA._serialized_end=614
+  _RUNMETADATA._serialized_start=617
+  _RUNMETADATA._serialized_end=820
+  _SAMPLEWINDOW._serialized_start=823
+  _SAMPLEWINDOW._serialized_end=1734
 # @@protoc_insertion_point(module_scope)
@@ -7,6 +7,13 @@
 
 #define	ROTL32(x, r)	((x) << (r)) | ((x) >> (32 - (r)))
 
+/* The tail switches consume the leftover bytes by falling through */
+#if (defined(__GNUC__) && __GNUC__ >= 7) || defined(__clang__)
+#define	FALLTHROUGH	__attribute__((fallthrough))
+#else
+#define	FALLTHROUGH	((void)0)
+#endif
+
 uint32_t MurmurHash3_x86_32(const void *key, uint32_t len, uint32_t seed) {
 	const uint8_t *data = (const uint8_t *)key;
 	const int32_t nblocks = (int32_t)len / 4;
@@ -39,8 +46,10 @@ uint32_t MurmurHash3_x86_32(const void *key, uint32_t len, uint32_t seed) {
 	{
 		case 3:
 			k1 ^= (uint32_t)tail[2] << 16;
+			FALLTHROUGH;
 		case 2:
 			k1 ^= (uint32_t)tail[1] << 8;
+			FALLTHROUGH;
 		case 1:
 			k1 ^= tail[0];
 			k1 *= c1;
@@ -59,3 +68,100 @@ uint32_t MurmurHash3_x86_32(const void *key, uint32_t len, uint32_t seed) {
 
 	return h1;
 }
+
+#define	ROTL64(x, r)	((x) << (r)) | ((x) >> (64 - (r)))
+
+static inline uint64_t fmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+
+	return k;
+}
+
+void MurmurHash3_x64_128(const void *key, uint32_t len, uint32_t seed, void *out) {
+	const uint8_t *data = (const uint8_t *)key;
+	const int32_t nblocks = (int32_t)len / 16;
+
+	uint64_t h1 = seed;
+	uint64_t h2 = seed;
+	int i;
+
+	const uint64_t c1 = 0x87c37b91114253d5ULL;
+	const uint64_t c2 = 0x4cf5ad432745937fULL;
+	const uint64_t *blocks = (const uint64_t *)(data);
+
+	for(i = 0; i < nblocks; i++)
+	{
+		uint64_t k1 = blocks[i * 2 + 0];
+		uint64_t k2 = blocks[i * 2 + 1];
+
+		k1 *= c1;
+		k1 = ROTL64(k1, 31);
+		k1 *= c2;
+		h1 ^= k1;
+
+		h1 = ROTL64(h1, 27);
+		h1 += h2;
+		h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= c2;
+		k2 = ROTL64(k2, 33);
+		k2 *= c1;
+		h2 ^= k2;
+
+		h2 = ROTL64(h2, 31);
+		h2 += h1;
+		h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	const uint8_t * tail = (const uint8_t *)(data + nblocks * 16);
+
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+
+	switch(len & 15)
+	{
+		case 15: k2 ^= (uint64_t)tail[14] << 48; FALLTHROUGH;
+		case 14: k2 ^= (uint64_t)tail[13] << 40; FALLTHROUGH;
+		case 13: k2 ^= (uint64_t)tail[12] << 32; FALLTHROUGH;
+		case 12: k2 ^= (uint64_t)tail[11] << 24; FALLTHROUGH;
+		case 11: k2 ^= (uint64_t)tail[10] << 16; FALLTHROUGH;
+		case 10: k2 ^= (uint64_t)tail[ 9] << 8; FALLTHROUGH;
+		case  9: k2 ^= (uint64_t)tail[ 8] << 0;
+			k2 *= c2;
+			k2 = ROTL64(k2, 33);
+			k2 *= c1;
+			h2 ^= k2;
+			FALLTHROUGH;
+		case  8: k1 ^= (uint64_t)tail[ 7] << 56; FALLTHROUGH;
+		case  7: k1 ^= (uint64_t)tail[ 6] << 48; FALLTHROUGH;
+		case  6: k1 ^= (uint64_t)tail[ 5] << 40; FALLTHROUGH;
+		case  5: k1 ^= (uint64_t)tail[ 4] << 32; FALLTHROUGH;
+		case  4: k1 ^= (uint64_t)tail[ 3] << 24; FALLTHROUGH;
+		case  3: k1 ^= (uint64_t)tail[ 2] << 16; FALLTHROUGH;
+		case  2: k1 ^= (uint64_t)tail[ 1] << 8; FALLTHROUGH;
+		case  1: k1 ^= (uint64_t)tail[ 0] << 0;
+			k1 *= c1;
+			k1 = ROTL64(k1, 31);
+			k1 *= c2;
+			h1 ^= k1;
+	};
+
+	h1 ^= len;
+	h2 ^= len;
+
+	h1 += h2;
+	h2 += h1;
+
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+
+	h1 += h2;
+	h2 += h1;
+
+	((uint64_t *)out)[0] = h1;
+	((uint64_t *)out)[1] = h2;
+}
@@ -0,0 +1,876 @@
+#define _GNU_SOURCE  /* pwrite, pthread_condattr_setclock */
+#include "async_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define AW_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+/* Flush and close help drain the queue when the I/O thread makes no
+   progress for a slice, so a stalled or killed I/O thread (e.g. at
+   DynamoRIO process exit) only costs the buffers it was holding. */
+#define AW_WAIT_SLICE_MS   50
+#define AW_WAIT_TIMEOUT_S  10
+
+#define AW_URING_DEPTH     16
+
+/* DONE: the I/O thread has finished and is signaling; EXITED: it no
+   longer touches the writer */
+enum { AW_THREAD_NONE, AW_THREAD_RUNNING, AW_THREAD_DONE, AW_THREAD_EXITED };
+
+/* Default auto-reset event (aw_sync_t) */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cv;
+    int             set;
+} aw_pevent_t;
+
+/* Bounded MPMC queue (Vyukov): a cell's sequence number says whether it is
+   ready for the next push (seq == pos) or pop (seq == pos + 1). */
+typedef struct {
+    size_t       seq;
+    aw_buffer_t *buf;
+} aw_cell_t;
+
+typedef struct {
+    aw_cell_t *cells;
+    size_t     mask;
+    char       pad0[64];
+    size_t     head;       /* next pop */
+    char       pad1[64];
+    size_t     tail;       /* next push */
+    char       pad2[64];
+} aw_queue_t;
+
+#ifdef AW_HAVE_IO_URING
+typedef struct {
+    int       fd;
+    unsigned  entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void     *sq_ptr, *cq_ptr;
+    size_t    sq_sz, cq_sz, sqes_sz;
+} aw_uring_t;
+#endif
+
+struct async_writer {
+    int          fd;
+    aw_io_t     *io;           /* shared I/O thread, or NULL */
+    async_writer_t *ready_next; /* next in io->ready */
+    int          queued;       /* listed with io (or being written by it) */
+    int          io_busy;      /* the shared thread is writing our buffers */
+    size_t       buffer_size;
+    unsigned     num_buffers;
+    aw_buffer_t *bufs;
+    char        *mem;
+
+    aw_queue_t   free_q;
+    aw_queue_t   submit_q;
+
+    uint64_t     file_off;     /* next submit offset */
+    uint64_t     submitted;
+    uint64_t     completed;
+    int          error;
+
+    aw_sync_t    sync;
+    void        *work_ev;      /* I/O thread sleeps here */
+    void        *idle_ev;      /* producers, flush and close wait here */
+    int          io_sleeping;
+    int          waiters;
+    int          stop;
+    int          thread_state;
+    int          threaded;
+    int          joinable;
+    pthread_t    thread;
+
+    aw_buffer_t *cur;          /* stream interface buffer */
+
+    /* stats */
+    uint64_t     bytes_written;
+    uint64_t     buffers_written;
+    uint64_t     acquire_stalls;
+    uint64_t     stall_ns;
+    uint64_t     max_queued;
+    uint64_t     write_errors;
+
+    int          use_uring;
+#ifdef AW_HAVE_IO_URING
+    aw_uring_t   ring;
+#endif
+};
+
+/* Shared I/O thread: writers with submitted buffers push themselves on
+   ready (newest first), and the thread takes the whole list at once */
+struct aw_io {
+    aw_sync_t       sync;
+    void           *work_ev;
+    void           *idle_ev;   /* closing writers and aw_io_destroy() wait here */
+    async_writer_t *ready;
+    int             sleeping;
+    int             waiters;
+    int             stop;
+    int             stalled;   /* a close gave up waiting: don't wait again */
+    int             thread_state;
+    int             joinable;
+    pthread_t       thread;
+};
+
+static aw_spawn_fn aw_default_spawn;
+
+/* --- helpers --- */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *pevent_create(void) {
+    aw_pevent_t *ev = (aw_pevent_t *)calloc(1, sizeof(*ev));
+    pthread_condattr_t attr;
+
+    if (!ev) return NULL;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&ev->lock, NULL);
+    pthread_cond_init(&ev->cv, &attr);
+    pthread_condattr_destroy(&attr);
+    return ev;
+}
+
+static void pevent_destroy(void *p) {
+    aw_pevent_t *ev = (aw_pevent_t *)p;
+    pthread_cond_destroy(&ev->cv);
+    pthread_mutex_destroy(&ev->lock);
+    free(ev);
+}
+
+static void pevent_wait(void *p, unsigned timeout_ms) {
+    aw_pevent_t *ev = (aw_pevent_t *)p;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&ev->lock);
+    while (!ev->set) {
+        if (timeout_ms == 0)
+            pthread_cond_wait(&ev->cv, &ev->lock);
+        else if (pthread_cond_timedwait(&ev->cv, &ev->lock, &ts) == ETIMEDOUT)
+            break;
+    }
+    ev->set = 0;
+    pthread_mutex_unlock(&ev->lock);
+}
+
+static void pevent_signal(void *p) {
+    aw_pevent_t *ev = (aw_pevent_t *)p;
+    pthread_mutex_lock(&ev->lock);
+    ev->set = 1;
+    pthread_cond_broadcast(&ev->cv);
+    pthread_mutex_unlock(&ev->lock);
+}
+
+static const aw_sync_t aw_pthread_sync = {
+    pevent_create, pevent_destroy, pevent_wait, pevent_signal
+};
+static aw_sync_t aw_default_sync = {
+    pevent_create, pevent_destroy, pevent_wait, pevent_signal
+};
+
+static int q_init(aw_queue_t *q, size_t n) {
+    size_t cap = 1;
+    while (cap < n) cap <<= 1;
+
+    memset(q, 0, sizeof(*q));
+    q->cells = (aw_cell_t *)calloc(cap, sizeof(aw_cell_t));
+    if (!q->cells) return -1;
+    for (size_t i = 0; i < cap; i++)
+        q->cells[i].seq = i;
+    q->mask = cap - 1;
+    return 0;
+}
+
+static int q_push(aw_queue_t *q, aw_buffer_t *b) {
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        aw_cell_t *c = &q->cells[pos & q->mask];
+        size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                c->buf = b;
+                __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if (dif < 0) {
+            return -1;                                  /* full */
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static aw_buffer_t *q_pop(aw_queue_t *q) {
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    for (;;) {
+        aw_cell_t *c = &q->cells[pos & q->mask];
+        size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                aw_buffer_t *b = c->buf;
+                __atomic_store_n(&c->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+                return b;
+            }
+        } else if (dif < 0) {
+            return NULL;                                /* empty */
+        } else {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static size_t q_depth(const aw_queue_t *q) {
+    return __atomic_load_n(&q->tail, __ATOMIC_RELAXED) -
+           __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+}
+
+static int pwrite_all(int fd, const char *p, size_t n, uint64_t off) {
+    while (n) {
+        ssize_t r = pwrite(fd, p, n, (off_t)off);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (r == 0) return -1;
+        p += r;
+        n -= (size_t)r;
+        off += (uint64_t)r;
+    }
+    return 0;
+}
+
+/* Account for a written buffer and put it back in the pool */
+static void aw_complete(async_writer_t *w, aw_buffer_t *b, int ok) {
+    if (ok) {
+        __atomic_add_fetch(&w->bytes_written, b->len, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&w->buffers_written, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&w->write_errors, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->error, 1, __ATOMIC_RELAXED);
+    }
+    b->len = 0;
+    q_push(&w->free_q, b);
+    __atomic_add_fetch(&w->completed, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&w->waiters, __ATOMIC_SEQ_CST))
+        w->sync.event_signal(w->idle_ev);
+}
+
+static void aw_write_buffer(async_writer_t *w, aw_buffer_t *b) {
+    aw_complete(w, b, pwrite_all(w->fd, b->data, b->len, b->offset) == 0);
+}
+
+/* Next submitted buffer for the I/O thread. With block set, sleeps until
+   one arrives; NULL then means stop was requested and the queue is empty. */
+static aw_buffer_t *io_next(async_writer_t *w, int block) {
+    aw_buffer_t *b = q_pop(&w->submit_q);
+    if (b || !block) return b;
+
+    /* Submitters check io_sleeping after queueing, and a signal nobody
+       waits for yet is kept, so a buffer queued after the check below
+       wakes us */
+    __atomic_store_n(&w->io_sleeping, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (!(b = q_pop(&w->submit_q)) && !__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE))
+        w->sync.event_wait(w->work_ev, 0);
+    __atomic_store_n(&w->io_sleeping, 0, __ATOMIC_RELAXED);
+    return b;
+}
+
+/* Wait until completed >= target. If a wait slice passes without progress
+   the caller drains the submit queue itself; it gives up once nothing has
+   completed for AW_WAIT_TIMEOUT_S. */
+static int aw_wait_completed(async_writer_t *w, uint64_t target) {
+    uint64_t last = __atomic_load_n(&w->completed, __ATOMIC_SEQ_CST);
+    uint64_t since = now_ns();
+
+    while (last < target) {
+        __atomic_add_fetch(&w->waiters, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&w->completed, __ATOMIC_SEQ_CST) < target)
+            w->sync.event_wait(w->idle_ev, AW_WAIT_SLICE_MS);
+        __atomic_sub_fetch(&w->waiters, 1, __ATOMIC_RELAXED);
+
+        uint64_t done = __atomic_load_n(&w->completed, __ATOMIC_SEQ_CST);
+        if (done == last && now_ns() - since >= AW_WAIT_SLICE_MS * 1000000ull) {
+            aw_buffer_t *b;
+            while ((b = q_pop(&w->submit_q)) != NULL)
+                aw_write_buffer(w, b);
+            done = __atomic_load_n(&w->completed, __ATOMIC_SEQ_CST);
+        }
+        if (done != last)
+            since = now_ns();
+        else if (now_ns() - since > (uint64_t)AW_WAIT_TIMEOUT_S * 1000000000ull)
+            return -1;
+        last = done;
+    }
+    return 0;
+}
+
+/* --- io_uring backend --- */
+
+#ifdef AW_HAVE_IO_URING
+static int uring_init(aw_uring_t *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) return -1;
+
+    r->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        if (r->cq_sz > r->sq_sz) r->sq_sz = r->cq_sz;
+        r->cq_sz = r->sq_sz;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_sz, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) goto fail_fd;
+    r->cq_ptr = single ? r->sq_ptr
+                       : mmap(NULL, r->cq_sz, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ptr == MAP_FAILED) goto fail_sq;
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) goto fail_cq;
+
+    char *sq = (char *)r->sq_ptr, *cq = (char *)r->cq_ptr;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->entries = p.sq_entries;
+    return 0;
+
+fail_cq:
+    if (!single) munmap(r->cq_ptr, r->cq_sz);
+fail_sq:
+    munmap(r->sq_ptr, r->sq_sz);
+fail_fd:
+    close(r->fd);
+    r->fd = -1;
+    return -1;
+}
+
+static void uring_destroy(aw_uring_t *r) {
+    munmap(r->sqes, r->sqes_sz);
+    if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_sz);
+    munmap(r->sq_ptr, r->sq_sz);
+    close(r->fd);
+}
+
+static void uring_prep_write(aw_uring_t *r, int fd, aw_buffer_t *b) {
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)b->data;
+    sqe->len = (uint32_t)b->len;
+    sqe->off = b->offset;
+    sqe->user_data = (uint64_t)(uintptr_t)b;
+
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Returns 0 when stopped, -1 if the kernel rejected IORING_OP_WRITE and the
+   caller should continue with write() */
+static int uring_loop(async_writer_t *w) {
+    aw_uring_t *r = &w->ring;
+    unsigned inflight = 0, unsubmitted = 0;
+    int broken = 0;
+
+    for (;;) {
+        while (!broken && inflight < r->entries) {
+            aw_buffer_t *b = io_next(w, inflight == 0);
+            if (!b) break;
+            uring_prep_write(r, w->fd, b);
+            inflight++;
+            unsubmitted++;
+        }
+        if (inflight == 0)
+            return broken ? -1 : 0;
+
+        long ret = syscall(__NR_io_uring_enter, r->fd, unsubmitted, 1,
+                           IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret >= 0)
+            unsubmitted -= (unsigned)ret;
+        else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            __atomic_store_n(&w->error, 1, __ATOMIC_RELAXED);
+
+        unsigned head = *r->cq_head;
+        while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            aw_buffer_t *b = (aw_buffer_t *)(uintptr_t)cqe->user_data;
+            int res = cqe->res;
+            head++;
+            __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+            inflight--;
+
+            if (res == (int)b->len) {
+                aw_complete(w, b, 1);
+                continue;
+            }
+            /* short write or unsupported opcode: finish with write() */
+            if (res == -EINVAL || res == -EOPNOTSUPP)
+                broken = 1;
+            size_t done = res > 0 ? (size_t)res : 0;
+            aw_complete(w, b, pwrite_all(w->fd, b->data + done, b->len - done,
+                                         b->offset + done) == 0);
+        }
+    }
+}
+#endif
+
+/* --- I/O thread --- */
+
+static void aw_io_main(void *arg) {
+    async_writer_t *w = (async_writer_t *)arg;
+
+#ifdef AW_HAVE_IO_URING
+    if (w->use_uring && uring_loop(w) != 0) {
+        uring_destroy(&w->ring);
+        __atomic_store_n(&w->use_uring, 0, __ATOMIC_RELAXED);
+    }
+#endif
+    aw_buffer_t *b;
+    while ((b = io_next(w, 1)) != NULL)
+        aw_write_buffer(w, b);
+
+    __atomic_store_n(&w->thread_state, AW_THREAD_DONE, __ATOMIC_SEQ_CST);
+    w->sync.event_signal(w->idle_ev);
+    __atomic_store_n(&w->thread_state, AW_THREAD_EXITED, __ATOMIC_RELEASE);
+}
+
+static void *aw_pthread_main(void *arg) {
+    aw_io_main(arg);
+    return NULL;
+}
+
+/* Write the buffers of every listed writer until stopped */
+static void aw_io_shared_main(void *arg) {
+    aw_io_t *io = (aw_io_t *)arg;
+
+    for (;;) {
+        async_writer_t *list = __atomic_exchange_n(&io->ready, NULL, __ATOMIC_SEQ_CST);
+        async_writer_t *w = NULL;
+
+        if (!list) {
+            if (__atomic_load_n(&io->stop, __ATOMIC_ACQUIRE))
+                break;
+            /* as in io_next(): a writer listed after the check is signaled */
+            __atomic_store_n(&io->sleeping, 1, __ATOMIC_SEQ_CST);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            while (!__atomic_load_n(&io->ready, __ATOMIC_SEQ_CST) &&
+                   !__atomic_load_n(&io->stop, __ATOMIC_ACQUIRE))
+                io->sync.event_wait(io->work_ev, 0);
+            __atomic_store_n(&io->sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        /* oldest first */
+        while (list) {
+            async_writer_t *next = list->ready_next;
+            list->ready_next = w;
+            w = list;
+            list = next;
+        }
+        while (w) {
+            async_writer_t *next = w->ready_next;
+            aw_buffer_t *b;
+
+            /* unlisted before draining, so a buffer submitted meanwhile
+               lists the writer again */
+            __atomic_store_n(&w->io_busy, 1, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&w->queued, 0, __ATOMIC_SEQ_CST);
+            while ((b = q_pop(&w->submit_q)) != NULL)
+                aw_write_buffer(w, b);
+            __atomic_store_n(&w->io_busy, 0, __ATOMIC_SEQ_CST);    /* w may be freed */
+            w = next;
+        }
+        if (__atomic_load_n(&io->waiters, __ATOMIC_SEQ_CST))
+            io->sync.event_signal(io->idle_ev);
+    }
+
+    __atomic_store_n(&io->thread_state, AW_THREAD_DONE, __ATOMIC_SEQ_CST);
+    io->sync.event_signal(io->idle_ev);
+    __atomic_store_n(&io->thread_state, AW_THREAD_EXITED, __ATOMIC_RELEASE);
+}
+
+static void *aw_io_pthread_main(void *arg) {
+    aw_io_shared_main(arg);
+    return NULL;
+}
+
+/* pthread_create() with the application's signals kept off the thread */
+static int aw_pthread_create(pthread_t *t, void *(*main)(void *), void *arg) {
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rc = pthread_create(t, NULL, main, arg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return rc;
+}
+
+static int aw_start_thread(async_writer_t *w, aw_spawn_fn spawn) {
+    w->thread_state = AW_THREAD_RUNNING;
+
+    if (spawn) {
+        if (spawn(aw_io_main, w) == 0) return 0;
+    } else if (aw_pthread_create(&w->thread, aw_pthread_main, w) == 0) {
+        w->joinable = 1;
+        return 0;
+    }
+    w->thread_state = AW_THREAD_NONE;
+    return -1;
+}
+
+/* Wait for an I/O thread asked to stop to be done with its state; 0 once
+   it is, -1 after AW_WAIT_TIMEOUT_S */
+static int aw_wait_exited(const aw_sync_t *sync, void *idle_ev, int *waiters,
+                          const int *thread_state) {
+    uint64_t deadline = now_ns() + (uint64_t)AW_WAIT_TIMEOUT_S * 1000000000ull;
+    int state;
+
+    __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+    while ((state = __atomic_load_n(thread_state, __ATOMIC_ACQUIRE)) != AW_THREAD_EXITED &&
+           now_ns() < deadline)
+        sync->event_wait(idle_ev, state == AW_THREAD_DONE ? 1 : 1000);
+    __atomic_sub_fetch(waiters, 1, __ATOMIC_RELAXED);
+    return state == AW_THREAD_EXITED ? 0 : -1;
+}
+
+/* List w with its shared I/O thread after a submit */
+static void aw_io_list(aw_io_t *io, async_writer_t *w) {
+    if (__atomic_exchange_n(&w->queued, 1, __ATOMIC_SEQ_CST))
+        return;
+    async_writer_t *head = __atomic_load_n(&io->ready, __ATOMIC_RELAXED);
+    do {
+        w->ready_next = head;
+    } while (!__atomic_compare_exchange_n(&io->ready, &head, w, 1,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    if (__atomic_load_n(&io->sleeping, __ATOMIC_SEQ_CST))
+        io->sync.event_signal(io->work_ev);
+}
+
+/* Wait until the shared thread no longer touches w: neither listed nor
+   being written. Once a wait times out the thread is taken as stalled and
+   later closes do not wait. */
+static int aw_io_unlist(aw_io_t *io, async_writer_t *w) {
+    uint64_t deadline = now_ns() + (uint64_t)AW_WAIT_TIMEOUT_S * 1000000000ull;
+    int rc = 0;
+
+    __atomic_add_fetch(&io->waiters, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&w->queued, __ATOMIC_SEQ_CST) ||
+           __atomic_load_n(&w->io_busy, __ATOMIC_SEQ_CST)) {
+        if (__atomic_load_n(&io->stalled, __ATOMIC_RELAXED) || now_ns() >= deadline) {
+            __atomic_store_n(&io->stalled, 1, __ATOMIC_RELAXED);
+            rc = -1;
+            break;
+        }
+        io->sync.event_wait(io->idle_ev, AW_WAIT_SLICE_MS);
+    }
+    __atomic_sub_fetch(&io->waiters, 1, __ATOMIC_RELAXED);
+    return rc;
+}
+
+static void aw_free(async_writer_t *w) {
+    if (w->idle_ev) w->sync.event_destroy(w->idle_ev);
+    if (w->work_ev) w->sync.event_destroy(w->work_ev);
+    free(w->free_q.cells);
+    free(w->submit_q.cells);
+    free(w->bufs);
+    free(w->mem);
+    free(w);
+}
+
+/* --- API --- */
+
+void aw_set_default_spawn(aw_spawn_fn spawn) {
+    aw_default_spawn = spawn;
+}
+
+void aw_set_default_sync(const aw_sync_t *sync) {
+    aw_default_sync = sync ? *sync : aw_pthread_sync;
+}
+
+aw_io_t *aw_io_create(aw_spawn_fn spawn) {
+    aw_io_t *io = (aw_io_t *)calloc(1, sizeof(*io));
+    if (!io) return NULL;
+
+    if (!spawn) spawn = aw_default_spawn;
+    io->sync = aw_default_sync;
+    io->work_ev = io->sync.event_create();
+    io->idle_ev = io->sync.event_create();
+    if (io->work_ev && io->idle_ev) {
+        io->thread_state = AW_THREAD_RUNNING;
+        if (spawn) {
+            if (spawn(aw_io_shared_main, io) == 0) return io;
+        } else if (aw_pthread_create(&io->thread, aw_io_pthread_main, io) == 0) {
+            io->joinable = 1;
+            return io;
+        }
+    }
+    if (io->idle_ev) io->sync.event_destroy(io->idle_ev);
+    if (io->work_ev) io->sync.event_destroy(io->work_ev);
+    free(io);
+    return NULL;
+}
+
+int aw_io_destroy(aw_io_t *io) {
+    if (!io) return -1;
+
+    __atomic_store_n(&io->stop, 1, __ATOMIC_RELEASE);
+    io->sync.event_signal(io->work_ev);
+    if (aw_wait_exited(&io->sync, io->idle_ev, &io->waiters, &io->thread_state))
+        return -1;
+    if (io->joinable)
+        pthread_join(io->thread, NULL);
+    io->sync.event_destroy(io->idle_ev);
+    io->sync.event_destroy(io->work_ev);
+    free(io);
+    return 0;
+}
+
+async_writer_t *aw_open(const char *filename, const aw_config_t *cfg) {
+    aw_config_t c;
+    if (cfg) c = *cfg;
+    else memset(&c, 0, sizeof(c));
+    if (c.buffer_size == 0) c.buffer_size = AW_DEFAULT_BUFFER_SIZE;
+    if (c.num_buffers == 0) c.num_buffers = AW_DEFAULT_BUFFERS;
+
+    async_writer_t *w = (async_writer_t *)calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->buffer_size = c.buffer_size;
+    w->num_buffers = c.num_buffers;
+
+    w->sync = aw_default_sync;
+    w->work_ev = w->sync.event_create();
+    w->idle_ev = w->sync.event_create();
+
+    w->mem = (char *)malloc(c.buffer_size * c.num_buffers);
+    w->bufs = (aw_buffer_t *)calloc(c.num_buffers, sizeof(aw_buffer_t));
+    if (!w->work_ev || !w->idle_ev || !w->mem || !w->bufs ||
+        q_init(&w->free_q, c.num_buffers) || q_init(&w->submit_q, c.num_buffers)) {
+        aw_free(w);
+        return NULL;
+    }
+    for (unsigned i = 0; i < c.num_buffers; i++) {
+        w->bufs[i].data = w->mem + (size_t)i * c.buffer_size;
+        w->bufs[i].cap = c.buffer_size;
+        q_push(&w->free_q, &w->bufs[i]);
+    }
+
+    w->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        aw_free(w);
+        return NULL;
+    }
+
+    if (!c.sync && c.io) {
+        w->io = c.io;
+        w->threaded = 1;
+    } else if (!c.sync) {
+#ifdef AW_HAVE_IO_URING
+        if (c.backend != AW_BACKEND_WRITE) {
+            unsigned depth = c.num_buffers < AW_URING_DEPTH ? c.num_buffers : AW_URING_DEPTH;
+            w->use_uring = uring_init(&w->ring, depth) == 0;
+        }
+#endif
+        w->threaded = aw_start_thread(w, c.spawn ? c.spawn : aw_default_spawn) == 0;
+#ifdef AW_HAVE_IO_URING
+        if (!w->threaded && w->use_uring) {
+            uring_destroy(&w->ring);
+            w->use_uring = 0;
+        }
+#endif
+    }
+    return w;
+}
+
+aw_buffer_t *aw_try_acquire(async_writer_t *w) {
+    return w ? q_pop(&w->free_q) : NULL;
+}
+
+aw_buffer_t *aw_acquire(async_writer_t *w) {
+    if (!w) return NULL;
+
+    aw_buffer_t *b = q_pop(&w->free_q);
+    if (b) return b;
+
+    /* backpressure: every buffer is queued or being written */
+    uint64_t t0 = now_ns(), since = t0;
+    __atomic_add_fetch(&w->waiters, 1, __ATOMIC_SEQ_CST);
+    while (!(b = q_pop(&w->free_q))) {
+        w->sync.event_wait(w->idle_ev, AW_WAIT_SLICE_MS);
+        if (now_ns() - since >= AW_WAIT_SLICE_MS * 1000000ull) {
+            /* I/O thread not keeping up at all: write one buffer here */
+            aw_buffer_t *sb = q_pop(&w->submit_q);
+            if (sb)
+                aw_write_buffer(w, sb);
+            since = now_ns();
+        }
+    }
+    __atomic_sub_fetch(&w->waiters, 1, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&w->acquire_stalls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&w->stall_ns, now_ns() - t0, __ATOMIC_RELAXED);
+    return b;
+}
+
+void aw_release(async_writer_t *w, aw_buffer_t *buf) {
+    if (!w || !buf) return;
+    buf->len = 0;
+    q_push(&w->free_q, buf);
+    if (__atomic_load_n(&w->waiters, __ATOMIC_SEQ_CST))
+        w->sync.event_signal(w->idle_ev);
+}
+
+void aw_submit(async_writer_t *w, aw_buffer_t *buf) {
+    if (!w || !buf) return;
+    if (buf->len == 0) {
+        aw_release(w, buf);
+        return;
+    }
+
+    buf->offset = __atomic_fetch_add(&w->file_off, buf->len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&w->submitted, 1, __ATOMIC_SEQ_CST);
+
+    if (!w->threaded) {
+        aw_write_buffer(w, buf);
+        return;
+    }
+
+    q_push(&w->submit_q, buf);    /* never full: it holds every buffer */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    uint64_t depth = q_depth(&w->submit_q);
+    uint64_t max = __atomic_load_n(&w->max_queued, __ATOMIC_RELAXED);
+    while (depth > max &&
+           !__atomic_compare_exchange_n(&w->max_queued, &max, depth, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    if (w->io)
+        aw_io_list(w->io, w);
+    else if (__atomic_load_n(&w->io_sleeping, __ATOMIC_SEQ_CST))
+        w->sync.event_signal(w->work_ev);
+}
+
+int aw_write(async_writer_t *w, const void *data, size_t len) {
+    if (!w) return -1;
+
+    const char *p = (const char *)data;
+    while (len) {
+        if (!w->cur) w->cur = aw_acquire(w);
+
+        size_t n = w->cur->cap - w->cur->len;
+        if (n > len) n = len;
+        memcpy(w->cur->data + w->cur->len, p, n);
+        w->cur->len += n;
+        p += n;
+        len -= n;
+
+        if (w->cur->len == w->cur->cap) {
+            aw_submit(w, w->cur);
+            w->cur = NULL;
+        }
+    }
+    return __atomic_load_n(&w->error, __ATOMIC_RELAXED) ? -1 : 0;
+}
+
+int aw_flush(async_writer_t *w) {
+    if (!w) return -1;
+
+    if (w->cur) {
+        aw_submit(w, w->cur);
+        w->cur = NULL;
+    }
+    if (aw_wait_completed(w, __atomic_load_n(&w->submitted, __ATOMIC_SEQ_CST)))
+        return -1;
+    return __atomic_load_n(&w->error, __ATOMIC_RELAXED) ? -1 : 0;
+}
+
+int aw_close(async_writer_t *w) {
+    if (!w) return -1;
+
+    int rc = aw_flush(w);
+
+    if (w->io) {
+        /* the shared thread may still touch w: leave it (and the fd) alone */
+        if (aw_io_unlist(w->io, w))
+            return -1;
+    } else if (w->threaded) {
+        __atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+        w->sync.event_signal(w->work_ev);
+        if (aw_wait_exited(&w->sync, w->idle_ev, &w->waiters, &w->thread_state)) {
+            /* the thread may still touch w: leave it (and the fd) alone */
+            return -1;
+        }
+        if (w->joinable)
+            pthread_join(w->thread, NULL);
+#ifdef AW_HAVE_IO_URING
+        if (w->use_uring)
+            uring_destroy(&w->ring);
+#endif
+    }
+
+    if (close(w->fd) != 0)
+        rc = -1;
+    aw_free(w);
+    return rc;
+}
+
+void aw_get_stats(const async_writer_t *w, aw_stats_t *out) {
+    if (!w || !out) return;
+    out->bytes_written = __atomic_load_n(&w->bytes_written, __ATOMIC_RELAXED);
+    out->buffers_written = __atomic_load_n(&w->buffers_written, __ATOMIC_RELAXED);
+    out->acquire_stalls = __atomic_load_n(&w->acquire_stalls, __ATOMIC_RELAXED);
+    out->stall_ns = __atomic_load_n(&w->stall_ns, __ATOMIC_RELAXED);
+    out->max_queued = __atomic_load_n(&w->max_queued, __ATOMIC_RELAXED);
+    out->write_errors = __atomic_load_n(&w->write_errors, __ATOMIC_RELAXED);
+    out->io_uring = __atomic_load_n(&w->use_uring, __ATOMIC_RELAXED);
+    out->threaded = w->threaded;
+}
@@ -0,0 +1,94 @@
+#define _POSIX_C_SOURCE 200809L   /* posix_memalign */
+#include "buf_pool.h"
+#include "spsc_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BUF_POOL_ALIGN 64
+
+struct buf_pool {
+    unsigned     n;
+    size_t       size;
+    char        *mem;          /* n * size bytes */
+    pool_buf_t  *bufs;
+    spsc_ring_t *free_ring;    /* consumer -> owner */
+
+    /* owner side */
+    uint64_t     gets;
+    uint64_t     misses;
+    uint64_t     min_free;
+};
+
+/* --- API --- */
+
+buf_pool_t *buf_pool_create(unsigned num_buffers, size_t buffer_size) {
+    if (num_buffers == 0 || buffer_size == 0)
+        return NULL;
+
+    buf_pool_t *p = (buf_pool_t*)calloc(1, sizeof(*p));
+    if (!p) return NULL;
+
+    /* keep every buffer on its own cache lines */
+    size_t size = (buffer_size + BUF_POOL_ALIGN - 1) & ~(size_t)(BUF_POOL_ALIGN - 1);
+    p->n = num_buffers;
+    p->size = buffer_size;
+    p->min_free = num_buffers;
+    if (posix_memalign((void**)&p->mem, BUF_POOL_ALIGN, (size_t)num_buffers * size) != 0)
+        p->mem = NULL;
+    p->bufs = (pool_buf_t*)calloc(num_buffers, sizeof(pool_buf_t));
+    p->free_ring = spsc_ring_create(num_buffers);
+    if (!p->mem || !p->bufs || !p->free_ring) {
+        buf_pool_destroy(p);
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < num_buffers; i++) {
+        p->bufs[i].data = p->mem + (size_t)i * size;
+        spsc_ring_push(p->free_ring, &p->bufs[i]);
+    }
+    return p;
+}
+
+void buf_pool_destroy(buf_pool_t *p) {
+    if (!p) return;
+    spsc_ring_destroy(p->free_ring);
+    free(p->bufs);
+    free(p->mem);
+    free(p);
+}
+
+pool_buf_t *buf_pool_get(buf_pool_t *p) {
+    pool_buf_t *b = (pool_buf_t*)spsc_ring_pop(p->free_ring);
+
+    if (!b) {
+        p->misses++;
+        p->min_free = 0;
+        return NULL;
+    }
+    size_t left = spsc_ring_size(p->free_ring);
+    if (left < p->min_free)
+        p->min_free = left;
+    p->gets++;
+    b->len = 0;
+    return b;
+}
+
+void buf_pool_put(buf_pool_t *p, pool_buf_t *b) {
+    /* never full: there are only n buffers */
+    spsc_ring_push(p->free_ring, b);
+}
+
+void buf_pool_get_stats(const buf_pool_t *p, buf_pool_stats_t *out_stats) {
+    out_stats->gets = p->gets;
+    out_stats->misses = p->misses;
+    out_stats->min_free = p->min_free;
+}
+
+unsigned buf_pool_count(const buf_pool_t *p) {
+    return p->n;
+}
+
+size_t buf_pool_buffer_size(const buf_pool_t *p) {
+    return p->size;
+}
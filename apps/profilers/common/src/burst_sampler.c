@@ -0,0 +1,115 @@
+#include "burst_sampler.h"
+
+#include <math.h>
+#include <string.h>
+
+/* --- helpers --- */
+
+static uint64_t burst_rand(burst_sched_t *s) {
+    uint64_t x = s->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return s->rng = x;
+}
+
+/* uniform in [off/2, 3*off/2], at least 1 */
+static uint64_t burst_off_len(burst_sched_t *s) {
+    uint64_t len = s->off_len / 2 + burst_rand(s) % (s->off_len + 1);
+    return len ? len : 1;
+}
+
+/* --- API --- */
+
+void burst_sched_init(burst_sched_t *s, uint64_t on_len, uint64_t off_len,
+                      uint64_t seed) {
+    memset(s, 0, sizeof(*s));
+    s->on_len = on_len ? on_len : 1;
+    s->off_len = off_len;
+    s->on = 1;
+    /* any nonzero state; mix the seed so consecutive seeds diverge */
+    s->rng = (seed + 1) * 0x9e3779b97f4a7c15ULL;
+    if (!s->rng) s->rng = 1;
+}
+
+uint64_t burst_sched_first(const burst_sched_t *s) {
+    return s->off_len ? s->on_len : UINT64_MAX / 2;
+}
+
+uint64_t burst_sched_next(burst_sched_t *s, uint64_t units) {
+    if (!s->off_len) {              /* always on: one endless period */
+        s->units_on += units;
+        return UINT64_MAX / 2;
+    }
+    if (s->on) {
+        s->units_on += units;
+        s->periods++;
+        s->on = 0;
+        return burst_off_len(s);
+    }
+    s->units_off += units;
+    s->on = 1;
+    return s->on_len;
+}
+
+void burst_sched_finish(burst_sched_t *s, uint64_t units) {
+    if (s->on)
+        s->units_on += units;
+    else
+        s->units_off += units;
+}
+
+uint64_t burst_sched_units(const burst_sched_t *s) {
+    return s->units_on + s->units_off;
+}
+
+double burst_sched_fraction(const burst_sched_t *s) {
+    uint64_t total = burst_sched_units(s);
+    return total ? (double)s->units_on / (double)total : 0.0;
+}
+
+void burst_stat_add(burst_stat_t *st, double x, double u) {
+    st->n++;
+    st->sum_x += x;
+    st->sum_u += u;
+    st->sum_xx += x * x;
+    st->sum_xu += x * u;
+    st->sum_uu += u * u;
+}
+
+void burst_stat_merge(burst_stat_t *dst, const burst_stat_t *src) {
+    dst->n += src->n;
+    dst->sum_x += src->sum_x;
+    dst->sum_u += src->sum_u;
+    dst->sum_xx += src->sum_xx;
+    dst->sum_xu += src->sum_xu;
+    dst->sum_uu += src->sum_uu;
+}
+
+int burst_stat_estimate(const burst_stat_t *st, double total_units, double z,
+                        burst_estimate_t *out) {
+    memset(out, 0, sizeof(*out));
+    if (st->n == 0 || st->sum_u <= 0)
+        return -1;
+
+    double n = (double)st->n;
+    double r = st->sum_x / st->sum_u;
+    if (total_units < st->sum_u)
+        total_units = st->sum_u;
+    out->estimate = r * total_units;
+
+    if (st->n >= 2) {
+        /* sum of (x - r*u)^2 over the periods, from the running sums */
+        double ss = st->sum_xx - 2.0 * r * st->sum_xu + r * r * st->sum_uu;
+        double mean_u = st->sum_u / n;
+        double fpc = 1.0 - st->sum_u / total_units;
+        if (ss < 0) ss = 0;         /* rounding */
+        if (fpc < 0) fpc = 0;
+        double var_r = fpc * (ss / (n - 1.0)) / (n * mean_u * mean_u);
+        out->std_error = total_units * sqrt(var_r);
+    }
+    out->lo = out->estimate - z * out->std_error;
+    out->hi = out->estimate + z * out->std_error;
+    if (out->lo < 0) out->lo = 0;
+    return 0;
+}
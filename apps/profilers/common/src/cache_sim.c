@@ -0,0 +1,423 @@
+#include "cache_sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CS_LOCK_BITS 6
+#define CS_LOCKS     (1u << CS_LOCK_BITS)
+#define CS_RRPV_MAX  3          /* distant re-reference; lines are inserted at MAX - 1 */
+
+typedef struct {
+    char lock;
+    char pad[63];               /* one lock per cache line */
+} cs_lock_t;
+
+/* A set is one block of ways + 1 entries, so a lookup reads adjacent lines:
+   entry 0 holds the set's replacement state, then one entry per way */
+typedef struct {
+    uint64_t tag;               /* line + 1, 0 = invalid; set header: LRU clock or PLRU bits */
+    uint32_t stamp;             /* LRU: low bits of the set clock at the last use */
+    uint8_t  dirty;
+    uint8_t  rrpv;              /* RRIP */
+    uint16_t pad;
+} cs_way_t;
+
+struct cache_level {
+    cache_level_config_t cfg;
+    uint64_t   set_mask;
+    uint32_t   ways;
+    unsigned   plru_depth;      /* log2(ways) */
+    cs_way_t  *sets;            /* sets * (ways + 1) */
+    cs_lock_t *locks;           /* shared levels only, by set */
+};
+
+struct cache_hier {
+    cache_level_t *levels[CACHE_SIM_MAX_LEVELS];
+    unsigned  n;
+    unsigned  n_private;
+    unsigned  line_shift;
+
+    /* Last line accessed at a private first level, which nothing else can
+       evict: repeats of it are hits without a lookup, as long as a repeat
+       leaves the replacement state as it is (LRU and PLRU, not RRIP) */
+    int       fast_repeat;
+    uint64_t  last_line;        /* line + 1, 0 = none */
+    int       last_dirty;
+
+    cache_hier_stats_t stats;
+};
+
+/* --- helpers --- */
+
+static inline int cs_is_pow2(uint64_t x) {
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+/* Shared levels: lock the group of sets holding line */
+static inline void cs_lock(cache_level_t *c, uint64_t line) {
+    if (!c->locks) return;
+    cs_lock_t *l = &c->locks[line & c->set_mask & (CS_LOCKS - 1)];
+    while (__atomic_test_and_set(&l->lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&l->lock, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+static inline void cs_unlock(cache_level_t *c, uint64_t line) {
+    if (c->locks)
+        __atomic_clear(&c->locks[line & c->set_mask & (CS_LOCKS - 1)].lock, __ATOMIC_RELEASE);
+}
+
+static inline cs_way_t *cs_set(const cache_level_t *c, uint64_t line) {
+    return c->sets + (size_t)(line & c->set_mask) * (c->ways + 1);
+}
+
+/* The way holding tag in set s (its header at s[0]), or NULL */
+static inline cs_way_t *cs_find(const cache_level_t *c, cs_way_t *s, uint64_t tag) {
+    for (uint32_t w = 1; w <= c->ways; w++) {
+        if (s[w].tag == tag)
+            return &s[w];
+    }
+    return NULL;
+}
+
+/* Record a use of way w of set s, a hit or a fill */
+static void cs_touch(const cache_level_t *c, cs_way_t *s, cs_way_t *w, int fill) {
+    switch (c->cfg.repl) {
+    case CACHE_REPL_LRU:
+        w->stamp = (uint32_t)++s[0].tag;
+        break;
+    case CACHE_REPL_PLRU: {
+        /* point every node on the way's path away from it */
+        uint32_t way = (uint32_t)(w - s - 1);
+        uint64_t bits = s[0].tag;
+        unsigned node = 1;
+        for (unsigned l = c->plru_depth; l-- > 0;) {
+            unsigned b = (way >> l) & 1;
+            if (b) bits &= ~(1ULL << node);
+            else   bits |= 1ULL << node;
+            node = 2 * node + b;
+        }
+        s[0].tag = bits;
+        break;
+    }
+    case CACHE_REPL_RRIP:
+        w->rrpv = fill ? CS_RRPV_MAX - 1 : 0;
+        break;
+    }
+}
+
+static cs_way_t *cs_victim(const cache_level_t *c, cs_way_t *s) {
+    uint32_t w, v = 1;
+
+    for (w = 1; w <= c->ways; w++) {
+        if (s[w].tag == 0)
+            return &s[w];
+    }
+
+    switch (c->cfg.repl) {
+    case CACHE_REPL_LRU: {
+        /* oldest by age from the clock, which stays right across the
+           32-bit stamps wrapping */
+        uint32_t now = (uint32_t)s[0].tag;
+        for (w = 2; w <= c->ways; w++) {
+            if (now - s[w].stamp > now - s[v].stamp)
+                v = w;
+        }
+        break;
+    }
+    case CACHE_REPL_PLRU: {
+        uint64_t bits = s[0].tag;
+        unsigned node = 1;
+        v = 0;
+        for (unsigned l = 0; l < c->plru_depth; l++) {
+            unsigned b = (unsigned)(bits >> node) & 1;
+            v = (v << 1) | b;
+            node = 2 * node + b;
+        }
+        v++;
+        break;
+    }
+    case CACHE_REPL_RRIP:
+        for (;;) {
+            for (w = 1; w <= c->ways; w++) {
+                if (s[w].rrpv >= CS_RRPV_MAX)
+                    return &s[w];
+            }
+            for (w = 1; w <= c->ways; w++)
+                s[w].rrpv++;
+        }
+    }
+    return &s[v];
+}
+
+/* Install line in its set s, unless another hierarchy sharing the level
+   got there first. Returns 1 and the line in *victim if a dirty line was
+   evicted. */
+static int cs_fill(const cache_level_t *c, cs_way_t *s, uint64_t line, int dirty,
+                   uint64_t *victim) {
+    cs_way_t *w = cs_find(c, s, line + 1);
+    int evicted = 0;
+
+    if (!w) {
+        w = cs_victim(c, s);
+        if (w->tag != 0 && w->dirty) {
+            *victim = w->tag - 1;
+            evicted = 1;
+        }
+        w->tag = line + 1;
+        w->dirty = 0;
+    }
+    cs_touch(c, s, w, 1);
+    w->dirty |= (uint8_t)dirty;
+    return evicted;
+}
+
+static void ch_writeback(cache_hier_t *h, unsigned i, uint64_t line);
+
+/* Access line at level i and below; returns the level that served it */
+static unsigned ch_access(cache_hier_t *h, unsigned i, uint64_t line, int write) {
+    if (i == h->n) {
+        if (write) h->stats.mem_writes++;
+        else       h->stats.mem_reads++;
+        return i;
+    }
+
+    cache_level_t *c = h->levels[i];
+    cache_level_stats_t *st = &h->stats.level[i];
+    cs_way_t *s = cs_set(c, line), *w;
+    uint64_t victim = 0;
+    int evicted;
+    unsigned from;
+
+    cs_lock(c, line);
+    w = cs_find(c, s, line + 1);
+    if (w) {
+        cs_touch(c, s, w, 0);
+        if (write && c->cfg.write_back)
+            w->dirty = 1;
+        cs_unlock(c, line);
+        if (write) {
+            st->write_hits++;
+            if (!c->cfg.write_back)
+                ch_access(h, i + 1, line, 1);
+        } else {
+            st->read_hits++;
+        }
+        return i;
+    }
+    cs_unlock(c, line);
+
+    if (write) st->write_misses++;
+    else       st->read_misses++;
+    if (write && !c->cfg.write_allocate)
+        return ch_access(h, i + 1, line, 1);
+
+    /* Fetch the line; a write-through level passes the write itself down */
+    from = ch_access(h, i + 1, line, write && !c->cfg.write_back);
+    cs_lock(c, line);
+    evicted = cs_fill(c, s, line, write && c->cfg.write_back, &victim);
+    cs_unlock(c, line);
+    if (evicted) {
+        st->writebacks++;
+        ch_writeback(h, i + 1, victim);
+    }
+    return from;
+}
+
+/* A dirty line written back from the level above i */
+static void ch_writeback(cache_hier_t *h, unsigned i, uint64_t line) {
+    if (i == h->n) {
+        h->stats.mem_writes++;
+        return;
+    }
+
+    cache_level_t *c = h->levels[i];
+    cs_way_t *s = cs_set(c, line), *w;
+    uint64_t victim = 0;
+    int evicted = 0;
+
+    cs_lock(c, line);
+    w = cs_find(c, s, line + 1);
+    if (w && c->cfg.write_back) {
+        w->dirty = 1;
+        cs_unlock(c, line);
+        return;
+    }
+    if (!w && c->cfg.write_back && c->cfg.write_allocate) {
+        evicted = cs_fill(c, s, line, 1, &victim);
+        cs_unlock(c, line);
+        if (evicted) {
+            h->stats.level[i].writebacks++;
+            ch_writeback(h, i + 1, victim);
+        }
+        return;
+    }
+    cs_unlock(c, line);
+    ch_writeback(h, i + 1, line);
+}
+
+static unsigned ch_access_line(cache_hier_t *h, uint64_t line, int write) {
+    if (line + 1 == h->last_line && (!write || h->last_dirty)) {
+        if (write) h->stats.level[0].write_hits++;
+        else       h->stats.level[0].read_hits++;
+        return 0;
+    }
+
+    unsigned served = ch_access(h, 0, line, write);
+    if (h->fast_repeat) {
+        const cache_level_config_t *l1 = &h->levels[0]->cfg;
+        if (write && !l1->write_allocate && served != 0) {
+            h->last_line = 0;       /* not in the first level */
+        } else {
+            h->last_dirty = (write && l1->write_back) ||
+                            (line + 1 == h->last_line && h->last_dirty);
+            h->last_line = line + 1;
+        }
+    }
+    return served;
+}
+
+/* --- API --- */
+
+cache_level_t *cache_level_create(const cache_level_config_t *cfg, int shared) {
+    if (!cfg || cfg->ways == 0 || !cs_is_pow2(cfg->line_size))
+        return NULL;
+    uint64_t set_bytes = (uint64_t)cfg->ways * cfg->line_size;
+    if (cfg->size % set_bytes != 0 || !cs_is_pow2(cfg->size / set_bytes))
+        return NULL;
+    if (cfg->repl == CACHE_REPL_PLRU && (!cs_is_pow2(cfg->ways) || cfg->ways > 64))
+        return NULL;
+    if (cfg->repl != CACHE_REPL_LRU && cfg->repl != CACHE_REPL_PLRU &&
+        cfg->repl != CACHE_REPL_RRIP)
+        return NULL;
+
+    cache_level_t *c = (cache_level_t*)calloc(1, sizeof(*c));
+    if (!c) return NULL;
+
+    uint64_t sets = cfg->size / set_bytes;
+    size_t n = (size_t)(sets * cfg->ways);
+    c->cfg = *cfg;
+    c->set_mask = sets - 1;
+    c->ways = cfg->ways;
+    while ((1u << c->plru_depth) < cfg->ways)
+        c->plru_depth++;
+    c->sets = (cs_way_t*)calloc(n + (size_t)sets, sizeof(cs_way_t));
+    int ok = c->sets != NULL;
+    if (shared) {
+        c->locks = (cs_lock_t*)calloc(CS_LOCKS, sizeof(cs_lock_t));
+        ok = ok && c->locks;
+    }
+    if (!ok) {
+        cache_level_destroy(c);
+        return NULL;
+    }
+    return c;
+}
+
+void cache_level_destroy(cache_level_t *c) {
+    if (!c) return;
+    free(c->sets);
+    free(c->locks);
+    free(c);
+}
+
+cache_hier_t *cache_hier_create(const cache_level_config_t *cfg, unsigned n,
+                                cache_level_t *shared_last) {
+    unsigned total = n + (shared_last != NULL);
+    if (total == 0 || total > CACHE_SIM_MAX_LEVELS)
+        return NULL;
+
+    uint32_t line_size = n > 0 ? cfg[0].line_size : shared_last->cfg.line_size;
+    for (unsigned i = 0; i < n; i++) {
+        if (cfg[i].line_size != line_size)
+            return NULL;
+    }
+    if (shared_last && shared_last->cfg.line_size != line_size)
+        return NULL;
+
+    cache_hier_t *h = (cache_hier_t*)calloc(1, sizeof(*h));
+    if (!h) return NULL;
+    for (unsigned i = 0; i < n; i++) {
+        h->levels[i] = cache_level_create(&cfg[i], 0);
+        if (!h->levels[i]) {
+            cache_hier_destroy(h);
+            return NULL;
+        }
+        h->n_private++;
+    }
+    if (shared_last)
+        h->levels[n] = shared_last;
+    h->n = total;
+    h->fast_repeat = n > 0 && cfg[0].repl != CACHE_REPL_RRIP;
+    while ((1u << h->line_shift) < line_size)
+        h->line_shift++;
+    return h;
+}
+
+void cache_hier_destroy(cache_hier_t *h) {
+    if (!h) return;
+    for (unsigned i = 0; i < h->n_private; i++)
+        cache_level_destroy(h->levels[i]);
+    free(h);
+}
+
+unsigned cache_hier_levels(const cache_hier_t *h) {
+    return h->n;
+}
+
+unsigned cache_hier_access(cache_hier_t *h, uint64_t addr, uint32_t size, int write) {
+    uint64_t line = addr >> h->line_shift;
+    uint64_t last = size > 1 ? (addr + size - 1) >> h->line_shift : line;
+    unsigned served = ch_access_line(h, line, write);
+
+    while (line != last) {
+        unsigned s = ch_access_line(h, ++line, write);
+        if (s > served)
+            served = s;
+    }
+    return served;
+}
+
+void cache_hier_access_batch(cache_hier_t *h, const memref_t *refs, size_t n,
+                             uint8_t *served) {
+    for (size_t i = 0; i < n; i++) {
+        unsigned s = cache_hier_access(h, refs[i].addr, MEMREF_SIZE(&refs[i]),
+                                       MEMREF_IS_WRITE(&refs[i]));
+        if (served)
+            served[i] = (uint8_t)s;
+    }
+}
+
+void cache_hier_get_stats(const cache_hier_t *h, cache_hier_stats_t *out_stats) {
+    *out_stats = h->stats;
+}
+
+void cache_hier_stats_add(cache_hier_stats_t *dst, const cache_hier_stats_t *src) {
+    for (unsigned i = 0; i < CACHE_SIM_MAX_LEVELS; i++) {
+        dst->level[i].read_hits += src->level[i].read_hits;
+        dst->level[i].read_misses += src->level[i].read_misses;
+        dst->level[i].write_hits += src->level[i].write_hits;
+        dst->level[i].write_misses += src->level[i].write_misses;
+        dst->level[i].writebacks += src->level[i].writebacks;
+    }
+    dst->mem_reads += src->mem_reads;
+    dst->mem_writes += src->mem_writes;
+}
+
+int cache_repl_parse(const char *name, cache_repl_t *out) {
+    if (strcmp(name, "lru") == 0)       *out = CACHE_REPL_LRU;
+    else if (strcmp(name, "plru") == 0) *out = CACHE_REPL_PLRU;
+    else if (strcmp(name, "rrip") == 0) *out = CACHE_REPL_RRIP;
+    else return -1;
+    return 0;
+}
+
+const char *cache_repl_name(cache_repl_t repl) {
+    switch (repl) {
+    case CACHE_REPL_LRU:  return "lru";
+    case CACHE_REPL_PLRU: return "plru";
+    case CACHE_REPL_RRIP: return "rrip";
+    }
+    return "?";
+}
@@ -0,0 +1,775 @@
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L   /* fseeko/ftello */
+#include "ctrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char ctrace_magic[8]  = { 'M', 'S', 'C', 'T', 'R', 'A', 'C', 'E' };
+static const char ctrace_footer[8] = { 'M', 'S', 'C', 'T', 'I', 'D', 'X', '\0' };
+
+#define CT_FILE_HEADER   16
+#define CT_BLOCK_HEADER  40
+#define CT_INDEX_ENTRY   32
+#define CT_FOOTER        24
+#define CT_BLOCK_MAGIC   0x4b4c4243u   /* "CBLK" */
+
+/* Block codecs */
+#define CT_CODEC_RAW     0
+#define CT_CODEC_LZ      1
+
+/* Op byte: write and miss flags, log2 of the size (31 = varint size follows) */
+#define CT_OP_WRITE      0x80u
+#define CT_OP_MISS       0x40u
+#define CT_OP_SIZE_MASK  0x1fu
+#define CT_OP_SIZE_VAR   31u
+
+/* op byte + two 10-byte varints + 5-byte size varint */
+#define CT_MAX_EVENT_BYTES 26
+
+#define CT_IO_BUFFER     (1 << 20)
+
+/* LZ codec (LZ4 block layout: token, literals, 16-bit offset, match length) */
+#define LZ_HASH_BITS     13
+#define LZ_MIN_MATCH     4
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT      12
+#define LZ_MAX_OFFSET    65535
+
+typedef struct {
+    uint32_t  thread_id;
+    uint8_t  *raw;          /* encoded events of the open block */
+    size_t    raw_len;
+    uint32_t  n;
+    uint64_t  prev_ts;
+    uint64_t  prev_addr;
+    uint64_t  first_ts;
+} ct_stream_t;
+
+struct ctrace_writer {
+    FILE     *file;
+    char     *io_buf;
+    uint32_t  block_events;
+    unsigned  flags;
+    int       error;
+    uint64_t  offset;       /* bytes written so far */
+
+    /* thread id -> stream; linear probing, load <= 1/2 */
+    ct_stream_t **streams;
+    size_t    cap;
+    size_t    n_streams;
+    ct_stream_t *last;      /* stream of the previous event */
+
+    uint8_t  *lz_buf;
+    size_t    lz_cap;
+    uint32_t *lz_table;     /* hash -> position in the block */
+
+    ctrace_block_info_t *index;
+    size_t    n_blocks;
+    size_t    index_cap;
+};
+
+struct ctrace_reader {
+    FILE     *file;
+    uint32_t  block_events;
+    uint64_t  num_events;
+
+    ctrace_block_info_t *index;
+    size_t    n_blocks;
+
+    uint8_t  *stored;
+    size_t    stored_cap;
+    uint8_t  *raw;
+    size_t    raw_cap;
+};
+
+/* --- helpers --- */
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline void put_u64(uint8_t *p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t get_u64(const uint8_t *p) {
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static inline uint64_t zigzag(uint64_t cur, uint64_t prev) {
+    int64_t d = (int64_t)(cur - prev);
+    return ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t z) {
+    return (z >> 1) ^ (0 - (z & 1));
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/* Returns the position after the varint, or NULL if it runs past end */
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end,
+                                        uint64_t *out) {
+    uint64_t v = 0;
+    for (unsigned shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* log2 of a power-of-two size below 2^31; anything else takes the varint
+   escape (2^31 itself would collide with CT_OP_SIZE_VAR) */
+static inline uint8_t size_code(uint32_t size) {
+    if (size && !(size & (size - 1)) && size < (1u << CT_OP_SIZE_VAR))
+        return (uint8_t)__builtin_ctz(size);
+    return CT_OP_SIZE_VAR;
+}
+
+/* --- LZ codec --- */
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint8_t *lz_put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static inline size_t lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+/* Greedy single-probe compressor; each block starts with an empty table so
+   blocks stay independent. Returns the compressed size, or 0 if the output
+   would not be smaller than the input. */
+static size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst,
+                          uint32_t *pos) {
+    const uint8_t *ip = src, *anchor = src;
+    const uint8_t *end = src + n;
+    uint8_t *op = dst;
+    uint8_t *olimit = dst + n;      /* give up once we are not saving space */
+    memset(pos, 0xff, sizeof(uint32_t) << LZ_HASH_BITS);
+
+    if (n >= LZ_MF_LIMIT) {
+        const uint8_t *mflimit = end - LZ_MF_LIMIT;
+        const uint8_t *mlimit = end - LZ_LAST_LITERALS;
+
+        while (ip <= mflimit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+            uint32_t cand = pos[h];
+            uint32_t cur = (uint32_t)(ip - src);
+            pos[h] = cur;
+
+            if (cand == UINT32_MAX || cur - cand > LZ_MAX_OFFSET ||
+                read32(src + cand) != seq) {
+                ip++;
+                continue;
+            }
+
+            const uint8_t *ref = src + cand;
+            size_t mlen = LZ_MIN_MATCH;
+            while (ip + mlen < mlimit && ref[mlen] == ip[mlen])
+                mlen++;
+
+            size_t lit = (size_t)(ip - anchor);
+            if (op + 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1 > olimit)
+                return 0;
+
+            uint8_t *token = op++;
+            size_t ml = mlen - LZ_MIN_MATCH;
+            *token = (uint8_t)(((lit < 15 ? lit : 15) << 4) | (ml < 15 ? ml : 15));
+            if (lit >= 15)
+                op = lz_put_length(op, lit - 15);
+            memcpy(op, anchor, lit);
+            op += lit;
+            uint32_t off = cur - cand;
+            *op++ = (uint8_t)off;
+            *op++ = (uint8_t)(off >> 8);
+            if (ml >= 15)
+                op = lz_put_length(op, ml - 15);
+
+            ip += mlen;
+            anchor = ip;
+        }
+    }
+
+    /* last literals */
+    size_t lit = (size_t)(end - anchor);
+    if (op + 1 + lit / 255 + 1 + lit > olimit)
+        return 0;
+    *op++ = (uint8_t)((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15)
+        op = lz_put_length(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    return (size_t)(op - dst);
+}
+
+/* Returns the decompressed size, or -1 on malformed input */
+static long lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    const uint8_t *ip = src, *end = src + n;
+    uint8_t *op = dst, *oend = dst + cap;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= end) return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > (size_t)(end - ip) || lit > (size_t)(oend - op)) return -1;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        if (ip == end) break;       /* last sequence has no match */
+
+        if (end - ip < 2) return -1;
+        size_t off = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (off == 0 || off > (size_t)(op - dst)) return -1;
+
+        size_t mlen = token & 15;
+        if (mlen == 15) {
+            uint8_t b;
+            do {
+                if (ip >= end) return -1;
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ_MIN_MATCH;
+        if (mlen > (size_t)(oend - op)) return -1;
+
+        const uint8_t *ref = op - off;
+        for (size_t i = 0; i < mlen; i++)      /* may overlap */
+            op[i] = ref[i];
+        op += mlen;
+    }
+    return (long)(op - dst);
+}
+
+/* --- writer --- */
+
+static int ct_write(ctrace_writer_t *w, const void *p, size_t n) {
+    if (n && fwrite(p, 1, n, w->file) != n) {
+        w->error = 1;
+        return -1;
+    }
+    w->offset += n;
+    return 0;
+}
+
+static int ct_index_add(ctrace_writer_t *w, const ctrace_block_info_t *info) {
+    if (w->n_blocks == w->index_cap) {
+        size_t cap = w->index_cap ? w->index_cap * 2 : 256;
+        ctrace_block_info_t *idx = (ctrace_block_info_t *)
+            realloc(w->index, cap * sizeof(*idx));
+        if (!idx) return -1;
+        w->index = idx;
+        w->index_cap = cap;
+    }
+    w->index[w->n_blocks++] = *info;
+    return 0;
+}
+
+static int ct_write_block(ctrace_writer_t *w, ct_stream_t *s) {
+    if (s->n == 0) return 0;
+
+    const uint8_t *payload = s->raw;
+    size_t stored = s->raw_len;
+    uint32_t codec = CT_CODEC_RAW;
+
+    if (w->flags & CTRACE_COMPRESS) {
+        size_t c = lz_compress(s->raw, s->raw_len, w->lz_buf, w->lz_table);
+        if (c) {
+            payload = w->lz_buf;
+            stored = c;
+            codec = CT_CODEC_LZ;
+        }
+    }
+
+    ctrace_block_info_t info;
+    info.offset = w->offset;
+    info.thread_id = s->thread_id;
+    info.n_events = s->n;
+    info.first_timestamp = s->first_ts;
+    info.last_timestamp = s->prev_ts;
+
+    uint8_t hdr[CT_BLOCK_HEADER];
+    put_u32(hdr, CT_BLOCK_MAGIC);
+    put_u32(hdr + 4, s->thread_id);
+    put_u32(hdr + 8, s->n);
+    put_u32(hdr + 12, codec);
+    put_u32(hdr + 16, (uint32_t)s->raw_len);
+    put_u32(hdr + 20, (uint32_t)stored);
+    put_u64(hdr + 24, info.first_timestamp);
+    put_u64(hdr + 32, info.last_timestamp);
+
+    s->n = 0;
+    s->raw_len = 0;
+
+    if (ct_write(w, hdr, sizeof(hdr)) || ct_write(w, payload, stored))
+        return -1;
+    if (ct_index_add(w, &info)) {
+        w->error = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static inline size_t ct_slot(uint32_t tid, size_t cap) {
+    return (size_t)((tid * 2654435761u) & (uint32_t)(cap - 1));
+}
+
+static int ct_table_grow(ctrace_writer_t *w) {
+    size_t cap = w->cap ? w->cap * 2 : 64;
+    ct_stream_t **t = (ct_stream_t **)calloc(cap, sizeof(*t));
+    if (!t) return -1;
+
+    for (size_t i = 0; i < w->cap; i++) {
+        ct_stream_t *s = w->streams[i];
+        if (!s) continue;
+        size_t j = ct_slot(s->thread_id, cap);
+        while (t[j]) j = (j + 1) & (cap - 1);
+        t[j] = s;
+    }
+    free(w->streams);
+    w->streams = t;
+    w->cap = cap;
+    return 0;
+}
+
+static ct_stream_t *ct_stream(ctrace_writer_t *w, uint32_t tid) {
+    if (w->last && w->last->thread_id == tid)
+        return w->last;
+
+    size_t i = ct_slot(tid, w->cap);
+    while (w->streams[i]) {
+        if (w->streams[i]->thread_id == tid)
+            return w->last = w->streams[i];
+        i = (i + 1) & (w->cap - 1);
+    }
+
+    if ((w->n_streams + 1) * 2 > w->cap) {
+        if (ct_table_grow(w)) return NULL;
+        i = ct_slot(tid, w->cap);
+        while (w->streams[i]) i = (i + 1) & (w->cap - 1);
+    }
+
+    ct_stream_t *s = (ct_stream_t *)calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->raw = (uint8_t *)malloc((size_t)w->block_events * CT_MAX_EVENT_BYTES);
+    if (!s->raw) {
+        free(s);
+        return NULL;
+    }
+    s->thread_id = tid;
+
+    w->streams[i] = s;
+    w->n_streams++;
+    return w->last = s;
+}
+
+/* --- reader --- */
+
+static int ct_read_at(FILE *f, uint64_t off, void *p, size_t n) {
+    if (fseeko(f, (off_t)off, SEEK_SET)) return -1;
+    return fread(p, 1, n, f) == n ? 0 : -1;
+}
+
+static int ct_reserve(uint8_t **buf, size_t *cap, size_t n) {
+    if (n <= *cap) return 0;
+    uint8_t *p = (uint8_t *)realloc(*buf, n);
+    if (!p) return -1;
+    *buf = p;
+    *cap = n;
+    return 0;
+}
+
+static int ct_load_index(ctrace_reader_t *r, uint64_t file_size) {
+    uint8_t foot[CT_FOOTER];
+
+    if (file_size < CT_FILE_HEADER + CT_FOOTER ||
+        ct_read_at(r->file, file_size - CT_FOOTER, foot, sizeof(foot)) ||
+        memcmp(foot + 16, ctrace_footer, sizeof(ctrace_footer)))
+        return -1;
+
+    uint64_t off = get_u64(foot);
+    uint64_t n = get_u64(foot + 8);
+    if (off < CT_FILE_HEADER || off > file_size - CT_FOOTER ||
+        n != (file_size - CT_FOOTER - off) / CT_INDEX_ENTRY)
+        return -1;
+
+    uint8_t *buf = (uint8_t *)malloc(n ? n * CT_INDEX_ENTRY : 1);
+    r->index = (ctrace_block_info_t *)malloc(n ? n * sizeof(*r->index) : 1);
+    if (!buf || !r->index || ct_read_at(r->file, off, buf, n * CT_INDEX_ENTRY)) {
+        free(buf);
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        const uint8_t *e = buf + i * CT_INDEX_ENTRY;
+        r->index[i].offset = get_u64(e);
+        r->index[i].thread_id = get_u32(e + 8);
+        r->index[i].n_events = get_u32(e + 12);
+        r->index[i].first_timestamp = get_u64(e + 16);
+        r->index[i].last_timestamp = get_u64(e + 24);
+    }
+    r->n_blocks = (size_t)n;
+    free(buf);
+    return 0;
+}
+
+/* No footer: walk the block headers up to the first incomplete block */
+static int ct_scan_index(ctrace_reader_t *r, uint64_t file_size) {
+    uint64_t off = CT_FILE_HEADER;
+    size_t cap = 0;
+
+    free(r->index);
+    r->index = NULL;
+    r->n_blocks = 0;
+
+    while (off + CT_BLOCK_HEADER <= file_size) {
+        uint8_t hdr[CT_BLOCK_HEADER];
+        if (ct_read_at(r->file, off, hdr, sizeof(hdr))) break;
+
+        /* stops at the index, or at a block cut short by the crash */
+        uint32_t stored = get_u32(hdr + 20);
+        if (get_u32(hdr) != CT_BLOCK_MAGIC || get_u32(hdr + 8) > r->block_events ||
+            off + CT_BLOCK_HEADER + stored > file_size)
+            break;
+
+        if (r->n_blocks == cap) {
+            cap = cap ? cap * 2 : 256;
+            ctrace_block_info_t *idx = (ctrace_block_info_t *)
+                realloc(r->index, cap * sizeof(*idx));
+            if (!idx) return -1;
+            r->index = idx;
+        }
+        ctrace_block_info_t *b = &r->index[r->n_blocks++];
+        b->offset = off;
+        b->thread_id = get_u32(hdr + 4);
+        b->n_events = get_u32(hdr + 8);
+        b->first_timestamp = get_u64(hdr + 24);
+        b->last_timestamp = get_u64(hdr + 32);
+
+        off += CT_BLOCK_HEADER + stored;
+    }
+    return 0;
+}
+
+/* --- API --- */
+
+ctrace_writer_t *ctrace_writer_create(const char *filename,
+                                      uint32_t block_events, unsigned flags) {
+    if (block_events == 0) block_events = CTRACE_DEFAULT_BLOCK_EVENTS;
+    if (block_events > CTRACE_MAX_BLOCK_EVENTS) block_events = CTRACE_MAX_BLOCK_EVENTS;
+
+    ctrace_writer_t *w = (ctrace_writer_t *)calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->block_events = block_events;
+    w->flags = flags;
+
+    w->io_buf = (char *)malloc(CT_IO_BUFFER);
+    if (flags & CTRACE_COMPRESS) {
+        w->lz_cap = lz_bound((size_t)block_events * CT_MAX_EVENT_BYTES);
+        w->lz_buf = (uint8_t *)malloc(w->lz_cap);
+        w->lz_table = (uint32_t *)malloc(sizeof(uint32_t) << LZ_HASH_BITS);
+    }
+    if (!w->io_buf || ct_table_grow(w) ||
+        ((flags & CTRACE_COMPRESS) && (!w->lz_buf || !w->lz_table)))
+        goto fail;
+
+    w->file = fopen(filename, "wb");
+    if (!w->file) goto fail;
+    setvbuf(w->file, w->io_buf, _IOFBF, CT_IO_BUFFER);
+
+    uint8_t hdr[CT_FILE_HEADER];
+    memcpy(hdr, ctrace_magic, sizeof(ctrace_magic));
+    put_u32(hdr + 8, CTRACE_VERSION);
+    put_u32(hdr + 12, block_events);
+    if (ct_write(w, hdr, sizeof(hdr))) {
+        fclose(w->file);
+        goto fail;
+    }
+    return w;
+
+fail:
+    free(w->streams);
+    free(w->lz_buf);
+    free(w->lz_table);
+    free(w->io_buf);
+    free(w);
+    return NULL;
+}
+
+int ctrace_write_event(ctrace_writer_t *w, const ctrace_event_t *ev) {
+    if (!w || !ev) return -1;
+
+    ct_stream_t *s = ct_stream(w, ev->thread_id);
+    if (!s) {
+        w->error = 1;
+        return -1;
+    }
+
+    if (s->n == 0) {
+        /* deltas restart at every block */
+        s->prev_ts = 0;
+        s->prev_addr = 0;
+        s->first_ts = ev->timestamp;
+    }
+
+    uint8_t *p = s->raw + s->raw_len;
+    uint8_t code = size_code(ev->size);
+    *p++ = (uint8_t)((ev->is_write ? CT_OP_WRITE : 0) |
+                     (ev->is_miss ? CT_OP_MISS : 0) | code);
+    p = put_varint(p, zigzag(ev->timestamp, s->prev_ts));
+    p = put_varint(p, zigzag(ev->address, s->prev_addr));
+    if (code == CT_OP_SIZE_VAR)
+        p = put_varint(p, ev->size);
+
+    s->raw_len = (size_t)(p - s->raw);
+    s->prev_ts = ev->timestamp;
+    s->prev_addr = ev->address;
+
+    if (++s->n == w->block_events)
+        return ct_write_block(w, s);
+    return w->error ? -1 : 0;
+}
+
+int ctrace_write_events(ctrace_writer_t *w, const ctrace_event_t *evs, size_t n) {
+    int rc = 0;
+    for (size_t i = 0; i < n; i++)
+        rc |= ctrace_write_event(w, &evs[i]);
+    return rc ? -1 : 0;
+}
+
+int ctrace_writer_flush(ctrace_writer_t *w) {
+    if (!w) return -1;
+
+    for (size_t i = 0; i < w->cap; i++) {
+        if (w->streams[i])
+            ct_write_block(w, w->streams[i]);
+    }
+    if (fflush(w->file))
+        w->error = 1;
+    return w->error ? -1 : 0;
+}
+
+int ctrace_writer_close(ctrace_writer_t *w) {
+    if (!w) return -1;
+
+    ctrace_writer_flush(w);
+
+    /* index + footer */
+    uint64_t index_off = w->offset;
+    for (size_t i = 0; i < w->n_blocks && !w->error; i++) {
+        const ctrace_block_info_t *b = &w->index[i];
+        uint8_t e[CT_INDEX_ENTRY];
+        put_u64(e, b->offset);
+        put_u32(e + 8, b->thread_id);
+        put_u32(e + 12, b->n_events);
+        put_u64(e + 16, b->first_timestamp);
+        put_u64(e + 24, b->last_timestamp);
+        ct_write(w, e, sizeof(e));
+    }
+    uint8_t foot[CT_FOOTER];
+    put_u64(foot, index_off);
+    put_u64(foot + 8, w->n_blocks);
+    memcpy(foot + 16, ctrace_footer, sizeof(ctrace_footer));
+    if (!w->error)
+        ct_write(w, foot, sizeof(foot));
+
+    if (fclose(w->file))
+        w->error = 1;
+
+    int rc = w->error ? -1 : 0;
+    for (size_t i = 0; i < w->cap; i++) {
+        if (w->streams[i]) {
+            free(w->streams[i]->raw);
+            free(w->streams[i]);
+        }
+    }
+    free(w->streams);
+    free(w->index);
+    free(w->lz_buf);
+    free(w->lz_table);
+    free(w->io_buf);
+    free(w);
+    return rc;
+}
+
+ctrace_reader_t *ctrace_reader_open(const char *filename) {
+    ctrace_reader_t *r = (ctrace_reader_t *)calloc(1, sizeof(*r));
+    if (!r) return NULL;
+
+    r->file = fopen(filename, "rb");
+    if (!r->file) {
+        free(r);
+        return NULL;
+    }
+
+    uint8_t hdr[CT_FILE_HEADER];
+    if (fread(hdr, 1, sizeof(hdr), r->file) != sizeof(hdr) ||
+        memcmp(hdr, ctrace_magic, sizeof(ctrace_magic)) ||
+        get_u32(hdr + 8) != CTRACE_VERSION)
+        goto fail;
+    r->block_events = get_u32(hdr + 12);
+    if (r->block_events == 0 || r->block_events > CTRACE_MAX_BLOCK_EVENTS)
+        goto fail;
+
+    if (fseeko(r->file, 0, SEEK_END)) goto fail;
+    uint64_t file_size = (uint64_t)ftello(r->file);
+
+    if (ct_load_index(r, file_size) && ct_scan_index(r, file_size))
+        goto fail;
+
+    for (size_t i = 0; i < r->n_blocks; i++)
+        r->num_events += r->index[i].n_events;
+    return r;
+
+fail:
+    fclose(r->file);
+    free(r->index);
+    free(r);
+    return NULL;
+}
+
+void ctrace_reader_close(ctrace_reader_t *r) {
+    if (!r) return;
+    fclose(r->file);
+    free(r->index);
+    free(r->stored);
+    free(r->raw);
+    free(r);
+}
+
+uint32_t ctrace_reader_block_events(const ctrace_reader_t *r) {
+    return r ? r->block_events : 0;
+}
+
+size_t ctrace_reader_num_blocks(const ctrace_reader_t *r) {
+    return r ? r->n_blocks : 0;
+}
+
+uint64_t ctrace_reader_num_events(const ctrace_reader_t *r) {
+    return r ? r->num_events : 0;
+}
+
+int ctrace_reader_block_info(const ctrace_reader_t *r, size_t block,
+                             ctrace_block_info_t *out) {
+    if (!r || !out || block >= r->n_blocks) return -1;
+    *out = r->index[block];
+    return 0;
+}
+
+size_t ctrace_reader_find_block(const ctrace_reader_t *r, size_t from,
+                                uint32_t thread_id, uint64_t timestamp) {
+    if (!r) return 0;
+    for (size_t i = from; i < r->n_blocks; i++) {
+        const ctrace_block_info_t *b = &r->index[i];
+        if ((thread_id == CTRACE_ANY_THREAD || b->thread_id == thread_id) &&
+            b->last_timestamp >= timestamp)
+            return i;
+    }
+    return r->n_blocks;
+}
+
+int ctrace_reader_read_block(ctrace_reader_t *r, size_t block,
+                             ctrace_event_t *out) {
+    if (!r || !out || block >= r->n_blocks) return -1;
+
+    uint8_t hdr[CT_BLOCK_HEADER];
+    if (ct_read_at(r->file, r->index[block].offset, hdr, sizeof(hdr)))
+        return -1;
+
+    uint32_t tid = get_u32(hdr + 4);
+    uint32_t n = get_u32(hdr + 8);
+    uint32_t codec = get_u32(hdr + 12);
+    uint32_t raw_len = get_u32(hdr + 16);
+    uint32_t stored = get_u32(hdr + 20);
+    if (get_u32(hdr) != CT_BLOCK_MAGIC || n > r->block_events ||
+        raw_len > (uint64_t)r->block_events * CT_MAX_EVENT_BYTES)
+        return -1;
+
+    if (ct_reserve(&r->stored, &r->stored_cap, stored ? stored : 1) ||
+        fread(r->stored, 1, stored, r->file) != stored)
+        return -1;
+
+    const uint8_t *p;
+    if (codec == CT_CODEC_RAW) {
+        if (stored != raw_len) return -1;
+        p = r->stored;
+    } else if (codec == CT_CODEC_LZ) {
+        if (ct_reserve(&r->raw, &r->raw_cap, raw_len ? raw_len : 1) ||
+            lz_decompress(r->stored, stored, r->raw, raw_len) != (long)raw_len)
+            return -1;
+        p = r->raw;
+    } else {
+        return -1;
+    }
+
+    const uint8_t *end = p + raw_len;
+    uint64_t ts = 0, addr = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t dts, daddr, size;
+        if (p >= end) return -1;
+        uint8_t op = *p++;
+        if (!(p = get_varint(p, end, &dts)) || !(p = get_varint(p, end, &daddr)))
+            return -1;
+
+        uint8_t code = op & CT_OP_SIZE_MASK;
+        if (code == CT_OP_SIZE_VAR) {
+            if (!(p = get_varint(p, end, &size))) return -1;
+        } else {
+            size = (uint64_t)1 << code;
+        }
+
+        ts += unzigzag(dts);
+        addr += unzigzag(daddr);
+        out[i].timestamp = ts;
+        out[i].address = addr;
+        out[i].thread_id = tid;
+        out[i].size = (uint32_t)size;
+        out[i].is_write = (op & CT_OP_WRITE) != 0;
+        out[i].is_miss = (op & CT_OP_MISS) != 0;
+    }
+    return p == end ? (int)n : -1;
+}
@@ -6,19 +6,237 @@
 #include <stdio.h>
 
 #include "MurmurHash3.h"
+#include "hash64.h"
 #include "hll.h"
 
-static __inline uint8_t _hll_rank(uint32_t hash, uint8_t bits) {
-	uint8_t i;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HLL_X86_SIMD 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define HLL_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * Register kernels.
+ *
+ * Every register contributes 2^-r to the harmonic sum. For any sketch built
+ * by hll_add() the ranks are <= 29 and there are at most 2^20 registers, so
+ * every partial sum is a multiple of 2^-29 below 2^20 and is represented
+ * exactly in a double: summation order does not matter and the SIMD kernels
+ * return bit-identical results to the scalar loop.
+ */
+typedef double (*_hll_sum_fn)(const uint8_t *regs, size_t n, uint32_t *zeros);
+typedef void (*_hll_max_fn)(uint8_t *dst, const uint8_t *src, size_t n);
+
+static double _hll_inv_pow2[256];   /* 2^-r lookup table */
+
+static double _hll_sum_scalar(const uint8_t *regs, size_t n, uint32_t *zeros) {
+	double sum = 0;
+	uint32_t z = 0;
+	size_t i;
 
-	for(i = 1; i <= 32 - bits; i++) {
-		if(hash & 1)
-			break;
+	for(i = 0; i < n; i++) {
+		sum += _hll_inv_pow2[regs[i]];
+		z += (regs[i] == 0);
+	}
+
+	*zeros = z;
+	return sum;
+}
+
+static void _hll_max_scalar(uint8_t *dst, const uint8_t *src, size_t n) {
+	size_t i;
+
+	for(i = 0; i < n; i++) {
+		if(src[i] > dst[i])
+			dst[i] = src[i];
+	}
+}
+
+#ifdef HLL_X86_SIMD
+/* Builds 2^-r directly in the exponent field: (1023 - r) << 52. */
+static double _hll_sum_sse2(const uint8_t *regs, size_t n, uint32_t *zeros) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi64x(1023);
+	__m128d acc = _mm_setzero_pd();
+	uint32_t z = 0;
+	size_t i = 0;
+
+	for(; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(regs + i));
+		z += (uint32_t)__builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)));
+
+		__m128i w16[2] = { _mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero) };
+		for(int h = 0; h < 2; h++) {
+			__m128i w32[2] = { _mm_unpacklo_epi16(w16[h], zero), _mm_unpackhi_epi16(w16[h], zero) };
+			for(int q = 0; q < 2; q++) {
+				__m128i lo = _mm_unpacklo_epi32(w32[q], zero);
+				__m128i hi = _mm_unpackhi_epi32(w32[q], zero);
+				acc = _mm_add_pd(acc, _mm_castsi128_pd(_mm_slli_epi64(_mm_sub_epi64(bias, lo), 52)));
+				acc = _mm_add_pd(acc, _mm_castsi128_pd(_mm_slli_epi64(_mm_sub_epi64(bias, hi), 52)));
+			}
+		}
+	}
+
+	double lanes[2];
+	_mm_storeu_pd(lanes, acc);
+	double sum = lanes[0] + lanes[1];
+
+	uint32_t tail_zeros;
+	sum += _hll_sum_scalar(regs + i, n - i, &tail_zeros);
+	*zeros = z + tail_zeros;
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static double _hll_sum_avx2(const uint8_t *regs, size_t n, uint32_t *zeros) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i bias = _mm256_set1_epi64x(1023);
+	__m256d acc0 = _mm256_setzero_pd();
+	__m256d acc1 = _mm256_setzero_pd();
+	uint32_t z = 0;
+	size_t i = 0;
+
+	for(; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(regs + i));
+		z += (uint32_t)__builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)));
+
+		for(int k = 0; k < 32; k += 8) {
+			__m128i b = _mm_loadl_epi64((const __m128i *)(regs + i + k));
+			__m256i r0 = _mm256_cvtepu8_epi64(b);
+			__m256i r1 = _mm256_cvtepu8_epi64(_mm_srli_si128(b, 4));
+			acc0 = _mm256_add_pd(acc0, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, r0), 52)));
+			acc1 = _mm256_add_pd(acc1, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, r1), 52)));
+		}
+	}
+
+	__m256d acc = _mm256_add_pd(acc0, acc1);
+	__m128d s2 = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+	double sum = _mm_cvtsd_f64(_mm_add_sd(s2, _mm_unpackhi_pd(s2, s2)));
+
+	uint32_t tail_zeros;
+	sum += _hll_sum_scalar(regs + i, n - i, &tail_zeros);
+	*zeros = z + tail_zeros;
+	return sum;
+}
+
+static void _hll_max_sse2(uint8_t *dst, const uint8_t *src, size_t n) {
+	size_t i = 0;
+
+	for(; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_max_epu8(a, b));
+	}
+	_hll_max_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void _hll_max_avx2(uint8_t *dst, const uint8_t *src, size_t n) {
+	size_t i = 0;
+
+	for(; i + 32 <= n; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_max_epu8(a, b));
+	}
+	_hll_max_sse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void _hll_max_avx512(uint8_t *dst, const uint8_t *src, size_t n) {
+	size_t i = 0;
+
+	for(; i + 64 <= n; i += 64) {
+		__m512i a = _mm512_loadu_si512((const void *)(dst + i));
+		__m512i b = _mm512_loadu_si512((const void *)(src + i));
+		_mm512_storeu_si512((void *)(dst + i), _mm512_max_epu8(a, b));
+	}
+	_hll_max_sse2(dst + i, src + i, n - i);
+}
+#endif /* HLL_X86_SIMD */
 
-		hash >>= 1;
+#ifdef HLL_NEON
+static void _hll_max_neon(uint8_t *dst, const uint8_t *src, size_t n) {
+	size_t i = 0;
+
+	for(; i + 16 <= n; i += 16)
+		vst1q_u8(dst + i, vmaxq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+	_hll_max_scalar(dst + i, src + i, n - i);
+}
+#endif /* HLL_NEON */
+
+static _hll_sum_fn _hll_sum_impl = NULL;
+static _hll_max_fn _hll_max_impl = NULL;
+
+/* Picks kernels once, on first use; racing initializers store the same values. */
+static void _hll_dispatch_init(void) {
+	_hll_sum_fn sum_fn = _hll_sum_scalar;
+	_hll_max_fn max_fn = _hll_max_scalar;
+	int r;
+
+	for(r = 0; r < 256; r++)
+		_hll_inv_pow2[r] = ldexp(1.0, -r);
+
+#ifdef HLL_X86_SIMD
+	__builtin_cpu_init();
+	sum_fn = _hll_sum_sse2;
+	max_fn = _hll_max_sse2;
+	if(__builtin_cpu_supports("avx2")) {
+		sum_fn = _hll_sum_avx2;
+		max_fn = _hll_max_avx2;
+	}
+	if(__builtin_cpu_supports("avx512bw"))
+		max_fn = _hll_max_avx512;
+#elif defined(HLL_NEON)
+	max_fn = _hll_max_neon;
+#endif
+
+	__atomic_store_n(&_hll_sum_impl, sum_fn, __ATOMIC_RELEASE);
+	__atomic_store_n(&_hll_max_impl, max_fn, __ATOMIC_RELEASE);
+}
+
+double hll_registers_sum(const uint8_t *registers, size_t n, uint32_t *zeros) {
+	_hll_sum_fn fn = __atomic_load_n(&_hll_sum_impl, __ATOMIC_ACQUIRE);
+
+	if(!fn) {
+		_hll_dispatch_init();
+		fn = _hll_sum_impl;
+	}
+	return fn(registers, n, zeros);
+}
+
+void hll_registers_max(uint8_t *dst, const uint8_t *src, size_t n) {
+	_hll_max_fn fn = __atomic_load_n(&_hll_max_impl, __ATOMIC_ACQUIRE);
+
+	if(!fn) {
+		_hll_dispatch_init();
+		fn = _hll_max_impl;
 	}
+	fn(dst, src, n);
+}
+
+double hll_registers_sum_scalar(const uint8_t *registers, size_t n, uint32_t *zeros) {
+	if(!__atomic_load_n(&_hll_sum_impl, __ATOMIC_ACQUIRE))
+		_hll_dispatch_init();   /* fills the 2^-r table */
+	return _hll_sum_scalar(registers, n, zeros);
+}
+
+void hll_registers_max_scalar(uint8_t *dst, const uint8_t *src, size_t n) {
+	_hll_max_scalar(dst, src, n);
+}
+
+static __inline uint8_t _hll_rank(uint32_t hash, uint8_t bits) {
+	/* 1 + trailing zeros, capped at 33 - bits */
+	uint8_t max = (uint8_t)(33 - bits);
+	uint8_t r;
+
+	if(hash == 0)
+		return max;
 
-	return i;
+	r = (uint8_t)(__builtin_ctz(hash) + 1);
+	return r < max ? r : max;
 }
 
 int hll_init(struct HLL *hll, uint8_t bits) {
@@ -55,9 +273,29 @@ void hll_add(struct HLL *hll, const void *buf, size_t size) {
 	_hll_add_hash(hll, hash);
 }
 
+void hll_add_u64(struct HLL *hll, uint64_t key) {
+	_hll_add_hash(hll, (uint32_t)hash64_u64(key, HASH64_SEED));
+}
+
+#define HLL_BATCH	64
+
+void hll_add_u64_batch(struct HLL *hll, const uint64_t *keys, size_t n) {
+	uint64_t hash[HLL_BATCH];
+	size_t i, k;
+
+	while(n) {
+		k = n < HLL_BATCH ? n : HLL_BATCH;
+		hash64_u64_batch(keys, hash, k, HASH64_SEED);
+		for(i = 0; i < k; i++)
+			_hll_add_hash(hll, (uint32_t)hash[i]);
+
+		keys += k;
+		n -= k;
+	}
+}
+
 double hll_count(const struct HLL *hll) {
 	double alpha_mm;
-	uint32_t i;
 
 	switch (hll->bits) {
 		case 4:
@@ -76,19 +314,12 @@ double hll_count(const struct HLL *hll) {
 
 	alpha_mm *= ((double)hll->size * (double)hll->size);
 
-	double sum = 0;
-	for(i = 0; i < hll->size; i++) {
-		sum += 1.0 / (1 << hll->registers[i]);
-	}
+	uint32_t zeros;
+	double sum = hll_registers_sum(hll->registers, hll->size, &zeros);
 
 	double estimate = alpha_mm / sum;
 
 	if (estimate <= 5.0 / 2.0 * (double)hll->size) {
-		int zeros = 0;
-
-		for(i = 0; i < hll->size; i++)
-			zeros += (hll->registers[i] == 0);
-
 		if(zeros)
 			estimate = (double)hll->size * log((double)hll->size / zeros);
 
@@ -100,17 +331,12 @@ double hll_count(const struct HLL *hll) {
 }
 
 int hll_merge(struct HLL *dst, const struct HLL *src) {
-	uint32_t i;
-
 	if(dst->bits != src->bits) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	for(i = 0; i < dst->size; i++) {
-		if(src->registers[i] > dst->registers[i])
-			dst->registers[i] = src->registers[i];
-	}
+	hll_registers_max(dst->registers, src->registers, dst->size);
 
 	return 0;
 }
@@ -0,0 +1,412 @@
+
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include "MurmurHash3.h"
+#include "hash64.h"
+#include "hll.h"
+#include "hllpp.h"
+
+/*
+ * Sparse entries are (idx' << 6) | rank', where idx' is the top 25 bits of
+ * the hash and rank' the position of the first set bit in the remaining 39
+ * (at most 40), so sorting entries groups them by index with the largest
+ * rank last.
+ */
+#define SPARSE_RANK_BITS	6
+#define SPARSE_RANK_MASK	((1u << SPARSE_RANK_BITS) - 1)
+
+static const uint8_t hllpp_magic[4] = { 'H', 'L', 'P', 'P' };
+#define HLLPP_VERSION		1
+#define HLLPP_HEADER_SIZE	12
+
+static __inline uint8_t _hllpp_rank(uint64_t w, uint8_t width) {
+	/* 1-based position of the first set bit in the top 'width' bits of w */
+	if(w == 0)
+		return (uint8_t)(width + 1);
+
+	uint8_t r = (uint8_t)(__builtin_clzll(w) + 1);
+	return r > width + 1 ? (uint8_t)(width + 1) : r;
+}
+
+static __inline uint32_t _hllpp_sparse_entry(uint64_t hash) {
+	uint32_t idx = (uint32_t)(hash >> (64 - HLLPP_SPARSE_P));
+	uint8_t rank = _hllpp_rank(hash << HLLPP_SPARSE_P, 64 - HLLPP_SPARSE_P);
+
+	return (idx << SPARSE_RANK_BITS) | rank;
+}
+
+/* Dense register index and rank encoded by a sparse entry. */
+static __inline void _hllpp_decode(const hllpp_t *h, uint32_t entry,
+				   uint32_t *index, uint8_t *rank) {
+	uint32_t idx = entry >> SPARSE_RANK_BITS;
+	uint8_t shift = HLLPP_SPARSE_P - h->p;
+	uint32_t low = idx & ((1u << shift) - 1);
+
+	*index = idx >> shift;
+	if(low)
+		*rank = (uint8_t)(shift - (32 - __builtin_clz(low)) + 1);
+	else
+		*rank = (uint8_t)(shift + (entry & SPARSE_RANK_MASK));
+}
+
+static int _hllpp_cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Sort the insert buffer and merge it into the sparse list, keeping the
+   largest rank per index. Merges back to front so no scratch is needed. */
+static int _hllpp_fold(hllpp_t *h) {
+	size_t n = h->sparse_n, t = h->tmp_n;
+
+	if(t == 0)
+		return 0;
+
+	if(n + t > h->sparse_cap) {
+		size_t cap = h->sparse_cap ? h->sparse_cap : 64;
+		while(cap < n + t)
+			cap <<= 1;
+
+		uint32_t *s = realloc(h->sparse, cap * sizeof(uint32_t));
+		if(!s)
+			return -1;
+
+		h->sparse = s;
+		h->sparse_cap = cap;
+	}
+
+	qsort(h->tmp, t, sizeof(uint32_t), _hllpp_cmp_u32);
+
+	size_t k = n + t;
+	size_t i = n, j = t;
+	uint32_t last_idx = UINT32_MAX;
+
+	while(i > 0 || j > 0) {
+		uint32_t e;
+
+		if(j == 0 || (i > 0 && h->sparse[i - 1] > h->tmp[j - 1]))
+			e = h->sparse[--i];
+		else
+			e = h->tmp[--j];
+
+		/* walking backwards, the first entry of an index has the max rank */
+		if((e >> SPARSE_RANK_BITS) == last_idx)
+			continue;
+
+		last_idx = e >> SPARSE_RANK_BITS;
+		h->sparse[--k] = e;
+	}
+
+	h->sparse_n = n + t - k;
+	memmove(h->sparse, h->sparse + k, h->sparse_n * sizeof(uint32_t));
+	h->tmp_n = 0;
+
+	return 0;
+}
+
+static int _hllpp_to_dense(hllpp_t *h) {
+	size_t i;
+
+	if(h->dense)
+		return 0;
+
+	if(_hllpp_fold(h) == -1)
+		return -1;
+
+	if(!h->registers) {
+		h->registers = calloc(h->m, 1);
+		if(!h->registers)
+			return -1;
+	} else {
+		memset(h->registers, 0, h->m);
+	}
+
+	for(i = 0; i < h->sparse_n; i++) {
+		uint32_t index;
+		uint8_t rank;
+
+		_hllpp_decode(h, h->sparse[i], &index, &rank);
+		if(rank > h->registers[index])
+			h->registers[index] = rank;
+	}
+
+	h->sparse_n = 0;
+	h->dense = 1;
+
+	return 0;
+}
+
+static void _hllpp_insert_entry(hllpp_t *h, uint32_t entry) {
+	if(h->dense) {
+		uint32_t index;
+		uint8_t rank;
+
+		_hllpp_decode(h, entry, &index, &rank);
+		if(rank > h->registers[index])
+			h->registers[index] = rank;
+		return;
+	}
+
+	h->tmp[h->tmp_n++] = entry;
+	if(h->tmp_n < h->tmp_cap)
+		return;
+
+	/* 4-byte entries: past m/4 of them the dense form is smaller */
+	if(_hllpp_fold(h) == -1 || h->sparse_n > h->m / 4)
+		_hllpp_to_dense(h);
+}
+
+int hllpp_init(hllpp_t *h, uint8_t p) {
+	if(p < HLLPP_MIN_P || p > HLLPP_MAX_P) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	memset(h, 0, sizeof(*h));
+	h->p = p;
+	h->m = (size_t)1 << p;
+	h->tmp_cap = h->m / 16 > 16 ? h->m / 16 : 16;
+	h->tmp = malloc(h->tmp_cap * sizeof(uint32_t));
+	if(!h->tmp)
+		return -1;
+
+	return 0;
+}
+
+void hllpp_destroy(hllpp_t *h) {
+	free(h->registers);
+	free(h->sparse);
+	free(h->tmp);
+
+	h->registers = NULL;
+	h->sparse = NULL;
+	h->tmp = NULL;
+}
+
+void hllpp_reset(hllpp_t *h) {
+	h->dense = 0;
+	h->sparse_n = 0;
+	h->tmp_n = 0;
+}
+
+void hllpp_add_hash(hllpp_t *h, uint64_t hash) {
+	if(h->dense) {
+		uint32_t index = (uint32_t)(hash >> (64 - h->p));
+		uint8_t rank = _hllpp_rank(hash << h->p, (uint8_t)(64 - h->p));
+
+		if(rank > h->registers[index])
+			h->registers[index] = rank;
+		return;
+	}
+
+	_hllpp_insert_entry(h, _hllpp_sparse_entry(hash));
+}
+
+void hllpp_add(hllpp_t *h, const void *buf, size_t size) {
+	uint64_t hash[2];
+
+	MurmurHash3_x64_128(buf, (uint32_t)size, 0x5f61767a, hash);
+	hllpp_add_hash(h, hash[0]);
+}
+
+void hllpp_add_u64(hllpp_t *h, uint64_t key) {
+	hllpp_add_hash(h, hash64_u64(key, HASH64_SEED));
+}
+
+#define HLLPP_BATCH	64
+
+void hllpp_add_u64_batch(hllpp_t *h, const uint64_t *keys, size_t n) {
+	uint64_t hash[HLLPP_BATCH];
+	size_t i, k;
+
+	while(n) {
+		k = n < HLLPP_BATCH ? n : HLLPP_BATCH;
+		hash64_u64_batch(keys, hash, k, HASH64_SEED);
+		for(i = 0; i < k; i++)
+			hllpp_add_hash(h, hash[i]);
+
+		keys += k;
+		n -= k;
+	}
+}
+
+static double _hllpp_sigma(double x) {
+	if(x == 1.0)
+		return INFINITY;
+
+	double y = 1.0, z = x, zp;
+	do {
+		x *= x;
+		zp = z;
+		z += x * y;
+		y += y;
+	} while(z != zp);
+
+	return z;
+}
+
+static double _hllpp_tau(double x) {
+	if(x == 0.0 || x == 1.0)
+		return 0.0;
+
+	double y = 1.0, z = 1.0 - x, zp;
+	do {
+		x = sqrt(x);
+		zp = z;
+		y *= 0.5;
+		z -= (1.0 - x) * (1.0 - x) * y;
+	} while(z != zp);
+
+	return z / 3.0;
+}
+
+double hllpp_count(hllpp_t *h) {
+	if(!h->dense) {
+		const double ms = (double)(1u << HLLPP_SPARSE_P);
+
+		if(_hllpp_fold(h) == -1)
+			return 0.0;
+		return ms * log(ms / (ms - (double)h->sparse_n));
+	}
+
+	/* Ertl, "New cardinality estimation algorithms for HyperLogLog
+	   sketches" (2017), improved raw estimator. */
+	uint32_t q = 64 - h->p;
+	uint64_t c[66] = { 0 };
+	size_t i;
+
+	for(i = 0; i < h->m; i++)
+		c[h->registers[i]]++;
+
+	if(c[0] == h->m)
+		return 0.0;
+
+	double m = (double)h->m;
+	double z = m * _hllpp_tau(1.0 - (double)c[q + 1] / m);
+	uint32_t k;
+
+	for(k = q; k >= 1; k--)
+		z = 0.5 * (z + (double)c[k]);
+	z += m * _hllpp_sigma((double)c[0] / m);
+
+	return (0.5 / log(2.0)) * m * m / z;
+}
+
+int hllpp_merge(hllpp_t *dst, const hllpp_t *src) {
+	size_t i;
+
+	if(dst->p != src->p) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(src->dense) {
+		if(_hllpp_to_dense(dst) == -1)
+			return -1;
+		hll_registers_max(dst->registers, src->registers, dst->m);
+		return 0;
+	}
+
+	for(i = 0; i < src->sparse_n; i++)
+		_hllpp_insert_entry(dst, src->sparse[i]);
+	for(i = 0; i < src->tmp_n; i++)
+		_hllpp_insert_entry(dst, src->tmp[i]);
+
+	return 0;
+}
+
+static __inline void _put_u32(uint8_t *p, uint32_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+static __inline uint32_t _get_u32(const uint8_t *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+ssize_t hllpp_serialize(hllpp_t *h, void *buf, size_t buf_size) {
+	uint8_t *out = (uint8_t *)buf;
+	size_t i, n, size;
+
+	if(!h->dense && _hllpp_fold(h) == -1)
+		return -1;
+
+	n = h->dense ? h->m : h->sparse_n;
+	size = HLLPP_HEADER_SIZE + (h->dense ? n : n * sizeof(uint32_t));
+
+	if(!buf)
+		return (ssize_t)size;
+
+	if(buf_size < size) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	memcpy(out, hllpp_magic, sizeof(hllpp_magic));
+	out[4] = HLLPP_VERSION;
+	out[5] = h->p;
+	out[6] = h->dense;
+	out[7] = 0;
+	_put_u32(out + 8, (uint32_t)n);
+	out += HLLPP_HEADER_SIZE;
+
+	if(h->dense) {
+		memcpy(out, h->registers, n);
+	} else {
+		for(i = 0; i < n; i++)
+			_put_u32(out + i * sizeof(uint32_t), h->sparse[i]);
+	}
+
+	return (ssize_t)size;
+}
+
+int hllpp_deserialize(hllpp_t *h, const void *buf, size_t size) {
+	const uint8_t *in = (const uint8_t *)buf;
+	uint8_t dense;
+	size_t i, n;
+
+	if(size < HLLPP_HEADER_SIZE || memcmp(in, hllpp_magic, sizeof(hllpp_magic)) != 0 ||
+	   in[4] != HLLPP_VERSION || in[6] > 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(hllpp_init(h, in[5]) == -1)
+		return -1;
+
+	dense = in[6];
+	n = _get_u32(in + 8);
+	in += HLLPP_HEADER_SIZE;
+	size -= HLLPP_HEADER_SIZE;
+
+	if(dense) {
+		if(n != h->m || size < n || _hllpp_to_dense(h) == -1)
+			goto fail;
+		for(i = 0; i < n; i++) {
+			if(in[i] > 64 - h->p + 1)
+				goto fail;
+		}
+		memcpy(h->registers, in, n);
+		return 0;
+	}
+
+	if(size < n * sizeof(uint32_t))
+		goto fail;
+	for(i = 0; i < n; i++)
+		_hllpp_insert_entry(h, _get_u32(in + i * sizeof(uint32_t)));
+
+	return 0;
+
+fail:
+	hllpp_destroy(h);
+	errno = EINVAL;
+	return -1;
+}
@@ -0,0 +1,160 @@
+#include "line_union.h"
+#include "hash64.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LU_SHARD_BITS 6
+#define LU_SHARDS     (1u << LU_SHARD_BITS)
+#define LU_MIN_CAP    1024
+
+enum { LU_EMPTY = 0, LU_PRIVATE = 1, LU_SHARED = 2 };
+
+/* hash64_u64 is a bijection, so slots keep the hash and not the key */
+typedef struct {
+    uint64_t hash;
+    uint32_t owner;
+    uint32_t state;
+} lu_slot_t;
+
+typedef struct {
+    char       lock;
+    lu_slot_t *slots;
+    size_t     cap;        /* power of two */
+    size_t     n;
+    size_t     shared;
+    char       pad[24];    /* one shard per cache line */
+} lu_shard_t;
+
+struct line_union {
+    lu_shard_t shards[LU_SHARDS];
+    uint64_t   sources;
+};
+
+/* --- helpers --- */
+
+static inline uint32_t lu_shard_of(uint64_t hash) {
+    return (uint32_t)(hash >> (64 - LU_SHARD_BITS));
+}
+
+static void lu_lock(lu_shard_t *s) {
+    while (__atomic_test_and_set(&s->lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&s->lock, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+static void lu_unlock(lu_shard_t *s) {
+    __atomic_clear(&s->lock, __ATOMIC_RELEASE);
+}
+
+static lu_slot_t *lu_probe(lu_slot_t *slots, size_t cap, uint64_t hash) {
+    size_t mask = cap - 1;
+    for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+        if (slots[i].state == LU_EMPTY || slots[i].hash == hash)
+            return &slots[i];
+    }
+}
+
+/* Keep the load factor at or below 1/2 for one more key */
+static int lu_reserve(lu_shard_t *s) {
+    if (s->slots && 2 * (s->n + 1) <= s->cap)
+        return 0;
+
+    size_t cap = s->cap ? 2 * s->cap : LU_MIN_CAP;
+    lu_slot_t *slots = (lu_slot_t*)calloc(cap, sizeof(lu_slot_t));
+    if (!slots)
+        return -1;
+    for (size_t i = 0; i < s->cap; i++) {
+        if (s->slots[i].state != LU_EMPTY)
+            *lu_probe(slots, cap, s->slots[i].hash) = s->slots[i];
+    }
+    free(s->slots);
+    s->slots = slots;
+    s->cap = cap;
+    return 0;
+}
+
+static int lu_insert(lu_shard_t *s, uint32_t source, const uint64_t *hashes, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (lu_reserve(s) != 0)
+            return -1;
+        lu_slot_t *slot = lu_probe(s->slots, s->cap, hashes[i]);
+        if (slot->state == LU_EMPTY) {
+            slot->hash = hashes[i];
+            slot->owner = source;
+            slot->state = LU_PRIVATE;
+            s->n++;
+        } else if (slot->state == LU_PRIVATE && slot->owner != source) {
+            slot->state = LU_SHARED;
+            s->shared++;
+        }
+    }
+    return 0;
+}
+
+/* --- API --- */
+
+line_union_t *line_union_create(void) {
+    return (line_union_t*)calloc(1, sizeof(line_union_t));
+}
+
+void line_union_destroy(line_union_t *u) {
+    if (!u) return;
+    for (uint32_t s = 0; s < LU_SHARDS; s++)
+        free(u->shards[s].slots);
+    free(u);
+}
+
+int line_union_add(line_union_t *u, uint32_t source, const uint64_t *keys, size_t n) {
+    size_t start[LU_SHARDS + 1];
+    size_t fill[LU_SHARDS];
+    uint64_t *hashes;
+    int ret = 0;
+
+    __atomic_add_fetch(&u->sources, 1, __ATOMIC_RELAXED);
+    if (n == 0)
+        return 0;
+    hashes = (uint64_t*)malloc(n * sizeof(uint64_t));
+    if (!hashes)
+        return -1;
+
+    /* counting sort of the hashes by shard */
+    memset(start, 0, sizeof(start));
+    for (size_t i = 0; i < n; i++)
+        start[lu_shard_of(hash64_u64(keys[i], HASH64_SEED)) + 1]++;
+    for (uint32_t s = 0; s < LU_SHARDS; s++) {
+        start[s + 1] += start[s];
+        fill[s] = start[s];
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint64_t h = hash64_u64(keys[i], HASH64_SEED);
+        hashes[fill[lu_shard_of(h)]++] = h;
+    }
+
+    for (uint32_t s = 0; s < LU_SHARDS; s++) {
+        if (start[s + 1] == start[s])
+            continue;
+        lu_shard_t *shard = &u->shards[s];
+        lu_lock(shard);
+        if (lu_insert(shard, source, hashes + start[s], start[s + 1] - start[s]) != 0)
+            ret = -1;
+        lu_unlock(shard);
+    }
+
+    free(hashes);
+    return ret;
+}
+
+void line_union_get_stats(line_union_t *u, line_union_stats_t *out_stats) {
+    memset(out_stats, 0, sizeof(*out_stats));
+    for (uint32_t s = 0; s < LU_SHARDS; s++) {
+        lu_shard_t *shard = &u->shards[s];
+        lu_lock(shard);
+        out_stats->lines += shard->n;
+        out_stats->shared += shard->shared;
+        lu_unlock(shard);
+    }
+    out_stats->priv = out_stats->lines - out_stats->shared;
+    out_stats->sources = __atomic_load_n(&u->sources, __ATOMIC_RELAXED);
+}
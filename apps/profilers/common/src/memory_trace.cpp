@@ -2,18 +2,116 @@
 
 #include "memory_trace.h"
 #include "memory_trace.pb.h"
+#include "async_writer.h"
+#include <google/protobuf/arena.h>
+#include <climits>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
+
+// Arena bytes reserved per event: the MemoryEvent object, its slot in the
+// repeated field and allocator headers. The chunk is built inside one
+// preallocated block that survives Arena::Reset(), so steady-state event
+// recording does not touch the heap.
+static const size_t kArenaBytesPerEvent = 96;
+static const size_t kArenaSlack = 4096;
 
 struct memory_trace_writer {
-    memory_trace::MemoryTrace trace;
+    size_t chunk_events = MEMORY_TRACE_DEFAULT_CHUNK_EVENTS;
+    std::unique_ptr<char[]> arena_block;
+    std::unique_ptr<google::protobuf::Arena> arena;
+    memory_trace::MemoryTrace* chunk = nullptr;   // owned by the arena
+    std::string scratch;          // reused serialization buffer
+    std::string spilled;          // in-memory writer: serialized full chunks
+    async_writer_t* out = nullptr;   // streaming writer
+    uint64_t emitted_events = 0;  // events already serialized
+    bool failed = false;
 };
 
+namespace {
+
+void new_chunk(memory_trace_writer_t* writer) {
+    writer->chunk = google::protobuf::Arena::CreateMessage<memory_trace::MemoryTrace>(
+        writer->arena.get());
+    writer->chunk->mutable_events()->Reserve(static_cast<int>(writer->chunk_events));
+}
+
+memory_trace_writer_t* make_writer(size_t chunk_events) {
+    std::unique_ptr<memory_trace_writer_t> writer(new memory_trace_writer_t());
+    if (chunk_events == 0) chunk_events = MEMORY_TRACE_DEFAULT_CHUNK_EVENTS;
+    if (chunk_events > MEMORY_TRACE_MAX_CHUNK_EVENTS) chunk_events = MEMORY_TRACE_MAX_CHUNK_EVENTS;
+    writer->chunk_events = chunk_events;
+
+    google::protobuf::ArenaOptions options;
+    options.initial_block_size = chunk_events * kArenaBytesPerEvent + kArenaSlack;
+    writer->arena_block.reset(new char[options.initial_block_size]);
+    options.initial_block = writer->arena_block.get();
+    writer->arena.reset(new google::protobuf::Arena(options));
+    new_chunk(writer.get());
+    return writer.release();
+}
+
+// Append the current chunk to dst as 4-byte little-endian size + message
+bool serialize_chunk(const memory_trace_writer_t* writer, std::string& dst) {
+    size_t size = writer->chunk->ByteSizeLong();
+    if (size > UINT32_MAX) return false;
+
+    size_t pos = dst.size();
+    dst.resize(pos + 4 + size);
+    unsigned char* p = reinterpret_cast<unsigned char*>(&dst[pos]);
+    p[0] = (unsigned char)size;
+    p[1] = (unsigned char)(size >> 8);
+    p[2] = (unsigned char)(size >> 16);
+    p[3] = (unsigned char)(size >> 24);
+    writer->chunk->SerializeWithCachedSizesToArray(p + 4);
+    return true;
+}
+
+// Serialize the current chunk (to the file or the spill buffer) and start a
+// new one in the reset arena
+int emit_chunk(memory_trace_writer_t* writer) {
+    int n = writer->chunk->events_size();
+    if (n == 0) return 0;
+
+    bool ok;
+    if (writer->out) {
+        writer->scratch.clear();
+        ok = serialize_chunk(writer, writer->scratch) &&
+             aw_write(writer->out, writer->scratch.data(), writer->scratch.size()) == 0;
+    } else {
+        ok = serialize_chunk(writer, writer->spilled);
+    }
+
+    writer->emitted_events += static_cast<uint64_t>(n);
+    writer->arena->Reset();
+    new_chunk(writer);
+    if (!ok) writer->failed = true;
+    return ok ? 0 : -1;
+}
+
+}  // namespace
+
 extern "C" {
 
+memory_trace_writer_t* memory_trace_open_writer(const char* filename,
+                                                size_t chunk_events) {
+    if (!filename) return nullptr;
+
+    try {
+        std::unique_ptr<memory_trace_writer_t> writer(make_writer(chunk_events));
+        writer->out = aw_open(filename, nullptr);
+        if (!writer->out) return nullptr;
+        return writer.release();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
 memory_trace_writer_t* memory_trace_create_writer(void) {
     try {
-        return new memory_trace_writer_t();
+        return make_writer(MEMORY_TRACE_DEFAULT_CHUNK_EVENTS);
     } catch (...) {
         return nullptr;
     }
@@ -28,7 +126,7 @@ int memory_trace_add_event(memory_trace_writer_t* writer,
     if (!writer) return -1;
     
     try {
-        auto* event = writer->trace.add_events();
+        auto* event = writer->chunk->add_events();
         event->set_timestamp(timestamp);
         event->set_thread_id(thread_id);
         event->set_address(address);
@@ -39,24 +137,64 @@ int memory_trace_add_event(memory_trace_writer_t* writer,
         event->set_hit_miss(hit_miss == CACHE_HIT ? 
             memory_trace::HIT : memory_trace::MISS);
         
+        if (static_cast<size_t>(writer->chunk->events_size()) >= writer->chunk_events) {
+            return emit_chunk(writer);
+        }
         return 0;
     } catch (...) {
         return -1;
     }
 }
 
+int memory_trace_flush(memory_trace_writer_t* writer) {
+    if (!writer || !writer->out) return -1;
+
+    try {
+        int rc = emit_chunk(writer);
+        if (aw_flush(writer->out) != 0) {
+            writer->failed = true;
+            rc = -1;
+        }
+        return rc;
+    } catch (...) {
+        return -1;
+    }
+}
+
+int memory_trace_close_writer(memory_trace_writer_t* writer) {
+    if (!writer) return -1;
+
+    int rc = 0;
+    if (writer->out) {
+        try {
+            if (emit_chunk(writer) != 0) rc = -1;
+        } catch (...) {
+            rc = -1;
+        }
+        if (aw_close(writer->out) != 0) rc = -1;
+        writer->out = nullptr;
+        if (writer->failed) rc = -1;
+    }
+    delete writer;
+    return rc;
+}
+
 int memory_trace_write_to_file(memory_trace_writer_t* writer, const char* filename) {
-    if (!writer || !filename) return -1;
+    if (!writer || !filename || writer->out) return -1;
     
     try {
         std::ofstream output(filename, std::ios::binary);
         if (!output.is_open()) return -1;
         
-        if (!writer->trace.SerializeToOstream(&output)) {
-            return -1;
+        // Full chunks are already serialized; only the partial one is new
+        output.write(writer->spilled.data(), writer->spilled.size());
+        if (writer->chunk->events_size() > 0) {
+            writer->scratch.clear();
+            if (!serialize_chunk(writer, writer->scratch)) return -1;
+            output.write(writer->scratch.data(), writer->scratch.size());
         }
         
-        return 0;
+        return output.good() ? 0 : -1;
     } catch (...) {
         return -1;
     }
@@ -65,27 +203,42 @@ int memory_trace_write_to_file(memory_trace_writer_t* writer, const char* filena
 int memory_trace_write_to_buffer(memory_trace_writer_t* writer, 
                                 void* buffer, 
                                 size_t buffer_size) {
-    if (!writer) return -1;
+    if (!writer || writer->out) return -1;
     
     try {
-        std::string serialized;
-        if (!writer->trace.SerializeToString(&serialized)) {
+        // Size the partial chunk once; its cached sizes are reused below
+        size_t pending = 0;
+        if (writer->chunk->events_size() > 0) {
+            pending = 4 + writer->chunk->ByteSizeLong();
+        }
+        size_t total = writer->spilled.size() + pending;
+        if (total > static_cast<size_t>(INT_MAX)) {
             return -1;
         }
         
         // If buffer is NULL, return required size
         if (!buffer) {
-            return static_cast<int>(serialized.size());
+            return static_cast<int>(total);
         }
         
         // Check if buffer is large enough
-        if (buffer_size < serialized.size()) {
+        if (buffer_size < total) {
             return -1;
         }
         
-        // Copy data to buffer
-        std::memcpy(buffer, serialized.data(), serialized.size());
-        return static_cast<int>(serialized.size());
+        // Copy spilled chunks, then serialize the partial chunk in place
+        unsigned char* p = static_cast<unsigned char*>(buffer);
+        std::memcpy(p, writer->spilled.data(), writer->spilled.size());
+        p += writer->spilled.size();
+        if (pending) {
+            size_t size = pending - 4;
+            p[0] = (unsigned char)size;
+            p[1] = (unsigned char)(size >> 8);
+            p[2] = (unsigned char)(size >> 16);
+            p[3] = (unsigned char)(size >> 24);
+            writer->chunk->SerializeWithCachedSizesToArray(p + 4);
+        }
+        return static_cast<int>(total);
         
     } catch (...) {
         return -1;
@@ -94,15 +247,27 @@ int memory_trace_write_to_buffer(memory_trace_writer_t* writer,
 
 size_t memory_trace_get_event_count(memory_trace_writer_t* writer) {
     if (!writer) return 0;
-    return static_cast<size_t>(writer->trace.events_size());
+    return static_cast<size_t>(writer->emitted_events) +
+           static_cast<size_t>(writer->chunk->events_size());
 }
 
 void memory_trace_clear(memory_trace_writer_t* writer) {
     if (!writer) return;
-    writer->trace.clear_events();
+    writer->arena->Reset();
+    new_chunk(writer);
+    if (!writer->out) {
+        writer->spilled.clear();
+        writer->spilled.shrink_to_fit();
+        writer->emitted_events = 0;
+    }
 }
 
 void memory_trace_destroy_writer(memory_trace_writer_t* writer) {
+    if (!writer) return;
+    if (writer->out) {
+        memory_trace_close_writer(writer);
+        return;
+    }
     delete writer;
 }
 
@@ -113,6 +278,12 @@ void memory_trace_destroy_writer(memory_trace_writer_t* writer) {
 // Stub implementations when protobuf is not available
 extern "C" {
 
+memory_trace_writer_t* memory_trace_open_writer(const char* filename,
+                                                size_t chunk_events) {
+    (void)filename; (void)chunk_events;
+    return nullptr;
+}
+
 memory_trace_writer_t* memory_trace_create_writer(void) {
     return nullptr;
 }
@@ -127,6 +298,16 @@ int memory_trace_add_event(memory_trace_writer_t* writer,
     return -1;
 }
 
+int memory_trace_flush(memory_trace_writer_t* writer) {
+    (void)writer;
+    return -1;
+}
+
+int memory_trace_close_writer(memory_trace_writer_t* writer) {
+    (void)writer;
+    return -1;
+}
+
 int memory_trace_write_to_file(memory_trace_writer_t* writer, const char* filename) {
     (void)writer; (void)filename;
     return -1;
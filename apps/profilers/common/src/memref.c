@@ -0,0 +1,273 @@
+#include "memref.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MEMREF_X86_SIMD 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define MEMREF_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * The kernel makes two passes over each block of MEMREF_BLOCK records. A
+ * SIMD pass writes the line keys and one byte per record, min(size, 127) |
+ * write << 7; a scalar pass then bumps counters[byte], spread over
+ * MEMREF_LANES counter arrays so that runs of same-sized accesses do not
+ * form one chain of dependent increments. The 256 counters are folded into
+ * size classes through a table once per call, not once per reference.
+ */
+#define MEMREF_BLOCK 256
+#define MEMREF_IDX_SIZE_MAX 127
+
+typedef void (*memref_extract_fn)(const memref_t *refs, size_t n, uint64_t mask,
+                                  uint64_t *keys, uint8_t *idx);
+
+/* --- helpers --- */
+
+static void memref_count(const uint8_t *idx, size_t n, memref_counter_t *c) {
+    size_t i = 0;
+    for (; i + MEMREF_LANES <= n; i += MEMREF_LANES) {
+        c->cnt[0][idx[i]]++;
+        c->cnt[1][idx[i + 1]]++;
+        c->cnt[2][idx[i + 2]]++;
+        c->cnt[3][idx[i + 3]]++;
+    }
+    for (; i < n; i++)
+        c->cnt[0][idx[i]]++;
+}
+
+static void memref_fold(const memref_counter_t *c, memref_hist_t *hist) {
+    for (int size = 0; size <= MEMREF_IDX_SIZE_MAX; size++) {
+        int bin = memref_size_bin((uint32_t)size);
+        for (int lane = 0; lane < MEMREF_LANES; lane++) {
+            hist->read_size[bin] += c->cnt[lane][size];
+            hist->write_size[bin] += c->cnt[lane][size | 0x80];
+        }
+    }
+}
+
+static void memref_extract_scalar(const memref_t *refs, size_t n, uint64_t mask,
+                                  uint64_t *keys, uint8_t *idx) {
+    for (size_t i = 0; i < n; i++) {
+        uint32_t size = MEMREF_SIZE(&refs[i]);
+        if (keys) keys[i] = refs[i].addr & mask;
+        idx[i] = (uint8_t)((size < MEMREF_IDX_SIZE_MAX ? size : MEMREF_IDX_SIZE_MAX) |
+                           (MEMREF_IS_WRITE(&refs[i]) ? 0x80 : 0));
+    }
+}
+
+#ifdef MEMREF_X86_SIMD
+/* 16-bit size codes (size | write << 15) in the low word of each lane -> idx */
+static inline __m128i memref_code_to_idx(__m128i code) {
+    __m128i size = _mm_min_epi16(_mm_and_si128(code, _mm_set1_epi16(0x7fff)),
+                                 _mm_set1_epi16(MEMREF_IDX_SIZE_MAX));
+    return _mm_or_si128(size, _mm_slli_epi16(_mm_srli_epi16(code, 15), 7));
+}
+
+static void memref_extract_sse2(const memref_t *refs, size_t n, uint64_t mask,
+                                uint64_t *keys, uint8_t *idx) {
+    const __m128i m = _mm_set1_epi64x((long long)mask);
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        __m128i r0 = _mm_loadu_si128((const __m128i *)&refs[i]);
+        __m128i r1 = _mm_loadu_si128((const __m128i *)&refs[i + 1]);
+        __m128i code = _mm_srli_epi64(_mm_unpackhi_epi64(r0, r1), MEMREF_SIZE_SHIFT);
+        if (keys)
+            _mm_storeu_si128((__m128i *)&keys[i], _mm_and_si128(_mm_unpacklo_epi64(r0, r1), m));
+        code = memref_code_to_idx(code);
+        idx[i] = (uint8_t)_mm_cvtsi128_si32(code);
+        idx[i + 1] = (uint8_t)_mm_extract_epi16(code, 4);
+    }
+    memref_extract_scalar(refs + i, n - i, mask, keys ? keys + i : NULL, idx + i);
+}
+
+__attribute__((target("avx2")))
+static void memref_extract_avx2(const memref_t *refs, size_t n, uint64_t mask,
+                                uint64_t *keys, uint8_t *idx) {
+    const __m256i m = _mm256_set1_epi64x((long long)mask);
+    /* low dword of each 64-bit lane into the low 128 bits */
+    const __m256i low_dwords = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i code[2];
+        for (int h = 0; h < 2; h++) {
+            /* [a0 i0 a1 i1], [a2 i2 a3 i3] -> [a0 a2 | a1 a3], [i0 i2 | i1 i3] */
+            size_t j = i + 4 * h;
+            __m256i r01 = _mm256_loadu_si256((const __m256i *)&refs[j]);
+            __m256i r23 = _mm256_loadu_si256((const __m256i *)&refs[j + 2]);
+            __m256i info = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(r01, r23), 0xd8);
+            if (keys) {
+                __m256i addr = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(r01, r23), 0xd8);
+                _mm256_storeu_si256((__m256i *)&keys[j], _mm256_and_si256(addr, m));
+            }
+            code[h] = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+                _mm256_srli_epi64(info, MEMREF_SIZE_SHIFT), low_dwords));
+        }
+        /* eight dwords -> eight words -> eight bytes */
+        __m128i words = memref_code_to_idx(_mm_packus_epi32(code[0], code[1]));
+        _mm_storel_epi64((__m128i *)&idx[i], _mm_packus_epi16(words, words));
+    }
+    memref_extract_sse2(refs + i, n - i, mask, keys ? keys + i : NULL, idx + i);
+}
+#endif /* MEMREF_X86_SIMD */
+
+#ifdef MEMREF_NEON
+static void memref_extract_neon(const memref_t *refs, size_t n, uint64_t mask,
+                                uint64_t *keys, uint8_t *idx) {
+    const uint64x2_t m = vdupq_n_u64(mask);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint16x4_t code[2];
+        for (int h = 0; h < 2; h++) {
+            /* vld2 deinterleaves: val[0] = addresses, val[1] = info words */
+            size_t j = i + 4 * h;
+            uint64x2x2_t r01 = vld2q_u64((const uint64_t *)&refs[j]);
+            uint64x2x2_t r23 = vld2q_u64((const uint64_t *)&refs[j + 2]);
+            if (keys) {
+                vst1q_u64(&keys[j], vandq_u64(r01.val[0], m));
+                vst1q_u64(&keys[j + 2], vandq_u64(r23.val[0], m));
+            }
+            code[h] = vmovn_u32(vcombine_u32(vmovn_u64(vshrq_n_u64(r01.val[1], MEMREF_SIZE_SHIFT)),
+                                             vmovn_u64(vshrq_n_u64(r23.val[1], MEMREF_SIZE_SHIFT))));
+        }
+        uint16x8_t c = vcombine_u16(code[0], code[1]);
+        uint16x8_t size = vminq_u16(vandq_u16(c, vdupq_n_u16(0x7fff)),
+                                    vdupq_n_u16(MEMREF_IDX_SIZE_MAX));
+        uint16x8_t write = vshlq_n_u16(vshrq_n_u16(c, 15), 7);
+        vst1_u8(&idx[i], vmovn_u16(vorrq_u16(size, write)));
+    }
+    memref_extract_scalar(refs + i, n - i, mask, keys ? keys + i : NULL, idx + i);
+}
+#endif /* MEMREF_NEON */
+
+static memref_extract_fn memref_extract_impl = NULL;
+
+/* Picks the kernel once, on first use; racing initializers store the same value. */
+static memref_extract_fn memref_dispatch(void) {
+    memref_extract_fn fn = __atomic_load_n(&memref_extract_impl, __ATOMIC_ACQUIRE);
+    if (fn) return fn;
+
+    fn = memref_extract_scalar;
+#ifdef MEMREF_X86_SIMD
+    __builtin_cpu_init();
+    fn = memref_extract_sse2;
+    if (__builtin_cpu_supports("avx2"))
+        fn = memref_extract_avx2;
+#elif defined(MEMREF_NEON)
+    fn = memref_extract_neon;
+#endif
+    __atomic_store_n(&memref_extract_impl, fn, __ATOMIC_RELEASE);
+    return fn;
+}
+
+static void memref_count_with(memref_extract_fn extract, const memref_t *refs, size_t n,
+                              uint64_t line_mask, uint64_t *line_keys, memref_counter_t *c) {
+    uint8_t idx[MEMREF_BLOCK];
+
+    while (n) {
+        size_t k = n < MEMREF_BLOCK ? n : MEMREF_BLOCK;
+        /* fold before a 32-bit counter could wrap */
+        if (c->pending >= (1u << 31)) {
+            memref_fold(c, &c->folded);
+            memset(c->cnt, 0, sizeof(c->cnt));
+            c->pending = 0;
+        }
+        extract(refs, k, line_mask, line_keys, idx);
+        memref_count(idx, k, c);
+        c->pending += (uint32_t)k;
+        refs += k;
+        if (line_keys) line_keys += k;
+        n -= k;
+    }
+}
+
+static void memref_batch_with(memref_extract_fn extract, const memref_t *refs, size_t n,
+                              uint64_t line_mask, uint64_t *line_keys, memref_hist_t *hist) {
+    memref_counter_t c;
+
+    memset(&c, 0, sizeof(c));
+    memref_count_with(extract, refs, n, line_mask, line_keys, &c);
+    memref_fold(&c, hist);
+    memref_hist_add(hist, &c.folded);
+}
+
+/* --- API --- */
+
+int memref_size_bin(uint32_t size) {
+    switch (size) {
+    case 1:  return 0;
+    case 2:  return 1;
+    case 4:  return 2;
+    case 8:  return 3;
+    case 16: return 4;
+    case 32: return 5;
+    case 64: return 6;
+    default: return MEMREF_BIN_OTHER;
+    }
+}
+
+uint64_t memref_hist_reads(const memref_hist_t *h) {
+    uint64_t n = 0;
+    for (int b = 0; b < MEMREF_SIZE_BINS; b++)
+        n += h->read_size[b];
+    return n;
+}
+
+uint64_t memref_hist_writes(const memref_hist_t *h) {
+    uint64_t n = 0;
+    for (int b = 0; b < MEMREF_SIZE_BINS; b++)
+        n += h->write_size[b];
+    return n;
+}
+
+void memref_hist_add(memref_hist_t *dst, const memref_hist_t *src) {
+    for (int b = 0; b < MEMREF_SIZE_BINS; b++) {
+        dst->read_size[b] += src->read_size[b];
+        dst->write_size[b] += src->write_size[b];
+    }
+}
+
+void memref_batch(const memref_t *refs, size_t n, uint64_t line_mask,
+                  uint64_t *line_keys, memref_hist_t *hist) {
+    memref_batch_with(memref_dispatch(), refs, n, line_mask, line_keys, hist);
+}
+
+void memref_batch_scalar(const memref_t *refs, size_t n, uint64_t line_mask,
+                         uint64_t *line_keys, memref_hist_t *hist) {
+    memref_batch_with(memref_extract_scalar, refs, n, line_mask, line_keys, hist);
+}
+
+void memref_count_batch(const memref_t *refs, size_t n, uint64_t line_mask,
+                        uint64_t *line_keys, memref_counter_t *c) {
+    memref_count_with(memref_dispatch(), refs, n, line_mask, line_keys, c);
+}
+
+void memref_counter_take(memref_counter_t *c, memref_hist_t *hist) {
+    if (c->pending) {
+        memref_fold(c, hist);
+        memset(c->cnt, 0, sizeof(c->cnt));
+        c->pending = 0;
+    }
+    memref_hist_add(hist, &c->folded);
+    memset(&c->folded, 0, sizeof(c->folded));
+}
+
+size_t memref_coarsen(const uint64_t *keys, size_t n, uint64_t mask, uint64_t *out) {
+    size_t m;
+
+    if (n == 0)
+        return 0;
+    out[0] = keys[0] & mask;
+    m = 1;
+    for (size_t i = 1; i < n; i++) {
+        uint64_t key = keys[i] & mask;
+        if (key != out[m - 1])
+            out[m++] = key;
+    }
+    return m;
+}
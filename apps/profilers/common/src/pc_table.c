@@ -0,0 +1,300 @@
+#include "pc_table.h"
+#include "hash64.h"
+#include "hll.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PC_TABLE_HLL_MIN_BITS 4
+#define PC_TABLE_HLL_MAX_BITS 12
+#define PC_TABLE_NONE UINT32_MAX
+
+typedef struct {
+    uint64_t pc;
+    uint64_t bytes;
+    uint64_t error;
+    uint64_t reads;
+    uint64_t writes;
+    uint32_t heap_pos;
+} pc_entry_t;
+
+struct pc_table {
+    size_t      cap;
+    size_t      n;
+    uint8_t     hll_bits;
+    size_t      hll_size;
+    pc_entry_t *e;
+    uint8_t    *regs;       /* hll_size registers per entry */
+    uint32_t   *heap;       /* entry indices, min-heap on bytes */
+    uint32_t   *index;      /* entry index + 1 per slot, 0 = empty */
+    size_t      mask;
+    uint32_t    last;       /* entry of the previous lookup */
+
+    uint64_t    refs;
+    uint64_t    bytes;
+    uint64_t    evictions;
+};
+
+/* --- helpers --- */
+
+static inline uint8_t *pc_regs(const pc_table_t *t, uint32_t i) {
+    return t->regs + (size_t)i * t->hll_size;
+}
+
+static inline struct HLL pc_hll(const pc_table_t *t, uint32_t i) {
+    struct HLL h = { t->hll_bits, t->hll_size, pc_regs(t, i) };
+    return h;
+}
+
+static inline size_t pc_slot(const pc_table_t *t, uint64_t pc) {
+    return (size_t)hash64_u64(pc, HASH64_SEED) & t->mask;
+}
+
+static uint32_t pc_find(const pc_table_t *t, uint64_t pc) {
+    for (size_t s = pc_slot(t, pc);; s = (s + 1) & t->mask) {
+        uint32_t i = t->index[s];
+        if (i == 0)
+            return PC_TABLE_NONE;
+        if (t->e[i - 1].pc == pc)
+            return i - 1;
+    }
+}
+
+static void pc_index_insert(pc_table_t *t, uint32_t i) {
+    size_t s = pc_slot(t, t->e[i].pc);
+    while (t->index[s])
+        s = (s + 1) & t->mask;
+    t->index[s] = i + 1;
+}
+
+/* Linear-probing delete with backward shift, so no tombstones accumulate */
+static void pc_index_remove(pc_table_t *t, uint64_t pc) {
+    size_t s = pc_slot(t, pc);
+    while (t->e[t->index[s] - 1].pc != pc)
+        s = (s + 1) & t->mask;
+
+    size_t hole = s;
+    for (s = (hole + 1) & t->mask; t->index[s]; s = (s + 1) & t->mask) {
+        size_t home = pc_slot(t, t->e[t->index[s] - 1].pc);
+        /* move the entry back if its home is not in (hole, s] */
+        if (((s - home) & t->mask) >= ((s - hole) & t->mask)) {
+            t->index[hole] = t->index[s];
+            hole = s;
+        }
+    }
+    t->index[hole] = 0;
+}
+
+static inline void pc_heap_set(pc_table_t *t, uint32_t pos, uint32_t i) {
+    t->heap[pos] = i;
+    t->e[i].heap_pos = pos;
+}
+
+static void pc_sift_up(pc_table_t *t, uint32_t pos) {
+    uint32_t i = t->heap[pos];
+    while (pos > 0) {
+        uint32_t parent = (pos - 1) / 2;
+        if (t->e[t->heap[parent]].bytes <= t->e[i].bytes)
+            break;
+        pc_heap_set(t, pos, t->heap[parent]);
+        pos = parent;
+    }
+    pc_heap_set(t, pos, i);
+}
+
+/* After entry i's bytes grew */
+static void pc_sift_down(pc_table_t *t, uint32_t i) {
+    uint32_t pos = t->e[i].heap_pos;
+    uint32_t n = (uint32_t)t->n;
+    for (;;) {
+        uint32_t c = 2 * pos + 1;
+        if (c >= n)
+            break;
+        if (c + 1 < n && t->e[t->heap[c + 1]].bytes < t->e[t->heap[c]].bytes)
+            c++;
+        if (t->e[i].bytes <= t->e[t->heap[c]].bytes)
+            break;
+        pc_heap_set(t, pos, t->heap[c]);
+        pos = c;
+    }
+    pc_heap_set(t, pos, i);
+}
+
+/*
+ * Entry for pc, admitting it if needed: a free entry while there is one,
+ * otherwise the one with the fewest bytes, whose bytes the newcomer keeps
+ * as its error. Either way the caller then adds to bytes and sifts down.
+ */
+static uint32_t pc_admit(pc_table_t *t, uint64_t pc) {
+    uint32_t i;
+
+    if (t->n < t->cap) {
+        i = (uint32_t)t->n++;
+        memset(&t->e[i], 0, sizeof(t->e[i]));
+        t->e[i].pc = pc;
+        pc_heap_set(t, i, i);
+        pc_sift_up(t, i);
+    } else {
+        i = t->heap[0];
+        pc_index_remove(t, t->e[i].pc);
+        t->e[i].pc = pc;
+        t->e[i].error = t->e[i].bytes;
+        t->e[i].reads = 0;
+        t->e[i].writes = 0;
+        memset(pc_regs(t, i), 0, t->hll_size);
+        t->evictions++;
+    }
+    pc_index_insert(t, i);
+    return i;
+}
+
+static inline void pc_record_one(pc_table_t *t, uint64_t pc, uint64_t line_key,
+                                 uint32_t size, int write) {
+    uint32_t i = t->last;
+
+    /* consecutive references often come from the same instruction */
+    if (i == PC_TABLE_NONE || t->e[i].pc != pc) {
+        i = pc_find(t, pc);
+        if (i == PC_TABLE_NONE)
+            i = pc_admit(t, pc);
+        t->last = i;
+    }
+
+    pc_entry_t *e = &t->e[i];
+    if (write)
+        e->writes++;
+    else
+        e->reads++;
+    e->bytes += size;
+    struct HLL h = pc_hll(t, i);
+    hll_add_u64(&h, line_key);
+    if (size)
+        pc_sift_down(t, i);
+
+    t->refs++;
+    t->bytes += size;
+}
+
+static int pc_cmp_bytes_desc(const void *a, const void *b) {
+    const pc_entry_t *x = *(const pc_entry_t *const *)a;
+    const pc_entry_t *y = *(const pc_entry_t *const *)b;
+    if (x->bytes != y->bytes)
+        return x->bytes < y->bytes ? 1 : -1;
+    return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+/* --- API --- */
+
+pc_table_t *pc_table_create(size_t capacity, uint8_t hll_bits) {
+    if (capacity == 0 || capacity >= PC_TABLE_NONE / 2 ||
+        hll_bits < PC_TABLE_HLL_MIN_BITS || hll_bits > PC_TABLE_HLL_MAX_BITS)
+        return NULL;
+
+    pc_table_t *t = (pc_table_t*)calloc(1, sizeof(*t));
+    if (!t) return NULL;
+
+    size_t slots = 16;
+    while (slots < 2 * capacity)
+        slots <<= 1;
+
+    t->cap = capacity;
+    t->hll_bits = hll_bits;
+    t->hll_size = (size_t)1 << hll_bits;
+    t->mask = slots - 1;
+    t->last = PC_TABLE_NONE;
+    t->e = (pc_entry_t*)malloc(capacity * sizeof(pc_entry_t));
+    t->regs = (uint8_t*)calloc(capacity, t->hll_size);
+    t->heap = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    t->index = (uint32_t*)calloc(slots, sizeof(uint32_t));
+    if (!t->e || !t->regs || !t->heap || !t->index) {
+        pc_table_destroy(t);
+        return NULL;
+    }
+    return t;
+}
+
+void pc_table_destroy(pc_table_t *t) {
+    if (!t) return;
+    free(t->e);
+    free(t->regs);
+    free(t->heap);
+    free(t->index);
+    free(t);
+}
+
+void pc_table_record(pc_table_t *t, uint64_t pc, uint64_t line_key,
+                     uint32_t size, int write) {
+    pc_record_one(t, pc, line_key, size, write);
+}
+
+void pc_table_record_batch(pc_table_t *t, const memref_t *refs, size_t n,
+                           uint64_t line_mask) {
+    for (size_t k = 0; k < n; k++) {
+        pc_record_one(t, MEMREF_PC(&refs[k]), refs[k].addr & line_mask,
+                      MEMREF_SIZE(&refs[k]), MEMREF_IS_WRITE(&refs[k]));
+    }
+}
+
+int pc_table_merge(pc_table_t *dst, const pc_table_t *src) {
+    if (dst->hll_bits != src->hll_bits)
+        return -1;
+
+    for (uint32_t k = 0; k < (uint32_t)src->n; k++) {
+        const pc_entry_t *s = &src->e[k];
+        uint32_t i = pc_find(dst, s->pc);
+        if (i == PC_TABLE_NONE) {
+            /* admitted with no sketch of its own yet: take src's */
+            i = pc_admit(dst, s->pc);
+            memcpy(pc_regs(dst, i), pc_regs(src, k), dst->hll_size);
+        } else {
+            hll_registers_max(pc_regs(dst, i), pc_regs(src, k), dst->hll_size);
+        }
+        pc_entry_t *d = &dst->e[i];
+        d->bytes += s->bytes;
+        d->error += s->error;
+        d->reads += s->reads;
+        d->writes += s->writes;
+        pc_sift_down(dst, i);
+    }
+    dst->last = PC_TABLE_NONE;
+    dst->refs += src->refs;
+    dst->bytes += src->bytes;
+    dst->evictions += src->evictions;
+    return 0;
+}
+
+void pc_table_get_stats(const pc_table_t *t, pc_table_stats_t *out_stats) {
+    out_stats->refs = t->refs;
+    out_stats->bytes = t->bytes;
+    out_stats->entries = t->n;
+    out_stats->evictions = t->evictions;
+}
+
+size_t pc_table_top(const pc_table_t *t, pc_stat_t *out, size_t max) {
+    const pc_entry_t **order;
+    size_t n = t->n;
+
+    if (max == 0 || n == 0)
+        return 0;
+    order = (const pc_entry_t**)malloc(n * sizeof(*order));
+    if (!order)
+        return 0;
+    for (size_t k = 0; k < n; k++)
+        order[k] = &t->e[k];
+    qsort(order, n, sizeof(*order), pc_cmp_bytes_desc);
+
+    if (max > n)
+        max = n;
+    for (size_t k = 0; k < max; k++) {
+        const pc_entry_t *e = order[k];
+        struct HLL h = pc_hll(t, (uint32_t)(e - t->e));
+        out[k].pc = e->pc;
+        out[k].bytes = e->bytes;
+        out[k].error = e->error;
+        out[k].reads = e->reads;
+        out[k].writes = e->writes;
+        out[k].lines = hll_count(&h);
+    }
+    free(order);
+    return max;
+}
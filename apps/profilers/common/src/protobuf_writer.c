@@ -3,6 +3,8 @@
  */
 
 #include "protobuf_writer.h"
+#include "async_writer.h"
+#include "memref.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -11,34 +13,111 @@
 
 /* Memory Trace Writer Structure */
 struct pb_trace_writer {
-    FILE *file;
+    async_writer_t *out;          /* file I/O happens on its thread */
+
+    /* Current chunk: preallocated events plus the pointer array the packed
+       MemoryTrace refers to */
+    MemoryTrace__MemoryEvent *events;
+    MemoryTrace__MemoryEvent **event_ptrs;
+    size_t chunk_events;
+    size_t n_events;
+
+    uint8_t *pack_buf;            /* reused across chunks */
+    size_t pack_cap;
+
     size_t total_events_written;  /* Total events written to file */
 };
 
 /* Time-Series Writer Structure */
 struct pb_timeseries_writer {
-    FILE *file;
-    Memsys__Timeseries__RunMetadata *metadata;  /* Keep metadata for writing with each sample batch */
+    async_writer_t *out;
+    Memsys__Timeseries__RunMetadata *metadata;  /* Written once, in the header */
+
+    /* Current batch: preallocated samples with their histogram storage */
+    Memsys__Timeseries__SampleWindow *samples;
+    Memsys__Timeseries__SampleWindow **sample_ptrs;
+    uint64_t *hist;               /* 2 * PB_TS_SIZE_BINS per sample */
+    uint64_t *region_counts;      /* 3 * PB_TS_REGIONS per sample */
+    double *region_wss;           /* PB_TS_REGIONS per sample */
+    size_t n_samples;
+
+    uint8_t *pack_buf;            /* reused across records */
+    size_t pack_cap;
+
+    uint32_t num_threads;
     size_t total_samples_written;  /* Total samples written to file */
 };
 
 /* ========== Memory Trace Writer ========== */
 
-pb_trace_writer_t* pb_trace_writer_create(const char *filename) {
-    pb_trace_writer_t *writer = (pb_trace_writer_t*)malloc(sizeof(pb_trace_writer_t));
+/* Pack the current chunk as one length-delimited MemoryTrace */
+static void pb_trace_write_chunk(pb_trace_writer_t *writer) {
+    if (writer->n_events == 0) return;
+
+    MemoryTrace__MemoryTrace trace = MEMORY_TRACE__MEMORY_TRACE__INIT;
+    trace.events = writer->event_ptrs;
+    trace.n_events = writer->n_events;
+
+    size_t packed_size = memory_trace__memory_trace__get_packed_size(&trace);
+    if (packed_size > writer->pack_cap) {
+        uint8_t *buf = (uint8_t*)realloc(writer->pack_buf, packed_size);
+        if (!buf) {
+            writer->n_events = 0;   /* drop the chunk rather than the file */
+            return;
+        }
+        writer->pack_buf = buf;
+        writer->pack_cap = packed_size;
+    }
+    memory_trace__memory_trace__pack(&trace, writer->pack_buf);
+
+    /* Write length-delimited: 4-byte size + data */
+    uint32_t msg_size = (uint32_t)packed_size;
+    aw_write(writer->out, &msg_size, sizeof(uint32_t));
+    aw_write(writer->out, writer->pack_buf, packed_size);
+
+    writer->total_events_written += writer->n_events;
+    writer->n_events = 0;
+}
+
+pb_trace_writer_t* pb_trace_writer_create_io(const char *filename,
+                                             size_t chunk_events,
+                                             const aw_config_t *io) {
+    pb_trace_writer_t *writer = (pb_trace_writer_t*)calloc(1, sizeof(pb_trace_writer_t));
     if (!writer) return NULL;
 
-    writer->file = fopen(filename, "wb");
-    if (!writer->file) {
+    if (chunk_events == 0) chunk_events = PB_TRACE_DEFAULT_CHUNK_EVENTS;
+    writer->chunk_events = chunk_events;
+    writer->events = (MemoryTrace__MemoryEvent*)
+        malloc(chunk_events * sizeof(MemoryTrace__MemoryEvent));
+    writer->event_ptrs = (MemoryTrace__MemoryEvent**)
+        malloc(chunk_events * sizeof(MemoryTrace__MemoryEvent*));
+    if (writer->events && writer->event_ptrs)
+        writer->out = aw_open(filename, io);
+    if (!writer->out) {
+        free(writer->events);
+        free(writer->event_ptrs);
         free(writer);
         return NULL;
     }
 
-    writer->total_events_written = 0;
+    for (size_t i = 0; i < chunk_events; i++) {
+        memory_trace__memory_event__init(&writer->events[i]);
+        writer->events[i].hit_miss = MEMORY_TRACE__HIT_MISS__MISS;
+        writer->event_ptrs[i] = &writer->events[i];
+    }
 
     return writer;
 }
 
+pb_trace_writer_t* pb_trace_writer_create_chunked(const char *filename,
+                                                  size_t chunk_events) {
+    return pb_trace_writer_create_io(filename, chunk_events, NULL);
+}
+
+pb_trace_writer_t* pb_trace_writer_create(const char *filename) {
+    return pb_trace_writer_create_chunked(filename, PB_TRACE_DEFAULT_CHUNK_EVENTS);
+}
+
 void pb_trace_write_event(pb_trace_writer_t *writer,
                           uint64_t timestamp,
                           uint32_t thread_id,
@@ -47,75 +126,165 @@ void pb_trace_write_event(pb_trace_writer_t *writer,
                           uint32_t size) {
     if (!writer) return;
 
-    /* Create a single event */
-    MemoryTrace__MemoryEvent event = MEMORY_TRACE__MEMORY_EVENT__INIT;
-    event.timestamp = timestamp;
-    event.thread_id = thread_id;
-    event.address = address;
-    event.mem_op = is_write ? MEMORY_TRACE__MEM_OP__WRITE : MEMORY_TRACE__MEM_OP__READ;
-    event.hit_miss = MEMORY_TRACE__HIT_MISS__MISS;
-
-    /* Create a wrapper trace with this single event */
-    MemoryTrace__MemoryTrace trace = MEMORY_TRACE__MEMORY_TRACE__INIT;
-    MemoryTrace__MemoryEvent *event_ptr = &event;
-    trace.events = &event_ptr;
-    trace.n_events = 1;
-
-    /* Serialize and write immediately */
-    size_t packed_size = memory_trace__memory_trace__get_packed_size(&trace);
-    uint8_t *buffer = (uint8_t*)malloc(packed_size);
-    memory_trace__memory_trace__pack(&trace, buffer);
+    MemoryTrace__MemoryEvent *event = &writer->events[writer->n_events];
+    event->timestamp = timestamp;
+    event->thread_id = thread_id;
+    event->address = address;
+    event->mem_op = is_write ? MEMORY_TRACE__MEM_OP__WRITE : MEMORY_TRACE__MEM_OP__READ;
+    event->hit_miss = MEMORY_TRACE__HIT_MISS__MISS;
+    event->size = size;
+    event->hit_level = 0;
+
+    if (++writer->n_events == writer->chunk_events)
+        pb_trace_write_chunk(writer);
+}
 
-    /* Write length-delimited: 4-byte size + data */
-    uint32_t msg_size = (uint32_t)packed_size;
-    fwrite(&msg_size, sizeof(uint32_t), 1, writer->file);
-    fwrite(buffer, 1, packed_size, writer->file);
-    fflush(writer->file);  /* Force to disk immediately */
+void pb_trace_write_events(pb_trace_writer_t *writer,
+                           const pb_trace_event_t *events,
+                           size_t n) {
+    if (!writer) return;
 
-    free(buffer);
-    writer->total_events_written++;
+    for (size_t i = 0; i < n; i++) {
+        MemoryTrace__MemoryEvent *event = &writer->events[writer->n_events];
+        event->timestamp = events[i].timestamp;
+        event->thread_id = events[i].thread_id;
+        event->address = events[i].address;
+        event->mem_op = events[i].is_write ? MEMORY_TRACE__MEM_OP__WRITE
+                                           : MEMORY_TRACE__MEM_OP__READ;
+        /* without simulation every event stays a miss, as it always was */
+        event->hit_miss = events[i].hit_level == 1 ? MEMORY_TRACE__HIT_MISS__HIT
+                                                   : MEMORY_TRACE__HIT_MISS__MISS;
+        event->size = events[i].size;
+        event->hit_level = events[i].hit_level;
+
+        if (++writer->n_events == writer->chunk_events)
+            pb_trace_write_chunk(writer);
+    }
 }
 
 void pb_trace_flush(pb_trace_writer_t *writer) {
     if (!writer) return;
-    /* Ensure OS buffer is flushed to disk */
-    fflush(writer->file);
+    pb_trace_write_chunk(writer);
+    /* Wait until everything handed to the I/O thread is written */
+    aw_flush(writer->out);
 }
 
 void pb_trace_writer_close(pb_trace_writer_t *writer) {
     if (!writer) return;
 
-    /* Final flush */
-    fflush(writer->file);
-    fclose(writer->file);
+    /* Final partial chunk */
+    pb_trace_write_chunk(writer);
+    aw_close(writer->out);
+
+    free(writer->events);
+    free(writer->event_ptrs);
+    free(writer->pack_buf);
     free(writer);
 }
 
 /* ========== Time-Series Metrics Writer ========== */
 
-pb_timeseries_writer_t* pb_timeseries_writer_create(
+static const char pb_ts_magic[4] = { 'M', 'S', 'T', 'S' };
+#define PB_TS_FORMAT_VERSION 2
+#define PB_TS_IO_BUFFER      (64 << 10)
+#define PB_TS_IO_BUFFERS     4
+
+static const char *pb_ts_size_bins[PB_TS_SIZE_BINS] = {
+    "1", "2", "4", "8", "16", "32", "64", "other"
+};
+
+static const char *pb_ts_regions[PB_TS_REGIONS] = {
+    "other", "stack", "heap", "global", "mmap"
+};
+
+/* Pack one record and write it length-delimited */
+static void pb_timeseries_write_record(pb_timeseries_writer_t *writer,
+                                       const Memsys__Timeseries__TimeSeriesRecord *record) {
+    size_t packed_size = memsys__timeseries__time_series_record__get_packed_size(record);
+    if (packed_size > writer->pack_cap) {
+        uint8_t *buf = (uint8_t*)realloc(writer->pack_buf, packed_size);
+        if (!buf) return;
+        writer->pack_buf = buf;
+        writer->pack_cap = packed_size;
+    }
+    memsys__timeseries__time_series_record__pack(record, writer->pack_buf);
+
+    /* Write length-delimited: 4-byte size + data */
+    uint32_t msg_size = (uint32_t)packed_size;
+    aw_write(writer->out, &msg_size, sizeof(uint32_t));
+    aw_write(writer->out, writer->pack_buf, packed_size);
+}
+
+static void pb_timeseries_write_batch(pb_timeseries_writer_t *writer) {
+    if (writer->n_samples == 0) return;
+
+    Memsys__Timeseries__SampleBatch batch = MEMSYS__TIMESERIES__SAMPLE_BATCH__INIT;
+    batch.samples = writer->sample_ptrs;
+    batch.n_samples = writer->n_samples;
+
+    Memsys__Timeseries__TimeSeriesRecord record = MEMSYS__TIMESERIES__TIME_SERIES_RECORD__INIT;
+    record.record_case = MEMSYS__TIMESERIES__TIME_SERIES_RECORD__RECORD_BATCH;
+    record.batch = &batch;
+    pb_timeseries_write_record(writer, &record);
+
+    writer->total_samples_written += writer->n_samples;
+    writer->n_samples = 0;
+}
+
+static void pb_timeseries_free(pb_timeseries_writer_t *writer) {
+    if (writer->metadata) {
+        free((void*)writer->metadata->profiler);
+        free((void*)writer->metadata->command);
+        free(writer->metadata);
+    }
+    free(writer->samples);
+    free(writer->sample_ptrs);
+    free(writer->hist);
+    free(writer->region_counts);
+    free(writer->region_wss);
+    free(writer->pack_buf);
+    free(writer);
+}
+
+pb_timeseries_writer_t* pb_timeseries_writer_create_io(
     const char *filename,
     const char *profiler,
     uint32_t pid,
     const char *command,
     uint32_t sample_window_refs,
-    uint32_t cache_line_size) {
+    uint32_t cache_line_size,
+    const aw_config_t *io) {
 
     pb_timeseries_writer_t *writer =
-        (pb_timeseries_writer_t*)malloc(sizeof(pb_timeseries_writer_t));
+        (pb_timeseries_writer_t*)calloc(1, sizeof(pb_timeseries_writer_t));
     if (!writer) return NULL;
 
-    writer->file = fopen(filename, "wb");
-    if (!writer->file) {
-        free(writer);
+    writer->metadata = (Memsys__Timeseries__RunMetadata*)
+        malloc(sizeof(Memsys__Timeseries__RunMetadata));
+    writer->samples = (Memsys__Timeseries__SampleWindow*)
+        malloc(PB_TS_BATCH_SAMPLES * sizeof(Memsys__Timeseries__SampleWindow));
+    writer->sample_ptrs = (Memsys__Timeseries__SampleWindow**)
+        malloc(PB_TS_BATCH_SAMPLES * sizeof(Memsys__Timeseries__SampleWindow*));
+    writer->hist = (uint64_t*)
+        malloc(PB_TS_BATCH_SAMPLES * 2 * PB_TS_SIZE_BINS * sizeof(uint64_t));
+    writer->region_counts = (uint64_t*)
+        malloc(PB_TS_BATCH_SAMPLES * 3 * PB_TS_REGIONS * sizeof(uint64_t));
+    writer->region_wss = (double*)
+        malloc(PB_TS_BATCH_SAMPLES * PB_TS_REGIONS * sizeof(double));
+    if (writer->metadata && writer->samples && writer->sample_ptrs && writer->hist &&
+        writer->region_counts && writer->region_wss) {
+        /* low volume: a few small buffers are plenty */
+        aw_config_t cfg = { PB_TS_IO_BUFFER, PB_TS_IO_BUFFERS, AW_BACKEND_AUTO, NULL, 0, NULL };
+        writer->out = aw_open(filename, io ? io : &cfg);
+    }
+    if (!writer->out) {
+        free(writer->metadata);
+        writer->metadata = NULL;
+        pb_timeseries_free(writer);
         return NULL;
     }
 
-    /* Initialize and store metadata (will be written with each sample) */
-    writer->metadata = (Memsys__Timeseries__RunMetadata*)
-        malloc(sizeof(Memsys__Timeseries__RunMetadata));
     memsys__timeseries__run_metadata__init(writer->metadata);
-
     writer->metadata->profiler = strdup(profiler);
     writer->metadata->pid = pid;
     writer->metadata->command = strdup(command);
@@ -123,105 +292,121 @@ pb_timeseries_writer_t* pb_timeseries_writer_create(
     writer->metadata->cache_line_size = cache_line_size;
     writer->metadata->start_timestamp = 0;
     writer->metadata->num_threads = 0;
+    writer->metadata->page_size = MEMREF_PAGE_SIZE;
+    writer->metadata->huge_page_size = MEMREF_HUGE_PAGE_SIZE;
+
+    /* Point each preallocated sample at its slice of the histogram and
+       region storage; the region counts are set per sample */
+    for (size_t i = 0; i < PB_TS_BATCH_SAMPLES; i++) {
+        Memsys__Timeseries__SampleWindow *sample = &writer->samples[i];
+        memsys__timeseries__sample_window__init(sample);
+        sample->read_size_hist = &writer->hist[i * 2 * PB_TS_SIZE_BINS];
+        sample->n_read_size_hist = PB_TS_SIZE_BINS;
+        sample->write_size_hist = &writer->hist[i * 2 * PB_TS_SIZE_BINS + PB_TS_SIZE_BINS];
+        sample->n_write_size_hist = PB_TS_SIZE_BINS;
+        sample->region_reads = &writer->region_counts[i * 3 * PB_TS_REGIONS];
+        sample->region_writes = &writer->region_counts[i * 3 * PB_TS_REGIONS + PB_TS_REGIONS];
+        sample->region_bytes = &writer->region_counts[i * 3 * PB_TS_REGIONS + 2 * PB_TS_REGIONS];
+        sample->region_wss = &writer->region_wss[i * PB_TS_REGIONS];
+        writer->sample_ptrs[i] = sample;
+    }
 
-    writer->total_samples_written = 0;
+    /* Header record: magic, then metadata once for the whole file */
+    Memsys__Timeseries__TimeSeriesHeader header = MEMSYS__TIMESERIES__TIME_SERIES_HEADER__INIT;
+    header.format_version = PB_TS_FORMAT_VERSION;
+    header.metadata = writer->metadata;
+    header.size_bins = (char**)pb_ts_size_bins;
+    header.n_size_bins = PB_TS_SIZE_BINS;
+    header.regions = (char**)pb_ts_regions;
+    header.n_regions = PB_TS_REGIONS;
 
-    return writer;
-}
+    Memsys__Timeseries__TimeSeriesRecord record = MEMSYS__TIMESERIES__TIME_SERIES_RECORD__INIT;
+    record.record_case = MEMSYS__TIMESERIES__TIME_SERIES_RECORD__RECORD_HEADER;
+    record.header = &header;
 
-void pb_timeseries_write_sample(pb_timeseries_writer_t *writer,
-                                uint64_t window_number,
-                                uint32_t thread_id,
-                                uint64_t read_count,
-                                uint64_t write_count,
-                                uint64_t total_refs,
-                                uint64_t wss_exact,
-                                double wss_approx,
-                                uint64_t timestamp,
-                                uint64_t read_size_1, uint64_t read_size_2, uint64_t read_size_4, uint64_t read_size_8,
-                                uint64_t read_size_16, uint64_t read_size_32, uint64_t read_size_64, uint64_t read_size_other,
-                                uint64_t write_size_1, uint64_t write_size_2, uint64_t write_size_4, uint64_t write_size_8,
-                                uint64_t write_size_16, uint64_t write_size_32, uint64_t write_size_64, uint64_t write_size_other) {
-    if (!writer) return;
+    aw_write(writer->out, pb_ts_magic, sizeof(pb_ts_magic));
+    pb_timeseries_write_record(writer, &record);
 
-    /* Create a single sample */
-    Memsys__Timeseries__SampleWindow sample = MEMSYS__TIMESERIES__SAMPLE_WINDOW__INIT;
-    sample.window_number = window_number;
-    sample.thread_id = thread_id;
-    sample.read_count = read_count;
-    sample.write_count = write_count;
-    sample.total_refs = total_refs;
-    sample.wss_exact = wss_exact;
-    sample.wss_approx = wss_approx;
-    sample.timestamp = timestamp;
-
-    /* Set read size histograms */
-    sample.read_size_1 = read_size_1;
-    sample.read_size_2 = read_size_2;
-    sample.read_size_4 = read_size_4;
-    sample.read_size_8 = read_size_8;
-    sample.read_size_16 = read_size_16;
-    sample.read_size_32 = read_size_32;
-    sample.read_size_64 = read_size_64;
-    sample.read_size_other = read_size_other;
-
-    /* Set write size histograms */
-    sample.write_size_1 = write_size_1;
-    sample.write_size_2 = write_size_2;
-    sample.write_size_4 = write_size_4;
-    sample.write_size_8 = write_size_8;
-    sample.write_size_16 = write_size_16;
-    sample.write_size_32 = write_size_32;
-    sample.write_size_64 = write_size_64;
-    sample.write_size_other = write_size_other;
-
-    /* Create a wrapper TimeSeriesData with metadata and this single sample */
-    Memsys__Timeseries__TimeSeriesData data = MEMSYS__TIMESERIES__TIME_SERIES_DATA__INIT;
-    data.metadata = writer->metadata;
-    Memsys__Timeseries__SampleWindow *sample_ptr = &sample;
-    data.samples = &sample_ptr;
-    data.n_samples = 1;
-
-    /* Serialize and write immediately */
-    size_t packed_size = memsys__timeseries__time_series_data__get_packed_size(&data);
-    uint8_t *buffer = (uint8_t*)malloc(packed_size);
-    memsys__timeseries__time_series_data__pack(&data, buffer);
+    return writer;
+}
 
-    /* Write length-delimited: 4-byte size + data */
-    uint32_t msg_size = (uint32_t)packed_size;
-    fwrite(&msg_size, sizeof(uint32_t), 1, writer->file);
-    fwrite(buffer, 1, packed_size, writer->file);
-    fflush(writer->file);  /* Force to disk immediately */
+pb_timeseries_writer_t* pb_timeseries_writer_create(
+    const char *filename,
+    const char *profiler,
+    uint32_t pid,
+    const char *command,
+    uint32_t sample_window_refs,
+    uint32_t cache_line_size) {
+    return pb_timeseries_writer_create_io(filename, profiler, pid, command,
+                                          sample_window_refs, cache_line_size, NULL);
+}
 
-    free(buffer);
-    writer->total_samples_written++;
+void pb_timeseries_write_sample(pb_timeseries_writer_t *writer,
+                                const pb_ts_sample_t *sample) {
+    if (!writer || !sample) return;
+
+    Memsys__Timeseries__SampleWindow *out = &writer->samples[writer->n_samples];
+    out->window_number = sample->window_number;
+    out->thread_id = sample->thread_id;
+    out->read_count = sample->read_count;
+    out->write_count = sample->write_count;
+    out->total_refs = sample->total_refs;
+    out->wss_exact = sample->wss_exact;
+    out->wss_approx = sample->wss_approx;
+    out->timestamp = sample->timestamp;
+    memcpy(out->read_size_hist, sample->read_size_hist, sizeof(sample->read_size_hist));
+    memcpy(out->write_size_hist, sample->write_size_hist, sizeof(sample->write_size_hist));
+    out->wss_page_exact = sample->wss_page_exact;
+    out->wss_page_approx = sample->wss_page_approx;
+    out->wss_huge_page_exact = sample->wss_huge_page_exact;
+    out->wss_huge_page_approx = sample->wss_huge_page_approx;
+    out->l1_hits = sample->l1_hits;
+    out->l1_misses = sample->l1_misses;
+    out->l2_hits = sample->l2_hits;
+    out->l2_misses = sample->l2_misses;
+    out->llc_hits = sample->llc_hits;
+    out->llc_misses = sample->llc_misses;
+    out->n_region_reads = out->n_region_writes = out->n_region_bytes = out->n_region_wss =
+        sample->n_regions;
+    memcpy(out->region_reads, sample->region_reads, sizeof(sample->region_reads));
+    memcpy(out->region_writes, sample->region_writes, sizeof(sample->region_writes));
+    memcpy(out->region_bytes, sample->region_bytes, sizeof(sample->region_bytes));
+    memcpy(out->region_wss, sample->region_wss, sizeof(sample->region_wss));
+
+    if (++writer->n_samples == PB_TS_BATCH_SAMPLES)
+        pb_timeseries_write_batch(writer);
 }
 
 void pb_timeseries_flush(pb_timeseries_writer_t *writer) {
     if (!writer) return;
-    /* Ensure OS buffer is flushed to disk */
-    fflush(writer->file);
+    pb_timeseries_write_batch(writer);
+    /* Wait until everything handed to the I/O thread is written */
+    aw_flush(writer->out);
 }
 
 void pb_timeseries_set_num_threads(pb_timeseries_writer_t *writer,
                                    uint32_t num_threads) {
-    if (!writer || !writer->metadata) return;
-    writer->metadata->num_threads = num_threads;
+    if (!writer) return;
+    writer->num_threads = num_threads;
 }
 
 void pb_timeseries_writer_close(pb_timeseries_writer_t *writer) {
     if (!writer) return;
 
-    /* Final flush */
-    fflush(writer->file);
+    pb_timeseries_write_batch(writer);
 
-    /* Cleanup metadata */
-    free((void*)writer->metadata->profiler);
-    free((void*)writer->metadata->command);
-    free(writer->metadata);
+    /* Trailer with the values only known at the end of the run */
+    Memsys__Timeseries__TimeSeriesTrailer trailer = MEMSYS__TIMESERIES__TIME_SERIES_TRAILER__INIT;
+    trailer.num_threads = writer->num_threads;
+    trailer.num_samples = writer->total_samples_written;
 
-    fclose(writer->file);
-    free(writer);
+    Memsys__Timeseries__TimeSeriesRecord record = MEMSYS__TIMESERIES__TIME_SERIES_RECORD__INIT;
+    record.record_case = MEMSYS__TIMESERIES__TIME_SERIES_RECORD__RECORD_TRAILER;
+    record.trailer = &trailer;
+    pb_timeseries_write_record(writer, &record);
+
+    aw_close(writer->out);
+    pb_timeseries_free(writer);
 }
 
 #else /* !HAVE_PROTOBUF_C */
@@ -239,6 +424,23 @@ void pb_trace_write_event(pb_trace_writer_t *writer,
     /* No-op */
 }
 
+pb_trace_writer_t* pb_trace_writer_create_chunked(const char *filename,
+                                                  size_t chunk_events) {
+    return pb_trace_writer_create(filename);
+}
+
+pb_trace_writer_t* pb_trace_writer_create_io(const char *filename,
+                                             size_t chunk_events,
+                                             const aw_config_t *io) {
+    return pb_trace_writer_create(filename);
+}
+
+void pb_trace_write_events(pb_trace_writer_t *writer,
+                           const pb_trace_event_t *events,
+                           size_t n) {
+    /* No-op */
+}
+
 void pb_trace_flush(pb_trace_writer_t *writer) {
     /* No-op */
 }
@@ -255,16 +457,16 @@ pb_timeseries_writer_t* pb_timeseries_writer_create(
     return NULL;
 }
 
+pb_timeseries_writer_t* pb_timeseries_writer_create_io(
+    const char *filename, const char *profiler, uint32_t pid,
+    const char *command, uint32_t sample_window_refs,
+    uint32_t cache_line_size, const aw_config_t *io) {
+    return pb_timeseries_writer_create(filename, profiler, pid, command,
+                                       sample_window_refs, cache_line_size);
+}
+
 void pb_timeseries_write_sample(pb_timeseries_writer_t *writer,
-                                uint64_t window_number, uint32_t thread_id,
-                                uint64_t read_count, uint64_t write_count,
-                                uint64_t total_refs,
-                                uint64_t wss_exact, double wss_approx,
-                                uint64_t timestamp,
-                                uint64_t read_size_1, uint64_t read_size_2, uint64_t read_size_4, uint64_t read_size_8,
-                                uint64_t read_size_16, uint64_t read_size_32, uint64_t read_size_64, uint64_t read_size_other,
-                                uint64_t write_size_1, uint64_t write_size_2, uint64_t write_size_4, uint64_t write_size_8,
-                                uint64_t write_size_16, uint64_t write_size_32, uint64_t write_size_64, uint64_t write_size_other) {
+                                const pb_ts_sample_t *sample) {
     /* No-op */
 }
 
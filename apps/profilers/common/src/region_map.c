@@ -0,0 +1,223 @@
+#include "region_map.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define RM_MIN_CAP 64
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint8_t  region;
+} rm_range_t;
+
+struct region_map {
+    rm_range_t *ranges;        /* sorted, disjoint */
+    size_t      n;
+    size_t      cap;
+    int         readers;
+    char        writer;        /* held, or wanted, by an updater */
+};
+
+static const char *const mem_region_names[MEM_REGION_COUNT] = {
+    "other", "stack", "heap", "global", "mmap"
+};
+
+/* --- helpers --- */
+
+/* Readers announce themselves and back off while a writer is about;
+   the writer takes its flag first and then waits for the readers to
+   drain, so neither can miss the other */
+static void rm_read_lock(region_map_t *m) {
+    for (;;) {
+        while (__atomic_load_n(&m->writer, __ATOMIC_RELAXED))
+            ;
+        __atomic_add_fetch(&m->readers, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&m->writer, __ATOMIC_SEQ_CST))
+            return;
+        __atomic_sub_fetch(&m->readers, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void rm_read_unlock(region_map_t *m) {
+    __atomic_sub_fetch(&m->readers, 1, __ATOMIC_RELEASE);
+}
+
+static void rm_write_lock(region_map_t *m) {
+    while (__atomic_test_and_set(&m->writer, __ATOMIC_SEQ_CST)) {
+        while (__atomic_load_n(&m->writer, __ATOMIC_RELAXED))
+            ;
+    }
+    while (__atomic_load_n(&m->readers, __ATOMIC_SEQ_CST))
+        ;
+}
+
+static void rm_write_unlock(region_map_t *m) {
+    __atomic_clear(&m->writer, __ATOMIC_RELEASE);
+}
+
+/* Room for n + extra ranges */
+static int rm_reserve(region_map_t *m, size_t extra) {
+    if (m->n + extra <= m->cap)
+        return 0;
+
+    size_t cap = m->cap ? m->cap : RM_MIN_CAP;
+    while (cap < m->n + extra)
+        cap *= 2;
+    rm_range_t *ranges = (rm_range_t*)realloc(m->ranges, cap * sizeof(rm_range_t));
+    if (!ranges)
+        return -1;
+    m->ranges = ranges;
+    m->cap = cap;
+    return 0;
+}
+
+/* Index of the last range starting at or below addr, or -1. Branch-free
+   halving: lookups of scattered addresses would mispredict every step. */
+static ptrdiff_t rm_floor(const region_map_t *m, uint64_t addr) {
+    const rm_range_t *base = m->ranges;
+    size_t len = m->n;
+
+    if (len == 0)
+        return -1;
+    while (len > 1) {
+        size_t half = len / 2;
+        base = base[half].start <= addr ? base + half : base;
+        len -= half;
+    }
+    return base->start <= addr ? base - m->ranges : -1;
+}
+
+/* The interval, range or gap, that holds addr: [*lo, *hi) of region */
+static uint8_t rm_find(const region_map_t *m, uint64_t addr, uint64_t *lo, uint64_t *hi) {
+    ptrdiff_t i = rm_floor(m, addr);
+
+    if (i >= 0 && addr < m->ranges[i].end) {
+        *lo = m->ranges[i].start;
+        *hi = m->ranges[i].end;
+        return m->ranges[i].region;
+    }
+    *lo = i >= 0 ? m->ranges[i].end : 0;
+    *hi = (size_t)(i + 1) < m->n ? m->ranges[i + 1].start : UINT64_MAX;
+    return MEM_REGION_OTHER;
+}
+
+/* Clear [start, end), splitting ranges that straddle its ends; returns
+   where a range starting at start goes. Needs room for one more range. */
+static size_t rm_carve(region_map_t *m, uint64_t start, uint64_t end) {
+    rm_range_t *r = m->ranges;
+    size_t i = (size_t)(rm_floor(m, start) + 1), j;
+
+    if (i > 0 && r[i - 1].start == start)
+        i--;
+    /* a range beginning below start keeps its head */
+    if (i > 0 && r[i - 1].end > start) {
+        if (r[i - 1].end > end) {
+            memmove(&r[i + 1], &r[i], (m->n - i) * sizeof(rm_range_t));
+            r[i] = r[i - 1];
+            r[i].start = end;
+            r[i - 1].end = start;
+            m->n++;
+            return i;
+        }
+        r[i - 1].end = start;
+    }
+    /* drop the ranges inside, then trim one straddling end */
+    for (j = i; j < m->n && r[j].end <= end; j++)
+        ;
+    memmove(&r[i], &r[j], (m->n - j) * sizeof(rm_range_t));
+    m->n -= j - i;
+    if (i < m->n && r[i].start < end)
+        r[i].start = end;
+    return i;
+}
+
+/* --- API --- */
+
+region_map_t *region_map_create(void) {
+    return (region_map_t*)calloc(1, sizeof(region_map_t));
+}
+
+void region_map_destroy(region_map_t *m) {
+    if (!m) return;
+    free(m->ranges);
+    free(m);
+}
+
+int region_map_set(region_map_t *m, uint64_t start, uint64_t end, uint8_t region) {
+    int rc = 0;
+
+    if (start >= end)
+        return 0;
+    rm_write_lock(m);
+    /* a split and the new range */
+    if (rm_reserve(m, 2) != 0) {
+        rc = -1;
+    } else {
+        size_t p = rm_carve(m, start, end);
+        rm_range_t *r = m->ranges;
+        if (region != MEM_REGION_OTHER) {
+            int left = p > 0 && r[p - 1].end == start && r[p - 1].region == region;
+            int right = p < m->n && r[p].start == end && r[p].region == region;
+            if (left && right) {
+                r[p - 1].end = r[p].end;
+                memmove(&r[p], &r[p + 1], (m->n - p - 1) * sizeof(rm_range_t));
+                m->n--;
+            } else if (left) {
+                r[p - 1].end = end;
+            } else if (right) {
+                r[p].start = start;
+            } else {
+                memmove(&r[p + 1], &r[p], (m->n - p) * sizeof(rm_range_t));
+                r[p].start = start;
+                r[p].end = end;
+                r[p].region = region;
+                m->n++;
+            }
+        }
+    }
+    rm_write_unlock(m);
+    return rc;
+}
+
+int region_map_remove(region_map_t *m, uint64_t start, uint64_t end) {
+    return region_map_set(m, start, end, MEM_REGION_OTHER);
+}
+
+uint8_t region_map_lookup(region_map_t *m, uint64_t addr) {
+    uint64_t lo, hi;
+    uint8_t region;
+
+    rm_read_lock(m);
+    region = rm_find(m, addr, &lo, &hi);
+    rm_read_unlock(m);
+    return region;
+}
+
+void region_map_lookup_batch(region_map_t *m, const memref_t *refs, size_t n,
+                             uint8_t *regions) {
+    uint64_t lo = 1, hi = 0;   /* empty: the first reference searches */
+    uint8_t region = MEM_REGION_OTHER;
+
+    rm_read_lock(m);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t addr = refs[i].addr;
+        if (addr < lo || addr >= hi)
+            region = rm_find(m, addr, &lo, &hi);
+        regions[i] = region;
+    }
+    rm_read_unlock(m);
+}
+
+size_t region_map_size(region_map_t *m) {
+    size_t n;
+
+    rm_read_lock(m);
+    n = m->n;
+    rm_read_unlock(m);
+    return n;
+}
+
+const char *mem_region_name(unsigned region) {
+    return region < MEM_REGION_COUNT ? mem_region_names[region] : "unknown";
+}
@@ -0,0 +1,355 @@
+#include "reuse_distance.h"
+#include "hash64.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Histogram buckets: distances 0..15 exactly, then 8 log-linear sub-buckets
+ * per power of two (<= 12.5% relative width) up to 2^64.
+ */
+#define RD_LINEAR      16
+#define RD_SUB_BITS    3
+#define RD_SUB         (1u << RD_SUB_BITS)
+#define RD_BUCKETS     (RD_LINEAR + (64 - 4) * RD_SUB)
+
+/* SHARDS: a key is sampled iff the top 24 bits of its hash < threshold */
+#define RD_MOD_BITS    24
+#define RD_MOD         ((uint64_t)1 << RD_MOD_BITS)
+#define RD_SEED        0x9e3779b97f4a7c15ULL
+
+#define RD_MIN_SLOTS   1024
+#define RD_MIN_TABLE   1024
+
+struct rd_ctx {
+    /* sampling */
+    uint64_t  threshold;
+    double    rate;        /* threshold / RD_MOD */
+    size_t    max_keys;
+
+    /* key -> slot (+1, 0 = empty); linear probing, load <= 1/2 */
+    uint64_t *keys;
+    uint64_t *slots;
+    size_t    cap;
+    size_t    n;
+
+    /* Fenwick tree over access slots; a slot is occupied by the key whose
+       last access it was */
+    uint32_t *bit;
+    uint64_t *slot_key;
+    uint64_t *occ;         /* occupancy bitmap */
+    uint64_t  tcap;
+    uint64_t  now;         /* next slot to hand out */
+
+    /* results */
+    double    hist[RD_BUCKETS];
+    double    cold;
+    uint64_t  refs;
+    uint64_t  sampled;
+};
+
+/* --- helpers --- */
+
+static inline uint64_t rd_hash(uint64_t key) {
+    return hash64_u64(key, RD_SEED);
+}
+
+static inline int rd_sampled(const rd_ctx_t *c, uint64_t h) {
+    return (h >> (64 - RD_MOD_BITS)) < c->threshold;
+}
+
+static size_t rd_bucket(uint64_t d) {
+    if (d < RD_LINEAR) return (size_t)d;
+    unsigned e = 63u - (unsigned)__builtin_clzll(d);     /* >= 4 */
+    unsigned sub = (unsigned)(d >> (e - RD_SUB_BITS)) & (RD_SUB - 1);
+    return RD_LINEAR + (size_t)(e - 4) * RD_SUB + sub;
+}
+
+static void rd_bucket_range(size_t b, uint64_t *lo, uint64_t *hi) {
+    if (b < RD_LINEAR) {
+        *lo = b;
+        *hi = b + 1;
+        return;
+    }
+    unsigned e = (unsigned)((b - RD_LINEAR) / RD_SUB) + 4;
+    uint64_t sub = (b - RD_LINEAR) % RD_SUB;
+    uint64_t width = (uint64_t)1 << (e - RD_SUB_BITS);
+    *lo = (RD_SUB + sub) * width;
+    *hi = (e == 63 && sub == RD_SUB - 1) ? UINT64_MAX : *lo + width;
+}
+
+static void bit_add(uint32_t *bit, uint64_t n, uint64_t i, int32_t v) {
+    for (i++; i <= n; i += i & (~i + 1))
+        bit[i - 1] += (uint32_t)v;
+}
+
+/* number of occupied slots in [0, i] */
+static uint64_t bit_prefix(const uint32_t *bit, uint64_t i) {
+    uint64_t s = 0;
+    for (i++; i > 0; i -= i & (~i + 1))
+        s += bit[i - 1];
+    return s;
+}
+
+static size_t table_find(const rd_ctx_t *c, uint64_t key, uint64_t h) {
+    size_t mask = c->cap - 1;
+    size_t i = (size_t)h & mask;
+    while (c->slots[i] != 0 && c->keys[i] != key)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static int table_alloc(rd_ctx_t *c, size_t cap) {
+    uint64_t *keys = (uint64_t *)malloc(cap * sizeof(uint64_t));
+    uint64_t *slots = (uint64_t *)calloc(cap, sizeof(uint64_t));
+    if (!keys || !slots) {
+        free(keys);
+        free(slots);
+        return -1;
+    }
+    free(c->keys);
+    free(c->slots);
+    c->keys = keys;
+    c->slots = slots;
+    c->cap = cap;
+    c->n = 0;
+    return 0;
+}
+
+static int table_grow(rd_ctx_t *c) {
+    uint64_t *old_keys = c->keys, *old_slots = c->slots;
+    size_t old_cap = c->cap;
+
+    c->keys = NULL;
+    c->slots = NULL;
+    if (table_alloc(c, old_cap * 2) != 0) {
+        c->keys = old_keys;
+        c->slots = old_slots;
+        c->cap = old_cap;
+        return -1;
+    }
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old_slots[i] == 0) continue;
+        size_t j = table_find(c, old_keys[i], rd_hash(old_keys[i]));
+        c->keys[j] = old_keys[i];
+        c->slots[j] = old_slots[i];
+        c->n++;
+    }
+    free(old_keys);
+    free(old_slots);
+    return 0;
+}
+
+/* Renumber live keys to slots 0..live-1 in last-access order, dropping
+   those no longer sampled, and rebuild the table and Fenwick tree. */
+static int rd_compact(rd_ctx_t *c) {
+    uint64_t live = 0;
+
+#define RD_OCCUPIED(i) (c->occ[(i) >> 6] & ((uint64_t)1 << ((i) & 63)))
+    for (uint64_t i = 0; i < c->now; i++) {
+        if (RD_OCCUPIED(i) && rd_sampled(c, rd_hash(c->slot_key[i])))
+            live++;
+    }
+
+    /* allocate first so that a failure leaves the context untouched */
+    uint64_t tcap = c->tcap;
+    while (tcap < live * 2)
+        tcap *= 2;
+    if (tcap != c->tcap) {
+        uint32_t *bit = (uint32_t *)realloc(c->bit, tcap * sizeof(uint32_t));
+        if (bit) c->bit = bit;
+        uint64_t *sk = (uint64_t *)realloc(c->slot_key, tcap * sizeof(uint64_t));
+        if (sk) c->slot_key = sk;
+        uint64_t *occ = (uint64_t *)realloc(c->occ, (tcap + 63) / 64 * sizeof(uint64_t));
+        if (occ) c->occ = occ;
+        if (!bit || !sk || !occ) return -1;   /* old tcap is still valid */
+        c->tcap = tcap;
+    }
+
+    size_t cap = c->cap;
+    while (cap < live * 2)
+        cap *= 2;
+    if (table_alloc(c, cap) != 0) return -1;
+
+    uint64_t kept = 0;
+    for (uint64_t i = 0; i < c->now; i++) {
+        if (RD_OCCUPIED(i) && rd_sampled(c, rd_hash(c->slot_key[i])))
+            c->slot_key[kept++] = c->slot_key[i];
+    }
+#undef RD_OCCUPIED
+
+    memset(c->occ, 0, (c->tcap + 63) / 64 * sizeof(uint64_t));
+    for (uint64_t i = 0; i < live; i++) {
+        uint64_t key = c->slot_key[i];
+        size_t j = table_find(c, key, rd_hash(key));
+        c->keys[j] = key;
+        c->slots[j] = i + 1;
+        c->occ[i >> 6] |= (uint64_t)1 << (i & 63);
+    }
+    c->n = live;
+
+    /* linear-time Fenwick build over the first 'live' occupied slots */
+    for (uint64_t i = 0; i < c->tcap; i++)
+        c->bit[i] = i < live ? 1 : 0;
+    for (uint64_t i = 1; i <= c->tcap; i++) {
+        uint64_t j = i + (i & (~i + 1));
+        if (j <= c->tcap) c->bit[j - 1] += c->bit[i - 1];
+    }
+    c->now = live;
+    return 0;
+}
+
+static void rd_access(rd_ctx_t *c, uint64_t key, uint64_t h) {
+    if (c->now == c->tcap && rd_compact(c) != 0) return;
+    if ((c->n + 1) * 2 > c->cap && table_grow(c) != 0) return;
+
+    double w = 1.0 / c->rate;
+    size_t i = table_find(c, key, h);
+    c->sampled++;
+
+    if (c->slots[i] != 0) {
+        uint64_t t = c->slots[i] - 1;
+        uint64_t ds = c->n - bit_prefix(c->bit, t);   /* distinct keys since t */
+        double d = (double)ds * w;
+        c->hist[rd_bucket(d >= 18446744073709551615.0 ? UINT64_MAX : (uint64_t)d)] += w;
+        bit_add(c->bit, c->tcap, t, -1);
+        c->occ[t >> 6] &= ~((uint64_t)1 << (t & 63));
+    } else {
+        c->cold += w;
+        c->keys[i] = key;
+        c->n++;
+    }
+
+    uint64_t s = c->now++;
+    c->slots[i] = s + 1;
+    c->slot_key[s] = key;
+    c->occ[s >> 6] |= (uint64_t)1 << (s & 63);
+    bit_add(c->bit, c->tcap, s, 1);
+
+    /* SHARDS fixed-size: halve the rate and drop keys above it */
+    if (c->max_keys && c->n > c->max_keys && c->threshold > 1) {
+        c->threshold >>= 1;
+        c->rate = (double)c->threshold / (double)RD_MOD;
+        rd_compact(c);
+    }
+}
+
+/* --- API --- */
+
+rd_ctx_t *rd_create(double sample_rate, size_t max_keys) {
+    if (!(sample_rate > 0.0) || sample_rate > 1.0) return NULL;
+
+    rd_ctx_t *c = (rd_ctx_t *)calloc(1, sizeof(rd_ctx_t));
+    if (!c) return NULL;
+
+    c->threshold = (uint64_t)(sample_rate * (double)RD_MOD + 0.5);
+    if (c->threshold == 0) c->threshold = 1;
+    c->rate = (double)c->threshold / (double)RD_MOD;
+    c->max_keys = max_keys;
+
+    c->tcap = RD_MIN_SLOTS;
+    c->bit = (uint32_t *)calloc(c->tcap, sizeof(uint32_t));
+    c->slot_key = (uint64_t *)malloc(c->tcap * sizeof(uint64_t));
+    c->occ = (uint64_t *)calloc((c->tcap + 63) / 64, sizeof(uint64_t));
+    if (!c->bit || !c->slot_key || !c->occ || table_alloc(c, RD_MIN_TABLE) != 0) {
+        rd_destroy(c);
+        return NULL;
+    }
+    return c;
+}
+
+void rd_destroy(rd_ctx_t *ctx) {
+    if (!ctx) return;
+    free(ctx->keys);
+    free(ctx->slots);
+    free(ctx->bit);
+    free(ctx->slot_key);
+    free(ctx->occ);
+    free(ctx);
+}
+
+void rd_record(rd_ctx_t *ctx, uint64_t key) {
+    if (!ctx) return;
+    uint64_t h = rd_hash(key);
+    ctx->refs++;
+    if (rd_sampled(ctx, h))
+        rd_access(ctx, key, h);
+}
+
+void rd_record_batch(rd_ctx_t *ctx, const uint64_t *keys, size_t n) {
+    uint64_t h[64];
+
+    if (!ctx) return;
+    ctx->refs += n;
+    while (n) {
+        size_t k = n < 64 ? n : 64;
+        hash64_u64_batch(keys, h, k, RD_SEED);
+        for (size_t i = 0; i < k; i++) {
+            if (rd_sampled(ctx, h[i]))
+                rd_access(ctx, keys[i], h[i]);
+        }
+        keys += k;
+        n -= k;
+    }
+}
+
+void rd_merge(rd_ctx_t *dst, const rd_ctx_t *src) {
+    if (!dst || !src) return;
+    for (size_t b = 0; b < RD_BUCKETS; b++)
+        dst->hist[b] += src->hist[b];
+    dst->cold += src->cold;
+    dst->refs += src->refs;
+    dst->sampled += src->sampled;
+}
+
+void rd_get_stats(const rd_ctx_t *ctx, rd_stats_t *out_stats) {
+    if (!ctx || !out_stats) return;
+    out_stats->refs = ctx->refs;
+    out_stats->sampled = ctx->sampled;
+    out_stats->live_keys = ctx->n;
+    out_stats->rate = ctx->rate;
+    out_stats->cold = ctx->cold;
+}
+
+size_t rd_histogram(const rd_ctx_t *ctx, rd_bucket_t *out, size_t max) {
+    size_t n = 0;
+
+    if (!ctx) return 0;
+    for (size_t b = 0; b < RD_BUCKETS; b++) {
+        if (ctx->hist[b] == 0.0) continue;
+        if (out && n < max) {
+            rd_bucket_range(b, &out[n].lo, &out[n].hi);
+            out[n].count = ctx->hist[b];
+        }
+        n++;
+    }
+    return n;
+}
+
+double rd_miss_ratio(const rd_ctx_t *ctx, uint64_t cache_keys) {
+    if (!ctx || ctx->refs == 0) return 0.0;
+
+    /* misses = cold + accesses with distance >= cache_keys; a bucket that
+       straddles the size is split assuming uniform distances within it */
+    double misses = ctx->cold;
+    for (size_t b = 0; b < RD_BUCKETS; b++) {
+        if (ctx->hist[b] == 0.0) continue;
+        uint64_t lo, hi;
+        rd_bucket_range(b, &lo, &hi);
+        if (hi <= cache_keys) continue;
+        if (lo >= cache_keys)
+            misses += ctx->hist[b];
+        else
+            misses += ctx->hist[b] * (double)(hi - cache_keys) / (double)(hi - lo);
+    }
+
+    double r = misses / (double)ctx->refs;
+    return r < 0.0 ? 0.0 : (r > 1.0 ? 1.0 : r);
+}
+
+void rd_mrc(const rd_ctx_t *ctx, const uint64_t *cache_keys, size_t n,
+            double *out_miss_ratio) {
+    if (!cache_keys || !out_miss_ratio) return;
+    for (size_t i = 0; i < n; i++)
+        out_miss_ratio[i] = rd_miss_ratio(ctx, cache_keys[i]);
+}
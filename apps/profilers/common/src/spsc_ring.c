@@ -0,0 +1,79 @@
+#include "spsc_ring.h"
+
+#include <stdlib.h>
+
+struct spsc_ring {
+    void  **slots;
+    size_t  mask;
+    char    pad0[64];
+    size_t  tail;          /* next push, written by the producer */
+    size_t  head_cache;    /* producer's last view of head */
+    char    pad1[64];
+    size_t  head;          /* next pop, written by the consumer */
+    size_t  tail_cache;    /* consumer's last view of tail */
+    char    pad2[64];
+};
+
+/* --- API --- */
+
+spsc_ring_t *spsc_ring_create(size_t capacity) {
+    size_t cap = 1;
+
+    if (capacity == 0)
+        return NULL;
+    while (cap < capacity)
+        cap <<= 1;
+
+    spsc_ring_t *r = (spsc_ring_t*)calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    r->slots = (void**)calloc(cap, sizeof(void*));
+    if (!r->slots) {
+        free(r);
+        return NULL;
+    }
+    r->mask = cap - 1;
+    return r;
+}
+
+void spsc_ring_destroy(spsc_ring_t *r) {
+    if (!r) return;
+    free(r->slots);
+    free(r);
+}
+
+int spsc_ring_push(spsc_ring_t *r, void *item) {
+    size_t tail = r->tail;
+
+    if (tail - r->head_cache > r->mask) {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (tail - r->head_cache > r->mask)
+            return -1;
+    }
+    r->slots[tail & r->mask] = item;
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void *spsc_ring_pop(spsc_ring_t *r) {
+    size_t head = r->head;
+
+    if (head == r->tail_cache) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head == r->tail_cache)
+            return NULL;
+    }
+    void *item = r->slots[head & r->mask];
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+size_t spsc_ring_size(const spsc_ring_t *r) {
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    /* the two loads are not one snapshot; clamp a head read after tail */
+    return tail - head <= r->mask + 1 ? tail - head : 0;
+}
+
+size_t spsc_ring_capacity(const spsc_ring_t *r) {
+    return r->mask + 1;
+}
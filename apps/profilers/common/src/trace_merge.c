@@ -0,0 +1,510 @@
+#include "trace_merge.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char ts_magic[4] = { 'M', 'S', 'T', 'S' };
+
+/* Wire format (memory_trace.proto, timeseries_metrics.proto) */
+#define WIRE_VARINT      0
+#define WIRE_FIXED64     1
+#define WIRE_LENGTH      2
+#define WIRE_FIXED32     5
+
+#define TRACE_EVENTS     1   /* MemoryTrace.events */
+#define EVENT_TIMESTAMP  1   /* MemoryEvent.timestamp */
+#define RECORD_HEADER    1   /* TimeSeriesRecord oneof */
+#define RECORD_BATCH     2
+#define RECORD_TRAILER   3
+#define BATCH_SAMPLES    1   /* SampleBatch.samples */
+#define SAMPLE_TIMESTAMP 8   /* SampleWindow.timestamp */
+#define TRAILER_THREADS  1
+#define TRAILER_SAMPLES  2
+
+#define MERGE_IO_BUFFER  (1 << 20)   /* output */
+#define MERGE_INPUT_BUFFER (64 << 10)
+#define MERGE_MAX_INPUTS 256         /* open inputs per pass */
+#define MERGE_BATCH_SAMPLES 256   /* samples per output SampleBatch */
+
+/* One input stream: the current length-delimited record and the item
+   (event or sample) at the front of the stream */
+typedef struct {
+    FILE     *file;
+    char     *io_buf;
+    uint8_t  *rec;
+    size_t    rec_cap;
+    size_t    rec_len;
+    size_t    pos;          /* parse position in rec */
+    size_t    end;          /* end of the SampleBatch in rec (time series) */
+    const uint8_t *item;
+    size_t    item_len;
+    uint64_t  key;          /* timestamp of the item */
+} merge_input_t;
+
+typedef struct {
+    FILE     *file;
+    char     *io_buf;
+    uint8_t  *chunk;
+    size_t    chunk_len;
+    size_t    chunk_cap;
+    size_t    chunk_events;
+    int       error;
+} merge_output_t;
+
+/* --- helpers --- */
+
+static int read_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    uint64_t x = 0;
+    for (unsigned shift = 0; shift < 64 && *p < end; shift += 7) {
+        uint8_t b = *(*p)++;
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int skip_field(const uint8_t **p, const uint8_t *end, unsigned wire) {
+    uint64_t v;
+    switch (wire) {
+    case WIRE_VARINT:
+        return read_varint(p, end, &v);
+    case WIRE_FIXED64:
+        if (end - *p < 8) return 0;
+        *p += 8;
+        return 1;
+    case WIRE_LENGTH:
+        if (!read_varint(p, end, &v) || v > (uint64_t)(end - *p)) return 0;
+        *p += v;
+        return 1;
+    case WIRE_FIXED32:
+        if (end - *p < 4) return 0;
+        *p += 4;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static size_t put_varint(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+/* Next length-delimited field `field` in [*p, end); skips other fields.
+   Returns 1 with the payload, 0 at the end, -1 if malformed. */
+static int next_message(const uint8_t **p, const uint8_t *end, unsigned field,
+                        const uint8_t **msg, size_t *len) {
+    while (*p < end) {
+        uint64_t tag, n;
+        if (!read_varint(p, end, &tag)) return -1;
+        unsigned wire = (unsigned)(tag & 7);
+        if ((tag >> 3) == field && wire == WIRE_LENGTH) {
+            if (!read_varint(p, end, &n) || n > (uint64_t)(end - *p)) return -1;
+            *msg = *p;
+            *len = (size_t)n;
+            *p += n;
+            return 1;
+        }
+        if (!skip_field(p, end, wire)) return -1;
+    }
+    return 0;
+}
+
+/* Varint field `field` of a message, 0 if absent */
+static uint64_t varint_field(const uint8_t *p, const uint8_t *end, unsigned field) {
+    uint64_t value = 0;
+    while (p < end) {
+        uint64_t tag, v;
+        if (!read_varint(&p, end, &tag)) break;
+        unsigned wire = (unsigned)(tag & 7);
+        if ((tag >> 3) == field && wire == WIRE_VARINT) {
+            if (!read_varint(&p, end, &v)) break;
+            value = v;      /* last one wins, as in protobuf */
+        } else if (!skip_field(&p, end, wire)) {
+            break;
+        }
+    }
+    return value;
+}
+
+static int input_open(merge_input_t *in, const char *filename) {
+    memset(in, 0, sizeof(*in));
+    in->file = fopen(filename, "rb");
+    if (!in->file) return -1;
+    in->io_buf = (char*)malloc(MERGE_INPUT_BUFFER);
+    if (in->io_buf) setvbuf(in->file, in->io_buf, _IOFBF, MERGE_INPUT_BUFFER);
+    return 0;
+}
+
+static void input_close(merge_input_t *in) {
+    if (in->file) fclose(in->file);
+    free(in->io_buf);
+    free(in->rec);
+    memset(in, 0, sizeof(*in));
+}
+
+/* Read the next 4-byte size + record. Returns 0 at the end of the file,
+   including a truncated last record. */
+static int input_read_record(merge_input_t *in) {
+    uint8_t prefix[4];
+    if (fread(prefix, 1, sizeof(prefix), in->file) != sizeof(prefix)) return 0;
+    size_t len = (size_t)prefix[0] | (size_t)prefix[1] << 8 |
+                 (size_t)prefix[2] << 16 | (size_t)prefix[3] << 24;
+    if (len > in->rec_cap) {
+        uint8_t *rec = (uint8_t*)realloc(in->rec, len);
+        if (!rec) return 0;
+        in->rec = rec;
+        in->rec_cap = len;
+    }
+    if (fread(in->rec, 1, len, in->file) != len) return 0;
+    in->rec_len = len;
+    in->pos = 0;
+    return 1;
+}
+
+/* Advance to the next event of a trace input: 1, 0 at the end, -1 if
+   malformed */
+static int trace_next_event(merge_input_t *in) {
+    for (;;) {
+        const uint8_t *p = in->rec + in->pos;
+        const uint8_t *end = in->rec + in->rec_len;
+        int rc = next_message(&p, end, TRACE_EVENTS, &in->item, &in->item_len);
+        if (rc < 0) return -1;
+        if (rc > 0) {
+            in->pos = (size_t)(p - in->rec);
+            in->key = varint_field(in->item, in->item + in->item_len, EVENT_TIMESTAMP);
+            return 1;
+        }
+        if (!input_read_record(in)) return 0;
+    }
+}
+
+/* Advance to the next sample of a time-series input, across its
+   SampleBatch records: 1, 0 at the trailer or the end, -1 if malformed */
+static int timeseries_next_sample(merge_input_t *in) {
+    for (;;) {
+        const uint8_t *p = in->rec + in->pos;
+        int rc = next_message(&p, in->rec + in->end, BATCH_SAMPLES,
+                              &in->item, &in->item_len);
+        if (rc < 0) return -1;
+        if (rc > 0) {
+            in->pos = (size_t)(p - in->rec);
+            in->key = varint_field(in->item, in->item + in->item_len, SAMPLE_TIMESTAMP);
+            return 1;
+        }
+
+        /* next batch record; the trailer ends the stream, anything else
+           is skipped */
+        const uint8_t *batch;
+        size_t batch_len;
+        do {
+            if (!input_read_record(in)) return 0;
+            p = in->rec;
+            rc = next_message(&p, in->rec + in->rec_len, RECORD_BATCH, &batch, &batch_len);
+            if (rc < 0) return -1;
+            if (rc == 0) {
+                p = in->rec;
+                if (next_message(&p, in->rec + in->rec_len, RECORD_TRAILER,
+                                 &batch, &batch_len) > 0)
+                    return 0;
+            }
+        } while (rc == 0);
+        in->pos = (size_t)(batch - in->rec);
+        in->end = in->pos + batch_len;
+    }
+}
+
+/* Binary min-heap of input indices by (key, index) */
+static int heap_less(const merge_input_t *in, size_t a, size_t b) {
+    return in[a].key < in[b].key || (in[a].key == in[b].key && a < b);
+}
+
+static void heap_down(size_t *heap, size_t n, size_t i, const merge_input_t *in) {
+    for (;;) {
+        size_t l = 2 * i + 1, m = i;
+        if (l < n && heap_less(in, heap[l], heap[m])) m = l;
+        if (l + 1 < n && heap_less(in, heap[l + 1], heap[m])) m = l + 1;
+        if (m == i) return;
+        size_t t = heap[i];
+        heap[i] = heap[m];
+        heap[m] = t;
+        i = m;
+    }
+}
+
+static void heap_build(size_t *heap, size_t n, const merge_input_t *in) {
+    for (size_t i = n / 2; i-- > 0;)
+        heap_down(heap, n, i, in);
+}
+
+static int output_open(merge_output_t *out, const char *filename, size_t chunk_events) {
+    memset(out, 0, sizeof(*out));
+    out->file = fopen(filename, "wb");
+    if (!out->file) return -1;
+    out->io_buf = (char*)malloc(MERGE_IO_BUFFER);
+    if (out->io_buf) setvbuf(out->file, out->io_buf, _IOFBF, MERGE_IO_BUFFER);
+    out->chunk_events = chunk_events;
+    return 0;
+}
+
+static void output_write(merge_output_t *out, const void *data, size_t len) {
+    if (len && fwrite(data, 1, len, out->file) != len) out->error = 1;
+}
+
+/* Write one length-delimited record */
+static void output_record(merge_output_t *out, const uint8_t *rec, size_t len) {
+    uint8_t prefix[4] = { (uint8_t)len, (uint8_t)(len >> 8),
+                          (uint8_t)(len >> 16), (uint8_t)(len >> 24) };
+    output_write(out, prefix, sizeof(prefix));
+    output_write(out, rec, len);
+}
+
+/* Append one event (MemoryTrace.events entry) or sample (SampleBatch.samples
+   entry; also field 1) to the open chunk */
+static void output_event(merge_output_t *out, const uint8_t *ev, size_t len) {
+    size_t need = out->chunk_len + 11 + len;
+    if (need > out->chunk_cap) {
+        size_t cap = out->chunk_cap ? out->chunk_cap : 1 << 16;
+        while (cap < need) cap *= 2;
+        uint8_t *chunk = (uint8_t*)realloc(out->chunk, cap);
+        if (!chunk) {
+            out->error = 1;
+            return;
+        }
+        out->chunk = chunk;
+        out->chunk_cap = cap;
+    }
+    out->chunk[out->chunk_len++] = (uint8_t)(TRACE_EVENTS << 3 | WIRE_LENGTH);
+    out->chunk_len += put_varint(out->chunk + out->chunk_len, len);
+    memcpy(out->chunk + out->chunk_len, ev, len);
+    out->chunk_len += len;
+}
+
+static void output_chunk(merge_output_t *out) {
+    if (out->chunk_len == 0) return;
+    output_record(out, out->chunk, out->chunk_len);
+    out->chunk_len = 0;
+}
+
+/* Write the open chunk of samples as one SampleBatch record */
+static void output_batch(merge_output_t *out) {
+    uint8_t head[11];
+    size_t hlen = 0;
+
+    if (out->chunk_len == 0) return;
+    head[hlen++] = RECORD_BATCH << 3 | WIRE_LENGTH;
+    hlen += put_varint(head + hlen, out->chunk_len);
+    size_t len = hlen + out->chunk_len;
+    uint8_t prefix[4] = { (uint8_t)len, (uint8_t)(len >> 8),
+                          (uint8_t)(len >> 16), (uint8_t)(len >> 24) };
+    output_write(out, prefix, sizeof(prefix));
+    output_write(out, head, hlen);
+    output_write(out, out->chunk, out->chunk_len);
+    out->chunk_len = 0;
+}
+
+/* Returns -1 if anything failed to write */
+static int output_close(merge_output_t *out) {
+    int error = out->error;
+    if (fclose(out->file) != 0) error = 1;
+    free(out->io_buf);
+    free(out->chunk);
+    return error ? -1 : 0;
+}
+
+/* Merge of at most MERGE_MAX_INPUTS inputs into output */
+typedef int64_t (*merge_pass_t)(const char *output, const char *const *inputs,
+                                size_t n_inputs, size_t arg);
+
+/*
+ * Run pass over the inputs at most MERGE_MAX_INPUTS at a time: consecutive
+ * groups are merged into temporary files next to the output, named by
+ * level so that no pass writes one of its inputs, and those are merged in
+ * turn. Groups keep the input order, so ties still do. Returns what the
+ * last pass returns.
+ */
+static int64_t merge_in_passes(const char *output, const char *const *inputs,
+                               size_t n_inputs, merge_pass_t pass, size_t arg,
+                               unsigned level) {
+    if (n_inputs <= MERGE_MAX_INPUTS)
+        return pass(output, inputs, n_inputs, arg);
+
+    size_t groups = (n_inputs + MERGE_MAX_INPUTS - 1) / MERGE_MAX_INPUTS;
+    size_t name_len = strlen(output) + 48;
+    char **parts = (char**)calloc(groups, sizeof(char*));
+    int64_t written = -1;
+    size_t made = 0;
+    if (!parts) return -1;
+
+    for (size_t g = 0; g < groups; g++) {
+        size_t lo = g * MERGE_MAX_INPUTS;
+        size_t n = n_inputs - lo < MERGE_MAX_INPUTS ? n_inputs - lo : MERGE_MAX_INPUTS;
+        parts[g] = (char*)malloc(name_len);
+        if (!parts[g]) goto done;
+        snprintf(parts[g], name_len, "%s.merge%u.%zu", output, level, g);
+        made = g + 1;
+        if (pass(parts[g], inputs + lo, n, arg) < 0) goto done;
+    }
+    written = merge_in_passes(output, (const char *const *)parts, groups, pass, arg,
+                              level + 1);
+
+done:
+    for (size_t g = 0; g < made; g++) {
+        remove(parts[g]);
+        free(parts[g]);
+    }
+    free(parts);
+    return written;
+}
+
+static int64_t trace_merge_pass(const char *output, const char *const *inputs,
+                                size_t n_inputs, size_t chunk_events) {
+
+    merge_input_t *in = (merge_input_t*)calloc(n_inputs ? n_inputs : 1, sizeof(*in));
+    size_t *heap = (size_t*)malloc((n_inputs ? n_inputs : 1) * sizeof(size_t));
+    merge_output_t out;
+    int64_t written = -1;
+    size_t n = 0;
+    if (!in || !heap) goto done;
+
+    for (size_t i = 0; i < n_inputs; i++) {
+        if (input_open(&in[i], inputs[i]) != 0) goto done;
+        int rc = trace_next_event(&in[i]);
+        if (rc < 0) goto done;
+        if (rc > 0) heap[n++] = i;
+    }
+    if (output_open(&out, output, chunk_events) != 0) goto done;
+
+    written = 0;
+    heap_build(heap, n, in);
+    while (n > 0) {
+        merge_input_t *top = &in[heap[0]];
+        output_event(&out, top->item, top->item_len);
+        if ((uint64_t)++written % chunk_events == 0) output_chunk(&out);
+
+        int rc = trace_next_event(top);
+        if (rc < 0) out.error = 1;
+        if (rc <= 0) heap[0] = heap[--n];
+        heap_down(heap, n, 0, in);
+        if (out.error) break;
+    }
+    output_chunk(&out);
+    if (output_close(&out) != 0) written = -1;
+
+done:
+    for (size_t i = 0; in && i < n_inputs; i++)
+        input_close(&in[i]);   /* unopened inputs are still zeroed */
+    free(in);
+    free(heap);
+    return written;
+}
+
+/* The trailer counts threads threads however many inputs this pass has */
+static int64_t timeseries_merge_pass(const char *output, const char *const *inputs,
+                                     size_t n_inputs, size_t threads) {
+
+    merge_input_t *in = (merge_input_t*)calloc(n_inputs, sizeof(*in));
+    size_t *heap = (size_t*)malloc(n_inputs * sizeof(size_t));
+    uint8_t *header = NULL;
+    size_t header_len = 0;
+    merge_output_t out;
+    int64_t written = -1;
+    size_t n = 0;
+    if (!in || !heap) goto done;
+
+    for (size_t i = 0; i < n_inputs; i++) {
+        merge_input_t *cur = &in[i];
+        char magic[sizeof(ts_magic)];
+        const uint8_t *p, *msg;
+        size_t len;
+
+        if (input_open(cur, inputs[i]) != 0) goto done;
+        if (fread(magic, 1, sizeof(magic), cur->file) != sizeof(magic) ||
+            memcmp(magic, ts_magic, sizeof(magic)) != 0 ||
+            !input_read_record(cur))
+            goto done;
+        p = cur->rec;
+        if (next_message(&p, cur->rec + cur->rec_len, RECORD_HEADER, &msg, &len) <= 0)
+            goto done;
+        if (!header) {
+            header = (uint8_t*)malloc(cur->rec_len ? cur->rec_len : 1);
+            if (!header) goto done;
+            memcpy(header, cur->rec, cur->rec_len);
+            header_len = cur->rec_len;
+        }
+
+        int rc = timeseries_next_sample(cur);
+        if (rc < 0) goto done;
+        if (rc > 0) heap[n++] = i;
+    }
+    if (output_open(&out, output, MERGE_BATCH_SAMPLES) != 0) goto done;
+
+    output_write(&out, ts_magic, sizeof(ts_magic));
+    output_record(&out, header, header_len);
+
+    written = 0;
+    heap_build(heap, n, in);
+    while (n > 0) {
+        merge_input_t *top = &in[heap[0]];
+        output_event(&out, top->item, top->item_len);
+        if ((uint64_t)++written % MERGE_BATCH_SAMPLES == 0) output_batch(&out);
+
+        int rc = timeseries_next_sample(top);
+        if (rc < 0) out.error = 1;
+        if (rc <= 0) heap[0] = heap[--n];
+        heap_down(heap, n, 0, in);
+        if (out.error) break;
+    }
+    output_batch(&out);
+
+    /* Trailer for the merged file; zero fields are omitted as in proto3 */
+    {
+        uint8_t trailer[24], rec[32];
+        size_t tlen = 0, rlen = 0;
+        if (threads) {
+            trailer[tlen++] = TRAILER_THREADS << 3 | WIRE_VARINT;
+            tlen += put_varint(trailer + tlen, threads);
+        }
+        if (written) {
+            trailer[tlen++] = TRAILER_SAMPLES << 3 | WIRE_VARINT;
+            tlen += put_varint(trailer + tlen, (uint64_t)written);
+        }
+        rec[rlen++] = RECORD_TRAILER << 3 | WIRE_LENGTH;
+        rlen += put_varint(rec + rlen, tlen);
+        memcpy(rec + rlen, trailer, tlen);
+        output_record(&out, rec, rlen + tlen);
+    }
+    if (output_close(&out) != 0) written = -1;
+
+done:
+    for (size_t i = 0; in && i < n_inputs; i++)
+        input_close(&in[i]);   /* unopened inputs are still zeroed */
+    free(in);
+    free(heap);
+    free(header);
+    return written;
+}
+
+/* --- API --- */
+
+int64_t trace_merge_files(const char *output, const char *const *inputs,
+                          size_t n_inputs, size_t chunk_events) {
+    if (!output || (!inputs && n_inputs)) return -1;
+    if (chunk_events == 0) chunk_events = TRACE_MERGE_DEFAULT_CHUNK_EVENTS;
+    return merge_in_passes(output, inputs, n_inputs, trace_merge_pass, chunk_events, 0);
+}
+
+int64_t timeseries_merge_files(const char *output, const char *const *inputs,
+                               size_t n_inputs) {
+    if (!output || !inputs || n_inputs == 0) return -1;
+    return merge_in_passes(output, inputs, n_inputs, timeseries_merge_pass, n_inputs, 0);
+}
@@ -0,0 +1,476 @@
+#include "trace_reader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Index file: header, then one entry per chunk (little-endian)
+//   "MSTRIDX\0", u32 version, u32 reserved, u64 trace size,
+//   u64 trace mtime (ns), u64 chunk count
+//   entry: u64 payload offset, u32 length, u32 event count
+static const char kIndexMagic[8] = {'M', 'S', 'T', 'R', 'I', 'D', 'X', '\0'};
+static const size_t kIndexHeader = 40;
+static const size_t kIndexEntry = 16;
+
+// MemoryTrace / MemoryEvent field numbers (proto/memory_trace.proto)
+enum {
+    kTraceEvents = 1,
+    kEventTimestamp = 1,
+    kEventThreadId = 2,
+    kEventAddress = 3,
+    kEventMemOp = 4,
+    kEventHitMiss = 5,
+    kEventSize = 6,
+};
+
+enum { kWireVarint = 0, kWireFixed64 = 1, kWireLength = 2, kWireFixed32 = 5 };
+
+struct trace_reader {
+    const uint8_t* base = nullptr;
+    size_t size = 0;
+    std::vector<trace_chunk_info_t> chunks;
+    uint64_t num_events = 0;
+    uint32_t max_chunk_events = 0;
+};
+
+namespace {
+
+/* --- helpers --- */
+
+inline void put_u32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+inline void put_u64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+inline uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+inline uint64_t get_u64(const uint8_t* p) {
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+inline bool read_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+inline bool skip_field(const uint8_t*& p, const uint8_t* end, unsigned wire) {
+    uint64_t v;
+    switch (wire) {
+    case kWireVarint:
+        return read_varint(p, end, v);
+    case kWireFixed64:
+        if (end - p < 8) return false;
+        p += 8;
+        return true;
+    case kWireLength:
+        if (!read_varint(p, end, v) || v > (uint64_t)(end - p)) return false;
+        p += v;
+        return true;
+    case kWireFixed32:
+        if (end - p < 4) return false;
+        p += 4;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Walk the top-level fields of a MemoryTrace payload. fn(event_begin,
+// event_end) is called for every events entry; returns the number of
+// events, or -1 if the payload is not well-formed.
+template <typename Fn>
+int64_t walk_events(const uint8_t* p, const uint8_t* end, Fn fn) {
+    int64_t n = 0;
+    while (p < end) {
+        uint64_t tag;
+        if (!read_varint(p, end, tag)) return -1;
+        unsigned wire = (unsigned)(tag & 7);
+        if ((tag >> 3) == kTraceEvents && wire == kWireLength) {
+            uint64_t len;
+            if (!read_varint(p, end, len) || len > (uint64_t)(end - p)) return -1;
+            if (!fn(p, p + len, n)) return -1;
+            p += len;
+            n++;
+        } else if (!skip_field(p, end, wire)) {
+            return -1;
+        }
+    }
+    return n;
+}
+
+int64_t count_events(const uint8_t* p, size_t len) {
+    return walk_events(p, p + len, [](const uint8_t*, const uint8_t*, int64_t) { return true; });
+}
+
+// Decode one MemoryEvent straight into column slot i (proto3 defaults are 0)
+bool decode_event(const uint8_t* p, const uint8_t* end, const trace_columns_t* c,
+                  size_t i) {
+    uint64_t timestamp = 0, address = 0, thread_id = 0, mem_op = 0, hit_miss = 0, size = 0;
+    while (p < end) {
+        uint64_t tag;
+        if (!read_varint(p, end, tag)) return false;
+        unsigned wire = (unsigned)(tag & 7);
+        if (wire != kWireVarint) {
+            if (!skip_field(p, end, wire)) return false;
+            continue;
+        }
+        uint64_t v;
+        if (!read_varint(p, end, v)) return false;
+        switch (tag >> 3) {
+        case kEventTimestamp: timestamp = v; break;
+        case kEventThreadId:  thread_id = v; break;
+        case kEventAddress:   address = v; break;
+        case kEventMemOp:     mem_op = v; break;
+        case kEventHitMiss:   hit_miss = v; break;
+        case kEventSize:      size = v; break;
+        default: break;
+        }
+    }
+    if (c->timestamp) c->timestamp[i] = timestamp;
+    if (c->address)   c->address[i] = address;
+    if (c->thread_id) c->thread_id[i] = (uint32_t)thread_id;
+    if (c->size)      c->size[i] = (uint32_t)size;
+    if (c->is_write)  c->is_write[i] = mem_op == 1;
+    if (c->is_miss)   c->is_miss[i] = hit_miss == 1;
+    return true;
+}
+
+int64_t decode_payload(const trace_reader_t* r, const trace_chunk_info_t& ci,
+                       const trace_columns_t* c) {
+    const uint8_t* p = r->base + ci.offset;
+    int64_t n = walk_events(p, p + ci.length,
+        [&](const uint8_t* b, const uint8_t* e, int64_t i) {
+            return i < (int64_t)ci.n_events && decode_event(b, e, c, (size_t)i);
+        });
+    return n == (int64_t)ci.n_events ? n : -1;
+}
+
+// Walk the size prefixes. Stops at the first incomplete or malformed chunk
+// (a writer killed mid-chunk); returns true if the walk reached EOF.
+bool scan_chunks(trace_reader_t* r) {
+    size_t offset = 0;
+    while (r->size - offset >= 4) {
+        uint32_t len = get_u32(r->base + offset);
+        if (len > r->size - offset - 4) return false;
+        int64_t n = count_events(r->base + offset + 4, len);
+        if (n < 0 || n > (int64_t)UINT32_MAX) return false;
+        r->chunks.push_back({offset + 4, len, (uint32_t)n, 0});
+        offset += 4 + (size_t)len;
+    }
+    return offset == r->size;
+}
+
+bool build_index(trace_reader_t* r) {
+    if (r->size == 0 || scan_chunks(r)) return true;
+
+    // Not a clean chunk stream: an older single-message file, or chunks
+    // followed by a truncated one
+    if (r->size <= UINT32_MAX) {
+        int64_t n = count_events(r->base, r->size);
+        if (n >= 0 && n <= (int64_t)UINT32_MAX) {
+            r->chunks.assign(1, {0, (uint32_t)r->size, (uint32_t)n, 0});
+            return true;
+        }
+    }
+    return !r->chunks.empty();
+}
+
+std::string index_path(const char* filename) {
+    return std::string(filename) + ".idx";
+}
+
+uint64_t mtime_ns(const struct stat& st) {
+    return (uint64_t)st.st_mtim.tv_sec * 1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+}
+
+bool load_index(trace_reader_t* r, const char* filename, const struct stat& st) {
+    FILE* f = std::fopen(index_path(filename).c_str(), "rb");
+    if (!f) return false;
+
+    uint8_t hdr[kIndexHeader];
+    bool ok = std::fread(hdr, 1, sizeof(hdr), f) == sizeof(hdr) &&
+              !std::memcmp(hdr, kIndexMagic, 8) &&
+              get_u32(hdr + 8) == TRACE_READER_INDEX_VERSION &&
+              get_u64(hdr + 16) == (uint64_t)st.st_size &&
+              get_u64(hdr + 24) == mtime_ns(st);
+    uint64_t count = ok ? get_u64(hdr + 32) : 0;
+    ok = ok && count <= (uint64_t)st.st_size / 4;
+
+    std::vector<uint8_t> entries;
+    if (ok) {
+        entries.resize((size_t)count * kIndexEntry);
+        ok = std::fread(entries.data(), 1, entries.size(), f) == entries.size();
+    }
+    std::fclose(f);
+    if (!ok) return false;
+
+    r->chunks.resize((size_t)count);
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* e = &entries[i * kIndexEntry];
+        trace_chunk_info_t& ci = r->chunks[i];
+        ci.offset = get_u64(e);
+        ci.length = get_u32(e + 8);
+        ci.n_events = get_u32(e + 12);
+        if (ci.offset > r->size || ci.length > r->size - ci.offset) {
+            r->chunks.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+// Best effort: written to a temporary name and renamed into place, so a
+// concurrent reader never sees a partial index
+void save_index(const trace_reader_t* r, const char* filename, const struct stat& st) {
+    std::string path = index_path(filename);
+    std::string tmp = path + ".tmp." + std::to_string((long)getpid());
+    FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f) return;
+
+    std::vector<uint8_t> buf(kIndexHeader + r->chunks.size() * kIndexEntry);
+    std::memcpy(buf.data(), kIndexMagic, 8);
+    put_u32(&buf[8], TRACE_READER_INDEX_VERSION);
+    put_u32(&buf[12], 0);
+    put_u64(&buf[16], (uint64_t)st.st_size);
+    put_u64(&buf[24], mtime_ns(st));
+    put_u64(&buf[32], (uint64_t)r->chunks.size());
+    for (size_t i = 0; i < r->chunks.size(); i++) {
+        uint8_t* e = &buf[kIndexHeader + i * kIndexEntry];
+        put_u64(e, r->chunks[i].offset);
+        put_u32(e + 8, r->chunks[i].length);
+        put_u32(e + 12, r->chunks[i].n_events);
+    }
+
+    bool ok = std::fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+    }
+}
+
+unsigned resolve_threads(unsigned num_threads, size_t work) {
+    if (num_threads == 0) {
+        num_threads = std::thread::hardware_concurrency();
+        if (num_threads == 0) num_threads = 1;
+    }
+    return (unsigned)std::min<size_t>(num_threads, std::max<size_t>(work, 1));
+}
+
+// Run worker(tid) on num_threads threads (the caller is thread 0). If a
+// thread cannot be started, the ones that did start take its share.
+template <typename Fn>
+void run_parallel(unsigned num_threads, Fn worker) {
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < num_threads; t++) {
+        try {
+            threads.emplace_back(worker, t);
+        } catch (...) {
+            break;
+        }
+    }
+    worker(0u);
+    for (auto& th : threads) th.join();
+}
+
+}  // namespace
+
+extern "C" {
+
+/* --- API --- */
+
+trace_reader_t* trace_reader_open(const char* filename, unsigned flags) {
+    if (!filename) return nullptr;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    std::unique_ptr<trace_reader_t> r(new (std::nothrow) trace_reader_t());
+    if (!r) {
+        close(fd);
+        return nullptr;
+    }
+    r->size = (size_t)st.st_size;
+    if (r->size > 0) {
+        void* m = mmap(nullptr, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            close(fd);
+            return nullptr;
+        }
+        r->base = static_cast<const uint8_t*>(m);
+    }
+    close(fd);
+
+    try {
+        bool use_file = !(flags & TRACE_READER_NO_INDEX_FILE);
+        if (!(use_file && load_index(r.get(), filename, st))) {
+            r->chunks.clear();
+            if (!build_index(r.get())) {
+                trace_reader_close(r.release());
+                return nullptr;
+            }
+            if (use_file && r->size > 0) save_index(r.get(), filename, st);
+        }
+    } catch (...) {
+        trace_reader_close(r.release());
+        return nullptr;
+    }
+
+    for (trace_chunk_info_t& ci : r->chunks) {
+        ci.first_event = r->num_events;
+        r->num_events += ci.n_events;
+        r->max_chunk_events = std::max(r->max_chunk_events, ci.n_events);
+    }
+    return r.release();
+}
+
+void trace_reader_close(trace_reader_t* r) {
+    if (!r) return;
+    if (r->base) munmap(const_cast<uint8_t*>(r->base), r->size);
+    delete r;
+}
+
+size_t trace_reader_num_chunks(const trace_reader_t* r) {
+    return r ? r->chunks.size() : 0;
+}
+
+uint64_t trace_reader_num_events(const trace_reader_t* r) {
+    return r ? r->num_events : 0;
+}
+
+uint32_t trace_reader_max_chunk_events(const trace_reader_t* r) {
+    return r ? r->max_chunk_events : 0;
+}
+
+int trace_reader_chunk_info(const trace_reader_t* r, size_t chunk,
+                            trace_chunk_info_t* out) {
+    if (!r || !out || chunk >= r->chunks.size()) return -1;
+    *out = r->chunks[chunk];
+    return 0;
+}
+
+size_t trace_reader_find_chunk(const trace_reader_t* r, uint64_t event) {
+    if (!r) return 0;
+    if (event >= r->num_events) return r->chunks.size();
+    auto it = std::upper_bound(r->chunks.begin(), r->chunks.end(), event,
+        [](uint64_t e, const trace_chunk_info_t& ci) { return e < ci.first_event; });
+    return (size_t)(it - r->chunks.begin()) - 1;
+}
+
+int64_t trace_reader_decode_chunk(const trace_reader_t* r, size_t chunk,
+                                  const trace_columns_t* cols) {
+    if (!r || !cols || chunk >= r->chunks.size()) return -1;
+    return decode_payload(r, r->chunks[chunk], cols);
+}
+
+int64_t trace_reader_decode_chunks(const trace_reader_t* r, size_t first,
+                                   size_t count, const trace_columns_t* cols,
+                                   unsigned num_threads) {
+    if (!r || !cols || first > r->chunks.size() || count > r->chunks.size() - first) {
+        return -1;
+    }
+    if (count == 0) return 0;
+
+    const uint64_t base = r->chunks[first].first_event;
+    std::atomic<size_t> next(first);
+    std::atomic<bool> failed(false);
+
+    run_parallel(resolve_threads(num_threads, count), [&](unsigned) {
+        for (;;) {
+            size_t i = next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= first + count || failed.load(std::memory_order_relaxed)) return;
+
+            const trace_chunk_info_t& ci = r->chunks[i];
+            size_t at = (size_t)(ci.first_event - base);
+            trace_columns_t c = {
+                cols->timestamp ? cols->timestamp + at : nullptr,
+                cols->address   ? cols->address + at : nullptr,
+                cols->thread_id ? cols->thread_id + at : nullptr,
+                cols->size      ? cols->size + at : nullptr,
+                cols->is_write  ? cols->is_write + at : nullptr,
+                cols->is_miss   ? cols->is_miss + at : nullptr,
+            };
+            if (decode_payload(r, ci, &c) < 0) failed.store(true);
+        }
+    });
+
+    if (failed.load()) return -1;
+    const trace_chunk_info_t& last = r->chunks[first + count - 1];
+    return (int64_t)(last.first_event + last.n_events - base);
+}
+
+int trace_reader_for_each_chunk(const trace_reader_t* r, unsigned num_threads,
+                                trace_chunk_fn fn, void* user) {
+    if (!r || !fn) return -1;
+    if (r->chunks.empty()) return 0;
+
+    std::atomic<size_t> next(0);
+    std::atomic<int> status(0);   // 1 = stopped by fn, -1 = error
+
+    run_parallel(resolve_threads(num_threads, r->chunks.size()), [&](unsigned) {
+        const size_t cap = r->max_chunk_events;
+        std::vector<uint64_t> timestamp, address;
+        std::vector<uint32_t> thread_id, size;
+        std::vector<uint8_t> is_write, is_miss;
+        try {
+            timestamp.resize(cap);
+            address.resize(cap);
+            thread_id.resize(cap);
+            size.resize(cap);
+            is_write.resize(cap);
+            is_miss.resize(cap);
+        } catch (...) {
+            status.store(-1);
+            return;
+        }
+        trace_columns_t c = {timestamp.data(), address.data(), thread_id.data(),
+                             size.data(), is_write.data(), is_miss.data()};
+
+        for (;;) {
+            size_t i = next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= r->chunks.size() || status.load(std::memory_order_relaxed)) return;
+
+            const trace_chunk_info_t& ci = r->chunks[i];
+            int64_t n = decode_payload(r, ci, &c);
+            if (n < 0) {
+                status.store(-1);
+                return;
+            }
+            if (fn(i, ci.first_event, &c, (size_t)n, user)) {
+                int expected = 0;
+                status.compare_exchange_strong(expected, 1);
+                return;
+            }
+        }
+    });
+
+    return status.load();
+}
+
+} // extern "C"
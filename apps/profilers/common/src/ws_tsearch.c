@@ -13,6 +13,10 @@ struct ws_node {
 struct ws_ctx {
     void     *root;   /* tsearch root */
     ws_stats_t stats; /* incremental counters */
+    uint64_t *keys;   /* distinct keys, in first-seen order */
+    size_t    keys_n;
+    size_t    keys_cap;
+    uint64_t  keys_lost; /* distinct keys the list had no room for */
 };
 
 /* --- helpers --- */
@@ -27,6 +31,52 @@ static int ws_cmp(const void *pa, const void *pb) {
 
 static void ws_free_node(void *p) { free(p); }
 
+static void ws_push_key(ws_ctx_t *ctx, uintptr_t key) {
+    if (ctx->keys_n == ctx->keys_cap) {
+        size_t cap = ctx->keys_cap ? 2 * ctx->keys_cap : 1024;
+        uint64_t *keys = (uint64_t *)realloc(ctx->keys, cap * sizeof(uint64_t));
+        if (!keys) {        /* best-effort, like the tree, but counted */
+            ctx->keys_lost++;
+            return;
+        }
+        ctx->keys = keys;
+        ctx->keys_cap = cap;
+    }
+    ctx->keys[ctx->keys_n++] = key;
+}
+
+/* Record count accesses to key (count >= 1) */
+static void ws_record_n(ws_ctx_t *ctx, uintptr_t key, uint64_t count) {
+    ctx->stats.total += count;
+
+    struct ws_node *n = (struct ws_node *)malloc(sizeof(*n));
+    if (!n) return;  /* best-effort */
+    n->key = key;    /* already aligned/normalized by the caller */
+    n->count = count;
+
+    void **slot = tsearch(n, &ctx->root, ws_cmp);
+    if (!slot) {     /* out of memory inside tsearch */
+        free(n);
+        return;
+    }
+
+    struct ws_node *stored = *(struct ws_node **)slot;
+    if (stored == n) {
+        /* brand-new key */
+        ctx->stats.distinct += 1;
+        if (count == 1)
+            ctx->stats.singles += 1;
+        ws_push_key(ctx, key);
+        return;
+    }
+
+    /* existing key */
+    if (stored->count == 1 && ctx->stats.singles > 0)
+        ctx->stats.singles -= 1;   /* 1 -> 2 transition removes a single */
+    stored->count += count;
+    free(n);  /* discard candidate */
+}
+
 /* --- API --- */
 
 ws_ctx_t *ws_create(void) {
@@ -36,6 +86,7 @@ ws_ctx_t *ws_create(void) {
 void ws_destroy(ws_ctx_t *ctx) {
     if (!ctx) return;
     if (ctx->root) tdestroy(ctx->root, ws_free_node);
+    free(ctx->keys);
     free(ctx);
 }
 
@@ -46,37 +97,26 @@ void ws_reset(ws_ctx_t *ctx) {
         ctx->root = NULL;
     }
     ctx->stats = (ws_stats_t){0,0,0};
+    ctx->keys_n = 0;
+    ctx->keys_lost = 0;
 }
 
 void ws_record(ws_ctx_t *ctx, uintptr_t key) {
     if (!ctx) return;
+    ws_record_n(ctx, key, 1);
+}
 
-    ctx->stats.total += 1;
-
-    struct ws_node *n = (struct ws_node *)malloc(sizeof(*n));
-    if (!n) return;  /* best-effort */
-    n->key = key;    /* already aligned/normalized by the caller */
-    n->count = 1;
-
-    void **slot = tsearch(n, &ctx->root, ws_cmp);
-    if (!slot) {     /* out of memory inside tsearch */
-        free(n);
-        return;
-    }
+void ws_record_batch(ws_ctx_t *ctx, const uint64_t *keys, size_t n) {
+    if (!ctx) return;
 
-    struct ws_node *stored = *(struct ws_node **)slot;
-    if (stored == n) {
-        /* brand-new key */
-        ctx->stats.distinct += 1;
-        ctx->stats.singles  += 1;  /* count==1 */
-        return;
+    /* consecutive references to one line cost a single lookup */
+    size_t i = 0;
+    while (i < n) {
+        size_t j = i + 1;
+        while (j < n && keys[j] == keys[i]) j++;
+        ws_record_n(ctx, (uintptr_t)keys[i], j - i);
+        i = j;
     }
-
-    /* existing key */
-    if (stored->count == 1 && ctx->stats.singles > 0)
-        ctx->stats.singles -= 1;   /* 1 -> 2 transition removes a single */
-    stored->count += 1;
-    free(n);  /* discard candidate */
 }
 
 void ws_get_stats(ws_ctx_t *ctx, ws_stats_t *out_stats) {
@@ -84,3 +124,13 @@ void ws_get_stats(ws_ctx_t *ctx, ws_stats_t *out_stats) {
     *out_stats = ctx->stats;
 }
 
+
+const uint64_t *ws_keys(const ws_ctx_t *ctx, size_t *n) {
+    if (!ctx || !n) return NULL;
+    *n = ctx->keys_n;
+    return ctx->keys;
+}
+
+uint64_t ws_keys_lost(const ws_ctx_t *ctx) {
+    return ctx ? ctx->keys_lost : 0;
+}
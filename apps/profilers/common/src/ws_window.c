@@ -0,0 +1,263 @@
+#include "ws_window.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Slot states, judged against the reference position counter:
+ *   last == 0                 never used (terminates a probe chain)
+ *   0 < last < min_start      stale: key belongs to a closed window; the slot
+ *                             may be reused but does not terminate a probe
+ *   last >= min_start         live in at least the oldest open window
+ */
+struct ws_slot {
+    uintptr_t key;
+    uint64_t  last;  /* position of the most recent access */
+    uint64_t  prev;  /* position of the access before that (0 = none) */
+};
+
+struct ws_level {
+    uint64_t   window_refs; /* records per window, 0 = manual reset only */
+    uint64_t   start;       /* first position of the current window */
+    uint64_t   idx;         /* window number */
+    ws_stats_t stats;
+};
+
+struct ws_window {
+    struct ws_slot  *slots;
+    struct ws_slot  *spare;     /* same-size buffer reused by rebuilds */
+    size_t           cap;       /* power of two */
+    size_t           used;      /* slots that are not "never used" */
+    uint64_t         pos;       /* last assigned reference position */
+    uint64_t         min_start; /* start of the oldest open window */
+
+    struct ws_level *levels;
+    size_t           n_levels;
+
+    ws_window_cb_t   cb;
+    void            *cb_arg;
+};
+
+#define WS_WINDOW_INITIAL_CAP 1024
+
+/* --- helpers --- */
+
+static inline size_t ws_window_hash(uintptr_t key) {
+    uint64_t h = (uint64_t)key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+/* Number of live keys == distinct keys of the level that starts earliest. */
+static uint64_t ws_window_live(const ws_window_t *w) {
+    for (size_t i = 0; i < w->n_levels; i++) {
+        if (w->levels[i].start == w->min_start)
+            return w->levels[i].stats.distinct;
+    }
+    return 0;
+}
+
+static void ws_window_update_min_start(ws_window_t *w) {
+    uint64_t m = w->levels[0].start;
+    for (size_t i = 1; i < w->n_levels; i++) {
+        if (w->levels[i].start < m) m = w->levels[i].start;
+    }
+    w->min_start = m;
+}
+
+/* Drop stale slots by reinserting live ones; grows the table if the live
+   set alone would keep it more than a quarter full. */
+static int ws_window_rebuild(ws_window_t *w) {
+    size_t new_cap = w->cap;
+    uint64_t live = ws_window_live(w);
+    while ((uint64_t)new_cap < live * 4)
+        new_cap <<= 1;
+
+    struct ws_slot *dst;
+    if (new_cap == w->cap) {
+        if (!w->spare) {
+            w->spare = (struct ws_slot *)calloc(w->cap, sizeof(struct ws_slot));
+            if (!w->spare) return -1;
+        } else {
+            memset(w->spare, 0, w->cap * sizeof(struct ws_slot));
+        }
+        dst = w->spare;
+    } else {
+        dst = (struct ws_slot *)calloc(new_cap, sizeof(struct ws_slot));
+        if (!dst) return -1;
+    }
+
+    size_t mask = new_cap - 1;
+    size_t used = 0;
+    for (size_t i = 0; i < w->cap; i++) {
+        const struct ws_slot *s = &w->slots[i];
+        if (s->last < w->min_start) continue;  /* never used or stale */
+        size_t j = ws_window_hash(s->key) & mask;
+        while (dst[j].last != 0)
+            j = (j + 1) & mask;
+        dst[j] = *s;
+        used++;
+    }
+
+    if (new_cap == w->cap) {
+        w->spare = w->slots;
+    } else {
+        free(w->slots);
+        free(w->spare);
+        w->spare = NULL;
+        w->cap = new_cap;
+    }
+    w->slots = dst;
+    w->used = used;
+    return 0;
+}
+
+static void ws_window_close_level(ws_window_t *w, size_t level) {
+    struct ws_level *l = &w->levels[level];
+    l->start = w->pos + 1;
+    l->idx += 1;
+    l->stats = (ws_stats_t){0,0,0};
+    ws_window_update_min_start(w);
+}
+
+/* Report and close every level whose window ends at pos */
+static void ws_window_close_full(ws_window_t *w, uint64_t pos) {
+    if (!w->cb) return;
+    for (size_t l = 0; l < w->n_levels; l++) {
+        struct ws_level *lv = &w->levels[l];
+        if (lv->window_refs && pos - lv->start + 1 == lv->window_refs) {
+            w->cb(w->cb_arg, l, lv->idx, &lv->stats);
+            ws_window_close_level(w, l);
+        }
+    }
+}
+
+/* --- API --- */
+
+ws_window_t *ws_window_create(const uint64_t *window_refs, size_t n_levels,
+                              ws_window_cb_t cb, void *cb_arg) {
+    if (n_levels == 0) return NULL;
+
+    ws_window_t *w = (ws_window_t *)calloc(1, sizeof(ws_window_t));
+    if (!w) return NULL;
+
+    w->levels = (struct ws_level *)calloc(n_levels, sizeof(struct ws_level));
+    w->slots = (struct ws_slot *)calloc(WS_WINDOW_INITIAL_CAP, sizeof(struct ws_slot));
+    if (!w->levels || !w->slots) {
+        free(w->levels);
+        free(w->slots);
+        free(w);
+        return NULL;
+    }
+
+    w->cap = WS_WINDOW_INITIAL_CAP;
+    w->n_levels = n_levels;
+    w->cb = cb;
+    w->cb_arg = cb_arg;
+    /* positions start at 1 so that last == 0 can mean "never used" */
+    w->min_start = 1;
+    for (size_t i = 0; i < n_levels; i++) {
+        w->levels[i].window_refs = window_refs ? window_refs[i] : 0;
+        w->levels[i].start = 1;
+    }
+    return w;
+}
+
+void ws_window_destroy(ws_window_t *w) {
+    if (!w) return;
+    free(w->slots);
+    free(w->spare);
+    free(w->levels);
+    free(w);
+}
+
+void ws_window_reset(ws_window_t *w) {
+    if (!w) return;
+    for (size_t i = 0; i < w->n_levels; i++) {
+        struct ws_level *l = &w->levels[i];
+        l->start = w->pos + 1;
+        l->idx += 1;
+        l->stats = (ws_stats_t){0,0,0};
+    }
+    w->min_start = w->pos + 1;
+}
+
+void ws_window_reset_level(ws_window_t *w, size_t level) {
+    if (!w || level >= w->n_levels) return;
+    ws_window_close_level(w, level);
+}
+
+void ws_window_record(ws_window_t *w, uintptr_t key) {
+    if (!w) return;
+
+    if (w->used * 4 >= w->cap * 3 && ws_window_rebuild(w) != 0) {
+        /* best-effort, like ws_record(): the reference is counted and
+           windows still close on time, but the key is not tracked */
+        for (size_t l = 0; l < w->n_levels; l++)
+            w->levels[l].stats.total += 1;
+        ws_window_close_full(w, ++w->pos);
+        return;
+    }
+
+    uint64_t pos = ++w->pos;
+    size_t mask = w->cap - 1;
+    size_t i = ws_window_hash(key) & mask;
+    struct ws_slot *reuse = NULL;
+    struct ws_slot *s;
+
+    for (;;) {
+        s = &w->slots[i];
+        if (s->last == 0) {                  /* end of chain: key is new */
+            if (reuse) {
+                s = reuse;
+            } else {
+                w->used++;
+            }
+            s->key = key;
+            s->last = 0;
+            s->prev = 0;
+            break;
+        }
+        if (s->key == key) {
+            if (s->last < w->min_start) {    /* only seen in closed windows */
+                s->last = 0;
+                s->prev = 0;
+            }
+            break;
+        }
+        if (!reuse && s->last < w->min_start)
+            reuse = s;
+        i = (i + 1) & mask;
+    }
+
+    for (size_t l = 0; l < w->n_levels; l++) {
+        struct ws_level *lv = &w->levels[l];
+        lv->stats.total += 1;
+        if (s->last < lv->start) {
+            /* first access in this level's window */
+            lv->stats.distinct += 1;
+            lv->stats.singles  += 1;
+        } else if (s->prev < lv->start && lv->stats.singles > 0) {
+            lv->stats.singles -= 1;          /* 1 -> 2 transition */
+        }
+    }
+    s->prev = s->last;
+    s->last = pos;
+
+    ws_window_close_full(w, pos);
+}
+
+void ws_window_get_stats(const ws_window_t *w, size_t level,
+                         ws_stats_t *out_stats) {
+    if (!w || !out_stats || level >= w->n_levels) return;
+    *out_stats = w->levels[level].stats;
+}
+
+uint64_t ws_window_index(const ws_window_t *w, size_t level) {
+    if (!w || level >= w->n_levels) return 0;
+    return w->levels[level].idx;
+}
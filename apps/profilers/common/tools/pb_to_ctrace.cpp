@@ -0,0 +1,141 @@
+// Convert a protobuf memory trace (.pb) to the compact ctrace format.
+//
+// Usage: pb_to_ctrace [--block-events N] [--no-compress] input.pb output.ctrace
+//
+// Accepts both the chunked layout written by protobuf_writer and memory_trace
+// (a stream of length-delimited MemoryTrace messages) and older single-message
+// files. Chunks are converted one at a time, so the
+// input never has to fit in memory.
+
+#include "ctrace.h"
+#include "memory_trace.pb.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+int convert_chunk(ctrace_writer_t* writer, const memory_trace::MemoryTrace& trace,
+                  std::vector<ctrace_event_t>& events) {
+    events.resize(trace.events_size());
+    for (int i = 0; i < trace.events_size(); i++) {
+        const memory_trace::MemoryEvent& ev = trace.events(i);
+        ctrace_event_t& out = events[i];
+        out.timestamp = ev.timestamp();
+        out.address = ev.address();
+        out.thread_id = ev.thread_id();
+        out.size = ev.size();
+        out.is_write = ev.mem_op() == memory_trace::WRITE;
+        out.is_miss = ev.hit_miss() == memory_trace::MISS;
+    }
+    return ctrace_write_events(writer, events.data(), events.size());
+}
+
+void usage(const char* prog) {
+    std::cerr << "Usage: " << prog
+              << " [--block-events N] [--no-compress] input.pb output.ctrace\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    uint32_t block_events = CTRACE_DEFAULT_BLOCK_EVENTS;
+    unsigned flags = CTRACE_COMPRESS;
+    std::vector<const char*> paths;
+
+    for (int i = 1; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--block-events") && i + 1 < argc) {
+            block_events = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        } else if (!std::strcmp(argv[i], "--no-compress")) {
+            flags &= ~CTRACE_COMPRESS;
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.size() != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::ifstream input(paths[0], std::ios::binary | std::ios::ate);
+    if (!input.is_open()) {
+        std::cerr << "Error: cannot open " << paths[0] << "\n";
+        return 1;
+    }
+    const uint64_t file_size = (uint64_t)input.tellg();
+    input.seekg(0);
+
+    ctrace_writer_t* writer = ctrace_writer_create(paths[1], block_events, flags);
+    if (!writer) {
+        std::cerr << "Error: cannot create " << paths[1] << "\n";
+        return 1;
+    }
+
+    memory_trace::MemoryTrace trace;
+    std::vector<ctrace_event_t> events;
+    std::string buf;
+    uint64_t offset = 0, num_events = 0, num_chunks = 0;
+    int rc = 0;
+
+    // Length-delimited chunks: 4-byte little-endian size + MemoryTrace
+    while (offset + 4 <= file_size) {
+        unsigned char len_bytes[4];
+        input.read(reinterpret_cast<char*>(len_bytes), 4);
+        uint32_t len = (uint32_t)len_bytes[0] | ((uint32_t)len_bytes[1] << 8) |
+                       ((uint32_t)len_bytes[2] << 16) | ((uint32_t)len_bytes[3] << 24);
+
+        bool ok = input && offset + 4 + len <= file_size;
+        if (ok) {
+            buf.resize(len);
+            input.read(&buf[0], len);
+            ok = input && trace.ParseFromString(buf);
+        }
+        if (!ok) {
+            if (num_chunks > 0) {
+                std::cerr << "Error: corrupt chunk at offset " << offset << "\n";
+                rc = 1;
+            }
+            break;
+        }
+
+        rc |= convert_chunk(writer, trace, events) ? 1 : 0;
+        num_events += (uint64_t)trace.events_size();
+        num_chunks++;
+        offset += 4 + len;
+    }
+
+    // Not length-delimited: a single MemoryTrace message
+    if (num_chunks == 0 && rc == 0) {
+        input.clear();
+        input.seekg(0);
+        if (!trace.ParseFromIstream(&input)) {
+            std::cerr << "Error: " << paths[0] << " is not a memory trace\n";
+            rc = 1;
+        } else {
+            rc |= convert_chunk(writer, trace, events) ? 1 : 0;
+            num_events = (uint64_t)trace.events_size();
+        }
+    }
+
+    if (ctrace_writer_close(writer) != 0) {
+        std::cerr << "Error: failed writing " << paths[1] << "\n";
+        rc = 1;
+    }
+    if (rc != 0) return rc;
+
+    std::ifstream output(paths[1], std::ios::binary | std::ios::ate);
+    uint64_t out_size = (uint64_t)output.tellg();
+    std::printf("Converted %llu events: %llu -> %llu bytes (%.2f bytes/event)\n",
+                (unsigned long long)num_events, (unsigned long long)file_size,
+                (unsigned long long)out_size,
+                num_events ? (double)out_size / (double)num_events : 0.0);
+    return 0;
+}
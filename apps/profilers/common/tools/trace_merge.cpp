@@ -0,0 +1,88 @@
+// Merge per-thread profiler output streams into one time-ordered file.
+//
+// Usage: trace_merge [options] -o merged.pb input.pb ...
+//
+// memcount writes one trace and one time-series file per application thread
+// (memtrace_<pid>.t<n>.pb, timeseries_<pid>.t<n>.pb) and merges them at
+// exit unless told not to; this tool does the same merge offline, e.g. for
+// streams kept with merge_thread_streams=false or left by a killed run.
+// Traces are merged event by event on the timestamp, time series sample by
+// sample (see trace_merge.h).
+
+#include "trace_merge.h"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+void usage(const char* prog) {
+    std::fprintf(stderr,
+        "Usage: %s [options] -o OUTPUT input.pb ...\n"
+        "  -o, --output FILE     merged output file\n"
+        "  --timeseries          inputs are time-series files (default: memory traces)\n"
+        "  --chunk-events N      events per output MemoryTrace chunk (%u)\n",
+        prog, (unsigned)TRACE_MERGE_DEFAULT_CHUNK_EVENTS);
+}
+
+bool parse_uint(const char* s, unsigned long max, unsigned long* out) {
+    char* end;
+    errno = 0;
+    unsigned long v = std::strtoul(s, &end, 10);
+    if (errno || end == s || *end || v > max) return false;
+    *out = v;
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const char* output = nullptr;
+    bool timeseries = false;
+    size_t chunk_events = 0;
+    std::vector<const char*> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        const bool has_arg = i + 1 < argc;
+        unsigned long v = 0;
+        bool ok = true;
+        if ((!std::strcmp(a, "-o") || !std::strcmp(a, "--output")) && has_arg) {
+            output = argv[++i];
+        } else if (!std::strcmp(a, "--timeseries")) {
+            timeseries = true;
+        } else if (!std::strcmp(a, "--chunk-events") && has_arg) {
+            ok = parse_uint(argv[++i], 1u << 22, &v) && v;
+            chunk_events = v;
+        } else if (a[0] == '-') {
+            ok = false;
+        } else {
+            inputs.push_back(a);
+        }
+        if (!ok) {
+            std::fprintf(stderr, "Error: bad option %s\n", a);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!output || inputs.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int64_t n = timeseries
+        ? timeseries_merge_files(output, inputs.data(), inputs.size())
+        : trace_merge_files(output, inputs.data(), inputs.size(), chunk_events);
+    if (n < 0) {
+        std::fprintf(stderr, "Error: merge into %s failed (unreadable input or write error)\n",
+                     output);
+        return 1;
+    }
+    std::printf("Merged %zu files, %" PRId64 " %s -> %s\n", inputs.size(), n,
+                timeseries ? "samples" : "events", output);
+    return 0;
+}
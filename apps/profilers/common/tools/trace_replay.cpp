@@ -0,0 +1,809 @@
+// Offline replay of memcount analytics over recorded memory traces.
+//
+// Usage: trace_replay [options] memtrace_<pid>.pb ...
+//
+// Recomputes what memcount's memtrace() derives online -- per-thread and
+// total reference counts, read/write size breakdowns, exact and HLL working
+// set sizes, per-window WSS samples and (optionally) the SHARDS reuse
+// distance miss ratio curve -- from a .pb trace, with cache line size,
+// window size and sketch precision chosen after the fact.
+//
+// With --cache, the references also run through a simulated L1/L2/LLC
+// hierarchy per thread (cache_sim), the LLC shared by default, adding
+// per-level hits and misses to the windows and the summary.
+//
+// Chunks are processed in parallel. Every worker keeps mergeable state
+// (counters, HLL sketches, line sets, partial windows) that is merged once
+// all chunks are done: a sample window is a run of window_refs consecutive
+// references of one thread, so a first pass counts each thread's references
+// per chunk to place every event in its window, and windows cut by a chunk
+// boundary are stitched together from their pieces. Reuse distance depends
+// on the order of a thread's references, so it is computed per thread
+// instead, threads spread over the workers. The cache simulation depends on
+// the order of all threads' references (they meet in the shared LLC), so it
+// is one pass in file order.
+
+#include "trace_reader.h"
+#include "cache_sim.h"
+#include "hllpp.h"
+#include "reuse_distance.h"
+#include "protobuf_writer.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct Options {
+    uint32_t line_size = 64;
+    uint32_t window_refs = 1000;      // 0 = no sample windows
+    uint8_t hll_bits = 14;
+    uint8_t sample_hll_bits = 12;
+    bool exact = true;
+    bool hll = true;
+    bool reuse_distance = false;
+    double rd_sample_rate = 0.01;
+    uint32_t rd_max_keys = 65536;
+    unsigned threads = 0;
+    bool cache = false;
+    cache_level_config_t cache_cfg[3] = {      // L1, L2, LLC
+        {32 << 10, 8, 64, CACHE_REPL_LRU, 1, 1},
+        {1 << 20, 16, 64, CACHE_REPL_LRU, 1, 1},
+        {32 << 20, 16, 64, CACHE_REPL_RRIP, 1, 1}};
+    bool shared_llc = true;
+    const char* timeseries_out = nullptr;
+    const char* windows_csv = nullptr;
+};
+
+// Same bins as memcount's size_bin_t
+int size_bin(uint32_t size) {
+    switch (size) {
+    case 1:  return 0;
+    case 2:  return 1;
+    case 4:  return 2;
+    case 8:  return 3;
+    case 16: return 4;
+    case 32: return 5;
+    case 64: return 6;
+    default: return 7;
+    }
+}
+
+// hllpp_t with value semantics for the containers below
+class Hll {
+public:
+    Hll() = default;
+    explicit Hll(uint8_t p) {
+        if (hllpp_init(&h_, p) != 0) throw std::bad_alloc();
+        live_ = true;
+    }
+    Hll(Hll&& o) noexcept : h_(o.h_), live_(o.live_) { o.live_ = false; }
+    Hll& operator=(Hll&& o) noexcept {
+        if (this != &o) {
+            reset_live();
+            h_ = o.h_;
+            live_ = o.live_;
+            o.live_ = false;
+        }
+        return *this;
+    }
+    Hll(const Hll&) = delete;
+    Hll& operator=(const Hll&) = delete;
+    ~Hll() { reset_live(); }
+
+    bool live() const { return live_; }
+    void add(uint64_t key) { hllpp_add_u64(&h_, key); }
+    void add(const std::vector<uint64_t>& keys) { hllpp_add_u64_batch(&h_, keys.data(), keys.size()); }
+    void merge(const Hll& o) {
+        if (o.live_) hllpp_merge(&h_, &o.h_);
+    }
+    double count() { return live_ ? hllpp_count(&h_) : 0.0; }
+
+private:
+    void reset_live() {
+        if (live_) hllpp_destroy(&h_);
+        live_ = false;
+    }
+    hllpp_t h_{};
+    bool live_ = false;
+};
+
+struct Counts {
+    uint64_t refs = 0;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t read_size[PB_TS_SIZE_BINS] = {0};
+    uint64_t write_size[PB_TS_SIZE_BINS] = {0};
+
+    void add(uint32_t size, bool is_write) {
+        refs++;
+        if (is_write) {
+            writes++;
+            write_size[size_bin(size)]++;
+        } else {
+            reads++;
+            read_size[size_bin(size)]++;
+        }
+    }
+    void merge(const Counts& o) {
+        refs += o.refs;
+        reads += o.reads;
+        writes += o.writes;
+        for (int b = 0; b < PB_TS_SIZE_BINS; b++) {
+            read_size[b] += o.read_size[b];
+            write_size[b] += o.write_size[b];
+        }
+    }
+};
+
+// Whole-run state of one application thread
+struct ThreadState {
+    Counts counts;
+    std::unordered_set<uint64_t> lines;   // exact WSS
+    Hll hll;
+    std::vector<uint64_t> pending;        // line keys of the current chunk, for batched HLL adds
+};
+
+// (A piece of) one sample window
+struct Window {
+    Counts counts;
+    std::vector<uint64_t> lines;          // exact WSS; sorted and unique once closed
+    Hll hll;
+    uint64_t timestamp = 0;               // last event of the window
+
+    void merge(Window& o) {
+        counts.merge(o.counts);
+        std::vector<uint64_t> merged;
+        merged.reserve(lines.size() + o.lines.size());
+        std::set_union(lines.begin(), lines.end(), o.lines.begin(), o.lines.end(),
+                       std::back_inserter(merged));
+        lines.swap(merged);
+        if (!hll.live()) hll = std::move(o.hll);
+        else hll.merge(o.hll);
+        timestamp = std::max(timestamp, o.timestamp);
+    }
+};
+
+typedef std::pair<uint32_t, uint64_t> WindowKey;   // thread, window number
+
+// References served by L1, L2, the LLC and memory
+typedef std::array<uint64_t, 4> Served;
+
+const char* const kCacheLevelNames[3] = {"L1", "L2", "LLC"};
+
+struct Worker {
+    std::unordered_map<uint32_t, ThreadState> threads;
+    std::vector<pb_ts_sample_t> samples;            // windows complete within a chunk
+    std::map<WindowKey, Window> pieces;             // windows cut by a chunk boundary
+};
+
+class Replay {
+public:
+    Replay(const trace_reader_t* reader, const Options& opt) : reader_(reader), opt_(opt) {
+        line_mask_ = ~(uint64_t)(opt.line_size - 1);
+    }
+    ~Replay() {
+        if (rd_) rd_destroy(rd_);
+    }
+
+    int run(unsigned num_threads) {
+        if (opt_.window_refs && count_thread_refs(num_threads) != 0) return -1;
+
+        int rc = trace_reader_for_each_chunk(reader_, num_threads, &Replay::chunk_cb, this);
+        if (rc != 0) return -1;
+        merge_workers();
+
+        if (opt_.reuse_distance && replay_reuse_distance(num_threads) != 0) return -1;
+        if (opt_.cache && replay_cache() != 0) return -1;
+        return 0;
+    }
+
+    void print_summary(const char* path);
+    int write_windows();
+
+private:
+    /* --- pass 1: references per thread per chunk --- */
+
+    int count_thread_refs(unsigned num_threads) {
+        const size_t n_chunks = trace_reader_num_chunks(reader_);
+        chunk_refs_.assign(n_chunks, {});
+        int rc = trace_reader_for_each_chunk(reader_, num_threads,
+            [](size_t chunk, uint64_t, const trace_columns_t* c, size_t n, void* user) {
+                auto* self = static_cast<Replay*>(user);
+                std::unordered_map<uint32_t, uint64_t> refs;
+                for (size_t i = 0; i < n; i++) refs[c->thread_id[i]]++;
+                self->chunk_refs_[chunk].assign(refs.begin(), refs.end());
+                return 0;
+            }, this);
+        if (rc != 0) return -1;
+
+        // Running totals give each chunk the index of its first reference
+        // of every thread
+        std::unordered_map<uint32_t, uint64_t> total;
+        for (auto& refs : chunk_refs_) {
+            for (auto& tr : refs) {
+                uint64_t start = total[tr.first];
+                total[tr.first] += tr.second;
+                tr.second = start;
+            }
+        }
+        return 0;
+    }
+
+    /* --- pass 2: counters, sketches and windows --- */
+
+    static int chunk_cb(size_t chunk, uint64_t, const trace_columns_t* c, size_t n,
+                        void* user) {
+        auto* self = static_cast<Replay*>(user);
+        try {
+            self->process_chunk(self->worker_for_this_thread(), chunk, c, n);
+        } catch (...) {
+            return 1;
+        }
+        return 0;
+    }
+
+    // Each decoder thread accumulates into its own Worker
+    Worker& worker_for_this_thread() {
+        std::lock_guard<std::mutex> lock(worker_mutex_);
+        auto it = worker_of_.find(std::this_thread::get_id());
+        if (it == worker_of_.end()) {
+            workers_.emplace_back();
+            it = worker_of_.emplace(std::this_thread::get_id(), &workers_.back()).first;
+        }
+        return *it->second;
+    }
+
+    void process_chunk(Worker& w, size_t chunk, const trace_columns_t* c, size_t n) {
+        // Thread -> next reference index, and the window being filled
+        std::unordered_map<uint32_t, uint64_t> cursor;
+        std::unordered_map<uint32_t, std::pair<uint64_t, Window>> open;
+        if (opt_.window_refs) {
+            for (const auto& tr : chunk_refs_[chunk]) cursor.emplace(tr.first, tr.second);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            const uint32_t tid = c->thread_id[i];
+            const uint64_t key = c->address[i] & line_mask_;
+
+            ThreadState& ts = thread_state(w, tid);
+            ts.counts.add(c->size[i], c->is_write[i]);
+            if (opt_.exact) ts.lines.insert(key);
+            if (opt_.hll) ts.pending.push_back(key);
+
+            if (!opt_.window_refs) continue;
+            const uint64_t win = cursor[tid]++ / opt_.window_refs;
+            auto it = open.find(tid);
+            if (it != open.end() && it->second.first != win) {
+                close_window(w, tid, it->second.first, it->second.second);
+                open.erase(it);
+                it = open.end();
+            }
+            if (it == open.end()) {
+                it = open.emplace(tid, std::make_pair(win, Window())).first;
+                if (opt_.hll) it->second.second.hll = Hll(opt_.sample_hll_bits);
+            }
+            Window& wnd = it->second.second;
+            wnd.counts.add(c->size[i], c->is_write[i]);
+            if (opt_.exact) wnd.lines.push_back(key);
+            if (opt_.hll) wnd.hll.add(key);
+            wnd.timestamp = std::max(wnd.timestamp, c->timestamp[i]);
+        }
+
+        for (auto& o : open) close_window(w, o.first, o.second.first, o.second.second);
+        for (auto& t : w.threads) {
+            if (!t.second.pending.empty()) {
+                t.second.hll.add(t.second.pending);
+                t.second.pending.clear();
+            }
+        }
+    }
+
+    ThreadState& thread_state(Worker& w, uint32_t tid) {
+        auto it = w.threads.find(tid);
+        if (it == w.threads.end()) {
+            it = w.threads.emplace(tid, ThreadState()).first;
+            if (opt_.hll) it->second.hll = Hll(opt_.hll_bits);
+        }
+        return it->second;
+    }
+
+    void close_window(Worker& w, uint32_t tid, uint64_t win, Window& wnd) {
+        std::sort(wnd.lines.begin(), wnd.lines.end());
+        wnd.lines.erase(std::unique(wnd.lines.begin(), wnd.lines.end()), wnd.lines.end());
+        if (wnd.counts.refs == opt_.window_refs) {
+            w.samples.push_back(to_sample(tid, win, wnd));
+        } else {
+            // Cut by a chunk boundary (or the thread's last, partial window)
+            auto it = w.pieces.find(WindowKey(tid, win));
+            if (it == w.pieces.end()) w.pieces.emplace(WindowKey(tid, win), std::move(wnd));
+            else it->second.merge(wnd);
+        }
+    }
+
+    pb_ts_sample_t to_sample(uint32_t tid, uint64_t win, Window& wnd) {
+        pb_ts_sample_t s;
+        std::memset(&s, 0, sizeof(s));
+        s.window_number = win;
+        s.thread_id = tid;
+        s.read_count = wnd.counts.reads;
+        s.write_count = wnd.counts.writes;
+        s.total_refs = wnd.counts.refs;
+        s.wss_exact = opt_.exact ? wnd.lines.size() : 0;
+        s.wss_approx = wnd.hll.count();
+        s.timestamp = wnd.timestamp;
+        std::memcpy(s.read_size_hist, wnd.counts.read_size, sizeof(s.read_size_hist));
+        std::memcpy(s.write_size_hist, wnd.counts.write_size, sizeof(s.write_size_hist));
+        return s;
+    }
+
+    void merge_workers() {
+        std::map<WindowKey, Window> pieces;
+        for (Worker& w : workers_) {
+            for (auto& t : w.threads) {
+                ThreadState& dst = threads_[t.first];
+                dst.counts.merge(t.second.counts);
+                if (dst.lines.empty()) dst.lines.swap(t.second.lines);
+                else dst.lines.insert(t.second.lines.begin(), t.second.lines.end());
+                if (!dst.hll.live()) dst.hll = std::move(t.second.hll);
+                else dst.hll.merge(t.second.hll);
+            }
+            w.threads.clear();
+            samples_.insert(samples_.end(), w.samples.begin(), w.samples.end());
+            for (auto& p : w.pieces) {
+                auto it = pieces.find(p.first);
+                if (it == pieces.end()) pieces.emplace(p.first, std::move(p.second));
+                else it->second.merge(p.second);
+            }
+            w.pieces.clear();
+        }
+        for (auto& p : pieces) samples_.push_back(to_sample(p.first.first, p.first.second, p.second));
+
+        std::sort(samples_.begin(), samples_.end(),
+                  [](const pb_ts_sample_t& a, const pb_ts_sample_t& b) {
+                      return a.thread_id != b.thread_id ? a.thread_id < b.thread_id
+                                                        : a.window_number < b.window_number;
+                  });
+    }
+
+    /* --- reuse distance: one ordered pass per thread --- */
+
+    int replay_reuse_distance(unsigned num_threads) {
+        std::vector<uint32_t> tids;
+        for (const auto& t : threads_) tids.push_back(t.first);
+        if (tids.empty()) return 0;
+        num_threads = std::max(1u, std::min<unsigned>(num_threads, (unsigned)tids.size()));
+
+        // Worker k owns threads k, k + num_threads, ... and walks the chunks
+        // in file order, so each thread's references reach rd in order
+        std::vector<rd_ctx_t*> per_worker(num_threads, nullptr);
+        std::atomic<bool> failed(false);
+        auto worker = [&](unsigned k) {
+            std::unordered_map<uint32_t, rd_ctx_t*> rd;
+            for (size_t j = k; j < tids.size(); j += num_threads) {
+                rd_ctx_t* ctx = rd_create(opt_.rd_sample_rate, opt_.rd_max_keys);
+                if (!ctx) { failed = true; break; }
+                rd.emplace(tids[j], ctx);
+            }
+
+            const size_t cap = trace_reader_max_chunk_events(reader_);
+            std::vector<uint64_t> address(cap);
+            std::vector<uint32_t> thread_id(cap);
+            trace_columns_t c = {nullptr, address.data(), thread_id.data(), nullptr, nullptr, nullptr};
+            for (size_t chunk = 0; !failed && chunk < trace_reader_num_chunks(reader_); chunk++) {
+                int64_t n = trace_reader_decode_chunk(reader_, chunk, &c);
+                if (n < 0) { failed = true; break; }
+                for (int64_t i = 0; i < n; i++) {
+                    auto it = rd.find(thread_id[i]);
+                    if (it != rd.end()) rd_record(it->second, address[i] & line_mask_);
+                }
+            }
+
+            rd_ctx_t* merged = rd_create(opt_.rd_sample_rate, opt_.rd_max_keys);
+            if (!merged) failed = true;
+            for (auto& r : rd) {
+                if (merged) rd_merge(merged, r.second);
+                rd_destroy(r.second);
+            }
+            per_worker[k] = merged;
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned k = 1; k < num_threads; k++) pool.emplace_back(worker, k);
+        worker(0);
+        for (auto& t : pool) t.join();
+
+        rd_ = per_worker[0];
+        for (unsigned k = 1; k < num_threads; k++) {
+            if (per_worker[k]) {
+                if (rd_) rd_merge(rd_, per_worker[k]);
+                rd_destroy(per_worker[k]);
+            }
+        }
+        return failed ? -1 : 0;
+    }
+
+    /* --- cache simulation: one pass over all threads in file order --- */
+
+    int replay_cache() {
+        // The configuration is checked once up front, so a NULL here is
+        // out of memory
+        cache_level_t* llc = nullptr;
+        if (opt_.shared_llc) {
+            llc = cache_level_create(&opt_.cache_cfg[2], 1);
+            if (!llc) return -1;
+        }
+        std::unordered_map<uint32_t, cache_hier_t*> hier;
+        std::unordered_map<uint32_t, uint64_t> cursor;
+        std::map<WindowKey, Served> windows;
+        bool failed = false;
+
+        const size_t cap = trace_reader_max_chunk_events(reader_);
+        std::vector<uint64_t> address(cap);
+        std::vector<uint32_t> thread_id(cap), size(cap);
+        std::vector<uint8_t> is_write(cap);
+        trace_columns_t c = {nullptr, address.data(), thread_id.data(), size.data(),
+                             is_write.data(), nullptr};
+        for (size_t chunk = 0; !failed && chunk < trace_reader_num_chunks(reader_); chunk++) {
+            int64_t n = trace_reader_decode_chunk(reader_, chunk, &c);
+            if (n < 0) { failed = true; break; }
+            for (int64_t i = 0; i < n; i++) {
+                auto it = hier.find(thread_id[i]);
+                if (it == hier.end()) {
+                    cache_hier_t* h = cache_hier_create(opt_.cache_cfg, llc ? 2 : 3, llc);
+                    if (!h) { failed = true; break; }
+                    it = hier.emplace(thread_id[i], h).first;
+                }
+                unsigned level = cache_hier_access(it->second, address[i], size[i], is_write[i]);
+                served_[level]++;
+                if (opt_.window_refs) {
+                    uint64_t win = cursor[thread_id[i]]++ / opt_.window_refs;
+                    windows[WindowKey(thread_id[i], win)][level]++;
+                }
+            }
+        }
+
+        std::memset(&cache_stats_, 0, sizeof(cache_stats_));
+        for (auto& h : hier) {
+            cache_hier_stats_t st;
+            cache_hier_get_stats(h.second, &st);
+            cache_hier_stats_add(&cache_stats_, &st);
+            cache_hier_destroy(h.second);
+        }
+        cache_level_destroy(llc);
+
+        // samples_ is sorted by thread and window, as is windows
+        auto w = windows.begin();
+        for (pb_ts_sample_t& s : samples_) {
+            while (w != windows.end() && w->first < WindowKey(s.thread_id, s.window_number)) ++w;
+            if (w != windows.end() && w->first == WindowKey(s.thread_id, s.window_number))
+                set_cache_fields(s, w->second);
+        }
+        return failed ? -1 : 0;
+    }
+
+    // A level's hits are the references it served, its misses those served
+    // further down
+    static void set_cache_fields(pb_ts_sample_t& s, const Served& served) {
+        uint64_t* fields[3][2] = {{&s.l1_hits, &s.l1_misses},
+                                  {&s.l2_hits, &s.l2_misses},
+                                  {&s.llc_hits, &s.llc_misses}};
+        uint64_t below = served[3];
+        for (int l = 2; l >= 0; l--) {
+            *fields[l][0] = served[l];
+            *fields[l][1] = below;
+            below += served[l];
+        }
+    }
+
+    const trace_reader_t* reader_;
+    Options opt_;
+    uint64_t line_mask_;
+    std::vector<std::vector<std::pair<uint32_t, uint64_t>>> chunk_refs_;
+    std::deque<Worker> workers_;                    // stable addresses
+    std::unordered_map<std::thread::id, Worker*> worker_of_;
+    std::mutex worker_mutex_;
+    std::map<uint32_t, ThreadState> threads_;
+    std::vector<pb_ts_sample_t> samples_;
+    rd_ctx_t* rd_ = nullptr;
+    Served served_ = {};
+    cache_hier_stats_t cache_stats_ = {};
+};
+
+// Same report as memcount's event_exit()
+void Replay::print_summary(const char* path) {
+    static const char* const kBinNames[PB_TS_SIZE_BINS] = {
+        "1-byte", "2-byte", "4-byte", "8-byte", "16-byte", "32-byte", "64-byte", "other-size"};
+
+    Counts total;
+    uint64_t working_set = 0;
+    Hll global_hll;
+    if (opt_.hll) global_hll = Hll(opt_.hll_bits);
+    for (auto& t : threads_) {
+        total.merge(t.second.counts);
+        working_set += opt_.exact ? (uint64_t)t.second.lines.size()
+                                  : (uint64_t)t.second.hll.count();
+        global_hll.merge(t.second.hll);
+    }
+
+    std::printf("Replay of %s (line size %u, window %u refs, HLL p=%u/%u):\n", path,
+                opt_.line_size, opt_.window_refs, opt_.hll_bits, opt_.sample_hll_bits);
+    std::printf("  saw %" PRIu64 " memory references\n"
+                "  number of reads: %" PRIu64 "\n"
+                "  number of writes: %" PRIu64 "\n"
+                "  working set size: %" PRIu64 "\n"
+                "  threads: %zu\n",
+                total.refs, total.reads, total.writes, working_set, threads_.size());
+
+    std::printf("Read size breakdown:\n");
+    for (int b = 0; b < PB_TS_SIZE_BINS; b++)
+        std::printf("  %s reads: %" PRIu64 "\n", kBinNames[b], total.read_size[b]);
+    std::printf("Write size breakdown:\n");
+    for (int b = 0; b < PB_TS_SIZE_BINS; b++)
+        std::printf("  %s writes: %" PRIu64 "\n", kBinNames[b], total.write_size[b]);
+
+    if (opt_.hll) {
+        std::printf("Instrumentation results (HLL estimate):\n"
+                    "  estimated unique lines: %llu\n",
+                    (unsigned long long)global_hll.count());
+    }
+    if (opt_.window_refs) {
+        std::printf("Sample windows: %zu\n", samples_.size());
+    }
+
+    if (opt_.cache) {
+        std::printf("Cache simulation (%s LLC):\n", opt_.shared_llc ? "shared" : "per-thread");
+        for (int l = 0; l < 3; l++) {
+            const cache_level_config_t& c = opt_.cache_cfg[l];
+            const cache_level_stats_t& st = cache_stats_.level[l];
+            uint64_t hits = st.read_hits + st.write_hits;
+            uint64_t misses = st.read_misses + st.write_misses;
+            std::printf("  %-3s %" PRIu64 " KiB %u-way %s: %" PRIu64 " hits, %" PRIu64
+                        " misses (miss ratio %.4f), %" PRIu64 " writebacks\n",
+                        kCacheLevelNames[l], c.size >> 10, c.ways, cache_repl_name(c.repl),
+                        hits, misses, hits + misses ? (double)misses / (double)(hits + misses) : 0.0,
+                        st.writebacks);
+        }
+        std::printf("  references served by L1/L2/LLC/memory: %" PRIu64 "/%" PRIu64 "/%" PRIu64
+                    "/%" PRIu64 "\n  memory: %" PRIu64 " line reads, %" PRIu64 " writes\n",
+                    served_[0], served_[1], served_[2], served_[3],
+                    cache_stats_.mem_reads, cache_stats_.mem_writes);
+    }
+
+    if (rd_) {
+        rd_stats_t st = {};
+        rd_get_stats(rd_, &st);
+        std::printf("Reuse distance results (SHARDS rate %.4f, %llu of %llu references sampled):\n",
+                    opt_.rd_sample_rate, (unsigned long long)st.sampled,
+                    (unsigned long long)st.refs);
+        for (uint64_t kb = 16; kb <= 128 * 1024; kb *= 2) {
+            uint64_t lines = kb * 1024 / opt_.line_size;
+            std::printf("  LRU miss ratio @ %llu%s: %.4f\n",
+                        (unsigned long long)(kb >= 1024 ? kb / 1024 : kb),
+                        kb >= 1024 ? "MB" : "KB", rd_miss_ratio(rd_, lines));
+        }
+    }
+}
+
+int Replay::write_windows() {
+    int rc = 0;
+
+    if (opt_.windows_csv) {
+        FILE* f = std::fopen(opt_.windows_csv, "w");
+        if (!f) {
+            std::fprintf(stderr, "Error: cannot create %s: %s\n", opt_.windows_csv, std::strerror(errno));
+            return -1;
+        }
+        std::fprintf(f, "thread_id,window_number,timestamp,read_count,write_count,total_refs,"
+                        "wss_exact,wss_approx%s\n",
+                     opt_.cache ? ",l1_hits,l1_misses,l2_hits,l2_misses,llc_hits,llc_misses" : "");
+        for (const pb_ts_sample_t& s : samples_) {
+            std::fprintf(f, "%u,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.1f",
+                         s.thread_id, s.window_number, s.timestamp, s.read_count,
+                         s.write_count, s.total_refs, s.wss_exact, s.wss_approx);
+            if (opt_.cache) {
+                std::fprintf(f, ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+                             s.l1_hits, s.l1_misses, s.l2_hits, s.l2_misses, s.llc_hits,
+                             s.llc_misses);
+            }
+            std::fputc('\n', f);
+        }
+        if (std::fclose(f) != 0) rc = -1;
+    }
+
+    if (opt_.timeseries_out) {
+        pb_timeseries_writer_t* w = pb_timeseries_writer_create(
+            opt_.timeseries_out, "trace_replay", 0, "", opt_.window_refs, opt_.line_size);
+        if (!w) {
+            std::fprintf(stderr, "Error: cannot write %s (built without protobuf-c?)\n",
+                         opt_.timeseries_out);
+            return -1;
+        }
+        for (const pb_ts_sample_t& s : samples_) pb_timeseries_write_sample(w, &s);
+        pb_timeseries_set_num_threads(w, (uint32_t)threads_.size());
+        pb_timeseries_writer_close(w);
+    }
+    return rc;
+}
+
+void usage(const char* prog) {
+    std::fprintf(stderr,
+        "Usage: %s [options] trace.pb ...\n"
+        "  --line-size N         cache line size in bytes, power of two (64)\n"
+        "  --window N            references per sample window, 0 = none (1000)\n"
+        "  --hll-bits P          HLL precision of the run-wide WSS (14)\n"
+        "  --sample-hll-bits P   HLL precision of the per-window WSS (12)\n"
+        "  --no-exact            skip exact WSS tracking\n"
+        "  --no-hll              skip HLL WSS tracking\n"
+        "  --reuse-distance      SHARDS reuse distance / LRU miss ratio curve\n"
+        "  --rd-rate R           reuse distance sampling rate (0.01)\n"
+        "  --rd-max-keys N       lines tracked per thread before the rate halves (65536)\n"
+        "  --cache               simulate an L1/L2/LLC hierarchy per thread\n"
+        "  --l1 SIZE,WAYS        L1 geometry in bytes (32768,8)\n"
+        "  --l2 SIZE,WAYS        L2 geometry (1048576,16)\n"
+        "  --llc SIZE,WAYS       LLC geometry (33554432,16)\n"
+        "  --cache-repl P        L1/L2 replacement: lru, plru or rrip (lru)\n"
+        "  --llc-repl P          LLC replacement (rrip)\n"
+        "  --write-through       write-through instead of write-back\n"
+        "  --no-write-allocate   writes that miss do not fill\n"
+        "  --private-llc         one LLC per thread instead of a shared one\n"
+        "  --threads N           worker threads, 0 = one per CPU (0)\n"
+        "  --timeseries FILE     write the windows as a time-series .pb (one input only)\n"
+        "  --windows-csv FILE    write the windows as CSV (one input only)\n",
+        prog);
+}
+
+bool parse_uint(const char* s, unsigned long max, unsigned long* out) {
+    char* end;
+    errno = 0;
+    unsigned long v = std::strtoul(s, &end, 10);
+    if (errno || end == s || *end || v > max) return false;
+    *out = v;
+    return true;
+}
+
+// "SIZE,WAYS"
+bool parse_geometry(const char* s, cache_level_config_t* c) {
+    char* end;
+    errno = 0;
+    unsigned long long size = std::strtoull(s, &end, 10);
+    if (errno || end == s || *end != ',') return false;
+    unsigned long ways;
+    if (!parse_uint(end + 1, 1024, &ways) || ways == 0) return false;
+    c->size = size;
+    c->ways = (uint32_t)ways;
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    std::vector<const char*> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        const bool has_arg = i + 1 < argc;
+        unsigned long v = 0;
+        bool ok = true;
+        if (!std::strcmp(a, "--line-size") && has_arg) {
+            ok = parse_uint(argv[++i], 1u << 30, &v) && v && !(v & (v - 1));
+            opt.line_size = (uint32_t)v;
+        } else if (!std::strcmp(a, "--window") && has_arg) {
+            ok = parse_uint(argv[++i], UINT32_MAX, &v);
+            opt.window_refs = (uint32_t)v;
+        } else if (!std::strcmp(a, "--hll-bits") && has_arg) {
+            ok = parse_uint(argv[++i], HLLPP_MAX_P, &v) && v >= HLLPP_MIN_P;
+            opt.hll_bits = (uint8_t)v;
+        } else if (!std::strcmp(a, "--sample-hll-bits") && has_arg) {
+            ok = parse_uint(argv[++i], HLLPP_MAX_P, &v) && v >= HLLPP_MIN_P;
+            opt.sample_hll_bits = (uint8_t)v;
+        } else if (!std::strcmp(a, "--no-exact")) {
+            opt.exact = false;
+        } else if (!std::strcmp(a, "--no-hll")) {
+            opt.hll = false;
+        } else if (!std::strcmp(a, "--reuse-distance")) {
+            opt.reuse_distance = true;
+        } else if (!std::strcmp(a, "--rd-rate") && has_arg) {
+            opt.rd_sample_rate = std::strtod(argv[++i], nullptr);
+            ok = opt.rd_sample_rate > 0.0 && opt.rd_sample_rate <= 1.0;
+        } else if (!std::strcmp(a, "--rd-max-keys") && has_arg) {
+            ok = parse_uint(argv[++i], UINT32_MAX, &v);
+            opt.rd_max_keys = (uint32_t)v;
+        } else if (!std::strcmp(a, "--cache")) {
+            opt.cache = true;
+        } else if (!std::strcmp(a, "--l1") && has_arg) {
+            ok = parse_geometry(argv[++i], &opt.cache_cfg[0]);
+        } else if (!std::strcmp(a, "--l2") && has_arg) {
+            ok = parse_geometry(argv[++i], &opt.cache_cfg[1]);
+        } else if (!std::strcmp(a, "--llc") && has_arg) {
+            ok = parse_geometry(argv[++i], &opt.cache_cfg[2]);
+        } else if (!std::strcmp(a, "--cache-repl") && has_arg) {
+            ok = cache_repl_parse(argv[++i], &opt.cache_cfg[0].repl) == 0;
+            opt.cache_cfg[1].repl = opt.cache_cfg[0].repl;
+        } else if (!std::strcmp(a, "--llc-repl") && has_arg) {
+            ok = cache_repl_parse(argv[++i], &opt.cache_cfg[2].repl) == 0;
+        } else if (!std::strcmp(a, "--write-through")) {
+            for (auto& c : opt.cache_cfg) c.write_back = 0;
+        } else if (!std::strcmp(a, "--no-write-allocate")) {
+            for (auto& c : opt.cache_cfg) c.write_allocate = 0;
+        } else if (!std::strcmp(a, "--private-llc")) {
+            opt.shared_llc = false;
+        } else if (!std::strcmp(a, "--threads") && has_arg) {
+            ok = parse_uint(argv[++i], 4096, &v);
+            opt.threads = (unsigned)v;
+        } else if (!std::strcmp(a, "--timeseries") && has_arg) {
+            opt.timeseries_out = argv[++i];
+        } else if (!std::strcmp(a, "--windows-csv") && has_arg) {
+            opt.windows_csv = argv[++i];
+        } else if (a[0] == '-') {
+            ok = false;
+        } else {
+            inputs.push_back(a);
+        }
+        if (!ok) {
+            std::fprintf(stderr, "Error: bad option %s\n", a);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (inputs.empty() ||
+        ((opt.timeseries_out || opt.windows_csv) && inputs.size() != 1)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (opt.cache) {
+        // Simulated lines are the replay's lines
+        for (auto& c : opt.cache_cfg) c.line_size = opt.line_size;
+        cache_hier_t* probe = cache_hier_create(opt.cache_cfg, 3, nullptr);
+        if (!probe) {
+            std::fprintf(stderr, "Error: invalid cache geometry (sets must be a power of two; "
+                                 "plru needs a power-of-two number of ways up to 64)\n");
+            return 1;
+        }
+        cache_hier_destroy(probe);
+    }
+
+    unsigned num_threads = opt.threads ? opt.threads : std::thread::hardware_concurrency();
+    if (num_threads == 0) num_threads = 1;
+
+    int rc = 0;
+    for (const char* path : inputs) {
+        trace_reader_t* reader = trace_reader_open(path, 0);
+        if (!reader) {
+            std::fprintf(stderr, "Error: %s is not a readable memory trace\n", path);
+            rc = 1;
+            continue;
+        }
+        {
+            Replay replay(reader, opt);
+            if (replay.run(num_threads) != 0) {
+                std::fprintf(stderr, "Error: replay of %s failed (malformed chunk or out of memory)\n", path);
+                rc = 1;
+            } else {
+                replay.print_summary(path);
+                if (replay.write_windows() != 0) rc = 1;
+            }
+        }
+        trace_reader_close(reader);
+    }
+    return rc;
+}
@@ -35,15 +35,37 @@
 #include <string.h> /* for memset */
 #include <stddef.h> /* for offsetof */
 #include <math.h>
+#ifdef LINUX
+#    include <sys/mman.h>    /* MAP_ANONYMOUS, MAP_STACK */
+#    include <sys/syscall.h> /* SYS_mmap, ... */
+#endif
 #include "dr_api.h"
 #include "drmgr.h"
 #include "drreg.h"
 #include "drutil.h"
 #include "drx.h"
+#include "drbbdup.h"
+#include "drwrap.h"
 #include "utils.h"
 #include "ws_tsearch.h"
-#include "hll.h"
+#include "ws_window.h"
+#include "hllpp.h"
+#include "reuse_distance.h"
 #include "protobuf_writer.h"
+#include "async_writer.h"
+#include "trace_merge.h"
+#include "memref.h"
+#include "burst_sampler.h"
+#include "pc_table.h"
+#include "line_union.h"
+#include "spsc_ring.h"
+#include "buf_pool.h"
+#include "cache_sim.h"
+#include "region_map.h"
+#include "drsyms.h"
+
+/* Extra exact working-set window lengths tracked in the same pass */
+#define WSS_WINDOW_SIZES 4
 
 /* Configuration structure */
 typedef struct {
@@ -61,11 +83,68 @@ typedef struct {
     /* WSS tracking method control */
     bool wss_exact_tracking;    /* Enable exact WSS tracking (memory intensive) */
     bool wss_hll_tracking;      /* Enable HLL-based WSS tracking (memory efficient) */
+    bool wss_page_tracking;     /* Also track 4 KiB pages and 2 MiB huge pages */
+    uint64 wss_window_sizes[WSS_WINDOW_SIZES];  /* extra exact window lengths, in references */
+    uint wss_window_count;      /* entries of wss_window_sizes in use */
+
+    /* Reuse distance / miss ratio curve (SHARDS-sampled) */
+    bool enable_reuse_distance;
+    double rd_sample_rate;              /* fraction of lines tracked, (0, 1] */
+    uint rd_max_keys;                   /* lines tracked per thread before the rate is halved, 0 = no limit */
+
+    /* Per-instruction attribution (Space-Saving table of the heaviest pcs) */
+    bool enable_pc_tracking;
+    uint pc_table_size;                 /* pcs tracked per thread and overall */
+    uint pc_hll_bits;                   /* per-pc line sketch: 2^bits bytes */
+    uint pc_top_n;                      /* pcs listed in the exit report */
+
+    /* Cache simulation: an L1, L2 and LLC of cache_line_size lines in front
+       of memory, private per thread except for an optionally shared LLC */
+    bool enable_cache_sim;
+    uint64 cache_l1_size;               /* bytes */
+    uint cache_l1_ways;
+    uint64 cache_l2_size;
+    uint cache_l2_ways;
+    uint64 cache_llc_size;
+    uint cache_llc_ways;
+    char cache_replacement[16];         /* L1 and L2: lru, plru or rrip */
+    char cache_llc_replacement[16];
+    bool cache_write_back;              /* else write-through */
+    bool cache_write_allocate;          /* else no-write-allocate */
+    bool cache_shared_llc;              /* one LLC for all threads */
+
+    /* Memory region classification: stack, heap, global (module images),
+       file-backed mmap or other, per reference */
+    bool enable_region_tracking;
 
     /* Instruction threshold control */
     bool enable_instruction_threshold;  /* Enable instruction threshold termination */
     uint64 instruction_threshold;       /* Number of instructions before termination */
 
+    /* Per-thread output streams: each thread writes its own trace and
+       time-series file, so no writer or lock is shared between threads */
+    bool per_thread_streams;
+    bool merge_thread_streams;          /* merge them into one file each at exit */
+
+    /* Burst sampling: instrumented periods of burst_on_units alternate with
+       uninstrumented ones of about burst_off_units, and the counts are
+       extrapolated to the whole run */
+    uint64 burst_on_units;
+    uint64 burst_off_units;             /* 0 = instrument everything */
+    bool burst_unit_refs;               /* units are memory references, not instructions */
+
+    /* Region of interest: only code run inside it is instrumented. Each
+       configured source must be active for the ROI to be. */
+    bool roi_annotations;               /* between memcount_roi_begin() and _end() calls */
+    char roi_function[128];             /* while inside this function, "" = any */
+    uint64 roi_start_instrs;            /* from this global instruction count... */
+    uint64 roi_length_instrs;           /* ...for this many instructions, 0 = to the end */
+
+    /* Analysis offload: full buffers are queued to analysis threads, and
+       the application thread continues in a fresh one */
+    uint offload_threads;               /* 0 = analyze on the application thread */
+    uint offload_buffers;               /* buffers per application thread */
+
     /* Protobuf output file paths */
     char pb_trace_output[256];
     char pb_timeseries_output[256];
@@ -74,40 +153,139 @@ typedef struct {
 /* Global configuration with default values */
 static memcount_config_t config = {
     .cache_line_size = 64,
-    .hll_bits = 4,
-    .sample_hll_bits = 4,
+    .hll_bits = 14,
+    .sample_hll_bits = 12,
     .sample_window_refs = 1000,
     .max_mem_refs = 8192,
     .enable_trace = true,
     .wss_stat_tracking = true,
     .wss_exact_tracking = true,
     .wss_hll_tracking = true,
+    .wss_page_tracking = true,
+    .wss_window_count = 0,
+    .enable_reuse_distance = false,
+    .rd_sample_rate = 0.01,
+    .rd_max_keys = 65536,
+    .enable_pc_tracking = false,
+    .pc_table_size = 1024,
+    .pc_hll_bits = 6,
+    .pc_top_n = 20,
+    .enable_cache_sim = false,
+    .cache_l1_size = 32768,
+    .cache_l1_ways = 8,
+    .cache_l2_size = 1048576,
+    .cache_l2_ways = 16,
+    .cache_llc_size = 33554432,
+    .cache_llc_ways = 16,
+    .cache_replacement = "lru",
+    .cache_llc_replacement = "rrip",
+    .cache_write_back = true,
+    .cache_write_allocate = true,
+    .cache_shared_llc = true,
+    .enable_region_tracking = false,
     .enable_instruction_threshold = false,
     .instruction_threshold = 100000000,  /* Default: 100M instructions */
+    .per_thread_streams = true,
+    .merge_thread_streams = true,
+    .burst_on_units = 10000000,
+    .burst_off_units = 0,
+    .burst_unit_refs = false,
+    .roi_annotations = false,
+    .roi_function = "",
+    .roi_start_instrs = 0,
+    .roi_length_instrs = 0,
+    .offload_threads = 0,
+    .offload_buffers = 4,
     .pb_trace_output = "memtrace",
     .pb_timeseries_output = "timeseries"
 };
 
 /* Derived values calculated from config */
 static uintptr_t cache_line_mask;
+static bool page_tracking;     /* wss_page_tracking with exact or HLL tracking on */
+static size_t wss_window_base; /* sample_ws level of wss_window_sizes[0] */
 static size_t mem_buf_size;
 
-static HLL global_hll;
+static hllpp_t global_hll;
 static void *hll_mutex;
 
-/* Each mem_ref_t includes the type of reference (read or write),
- * the address referenced, and the size of the reference.
- */ // FIXME: can this be shortened?
-typedef struct _mem_ref_t {
-    bool write;
-    void *addr;
-    size_t size;
-    app_pc pc;
-    uint64 timestamp;
-} mem_ref_t;
+static rd_ctx_t *global_rd;    /* merged per-thread reuse distance histograms */
+static void *rd_mutex;
+
+static pc_table_t *global_pcs; /* merged per-thread pc tables */
+static void *pc_mutex;
+
+/* L1, L2 and LLC; cache_sim_levels is 0 with cache simulation off */
+enum { CACHE_L1, CACHE_L2, CACHE_LLC, CACHE_LEVELS };
+static cache_level_config_t cache_cfg[CACHE_LEVELS];
+static uint cache_sim_levels;
+static cache_level_t *shared_llc;            /* cache_shared_llc */
+static cache_hier_stats_t global_cache_stats; /* merged per thread, under cache_mutex */
+static void *cache_mutex;
+
+/* Reads, writes and bytes of one memory region */
+typedef struct {
+    uint64 reads;
+    uint64 writes;
+    uint64 bytes;
+} region_count_t;
+
+/* Address ranges of each region, updated from module loads, thread starts
+ * and the mapping system calls; NULL with region tracking off
+ */
+static region_map_t *regions;
+static void *region_mutex;                 /* brk state and the totals below */
+static app_pc brk_start, brk_cur;          /* the brk heap */
+static region_count_t global_region[MEM_REGION_COUNT];
+static hllpp_t global_region_hll[MEM_REGION_COUNT];
+_Static_assert(MEM_REGION_COUNT == PB_TS_REGIONS,
+               "memory regions must match the time-series region entries");
+
+/* Each buffer entry is a packed 16-byte memref_t (memref.h): the address
+ * referenced, and the pc of the instruction with the size and type (read or
+ * write) of the reference folded into its spare top bits. The second word is
+ * known at instrumentation time, so the inline code fills a record with two
+ * stores.
+ */
+#ifndef X64
+#    error "the packed memref_t assumes a 64-bit target"
+#endif
+#if MEMREF_SIZE_BINS != PB_TS_SIZE_BINS
+#    error "memref size classes must match the time-series histograms"
+#endif
 
 /* Memory buffer size will be calculated from config at runtime */
 
+/* Extrapolated counts under burst sampling */
+enum { BURST_REFS, BURST_READS, BURST_WRITES, BURST_NUM_METRICS };
+
+/* Closed windows of one wss_window_sizes length */
+typedef struct {
+    uint64 windows;
+    uint64 sum;                /* distinct lines, summed over the windows */
+    uint64 max;
+} wss_window_stat_t;
+
+/* Working sets at the granularities coarser than a line, each kept with
+ * the same exact and HLL methods as the line one. Their keys are derived
+ * from the line keys of each buffer segment, so no pass over the buffer
+ * is added.
+ */
+enum { WSS_PAGE, WSS_HUGE_PAGE, WSS_GRANS };
+
+static const uint64 wss_gran_mask[WSS_GRANS] = {
+    ~(uint64)(MEMREF_PAGE_SIZE - 1),
+    ~(uint64)(MEMREF_HUGE_PAGE_SIZE - 1)
+};
+
+typedef struct {
+    uint64_t    *keys;         /* keys of the current segment, runs collapsed */
+    ws_ctx_t    *ws;           /* whole run, exact */
+    hllpp_t      hll;          /* whole run, approximate */
+    ws_window_t *sample_ws;    /* current window, exact */
+    hllpp_t      sample_hll;   /* current window, approximate */
+} wss_gran_t;
+
 /* thread private counter */
 typedef struct {
     char *buf_ptr;
@@ -115,59 +293,91 @@ typedef struct {
     /* buf_end holds the negative value of real address of buffer end. */
     ptr_int_t buf_end;
     void *cache;
+    uint64 num_instrs;       /* app instructions since the last flush, bumped inline */
     uint64 num_refs;
     uint64 num_reads;
     uint64 num_writes;
     uint64 working_set;
     ws_ctx_t *ws;
-    HLL hll;
+    hllpp_t hll;
+    uint64_t *line_keys;     /* keys of the current buffer, for batched WSS/HLL/RD updates */
+    rd_ctx_t *rd;
+    pc_table_t *pcs;           /* per-pc traffic, enable_pc_tracking */
+    cache_hier_t *caches;      /* simulated hierarchy, enable_cache_sim */
+    uint8_t *cache_served;     /* level that served each reference of the buffer */
+    wss_gran_t gran[WSS_GRANS];   /* page and huge-page working sets */
+
+    /* Memory regions (enable_region_tracking) */
+    uint8_t  *ref_regions;     /* region of each reference of the buffer */
+    uint64_t *region_keys;     /* a segment's line keys grouped by region */
+    region_count_t region_run[MEM_REGION_COUNT];
+    region_count_t region_win[MEM_REGION_COUNT];
+    hllpp_t   region_hll[MEM_REGION_COUNT];        /* whole run */
+    hllpp_t   region_sample_hll[MEM_REGION_COUNT]; /* current window */
+    uint64    sys_arg[3];      /* arguments of the mapping call in progress */
+    uint8_t   sys_region;      /* region of the range mremap moves */
+
+    /* Trace events of one filled buffer, handed to the writer in bulk */
+    pb_trace_event_t *trace_buf;   /* max_mem_refs events */
+    uint64    trace_last_us;       /* time of the previous buffer flush */
+    uint32_t  thread_id;
+    uint32_t  seq;                 /* unique per thread, unlike OS thread ids */
+
+    /* Burst sampling: the current period ends when burst_left, decremented
+       inline at every block entry, drops to zero */
+    int64     burst_left;
+    int64     burst_len;       /* burst_left at the start of the period */
+    burst_sched_t burst;
+    uint64    burst_refs0;     /* num_refs/reads/writes when the on period began */
+    uint64    burst_reads0;
+    uint64    burst_writes0;
+    burst_stat_t burst_stat[BURST_NUM_METRICS];
+
+    /* Block copy selection (drbbdup) */
+    uintptr_t *case_slot;      /* this thread's raw TLS case encoding */
+    void      *next_thread;    /* per_thread_t list, for ROI changes */
+    void      *prev_thread;
+    int64     roi_left;        /* instructions to the next ROI window check */
+    int64     threshold_left;  /* instructions to the next threshold check */
+
+    /* Analysis offload (offload_threads): filled buffers queue in full_ring
+       and go back to pool once analyzed. Whoever holds offload_lock -- the
+       thread's analysis worker, or the thread itself when it drains --
+       is the ring's consumer and the only user of the analysis state. */
+    buf_pool_t  *pool;
+    spsc_ring_t *full_ring;
+    pool_buf_t  *cur_buf;          /* buffer being filled */
+    void        *offload_lock;
+    void        *worker;           /* offload_worker_t serving this thread */
+    void        *next_offload;     /* the worker's per_thread_t list */
+    void        *prev_offload;
+    uint64      handed_off;        /* buffers queued */
+    uint64      analyzed;          /* buffers analyzed, atomic */
+    uint64      offload_stalls;    /* waits for a free buffer */
+    uint64      offload_stall_us;
+    uint64      offload_max_depth; /* most buffers queued at once */
+    uint64      buf_time_us;       /* flush time of the buffer being analyzed */
+
+    /* This thread's own output streams (per_thread_streams) */
+    pb_trace_writer_t      *trace_writer;
+    pb_timeseries_writer_t *timeseries_writer;
 
     /*Sampling API*/
-    ws_ctx_t *sample_ws;     /* exact WSS for the current window */
-    HLL       sample_hll;    /* HLL WSS for the current window */
+    ws_window_t *sample_ws;  /* exact WSS for the current window (O(1) reset), and
+                                the wss_window_sizes windows as further levels */
+    wss_window_stat_t win_stat[WSS_WINDOW_SIZES];
+    hllpp_t   sample_hll;    /* HLL WSS for the current window */
     uint64    sample_ref_count;
     uint64    sample_idx;    /* window number (0,1,2,...) */
 
-    /* Per-window counters for protobuf output */
-    uint64    sample_read_count;   /* reads in current window */
-    uint64    sample_write_count;  /* writes in current window */
-
-    /* Per-window size-specific counters */
-    uint64 sample_read_size_1;
-    uint64 sample_read_size_2;
-    uint64 sample_read_size_4;
-    uint64 sample_read_size_8;
-    uint64 sample_read_size_16;
-    uint64 sample_read_size_32;
-    uint64 sample_read_size_64;
-    uint64 sample_read_size_other;
-    uint64 sample_write_size_1;
-    uint64 sample_write_size_2;
-    uint64 sample_write_size_4;
-    uint64 sample_write_size_8;
-    uint64 sample_write_size_16;
-    uint64 sample_write_size_32;
-    uint64 sample_write_size_64;
-    uint64 sample_write_size_other;
-
-    /* Size-specific counters for reads and writes (global per thread) */
-    uint64 read_size_1;    /* 1-byte reads */
-    uint64 read_size_2;    /* 2-byte reads */
-    uint64 read_size_4;    /* 4-byte reads */
-    uint64 read_size_8;    /* 8-byte reads */
-    uint64 read_size_16;   /* 16-byte reads */
-    uint64 read_size_32;   /* 32-byte reads */
-    uint64 read_size_64;   /* 64-byte reads */
-    uint64 read_size_other; /* other size reads */
-
-    uint64 write_size_1;    /* 1-byte writes */
-    uint64 write_size_2;    /* 2-byte writes */
-    uint64 write_size_4;    /* 4-byte writes */
-    uint64 write_size_8;    /* 8-byte writes */
-    uint64 write_size_16;   /* 16-byte writes */
-    uint64 write_size_32;   /* 32-byte writes */
-    uint64 write_size_64;   /* 64-byte writes */
-    uint64 write_size_other; /* other size writes */
+    /* Per-window read/write counts by size class, for protobuf output */
+    memref_hist_t sample_hist;
+    uint64    sample_served[CACHE_LEVELS + 1];  /* references served per level, memory last */
+
+    /* Read/write counts by size class (global per thread) */
+    memref_hist_t size_hist;
+    /* References counted but not yet folded into the counts above */
+    memref_counter_t ref_counts;
 
 } per_thread_t;
 
@@ -184,30 +394,72 @@ static uint64 global_num_refs; /* keep a global memory reference count */
 static uint64 global_num_reads;
 static uint64 global_num_writes;
 static uint64 global_working_set;
+static line_union_t *global_lines; /* union of the threads' exact line sets */
+static volatile int thread_seq;    /* numbers threads for global_lines */
+static line_union_t *global_gran_lines[WSS_GRANS]; /* same, per coarser granularity */
+static volatile int lines_inexact; /* some thread's lines missing from the unions */
+static hllpp_t global_gran_hll[WSS_GRANS];         /* under hll_mutex */
+static wss_window_stat_t global_win_stat[WSS_WINDOW_SIZES];   /* under mutex */
 static int tls_index;
 
 /* Global size-specific counters */
-static uint64 global_read_size_1 = 0;
-static uint64 global_read_size_2 = 0;
-static uint64 global_read_size_4 = 0;
-static uint64 global_read_size_8 = 0;
-static uint64 global_read_size_16 = 0;
-static uint64 global_read_size_32 = 0;
-static uint64 global_read_size_64 = 0;
-static uint64 global_read_size_other = 0;
-
-static uint64 global_write_size_1 = 0;
-static uint64 global_write_size_2 = 0;
-static uint64 global_write_size_4 = 0;
-static uint64 global_write_size_8 = 0;
-static uint64 global_write_size_16 = 0;
-static uint64 global_write_size_32 = 0;
-static uint64 global_write_size_64 = 0;
-static uint64 global_write_size_other = 0;
+static memref_hist_t global_size_hist;
+
+/* Under burst sampling or an ROI, drbbdup keeps copies of every block,
+ * selected at block entry by a per-thread case encoding held in raw TLS.
+ * The zeroed TLS slot selects the instrumented copy.
+ */
+enum {
+    INSTRU_CASE_ON = 0,        /* full instrumentation */
+    INSTRU_CASE_BURST_OFF = 1, /* burst off period: countdowns only */
+    INSTRU_CASE_OUT_OF_ROI = 2,/* outside the ROI: instruction counts only */
+};
+static bool bbdup_enabled;
+static reg_id_t case_tls_seg;
+static uint case_tls_offs;
+static void *thread_list;      /* per_thread_t, under roi_mutex */
+
+static bool burst_enabled;
+static burst_stat_t global_burst_stat[BURST_NUM_METRICS];
+static uint64 global_burst_units;
+static uint64 global_burst_units_on;
+static uint64 global_burst_periods;
+
+/* Region of interest */
+#define ROI_CHECK_INSTRS 100000    /* max instructions between window checks */
+#define THRESHOLD_CHECK_INSTRS 100000  /* max instructions between threshold checks */
+static bool roi_enabled;
+static bool roi_window;            /* roi_start_instrs/roi_length_instrs set */
+static void *roi_mutex;
+static bool roi_active;            /* all configured sources active */
+static bool roi_marker_on;         /* memcount_roi_begin() seen last */
+static int roi_func_depth;         /* threads x nesting inside roi_function */
+static bool roi_window_on;
+static uint64 roi_entries;
+static bool drsyms_ready;
+
+/* Analysis offload workers; application thread i is served by worker
+ * i % offload_threads. An idle worker sleeps on its event, which producers
+ * signal after queueing a buffer when they see it sleeping.
+ */
+#define OFFLOAD_DRAIN_TIMEOUT_US 10000000   /* give up on a stuck worker */
+typedef struct {
+    void *mutex;               /* guards threads */
+    void *threads;             /* per_thread_t list */
+    void *wake;                /* dr event */
+    int   sleeping;
+    int   stop;
+    int   done;
+    int   dead;                /* stalled: its threads analyze their own buffers */
+} offload_worker_t;
+static offload_worker_t *offload_workers;
+static uint64 global_offload_buffers;       /* under mutex */
+static uint64 global_offload_stalls;
+static uint64 global_offload_stall_us;
+static uint64 global_offload_max_depth;
 
 /* Instruction threshold tracking */
-static uint64 global_instruction_count = 0;
-static void *instr_count_mutex = NULL;
+static volatile int64 global_instruction_count = 0;   /* updated atomically */
 static volatile bool threshold_reached = false;
 
 /* Execution time tracking */
@@ -222,14 +474,34 @@ static void *timeseries_mutex = NULL;       /* mutex for timeseries writer */
 static uint32_t global_thread_count = 0;    /* track total threads */
 static void *thread_count_mutex = NULL;
 
+/* Per-thread stream files, merged at exit. Only touched at thread
+   init and exit, under stream_mutex. */
+typedef struct _stream_file_t {
+    struct _stream_file_t *next;
+    char path[MAXIMUM_PATH];
+} stream_file_t;
+static stream_file_t *trace_stream_files = NULL;
+static stream_file_t *timeseries_stream_files = NULL;
+static void *stream_mutex = NULL;
+
+/* One writer per thread. Their file I/O runs on one I/O thread shared by
+   every application thread, or with offload_threads on the analysis
+   thread that fills the buffers, which is already off the application's
+   threads. */
+#define THREAD_TRACE_IO_BUFFER      (256 << 10)
+#define THREAD_TIMESERIES_IO_BUFFER (64 << 10)
+static aw_io_t *thread_stream_io = NULL;
+
 static void
 event_exit(void);
 static void
 event_thread_init(void *drcontext);
 static void
 event_thread_exit(void *drcontext);
+static uint64
+check_instruction_count(per_thread_t *data);
 static void
-check_instruction_threshold(uint64 num_instrs);
+roi_set_window(uint64 total);
 static dr_emit_flags_t
 event_bb_app2app(void *drcontext, void *tag, instrlist_t *bb, bool for_trace,
                  bool translating);
@@ -245,6 +517,18 @@ clean_call(void);
 static void
 memtrace(void *drcontext);
 static void
+offload_buffer(per_thread_t *data, bool refill);
+static uint
+offload_analyze_locked(per_thread_t *t, uint max);
+static bool
+offload_drain(per_thread_t *data);
+static bool
+offload_leave(per_thread_t *data);
+static void
+offload_worker_main(void *arg);
+static void
+offload_stop_workers(void);
+static void
 code_cache_init(void);
 static void
 code_cache_exit(void);
@@ -252,8 +536,48 @@ static void
 instrument_mem(void *drcontext, instrlist_t *ilist, instr_t *where, app_pc pc,
                instr_t *memref_instr, int pos, bool write);
 static void
-instrument_mem_direct(void *drcontext, instrlist_t *ilist, instr_t *where, app_pc pc,
-                     instr_t *memref_instr, int pos, bool write);
+instrument_instr_count(void *drcontext, instrlist_t *ilist, instr_t *where, uint num_instrs);
+static void
+instrument_countdown(void *drcontext, instrlist_t *ilist, instr_t *where, int offset,
+                     uint units, void *callee);
+static void
+instrument_app_instr(void *drcontext, instrlist_t *bb, instr_t *where, instru_data_t *data);
+static bool
+bbdup_init(void);
+
+/* async_writer I/O threads must be DynamoRIO client threads */
+static int spawn_io_thread(void (*fn)(void *), void *arg) {
+    return dr_create_client_thread(fn, arg) ? 0 : -1;
+}
+
+/* ...and block on DynamoRIO events rather than pthread condition
+ * variables. DR events have no timed wait: a timed wait sleeps 1 ms and
+ * returns, which async_writer allows (its waiters re-check).
+ */
+static void *io_event_create(void) {
+    return dr_event_create();
+}
+
+static void io_event_destroy(void *ev) {
+    dr_event_destroy(ev);
+}
+
+static void io_event_wait(void *ev, unsigned timeout_ms) {
+    if (timeout_ms == 0) {
+        dr_event_wait(ev);
+        dr_event_reset(ev);     /* consume the signal */
+    } else {
+        dr_sleep(1);
+    }
+}
+
+static void io_event_signal(void *ev) {
+    dr_event_signal(ev);
+}
+
+static const aw_sync_t io_sync = {
+    io_event_create, io_event_destroy, io_event_wait, io_event_signal
+};
 
 //Sampling Helper
 /* Get high-resolution timestamp */
@@ -261,48 +585,465 @@ static uint64 get_timestamp(void) {
     return dr_get_microseconds();
 }
 
-/* Check instruction threshold and terminate if reached */
-static void check_instruction_threshold(uint64 num_instrs) {
-    if (!config.enable_instruction_threshold || threshold_reached)
-        return;
+/* Add the thread's inline instruction count to the global one; returns the
+ * global count before the addition.
+ */
+static uint64 flush_instruction_count(per_thread_t *data) {
+    int64 n = (int64)data->num_instrs;
+    data->num_instrs = 0;
+    return (uint64)(dr_atomic_add64_return_sum(&global_instruction_count, n) - n);
+}
+
+/* Fold the references counted since the last fold into the thread's
+ * read/write counts and size histograms. Counting only bumps the unfolded
+ * counters, so this runs when the counts are read: at a sample window's
+ * close, at the end of a burst period and at thread exit.
+ */
+static void fold_ref_counts(per_thread_t *data) {
+    memref_hist_t hist;
+
+    memset(&hist, 0, sizeof(hist));
+    memref_counter_take(&data->ref_counts, &hist);
+    memref_hist_add(&data->size_hist, &hist);
+    data->num_reads += memref_hist_reads(&hist);
+    data->num_writes += memref_hist_writes(&hist);
+    if (config.wss_stat_tracking)
+        memref_hist_add(&data->sample_hist, &hist);
+}
+
+/* Flush the thread's instruction count, move the ROI window along and
+ * terminate if the threshold is reached; returns the global count. Called
+ * when the thread's threshold or ROI window countdown runs out, so the
+ * per-block path is an inline add and a countdown; the threshold and the
+ * window boundaries can be overshot by what each thread executed since its
+ * last check, at most THRESHOLD_CHECK_INSTRS or ROI_CHECK_INSTRS.
+ */
+static uint64 check_instruction_count(per_thread_t *data) {
+    bool threshold = config.enable_instruction_threshold && !threshold_reached;
+
+    if (!threshold && !roi_window)
+        return 0;
 
-    dr_mutex_lock(instr_count_mutex);
-    global_instruction_count += num_instrs;
+    uint64 n = data->num_instrs;
+    uint64 before = flush_instruction_count(data);
+    uint64 total = before + n;
 
-    if (global_instruction_count >= config.instruction_threshold) {
+    if (roi_window)
+        roi_set_window(total);
+
+    /* only the thread whose flush crosses the threshold exits */
+    if (threshold &&
+        before < config.instruction_threshold && total >= config.instruction_threshold) {
         threshold_reached = true;
-        dr_mutex_unlock(instr_count_mutex);
 
         dr_fprintf(STDERR, "\n=== Instruction threshold reached: %llu instructions ===\n",
-                   global_instruction_count);
+                   total);
         dr_fprintf(STDERR, "Terminating instrumentation and printing final stats...\n\n");
 
         /* Trigger exit which will print final stats */
         dr_exit_process(0);
+    }
+    return total;
+}
+
+/* Select the thread's block copies from the ROI and its burst period.
+ * Other threads write the slot too when the ROI changes, so callers hold
+ * roi_mutex when there is an ROI.
+ */
+static void update_thread_case(per_thread_t *data) {
+    if (roi_enabled && !roi_active)
+        *data->case_slot = INSTRU_CASE_OUT_OF_ROI;
+    else if (burst_enabled && !data->burst.on)
+        *data->case_slot = INSTRU_CASE_BURST_OFF;
+    else
+        *data->case_slot = INSTRU_CASE_ON;
+}
+
+/* Recompute the ROI after one of its sources changed; every thread picks
+ * up the change at its next block entry. Called with roi_mutex held.
+ */
+static void roi_update(void) {
+    bool active = (!config.roi_annotations || roi_marker_on) &&
+                  (config.roi_function[0] == '\0' || roi_func_depth > 0) &&
+                  (!roi_window || roi_window_on);
+
+    if (active == roi_active)
+        return;
+    roi_active = active;
+    if (active)
+        roi_entries++;
+    for (per_thread_t *t = thread_list; t != NULL; t = t->next_thread)
+        update_thread_case(t);
+}
+
+static void roi_set_window(uint64 total) {
+    bool on = total >= config.roi_start_instrs &&
+              (config.roi_length_instrs == 0 ||
+               total - config.roi_start_instrs < config.roi_length_instrs);
+    dr_mutex_lock(roi_mutex);
+    roi_window_on = on;
+    roi_update();
+    dr_mutex_unlock(roi_mutex);
+}
+
+/* Instructions from the global count total to the next window boundary */
+static uint64 roi_window_distance(uint64 total) {
+    if (total < config.roi_start_instrs)
+        return config.roi_start_instrs - total;
+    if (config.roi_length_instrs > 0 &&
+        total - config.roi_start_instrs < config.roi_length_instrs)
+        return config.roi_start_instrs + config.roi_length_instrs - total;
+    return UINT64_MAX;
+}
+
+static void roi_marker_begin(void *wrapcxt, void **user_data) {
+    dr_mutex_lock(roi_mutex);
+    roi_marker_on = true;
+    roi_update();
+    dr_mutex_unlock(roi_mutex);
+}
+
+static void roi_marker_end(void *wrapcxt, void **user_data) {
+    dr_mutex_lock(roi_mutex);
+    roi_marker_on = false;
+    roi_update();
+    dr_mutex_unlock(roi_mutex);
+}
+
+static void roi_function_enter(void *wrapcxt, void **user_data) {
+    dr_mutex_lock(roi_mutex);
+    roi_func_depth++;
+    roi_update();
+    dr_mutex_unlock(roi_mutex);
+}
+
+static void roi_function_exit(void *wrapcxt, void *user_data) {
+    dr_mutex_lock(roi_mutex);
+    if (roi_func_depth > 0)
+        roi_func_depth--;
+    roi_update();
+    dr_mutex_unlock(roi_mutex);
+}
+
+/* Memory region tracking. Module images are global data, thread stacks
+ * are registered as threads start, and the mapping system calls keep the
+ * rest current: brk and anonymous mmaps are heap (malloc takes its memory
+ * from them), MAP_STACK mmaps are stacks (pthread stacks), and file-backed
+ * mmaps are mmap. Lookups happen when a buffer is analyzed, so references
+ * made just before a range is unmapped or replaced take its new region.
+ */
+#define MAIN_STACK_RESERVE (8 << 20)   /* the default RLIMIT_STACK */
+
+/* Mapping lengths cover whole pages */
+static uint64 page_round(uint64 len) {
+    return (len + page_size - 1) & ~(uint64)(page_size - 1);
+}
+
+static void region_set(app_pc start, app_pc end, uint8_t region) {
+    if (region_map_set(regions, (uint64)start, (uint64)end, region) != 0)
+        dr_fprintf(STDERR, "Warning: out of memory tracking memory regions\n");
+}
+
+/* The stack the thread starts on; the main thread's grows on demand, so
+   it is taken to extend to the usual limit below its top */
+static void region_add_stack(void *drcontext) {
+    dr_mcontext_t mc = { sizeof(mc), DR_MC_CONTROL };
+    dr_mem_info_t info;
+    app_pc sp, top;
+
+    if (!dr_get_mcontext(drcontext, &mc))
+        return;
+    sp = (app_pc)reg_get_value(DR_REG_XSP, &mc);
+    if (!dr_query_memory_ex(sp, &info) || info.type == DR_MEMTYPE_FREE)
+        return;
+    top = info.base_pc + info.size;
+    if (dr_get_thread_id(drcontext) == dr_get_process_id() &&
+        info.size < MAIN_STACK_RESERVE && (ptr_uint_t)top > MAIN_STACK_RESERVE)
+        region_set(top - MAIN_STACK_RESERVE, top, MEM_REGION_STACK);
+    else
+        region_set(info.base_pc, top, MEM_REGION_STACK);
+}
+
+static void region_module_segments(const module_data_t *mod, uint8_t region) {
+#ifdef LINUX
+    if (mod->num_segments > 0) {
+        for (uint i = 0; i < mod->num_segments; i++)
+            region_set(mod->segments[i].start, mod->segments[i].end, region);
+        return;
+    }
+#endif
+    region_set(mod->start, mod->end, region);
+}
+
+static void event_module_unload(void *drcontext, const module_data_t *mod) {
+    region_module_segments(mod, MEM_REGION_OTHER);
+}
+
+#ifdef LINUX
+static bool event_filter_syscall(void *drcontext, int sysnum) {
+    return sysnum == SYS_mmap || sysnum == SYS_munmap || sysnum == SYS_mremap ||
+        sysnum == SYS_brk;
+}
+
+/* Arguments are only readable before the call */
+static bool event_pre_syscall(void *drcontext, int sysnum) {
+    per_thread_t *data;
+
+    if (!event_filter_syscall(drcontext, sysnum))
+        return true;
+    data = drmgr_get_tls_field(drcontext, tls_index);
+    for (int i = 0; i < 3; i++)
+        data->sys_arg[i] = (uint64)dr_syscall_get_param(drcontext, i);
+    if (sysnum == SYS_mmap)
+        data->sys_arg[2] = (uint64)dr_syscall_get_param(drcontext, 3);   /* flags */
+    else if (sysnum == SYS_mremap)
+        data->sys_region = region_map_lookup(regions, data->sys_arg[0]);
+
+    /* References are classified when their buffer is flushed: flush this
+       thread's before its ranges go away. Other threads' buffers are
+       still classified at their next flush. */
+    if ((sysnum == SYS_munmap || sysnum == SYS_mremap ||
+         (sysnum == SYS_brk && data->sys_arg[0] != 0 && (app_pc)data->sys_arg[0] < brk_cur)) &&
+        data->buf_ptr != data->buf_base)
+        memtrace(drcontext);
+    return true;
+}
+
+static void event_post_syscall(void *drcontext, int sysnum) {
+    per_thread_t *data;
+    app_pc res;
+
+    if (!event_filter_syscall(drcontext, sysnum))
+        return;
+    data = drmgr_get_tls_field(drcontext, tls_index);
+    res = (app_pc)dr_syscall_get_result(drcontext);
+    /* mmap, munmap and mremap fail with -errno; brk returns the break */
+    if (sysnum != SYS_brk && (ptr_uint_t)res >= (ptr_uint_t)-4095)
+        return;
+
+    if (sysnum == SYS_mmap) {
+        uint64 flags = data->sys_arg[2];
+        region_set(res, res + page_round(data->sys_arg[1]),
+                   (flags & MAP_STACK) ? MEM_REGION_STACK :
+                   (flags & MAP_ANONYMOUS) ? MEM_REGION_HEAP : MEM_REGION_MMAP);
+    } else if (sysnum == SYS_munmap) {
+        app_pc start = (app_pc)data->sys_arg[0];
+        region_set(start, start + page_round(data->sys_arg[1]),
+                   MEM_REGION_OTHER);
+    } else if (sysnum == SYS_mremap) {
+        app_pc old = (app_pc)data->sys_arg[0];
+        region_set(old, old + page_round(data->sys_arg[1]), MEM_REGION_OTHER);
+        region_set(res, res + page_round(data->sys_arg[2]), data->sys_region);
+    } else {
+        /* the first call, brk(0), tells where the heap starts */
+        dr_mutex_lock(region_mutex);
+        if (brk_start == NULL)
+            brk_start = brk_cur = res;
+        if (res > brk_cur)
+            region_set(brk_cur, res, MEM_REGION_HEAP);
+        else if (res < brk_cur && res >= brk_start)
+            region_set(res, brk_cur, MEM_REGION_OTHER);
+        if (res >= brk_start)
+            brk_cur = res;
+        dr_mutex_unlock(region_mutex);
+    }
+}
+#endif
+
+/* Address of an exported or (with drsyms) symbol-table function, or NULL */
+static app_pc find_function(const module_data_t *mod, const char *name) {
+    app_pc pc = (app_pc)dr_get_proc_address(mod->handle, name);
+    size_t offs;
+
+    if (pc == NULL && drsyms_ready &&
+        drsym_lookup_symbol(mod->full_path, name, &offs, DRSYM_DEMANGLE) == DRSYM_SUCCESS)
+        pc = mod->start + offs;
+    return pc;
+}
+
+/* Wrap the ROI marker and ROI functions as their modules load, and
+ * record the module's image as global data
+ */
+static void event_module_load(void *drcontext, const module_data_t *mod, bool loaded) {
+    app_pc pc;
+
+    if (regions) {
+        region_module_segments(mod, MEM_REGION_GLOBAL);
+    }
+    if (config.roi_annotations) {
+        if ((pc = find_function(mod, "memcount_roi_begin")) != NULL)
+            drwrap_wrap(pc, roi_marker_begin, NULL);
+        if ((pc = find_function(mod, "memcount_roi_end")) != NULL)
+            drwrap_wrap(pc, roi_marker_end, NULL);
+    }
+    if (config.roi_function[0] != '\0' &&
+        (pc = find_function(mod, config.roi_function)) != NULL) {
+        dr_fprintf(STDERR, "ROI function %s found in %s\n", config.roi_function,
+                   dr_module_preferred_name(mod) == NULL ? "?" : dr_module_preferred_name(mod));
+        drwrap_wrap(pc, roi_function_enter, roi_function_exit);
+    }
+}
+
+/* End the thread's current burst period after the units it ran. An on
+ * period first drains the buffer, so its counts are complete, and adds
+ * them to the extrapolation. The last period (thread exit) is accounted
+ * but not followed by another.
+ */
+static void burst_close_period(void *drcontext, per_thread_t *data, bool last) {
+    uint64 units = (uint64)(data->burst_len - data->burst_left);
+
+    if (data->burst.on) {
+        memtrace(drcontext);
+        /* the counts below need every buffer analyzed; a stalled worker
+           may still hold them, and the period is then left out */
+        if (data->pool == NULL || offload_drain(data)) {
+            fold_ref_counts(data);
+            if (units > 0) {
+                burst_stat_add(&data->burst_stat[BURST_REFS],
+                               (double)(data->num_refs - data->burst_refs0), (double)units);
+                burst_stat_add(&data->burst_stat[BURST_READS],
+                               (double)(data->num_reads - data->burst_reads0), (double)units);
+                burst_stat_add(&data->burst_stat[BURST_WRITES],
+                               (double)(data->num_writes - data->burst_writes0), (double)units);
+            }
+        }
+    }
+    if (last) {
+        burst_sched_finish(&data->burst, units);
+        return;
+    }
+
+    data->burst_len = (int64)burst_sched_next(&data->burst, units);
+    data->burst_left = data->burst_len;
+    data->burst_refs0 = data->num_refs;
+    data->burst_reads0 = data->num_reads;
+    data->burst_writes0 = data->num_writes;
+    if (roi_enabled) {
+        dr_mutex_lock(roi_mutex);
+        update_thread_case(data);
+        dr_mutex_unlock(roi_mutex);
     } else {
-        dr_mutex_unlock(instr_count_mutex);
+        update_thread_case(data);
     }
 }
 
-/* Direct trace function - called immediately for each memory access */
-static void direct_trace_write(void *addr, bool write, size_t size, app_pc pc) {
-    if (global_trace_writer && config.enable_trace) {
-        void *drcontext = dr_get_current_drcontext();
-        uint32_t thread_id = dr_get_thread_id(drcontext);
-        uint64_t timestamp = get_timestamp();
+/* Clean call made when the inline countdown runs out */
+static void burst_period_end(void) {
+    void *drcontext = dr_get_current_drcontext();
+    burst_close_period(drcontext, drmgr_get_tls_field(drcontext, tls_index), false);
+}
+
+/* Clean call made when the ROI window countdown runs out: count, then
+ * check again after ROI_CHECK_INSTRS or at the next window boundary
+ */
+static void roi_window_check(void) {
+    void *drcontext = dr_get_current_drcontext();
+    per_thread_t *data = drmgr_get_tls_field(drcontext, tls_index);
+    uint64 dist = roi_window_distance(check_instruction_count(data));
+
+    data->roi_left = dist < ROI_CHECK_INSTRS ? (int64)dist : ROI_CHECK_INSTRS;
+}
+
+/* Clean call made when the threshold countdown runs out: count, then check
+ * again after THRESHOLD_CHECK_INSTRS or when the threshold may be crossed
+ */
+static void threshold_check(void) {
+    void *drcontext = dr_get_current_drcontext();
+    per_thread_t *data = drmgr_get_tls_field(drcontext, tls_index);
+    uint64 total = check_instruction_count(data);
+    uint64 dist = total < config.instruction_threshold ?
+        config.instruction_threshold - total : 0;
+
+    data->threshold_left = dist < THRESHOLD_CHECK_INSTRS ? (int64)dist : THRESHOLD_CHECK_INSTRS;
+}
+
+/* Hand the trace events of one buffer to the thread's own writer, or to the
+ * shared one under trace_mutex. The inline buffer carries no per-reference
+ * time, so timestamps are spread evenly between the previous flush and this
+ * one: ordered within the thread and accurate to one buffer.
+ */
+static void emit_thread_trace(per_thread_t *data, const memref_t *refs, int n) {
+    if (n == 0) return;
+
+    uint64 now = data->buf_time_us;
+    uint64 span = now - data->trace_last_us;
+    for (int i = 0; i < n; i++) {
+        pb_trace_event_t *ev = &data->trace_buf[i];
+        ev->timestamp = data->trace_last_us + span * (uint64)(i + 1) / (uint64)n;
+        ev->address = refs[i].addr;
+        ev->thread_id = data->thread_id;
+        ev->size = MEMREF_SIZE(&refs[i]);
+        ev->is_write = MEMREF_IS_WRITE(&refs[i]);
+        ev->hit_level = data->caches ? data->cache_served[i] + 1 : 0;
+    }
+    data->trace_last_us = now;
 
-        /* Thread-safe write to global protobuf file */
+    if (data->trace_writer) {
+        pb_trace_write_events(data->trace_writer, data->trace_buf, n);
+    } else {
         dr_mutex_lock(trace_mutex);
-        pb_trace_write_event(global_trace_writer,
-                            timestamp,
-                            thread_id,
-                            (uint64_t)addr,
-                            write,
-                            (uint32_t)size);
+        pb_trace_write_events(global_trace_writer, data->trace_buf, n);
         dr_mutex_unlock(trace_mutex);
     }
 }
 
+static void register_stream_file(stream_file_t **list, const char *path) {
+    stream_file_t *f = dr_global_alloc(sizeof(stream_file_t));
+    dr_snprintf(f->path, sizeof(f->path), "%s", path);
+    NULL_TERMINATE_BUFFER(f->path);
+    dr_mutex_lock(stream_mutex);
+    f->next = *list;
+    *list = f;
+    dr_mutex_unlock(stream_mutex);
+}
+
+/* Merge the per-thread files of one output into <base>_<pid>.pb and delete
+ * them, or keep them when merging is disabled or fails. Called at exit,
+ * after every thread has closed its writers.
+ */
+static void merge_stream_files(stream_file_t **list, const char *base, bool timeseries) {
+    stream_file_t *f;
+    size_t n = 0, i;
+    int64_t merged = -1;
+    char output[MAXIMUM_PATH];
+
+    for (f = *list; f != NULL; f = f->next)
+        n++;
+    if (n == 0)
+        return;
+
+    dr_snprintf(output, sizeof(output), "%s_%d.pb", base, dr_get_process_id());
+    NULL_TERMINATE_BUFFER(output);
+    if (config.merge_thread_streams) {
+        /* the list is newest first: merge in thread start order */
+        const char **inputs = dr_global_alloc(n * sizeof(const char *));
+        for (f = *list, i = n; f != NULL; f = f->next)
+            inputs[--i] = f->path;
+        merged = timeseries ? timeseries_merge_files(output, inputs, n)
+                            : trace_merge_files(output, inputs, n, 0);
+        dr_global_free(inputs, n * sizeof(const char *));
+        if (merged >= 0) {
+            dr_fprintf(STDERR, "Merged %u per-thread %s files into %s (%lld %s)\n",
+                       (uint)n, timeseries ? "time-series" : "trace", output,
+                       (long long)merged, timeseries ? "samples" : "events");
+        } else {
+            dr_fprintf(STDERR, "Warning: failed to merge per-thread %s files into %s\n",
+                       timeseries ? "time-series" : "trace", output);
+        }
+    }
+    if (merged < 0) {
+        dr_fprintf(STDERR, "Per-thread %s files kept: %s_%d.t<n>.pb\n",
+                   timeseries ? "time-series" : "trace", base, dr_get_process_id());
+    }
+
+    while ((f = *list) != NULL) {
+        *list = f->next;
+        if (merged >= 0)
+            dr_delete_file(f->path);
+        dr_global_free(f, sizeof(stream_file_t));
+    }
+}
+
 /* Parse a simple key=value configuration file */
 static bool parse_config_file(const char *config_path) {
     file_t file;
@@ -382,10 +1123,91 @@ static bool parse_config_file(const char *config_path) {
             config.wss_exact_tracking = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
         } else if (strcmp(key, "wss_hll_tracking") == 0) {
             config.wss_hll_tracking = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "wss_page_tracking") == 0) {
+            config.wss_page_tracking = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "wss_window_sizes") == 0) {
+            /* comma-separated window lengths in references */
+            char *p = value, *end;
+            config.wss_window_count = 0;
+            while (*p != '\0') {
+                uint64 refs = strtoull(p, &end, 10);
+                if (end == p)
+                    break;
+                if (refs > 0 && config.wss_window_count < WSS_WINDOW_SIZES)
+                    config.wss_window_sizes[config.wss_window_count++] = refs;
+                else if (refs > 0)
+                    dr_fprintf(STDERR, "Warning: only %d wss_window_sizes are tracked, "
+                               "ignoring %llu\n", WSS_WINDOW_SIZES, (unsigned long long)refs);
+                p = end;
+                while (*p == ',' || *p == ' ')
+                    p++;
+            }
+        } else if (strcmp(key, "enable_reuse_distance") == 0) {
+            config.enable_reuse_distance = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "rd_sample_rate") == 0) {
+            config.rd_sample_rate = atof(value);
+        } else if (strcmp(key, "rd_max_keys") == 0) {
+            config.rd_max_keys = (uint)atoi(value);
+        } else if (strcmp(key, "enable_pc_tracking") == 0) {
+            config.enable_pc_tracking = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "pc_table_size") == 0) {
+            config.pc_table_size = (uint)atoi(value);
+        } else if (strcmp(key, "pc_hll_bits") == 0) {
+            config.pc_hll_bits = (uint)atoi(value);
+        } else if (strcmp(key, "pc_top_n") == 0) {
+            config.pc_top_n = (uint)atoi(value);
+        } else if (strcmp(key, "enable_cache_sim") == 0) {
+            config.enable_cache_sim = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "cache_l1_size") == 0) {
+            config.cache_l1_size = (uint64)strtoull(value, NULL, 10);
+        } else if (strcmp(key, "cache_l1_ways") == 0) {
+            config.cache_l1_ways = (uint)atoi(value);
+        } else if (strcmp(key, "cache_l2_size") == 0) {
+            config.cache_l2_size = (uint64)strtoull(value, NULL, 10);
+        } else if (strcmp(key, "cache_l2_ways") == 0) {
+            config.cache_l2_ways = (uint)atoi(value);
+        } else if (strcmp(key, "cache_llc_size") == 0) {
+            config.cache_llc_size = (uint64)strtoull(value, NULL, 10);
+        } else if (strcmp(key, "cache_llc_ways") == 0) {
+            config.cache_llc_ways = (uint)atoi(value);
+        } else if (strcmp(key, "cache_replacement") == 0) {
+            strncpy(config.cache_replacement, value, sizeof(config.cache_replacement) - 1);
+        } else if (strcmp(key, "cache_llc_replacement") == 0) {
+            strncpy(config.cache_llc_replacement, value, sizeof(config.cache_llc_replacement) - 1);
+        } else if (strcmp(key, "cache_write_back") == 0) {
+            config.cache_write_back = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "cache_write_allocate") == 0) {
+            config.cache_write_allocate = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "cache_shared_llc") == 0) {
+            config.cache_shared_llc = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "enable_region_tracking") == 0) {
+            config.enable_region_tracking = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
         } else if (strcmp(key, "enable_instruction_threshold") == 0) {
             config.enable_instruction_threshold = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
         } else if (strcmp(key, "instruction_threshold") == 0) {
             config.instruction_threshold = (uint64)strtoull(value, NULL, 10);
+        } else if (strcmp(key, "per_thread_streams") == 0) {
+            config.per_thread_streams = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "merge_thread_streams") == 0) {
+            config.merge_thread_streams = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "burst_on_units") == 0) {
+            config.burst_on_units = (uint64)strtoull(value, NULL, 10);
+        } else if (strcmp(key, "burst_off_units") == 0) {
+            config.burst_off_units = (uint64)strtoull(value, NULL, 10);
+        } else if (strcmp(key, "burst_unit") == 0) {
+            config.burst_unit_refs = (strcmp(value, "references") == 0 || strcmp(value, "refs") == 0);
+        } else if (strcmp(key, "roi_annotations") == 0) {
+            config.roi_annotations = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "roi_function") == 0) {
+            strncpy(config.roi_function, value, sizeof(config.roi_function) - 1);
+        } else if (strcmp(key, "roi_start_instrs") == 0) {
+            config.roi_start_instrs = (uint64)strtoull(value, NULL, 10);
+        } else if (strcmp(key, "roi_length_instrs") == 0) {
+            config.roi_length_instrs = (uint64)strtoull(value, NULL, 10);
+        } else if (strcmp(key, "offload_threads") == 0) {
+            config.offload_threads = (uint)atoi(value);
+        } else if (strcmp(key, "offload_buffers") == 0) {
+            config.offload_buffers = (uint)atoi(value);
         } else if (strcmp(key, "pb_trace_output") == 0) {
             strncpy(config.pb_trace_output, value, sizeof(config.pb_trace_output) - 1);
         } else if (strcmp(key, "pb_timeseries_output") == 0) {
@@ -401,78 +1223,208 @@ static bool parse_config_file(const char *config_path) {
 /* Initialize derived config values */
 static void init_config_derived_values(void) {
     cache_line_mask = (~(uintptr_t)(config.cache_line_size - 1));
-    mem_buf_size = sizeof(mem_ref_t) * config.max_mem_refs;
+    mem_buf_size = sizeof(memref_t) * config.max_mem_refs;
+
+    /* hllpp takes 4 to 18 bits (hll.c took up to 20) */
+    if (config.hll_bits < HLLPP_MIN_P || config.hll_bits > HLLPP_MAX_P) {
+        uint bits = config.hll_bits < HLLPP_MIN_P ? HLLPP_MIN_P : HLLPP_MAX_P;
+        dr_fprintf(STDERR, "Warning: hll_bits %u out of range %d-%d, using %u\n",
+                   config.hll_bits, HLLPP_MIN_P, HLLPP_MAX_P, bits);
+        config.hll_bits = bits;
+    }
+    if (config.sample_hll_bits < HLLPP_MIN_P || config.sample_hll_bits > HLLPP_MAX_P) {
+        uint bits = config.sample_hll_bits < HLLPP_MIN_P ? HLLPP_MIN_P : HLLPP_MAX_P;
+        dr_fprintf(STDERR, "Warning: sample_hll_bits %u out of range %d-%d, using %u\n",
+                   config.sample_hll_bits, HLLPP_MIN_P, HLLPP_MAX_P, bits);
+        config.sample_hll_bits = bits;
+    }
+
+    /* page keys are derived from line keys, so a line must fit in a page */
+    if (config.wss_page_tracking && config.cache_line_size > MEMREF_PAGE_SIZE) {
+        dr_fprintf(STDERR, "Warning: cache_line_size %u exceeds the page size, "
+                   "page working sets disabled\n", config.cache_line_size);
+        config.wss_page_tracking = false;
+    }
+    page_tracking = config.wss_page_tracking &&
+        (config.wss_exact_tracking || config.wss_hll_tracking);
+
+    if (config.wss_window_count > 0 && !config.wss_exact_tracking) {
+        dr_fprintf(STDERR, "Warning: wss_window_sizes needs wss_exact_tracking, "
+                   "extra windows disabled\n");
+        config.wss_window_count = 0;
+    }
+    /* the time-series window is level 0 of the same tracker when there is one */
+    wss_window_base = (config.wss_stat_tracking || config.wss_window_count == 0) ? 1 : 0;
+
+    /* one buffer being filled and at least one with the worker */
+    if (config.offload_threads > 0 && config.offload_buffers < 2) {
+        dr_fprintf(STDERR, "Warning: offload_buffers must be at least 2, using 2\n");
+        config.offload_buffers = 2;
+    }
+
+    if (config.enable_cache_sim) {
+        static const uint64 *const sizes[CACHE_LEVELS] = {
+            &config.cache_l1_size, &config.cache_l2_size, &config.cache_llc_size
+        };
+        static const uint *const ways[CACHE_LEVELS] = {
+            &config.cache_l1_ways, &config.cache_l2_ways, &config.cache_llc_ways
+        };
+        cache_repl_t repl, llc_repl;
+        if (cache_repl_parse(config.cache_replacement, &repl) != 0) {
+            dr_fprintf(STDERR, "Warning: unknown cache_replacement %s, using lru\n",
+                       config.cache_replacement);
+            repl = CACHE_REPL_LRU;
+        }
+        if (cache_repl_parse(config.cache_llc_replacement, &llc_repl) != 0) {
+            dr_fprintf(STDERR, "Warning: unknown cache_llc_replacement %s, using lru\n",
+                       config.cache_llc_replacement);
+            llc_repl = CACHE_REPL_LRU;
+        }
+        for (int l = 0; l < CACHE_LEVELS; l++) {
+            cache_cfg[l].size = *sizes[l];
+            cache_cfg[l].ways = *ways[l];
+            cache_cfg[l].line_size = config.cache_line_size;
+            cache_cfg[l].repl = l == CACHE_LLC ? llc_repl : repl;
+            cache_cfg[l].write_back = config.cache_write_back;
+            cache_cfg[l].write_allocate = config.cache_write_allocate;
+        }
+        /* a throwaway hierarchy validates the geometry */
+        cache_hier_t *probe = cache_hier_create(cache_cfg, CACHE_LEVELS, NULL);
+        if (probe == NULL) {
+            dr_fprintf(STDERR, "Warning: invalid cache geometry (sets must be a power of two), "
+                       "cache simulation disabled\n");
+            config.enable_cache_sim = false;
+        }
+        cache_hier_destroy(probe);
+    }
+    cache_sim_levels = config.enable_cache_sim ? CACHE_LEVELS : 0;
+
+#ifndef LINUX
+    if (config.enable_region_tracking) {
+        dr_fprintf(STDERR, "Warning: region tracking needs Linux, disabled\n");
+        config.enable_region_tracking = false;
+    }
+#endif
+}
+
+/* A wss_window_sizes window of the thread closed */
+static void wss_window_closed(void *arg, size_t level, uint64_t window_idx,
+                              const ws_stats_t *stats) {
+    per_thread_t *t = (per_thread_t *)arg;
+    wss_window_stat_t *ws;
+
+    if (level < wss_window_base)
+        return;
+    ws = &t->win_stat[level - wss_window_base];
+    ws->windows++;
+    ws->sum += stats->distinct;
+    if (stats->distinct > ws->max)
+        ws->max = stats->distinct;
 }
 
 static void finalize_sample_window(per_thread_t *t) {
     if (!t) return;
 
-    void *drcontext = dr_get_current_drcontext();
-    uint32_t thread_id = dr_get_thread_id(drcontext);
+    fold_ref_counts(t);
 
     /* exact WSS (only if enabled) */
     ws_stats_t s = {0};
     if (config.wss_exact_tracking && t->sample_ws) {
-        ws_get_stats(t->sample_ws, &s);
+        ws_window_get_stats(t->sample_ws, 0, &s);
     }
 
     /* HLL WSS (approx, only if enabled) */
     double wss_est = 0.0;
     if (config.wss_hll_tracking) {
-        wss_est = hll_count(&t->sample_hll);
-    }
-
-    /* Write to protobuf timeseries file (thread-safe) */
-    if (global_timeseries_writer && config.wss_stat_tracking) {
-        dr_mutex_lock(timeseries_mutex);
-        pb_timeseries_write_sample(
-            global_timeseries_writer,
-            t->sample_idx,              // window_number
-            thread_id,                  // thread_id
-            t->sample_read_count,       // read_count
-            t->sample_write_count,      // write_count
-            t->sample_ref_count,        // total_refs
-            s.distinct,                 // wss_exact
-            wss_est,                    // wss_approx
-            get_timestamp(),            // timestamp
-            // Read size histograms
-            t->sample_read_size_1, t->sample_read_size_2, t->sample_read_size_4, t->sample_read_size_8,
-            t->sample_read_size_16, t->sample_read_size_32, t->sample_read_size_64, t->sample_read_size_other,
-            // Write size histograms
-            t->sample_write_size_1, t->sample_write_size_2, t->sample_write_size_4, t->sample_write_size_8,
-            t->sample_write_size_16, t->sample_write_size_32, t->sample_write_size_64, t->sample_write_size_other
-        );
-        dr_mutex_unlock(timeseries_mutex);
+        wss_est = hllpp_count(&t->sample_hll);
+    }
+
+    /* the same in pages and huge pages */
+    uint64 gran_exact[WSS_GRANS] = {0};
+    double gran_est[WSS_GRANS] = {0};
+    if (page_tracking) {
+        for (int g = 0; g < WSS_GRANS; g++) {
+            if (t->gran[g].sample_ws) {
+                ws_stats_t gs;
+                ws_window_get_stats(t->gran[g].sample_ws, 0, &gs);
+                gran_exact[g] = gs.distinct;
+            }
+            if (config.wss_hll_tracking)
+                gran_est[g] = hllpp_count(&t->gran[g].sample_hll);
+        }
+    }
+
+    /* Write to the thread's time-series stream, or to the shared file */
+    if ((t->timeseries_writer || global_timeseries_writer) && config.wss_stat_tracking) {
+        pb_ts_sample_t sample;
+        sample.window_number = t->sample_idx;
+        sample.thread_id = t->thread_id;
+        sample.read_count = memref_hist_reads(&t->sample_hist);
+        sample.write_count = memref_hist_writes(&t->sample_hist);
+        sample.total_refs = t->sample_ref_count;
+        sample.wss_exact = s.distinct;
+        sample.wss_approx = wss_est;
+        sample.timestamp = t->buf_time_us;
+        sample.wss_page_exact = gran_exact[WSS_PAGE];
+        sample.wss_page_approx = gran_est[WSS_PAGE];
+        sample.wss_huge_page_exact = gran_exact[WSS_HUGE_PAGE];
+        sample.wss_huge_page_approx = gran_est[WSS_HUGE_PAGE];
+        for (int i = 0; i < MEMREF_SIZE_BINS; i++) {
+            sample.read_size_hist[i] = t->sample_hist.read_size[i];
+            sample.write_size_hist[i] = t->sample_hist.write_size[i];
+        }
+        /* a level's hits are the references it served, its misses those
+           served further down; all zero without cache simulation */
+        uint64_t *cache_fields[CACHE_LEVELS][2] = {
+            { &sample.l1_hits, &sample.l1_misses },
+            { &sample.l2_hits, &sample.l2_misses },
+            { &sample.llc_hits, &sample.llc_misses }
+        };
+        uint64 below = t->sample_served[CACHE_LEVELS];
+        for (int l = CACHE_LEVELS - 1; l >= 0; l--) {
+            *cache_fields[l][0] = t->sample_served[l];
+            *cache_fields[l][1] = below;
+            below += t->sample_served[l];
+        }
+        sample.n_regions = t->ref_regions ? PB_TS_REGIONS : 0;
+        for (int r = 0; r < MEM_REGION_COUNT; r++) {
+            sample.region_reads[r] = t->region_win[r].reads;
+            sample.region_writes[r] = t->region_win[r].writes;
+            sample.region_bytes[r] = t->region_win[r].bytes;
+            sample.region_wss[r] = t->ref_regions ? hllpp_count(&t->region_sample_hll[r]) : 0.0;
+        }
+        if (t->timeseries_writer) {
+            pb_timeseries_write_sample(t->timeseries_writer, &sample);
+        } else {
+            dr_mutex_lock(timeseries_mutex);
+            pb_timeseries_write_sample(global_timeseries_writer, &sample);
+            dr_mutex_unlock(timeseries_mutex);
+        }
     }
 
     /* reset for next window */
     if (config.wss_exact_tracking && t->sample_ws) {
-        ws_reset(t->sample_ws);       /* destroys nodes & zeros stats */
+        ws_window_reset_level(t->sample_ws, 0); /* bumps window start, keeps table */
     }
     if (config.wss_hll_tracking) {
-        hll_reset(&t->sample_hll);    /* zero registers, keep alloc */
+        hllpp_reset(&t->sample_hll);  /* back to sparse, keep allocs */
+    }
+    if (page_tracking) {
+        for (int g = 0; g < WSS_GRANS; g++) {
+            if (t->gran[g].sample_ws)
+                ws_window_reset(t->gran[g].sample_ws);
+            if (config.wss_hll_tracking)
+                hllpp_reset(&t->gran[g].sample_hll);
+        }
     }
     t->sample_ref_count = 0;
-    t->sample_read_count = 0;
-    t->sample_write_count = 0;
-
-    /* Reset per-window size counters */
-    t->sample_read_size_1 = 0;
-    t->sample_read_size_2 = 0;
-    t->sample_read_size_4 = 0;
-    t->sample_read_size_8 = 0;
-    t->sample_read_size_16 = 0;
-    t->sample_read_size_32 = 0;
-    t->sample_read_size_64 = 0;
-    t->sample_read_size_other = 0;
-    t->sample_write_size_1 = 0;
-    t->sample_write_size_2 = 0;
-    t->sample_write_size_4 = 0;
-    t->sample_write_size_8 = 0;
-    t->sample_write_size_16 = 0;
-    t->sample_write_size_32 = 0;
-    t->sample_write_size_64 = 0;
-    t->sample_write_size_other = 0;
+    memset(&t->sample_hist, 0, sizeof(t->sample_hist));
+    memset(t->sample_served, 0, sizeof(t->sample_served));
+    if (t->ref_regions) {
+        memset(t->region_win, 0, sizeof(t->region_win));
+        for (int r = 0; r < MEM_REGION_COUNT; r++)
+            hllpp_reset(&t->region_sample_hll[r]);
+    }
 
     t->sample_idx++;
 }
@@ -481,7 +1433,7 @@ DR_EXPORT void
 
 dr_client_main(client_id_t id, int argc, const char *argv[])
 {
-   drreg_options_t ops = { sizeof(ops), 2, false};
+   drreg_options_t ops = { sizeof(ops), 3, false};
     /* Specify priority relative to other instrumentation operations: */
     drmgr_priority_t priority = { sizeof(priority), /* size of struct */
                                   "memcount",       /* name of our operation */
@@ -527,13 +1479,97 @@ dr_client_main(client_id_t id, int argc, const char *argv[])
     start_time_us = dr_get_microseconds();
 
     hll_mutex = dr_mutex_create();
-    DR_ASSERT(hll_init(&global_hll, config.hll_bits) == 0);
+    DR_ASSERT(hllpp_init(&global_hll, config.hll_bits) == 0);
+
+    if (config.wss_exact_tracking) {
+        global_lines = line_union_create();
+        DR_ASSERT(global_lines != NULL);
+    }
+    if (page_tracking) {
+        for (int g = 0; g < WSS_GRANS; g++) {
+            if (config.wss_exact_tracking) {
+                global_gran_lines[g] = line_union_create();
+                DR_ASSERT(global_gran_lines[g] != NULL);
+            }
+            if (config.wss_hll_tracking)
+                DR_ASSERT(hllpp_init(&global_gran_hll[g], config.hll_bits) == 0);
+        }
+    }
+
+    if (config.enable_reuse_distance) {
+        rd_mutex = dr_mutex_create();
+        global_rd = rd_create(config.rd_sample_rate, 0);
+        DR_ASSERT(global_rd != NULL);
+    }
+
+    if (config.enable_pc_tracking) {
+        pc_mutex = dr_mutex_create();
+        global_pcs = pc_table_create(config.pc_table_size, (uint8_t)config.pc_hll_bits);
+        DR_ASSERT(global_pcs != NULL);
+    }
+
+    if (cache_sim_levels > 0) {
+        cache_mutex = dr_mutex_create();
+        if (config.cache_shared_llc) {
+            shared_llc = cache_level_create(&cache_cfg[CACHE_LLC], 1);
+            DR_ASSERT(shared_llc != NULL);
+        }
+    }
+
+    if (config.enable_region_tracking) {
+        regions = region_map_create();
+        DR_ASSERT(regions != NULL);
+        region_mutex = dr_mutex_create();
+        for (int r = 0; r < MEM_REGION_COUNT; r++)
+            DR_ASSERT(hllpp_init(&global_region_hll[r], config.hll_bits) == 0);
+#ifdef LINUX
+        dr_register_filter_syscall_event(event_filter_syscall);
+#endif
+    }
+
+    /* Symbols for the pc report and for finding ROI functions that are not
+       exported; without them pcs print as module+offset */
+    if (config.enable_pc_tracking || config.roi_annotations || config.roi_function[0] != '\0') {
+        drsyms_ready = drsym_init(0) == DRSYM_SUCCESS;
+        if (!drsyms_ready)
+            dr_fprintf(STDERR, "Warning: drsyms unavailable, symbol lookups disabled\n");
+    }
 
-    /* Initialize instruction count mutex */
-    instr_count_mutex = dr_mutex_create();
+    /* Analysis threads for the offload mode, before any application
+       thread registers with them */
+    if (config.offload_threads > 0) {
+        offload_workers = (offload_worker_t *)
+            dr_global_alloc(sizeof(offload_worker_t) * config.offload_threads);
+        for (uint i = 0; i < config.offload_threads; i++) {
+            offload_worker_t *w = &offload_workers[i];
+            memset(w, 0, sizeof(*w));
+            w->mutex = dr_mutex_create();
+            w->wake = dr_event_create();
+            DR_ASSERT(dr_create_client_thread(offload_worker_main, w));
+        }
+        dr_fprintf(STDERR, "Analysis offload: %u threads, %u buffers per application thread\n",
+                   config.offload_threads, config.offload_buffers);
+    }
 
-    /* Initialize protobuf writers (single file for all threads) */
-    if (config.enable_trace) {
+    /* Initialize protobuf writers; their file I/O runs on a client thread,
+       off the application's threads. With per_thread_streams every thread
+       opens its own writers in event_thread_init() instead of sharing a
+       single file for all threads. */
+    aw_set_default_spawn(spawn_io_thread);
+    aw_set_default_sync(&io_sync);
+    if (config.per_thread_streams && (config.enable_trace || config.wss_stat_tracking)) {
+        stream_mutex = dr_mutex_create();
+        if (config.offload_threads == 0) {
+            thread_stream_io = aw_io_create(NULL);
+            if (thread_stream_io == NULL)
+                dr_fprintf(STDERR, "Warning: Failed to start the stream I/O thread; "
+                           "application threads write their own streams\n");
+        }
+        dr_fprintf(STDERR, "Protobuf output: one stream per thread (%s_%d.t<n>.pb)%s\n",
+                   config.enable_trace ? config.pb_trace_output : config.pb_timeseries_output,
+                   dr_get_process_id(),
+                   config.merge_thread_streams ? ", merged at exit" : "");
+    } else if (config.enable_trace) {
         char trace_filename[256];
         dr_snprintf(trace_filename, sizeof(trace_filename), "%s_%d.pb",
                    config.pb_trace_output, dr_get_process_id());
@@ -543,10 +1579,11 @@ dr_client_main(client_id_t id, int argc, const char *argv[])
             dr_fprintf(STDERR, "Protobuf trace output enabled: %s\n", trace_filename);
         } else {
             dr_fprintf(STDERR, "Warning: Failed to create protobuf trace writer\n");
+            config.enable_trace = false;
         }
     }
 
-    if (config.wss_stat_tracking) {
+    if (config.wss_stat_tracking && !config.per_thread_streams) {
         char timeseries_filename[256];
         const char *command;
 
@@ -578,11 +1615,54 @@ dr_client_main(client_id_t id, int argc, const char *argv[])
         }
     }
 
+    /* Under burst sampling or an ROI drbbdup runs the insertion phase for
+       each block copy, and string loops must be expanded before blocks are
+       duplicated */
+    burst_enabled = config.burst_off_units > 0;
+    roi_window = config.roi_start_instrs > 0 || config.roi_length_instrs > 0;
+    roi_enabled = config.roi_annotations || config.roi_function[0] != '\0' || roi_window;
+    bbdup_enabled = burst_enabled || roi_enabled;
+    if (bbdup_enabled) {
+        priority.priority = DRMGR_PRIORITY_APP2APP_DRBBDUP - 1;
+    }
+    if (burst_enabled) {
+        dr_fprintf(STDERR, "Burst sampling: %llu %s on, about %llu off\n",
+                   config.burst_on_units,
+                   config.burst_unit_refs ? "references" : "instructions",
+                   config.burst_off_units);
+    }
+    if (roi_enabled) {
+        roi_mutex = dr_mutex_create();
+        roi_window_on = roi_window && config.roi_start_instrs == 0;
+        roi_active = false;
+        roi_update();
+        dr_fprintf(STDERR, "Region of interest:%s%s%s",
+                   config.roi_annotations ? " markers" : "",
+                   config.roi_function[0] != '\0' ? " function " : "",
+                   config.roi_function);
+        if (roi_window) {
+            dr_fprintf(STDERR, " instructions %llu..", config.roi_start_instrs);
+            if (config.roi_length_instrs > 0)
+                dr_fprintf(STDERR, "%llu", config.roi_start_instrs + config.roi_length_instrs);
+        }
+        dr_fprintf(STDERR, "\n");
+    }
+
     if (!drmgr_register_thread_init_event(event_thread_init) ||
         !drmgr_register_thread_exit_event(event_thread_exit) ||
         !drmgr_register_bb_app2app_event(event_bb_app2app, &priority) ||
-        !drmgr_register_bb_instrumentation_event(event_bb_analysis, event_bb_insert,
-                                                 &priority) ||
+        (!bbdup_enabled &&
+         !drmgr_register_bb_instrumentation_event(event_bb_analysis, event_bb_insert,
+                                                  &priority)) ||
+        (bbdup_enabled && !bbdup_init()) ||
+        (roi_enabled && !drwrap_init()) ||
+        ((roi_enabled || regions != NULL) &&
+         !drmgr_register_module_load_event(event_module_load)) ||
+        (regions != NULL && !drmgr_register_module_unload_event(event_module_unload)) ||
+#ifdef LINUX
+        (regions != NULL && (!drmgr_register_pre_syscall_event(event_pre_syscall) ||
+                             !drmgr_register_post_syscall_event(event_post_syscall))) ||
+#endif
         drreg_init(&ops) != DRREG_SUCCESS || !drx_init()) {
         /* something is wrong: can't continue */
         DR_ASSERT(false);
@@ -604,33 +1684,328 @@ dr_client_main(client_id_t id, int argc, const char *argv[])
     }
 }
 
+/* Traffic and working set of each memory region, summed over threads */
 static void
-event_exit()
+print_regions(void)
 {
-    char msg[512];
-    int len;
-    double hll_est_lines = hll_count(&global_hll);
-
-    /* Capture end time and calculate execution time */
-    end_time_us = dr_get_microseconds();
-    uint64 execution_time_us = end_time_us - start_time_us;
-    double execution_time_ms = execution_time_us / 1000.0;
-    double execution_time_sec = execution_time_us / 1000000.0;
-
-    len = dr_snprintf(msg, sizeof(msg) / sizeof(msg[0]),
-                        "Instrumentation results:\n"
-                        "  saw %llu memory references\n"
-                        "  number of reads: %llu\n"
-                        "  number of writes: %llu\n"
-                        "  working set size: %llu\n"
-                        "  execution time (us): %llu\n"
-                        "  execution time (ms): %.3f\n"
-                        "  execution time (s): %.6f\n",
-                        global_num_refs, global_num_reads, global_num_writes, global_working_set,
-                        execution_time_us, execution_time_ms, execution_time_sec);
-    DR_ASSERT (len > 0);
+    char msg[1024];
+    int len, pos;
+    uint64 total = 0;
+
+    for (int r = 0; r < MEM_REGION_COUNT; r++)
+        total += global_region[r].bytes;
+    pos = dr_snprintf(msg, sizeof(msg)/sizeof(msg[0]),
+                      "Memory regions (working set in lines, HLL estimate):\n"
+                      "  %-8s %14s %14s %16s %7s %12s\n",
+                      "region", "reads", "writes", "bytes", "share", "lines");
+    DR_ASSERT(pos > 0);
+
+    for (int r = 0; r < MEM_REGION_COUNT; r++) {
+        const region_count_t *c = &global_region[r];
+        len = dr_snprintf(msg + pos, sizeof(msg)/sizeof(msg[0]) - pos,
+                          "  %-8s %14llu %14llu %16llu %6.2f%% %12.0f\n",
+                          mem_region_name(r), (unsigned long long)c->reads,
+                          (unsigned long long)c->writes, (unsigned long long)c->bytes,
+                          total > 0 ? 100.0 * (double)c->bytes / (double)total : 0.0,
+                          hllpp_count(&global_region_hll[r]));
+        if (len < 0)
+            break;
+        pos += len;
+    }
     NULL_TERMINATE_BUFFER(msg);
     DISPLAY_STRING(msg);
+}
+
+/* Hits, misses and writebacks per simulated cache level, summed over threads */
+static void
+print_cache_sim(void)
+{
+    static const char *const names[CACHE_LEVELS] = { "L1", "L2", "LLC" };
+    char msg[1024];
+    int len, pos;
+
+    pos = dr_snprintf(msg, sizeof(msg)/sizeof(msg[0]),
+                      "Cache simulation (%u-byte lines, %s, %s, %s LLC):\n",
+                      config.cache_line_size,
+                      config.cache_write_back ? "write-back" : "write-through",
+                      config.cache_write_allocate ? "write-allocate" : "no-write-allocate",
+                      shared_llc != NULL ? "shared" : "private");
+    DR_ASSERT(pos > 0);
+
+    for (int l = 0; l < CACHE_LEVELS; l++) {
+        const cache_level_stats_t *st = &global_cache_stats.level[l];
+        uint64 hits = st->read_hits + st->write_hits;
+        uint64 misses = st->read_misses + st->write_misses;
+        len = dr_snprintf(msg + pos, sizeof(msg)/sizeof(msg[0]) - pos,
+                          "  %-3s %llu KiB %u-way %s: %llu hits, %llu misses "
+                          "(miss ratio %.4f), %llu writebacks\n",
+                          names[l], (unsigned long long)(cache_cfg[l].size / 1024),
+                          cache_cfg[l].ways, cache_repl_name(cache_cfg[l].repl),
+                          (unsigned long long)hits, (unsigned long long)misses,
+                          hits + misses > 0 ? (double)misses / (double)(hits + misses) : 0.0,
+                          (unsigned long long)st->writebacks);
+        if (len < 0)
+            break;
+        pos += len;
+    }
+    len = dr_snprintf(msg + pos, sizeof(msg)/sizeof(msg[0]) - pos,
+                      "  memory: %llu line reads, %llu writes\n",
+                      (unsigned long long)global_cache_stats.mem_reads,
+                      (unsigned long long)global_cache_stats.mem_writes);
+    if (len > 0)
+        pos += len;
+    NULL_TERMINATE_BUFFER(msg);
+    DISPLAY_STRING(msg);
+}
+
+/* Miss ratios of fully-associative LRU caches, 16KB..128MB */
+static void
+print_miss_ratio_curve(void)
+{
+    char msg[1024];
+    int len, pos;
+    rd_stats_t st = {0};
+
+    rd_get_stats(global_rd, &st);
+    pos = dr_snprintf(msg, sizeof(msg)/sizeof(msg[0]),
+                      "Reuse distance results (SHARDS rate %.4f, %llu of %llu references sampled):\n",
+                      config.rd_sample_rate, (unsigned long long)st.sampled,
+                      (unsigned long long)st.refs);
+    DR_ASSERT(pos > 0);
+
+    for (uint64 kb = 16; kb <= 128 * 1024; kb *= 2) {
+        uint64 lines = kb * 1024 / config.cache_line_size;
+        len = dr_snprintf(msg + pos, sizeof(msg)/sizeof(msg[0]) - pos,
+                          "  LRU miss ratio @ %llu%s: %.4f\n",
+                          (unsigned long long)(kb >= 1024 ? kb / 1024 : kb),
+                          kb >= 1024 ? "MB" : "KB", rd_miss_ratio(global_rd, lines));
+        if (len < 0)
+            break;
+        pos += len;
+    }
+    NULL_TERMINATE_BUFFER(msg);
+    DISPLAY_STRING(msg);
+}
+
+/* Where an application pc is: module+offset, and function+offset when
+ * the module has symbols
+ */
+static void
+symbolize_pc(app_pc pc, char *buf, size_t size)
+{
+    module_data_t *mod = dr_lookup_module(pc);
+    char name[128];
+    drsym_info_t sym;
+
+    if (mod == NULL) {
+        dr_snprintf(buf, size, "?");
+        buf[size - 1] = '\0';
+        return;
+    }
+
+    size_t offs = (size_t)(pc - mod->start);
+    const char *mod_name = dr_module_preferred_name(mod);
+    sym.struct_size = sizeof(sym);
+    sym.name = name;
+    sym.name_size = sizeof(name);
+    sym.file = NULL;
+    sym.file_size = 0;
+    drsym_error_t res = drsyms_ready ?
+        drsym_lookup_address(mod->full_path, offs, &sym, DRSYM_DEMANGLE) : DRSYM_ERROR;
+    if (res == DRSYM_SUCCESS || res == DRSYM_ERROR_LINE_NOT_AVAILABLE) {
+        dr_snprintf(buf, size, "%s!%s+" PIFX, mod_name == NULL ? "?" : mod_name,
+                    sym.name, (ptr_uint_t)(offs - sym.start_offs));
+    } else {
+        dr_snprintf(buf, size, "%s+" PIFX, mod_name == NULL ? "?" : mod_name, (ptr_uint_t)offs);
+    }
+    buf[size - 1] = '\0';
+    dr_free_module_data(mod);
+}
+
+/* The pcs with the most bytes accessed. Bytes may be overestimated by up to
+ * the "err" column for pcs admitted after the table filled up; reads,
+ * writes and lines count from admission.
+ */
+static void
+print_pc_top(void)
+{
+    char msg[1024];
+    char where[256];
+    int len, pos;
+    pc_table_stats_t st;
+    pc_stat_t *top;
+    size_t n;
+
+    pc_table_get_stats(global_pcs, &st);
+    top = dr_global_alloc(sizeof(pc_stat_t) * config.pc_top_n);
+    n = pc_table_top(global_pcs, top, config.pc_top_n);
+
+    pos = dr_snprintf(msg, sizeof(msg)/sizeof(msg[0]),
+                      "Top %u instructions by bytes accessed "
+                      "(%llu pcs tracked, %llu evictions):\n"
+                      "  %-18s %12s %12s %14s %10s %10s  %s",
+                      (uint)n, (unsigned long long)st.entries,
+                      (unsigned long long)st.evictions,
+                      "pc", "reads", "writes", "bytes", "err", "lines", "location");
+    DR_ASSERT(pos > 0);
+
+    for (size_t i = 0; i < n; i++) {
+        symbolize_pc((app_pc)(ptr_uint_t)top[i].pc, where, sizeof(where));
+        len = dr_snprintf(msg + pos, sizeof(msg)/sizeof(msg[0]) - pos,
+                          "\n  0x%016llx %12llu %12llu %14llu %10llu %10.0f  %s",
+                          (unsigned long long)top[i].pc, (unsigned long long)top[i].reads,
+                          (unsigned long long)top[i].writes, (unsigned long long)top[i].bytes,
+                          (unsigned long long)top[i].error, top[i].lines, where);
+        if (len < 0) {
+            /* buffer full: show what is there and start over with this row */
+            NULL_TERMINATE_BUFFER(msg);
+            DISPLAY_STRING(msg);
+            pos = 0;
+            i--;
+            continue;
+        }
+        pos += len;
+    }
+    NULL_TERMINATE_BUFFER(msg);
+    DISPLAY_STRING(msg);
+    dr_global_free(top, sizeof(pc_stat_t) * config.pc_top_n);
+}
+
+/* Whole-run totals extrapolated from the burst sampled periods */
+static void
+print_burst_estimates(void)
+{
+    static const char *names[BURST_NUM_METRICS] = { "memory references", "reads", "writes" };
+    char msg[1024];
+    int len, pos;
+
+    pos = dr_snprintf(msg, sizeof(msg)/sizeof(msg[0]),
+                      "Burst sampling estimate (%llu periods, %.2f%% of %s instrumented):\n",
+                      (unsigned long long)global_burst_periods,
+                      global_burst_units ? 100.0 * global_burst_units_on / global_burst_units : 0.0,
+                      config.burst_unit_refs ? "references" : "instructions");
+    DR_ASSERT(pos > 0);
+
+    for (int m = 0; m < BURST_NUM_METRICS; m++) {
+        burst_estimate_t est;
+        if (burst_stat_estimate(&global_burst_stat[m], (double)global_burst_units, 1.96,
+                                &est) != 0)
+            break;
+        len = dr_snprintf(msg + pos, sizeof(msg)/sizeof(msg[0]) - pos,
+                          "  %s: %.0f +/- %.0f (95%% CI %.0f..%.0f)\n",
+                          names[m], est.estimate, 1.96 * est.std_error, est.lo, est.hi);
+        if (len < 0)
+            break;
+        pos += len;
+    }
+    NULL_TERMINATE_BUFFER(msg);
+    DISPLAY_STRING(msg);
+}
+
+static void
+event_exit()
+{
+    char msg[512];
+    int len;
+    double hll_est_lines = hllpp_count(&global_hll);
+    line_union_stats_t lines = {0};
+
+    /* every thread has drained its buffers by now */
+    if (offload_workers) {
+        offload_stop_workers();
+    }
+
+    /* Threads' line sets overlap, so the working set is their union: exact
+       from the merged sets, else the merged HLL */
+    if (lines_inexact) {
+        dr_fprintf(STDERR, "Warning: some threads' lines could not be merged; "
+                   "the working set and sharing counts are lower bounds\n");
+    }
+    if (global_lines) {
+        line_union_get_stats(global_lines, &lines);
+        global_working_set = lines.lines;
+    } else if (config.wss_hll_tracking) {
+        global_working_set = (uint64)hll_est_lines;
+    }
+    uint64 gran_working_set[WSS_GRANS] = {0};
+    for (int g = 0; page_tracking && g < WSS_GRANS; g++) {
+        if (global_gran_lines[g]) {
+            line_union_stats_t gs;
+            line_union_get_stats(global_gran_lines[g], &gs);
+            gran_working_set[g] = gs.lines;
+        } else {
+            gran_working_set[g] = (uint64)hllpp_count(&global_gran_hll[g]);
+        }
+    }
+
+    /* Capture end time and calculate execution time */
+    end_time_us = dr_get_microseconds();
+    uint64 execution_time_us = end_time_us - start_time_us;
+    double execution_time_ms = execution_time_us / 1000.0;
+    double execution_time_sec = execution_time_us / 1000000.0;
+
+    len = dr_snprintf(msg, sizeof(msg) / sizeof(msg[0]),
+                        "Instrumentation results:\n"
+                        "  saw %llu memory references\n"
+                        "  number of reads: %llu\n"
+                        "  number of writes: %llu\n"
+                        "  working set size: %llu\n"
+                        "  execution time (us): %llu\n"
+                        "  execution time (ms): %.3f\n"
+                        "  execution time (s): %.6f\n",
+                        global_num_refs, global_num_reads, global_num_writes, global_working_set,
+                        execution_time_us, execution_time_ms, execution_time_sec);
+    DR_ASSERT (len > 0);
+    NULL_TERMINATE_BUFFER(msg);
+    DISPLAY_STRING(msg);
+
+    if (global_lines) {
+        len = dr_snprintf(msg, sizeof(msg)/sizeof(msg[0]),
+                          "Working set sharing (%llu threads):\n"
+                          "  private lines (one thread): %llu\n"
+                          "  shared lines (two or more threads): %llu\n",
+                          (unsigned long long)lines.sources,
+                          (unsigned long long)lines.priv,
+                          (unsigned long long)lines.shared);
+        DR_ASSERT(len > 0);
+        NULL_TERMINATE_BUFFER(msg);
+        DISPLAY_STRING(msg);
+    }
+
+    if (page_tracking) {
+        len = dr_snprintf(msg, sizeof(msg)/sizeof(msg[0]),
+                          "Working set by granularity:\n"
+                          "  %u-byte lines: %llu\n"
+                          "  4 KiB pages: %llu\n"
+                          "  2 MiB huge pages: %llu\n",
+                          config.cache_line_size,
+                          (unsigned long long)global_working_set,
+                          (unsigned long long)gran_working_set[WSS_PAGE],
+                          (unsigned long long)gran_working_set[WSS_HUGE_PAGE]);
+        DR_ASSERT(len > 0);
+        NULL_TERMINATE_BUFFER(msg);
+        DISPLAY_STRING(msg);
+    }
+
+    if (config.wss_window_count > 0) {
+        int pos = dr_snprintf(msg, sizeof(msg)/sizeof(msg[0]),
+                              "Windowed working set (lines per thread window):\n");
+        DR_ASSERT(pos > 0);
+        for (uint w = 0; w < config.wss_window_count; w++) {
+            const wss_window_stat_t *ws = &global_win_stat[w];
+            len = dr_snprintf(msg + pos, sizeof(msg)/sizeof(msg[0]) - pos,
+                              "  %llu refs: %llu windows, mean %.1f, max %llu\n",
+                              (unsigned long long)config.wss_window_sizes[w],
+                              (unsigned long long)ws->windows,
+                              ws->windows > 0 ? (double)ws->sum / (double)ws->windows : 0.0,
+                              (unsigned long long)ws->max);
+            if (len < 0)
+                break;
+            pos += len;
+        }
+        NULL_TERMINATE_BUFFER(msg);
+        DISPLAY_STRING(msg);
+    }
 
     /* Print size-specific read statistics */
     len = dr_snprintf(msg, sizeof(msg)/sizeof(msg[0]),
@@ -643,8 +2018,10 @@ event_exit()
                     "  32-byte reads: %llu\n"
                     "  64-byte reads: %llu\n"
                     "  other-size reads: %llu\n",
-                    global_read_size_1, global_read_size_2, global_read_size_4, global_read_size_8,
-                    global_read_size_16, global_read_size_32, global_read_size_64, global_read_size_other);
+                    global_size_hist.read_size[0], global_size_hist.read_size[1],
+                    global_size_hist.read_size[2], global_size_hist.read_size[3],
+                    global_size_hist.read_size[4], global_size_hist.read_size[5],
+                    global_size_hist.read_size[6], global_size_hist.read_size[7]);
     DR_ASSERT(len > 0);
     NULL_TERMINATE_BUFFER(msg);
     DISPLAY_STRING(msg);
@@ -660,8 +2037,10 @@ event_exit()
                     "  32-byte writes: %llu\n"
                     "  64-byte writes: %llu\n"
                     "  other-size writes: %llu\n",
-                    global_write_size_1, global_write_size_2, global_write_size_4, global_write_size_8,
-                    global_write_size_16, global_write_size_32, global_write_size_64, global_write_size_other);
+                    global_size_hist.write_size[0], global_size_hist.write_size[1],
+                    global_size_hist.write_size[2], global_size_hist.write_size[3],
+                    global_size_hist.write_size[4], global_size_hist.write_size[5],
+                    global_size_hist.write_size[6], global_size_hist.write_size[7]);
     DR_ASSERT(len > 0);
     NULL_TERMINATE_BUFFER(msg);
     DISPLAY_STRING(msg);
@@ -673,6 +2052,51 @@ event_exit()
 		    (unsigned long long) hll_est_lines);
     NULL_TERMINATE_BUFFER(msg); DISPLAY_STRING(msg);
 
+    /* Print LRU miss ratio curve from the reuse distance histogram */
+    if (global_rd) {
+        print_miss_ratio_curve();
+    }
+
+    if (roi_enabled) {
+        dr_snprintf(msg, sizeof(msg)/sizeof(msg[0]),
+                    "Region of interest: entered %llu times, results above cover it only",
+                    (unsigned long long)roi_entries);
+        NULL_TERMINATE_BUFFER(msg);
+        DISPLAY_STRING(msg);
+    }
+
+    if (burst_enabled) {
+        print_burst_estimates();
+    }
+
+    if (global_pcs) {
+        print_pc_top();
+    }
+
+    if (cache_sim_levels > 0) {
+        print_cache_sim();
+    }
+
+    if (regions != NULL) {
+        print_regions();
+    }
+
+    if (config.offload_threads > 0) {
+        len = dr_snprintf(msg, sizeof(msg)/sizeof(msg[0]),
+                          "Analysis offload (%u threads, %u buffers per thread):\n"
+                          "  buffers analyzed off the application threads: %llu\n"
+                          "  waits for a free buffer: %llu (%llu us)\n"
+                          "  deepest queue: %llu buffers\n",
+                          config.offload_threads, config.offload_buffers,
+                          (unsigned long long)global_offload_buffers,
+                          (unsigned long long)global_offload_stalls,
+                          (unsigned long long)global_offload_stall_us,
+                          (unsigned long long)global_offload_max_depth);
+        DR_ASSERT(len > 0);
+        NULL_TERMINATE_BUFFER(msg);
+        DISPLAY_STRING(msg);
+    }
+
     /* Close protobuf writers */
     if (global_trace_writer) {
         pb_trace_writer_close(global_trace_writer);
@@ -688,6 +2112,19 @@ event_exit()
         global_timeseries_writer = NULL;
     }
 
+    /* All threads have closed their streams by now */
+    if (thread_stream_io) {
+        if (aw_io_destroy(thread_stream_io) != 0)
+            dr_fprintf(STDERR, "Warning: stream I/O thread did not stop\n");
+        thread_stream_io = NULL;
+    }
+    if (stream_mutex) {
+        merge_stream_files(&trace_stream_files, config.pb_trace_output, false);
+        merge_stream_files(&timeseries_stream_files, config.pb_timeseries_output, true);
+        dr_mutex_destroy(stream_mutex);
+        stream_mutex = NULL;
+    }
+
     /* Destroy protobuf mutexes */
     if (trace_mutex) {
         dr_mutex_destroy(trace_mutex);
@@ -704,19 +2141,73 @@ event_exit()
 
     code_cache_exit();
 
+    if ((roi_enabled || regions != NULL) &&
+        !drmgr_unregister_module_load_event(event_module_load))
+        DR_ASSERT(false);
+    if (roi_enabled) {
+        drwrap_exit();
+        dr_mutex_destroy(roi_mutex);
+    }
+    if (regions != NULL) {
+        if (!drmgr_unregister_module_unload_event(event_module_unload))
+            DR_ASSERT(false);
+#ifdef LINUX
+        dr_unregister_filter_syscall_event(event_filter_syscall);
+        if (!drmgr_unregister_pre_syscall_event(event_pre_syscall) ||
+            !drmgr_unregister_post_syscall_event(event_post_syscall))
+            DR_ASSERT(false);
+#endif
+        region_map_destroy(regions);
+        regions = NULL;
+        dr_mutex_destroy(region_mutex);
+        for (int r = 0; r < MEM_REGION_COUNT; r++)
+            hllpp_destroy(&global_region_hll[r]);
+    }
+    if (bbdup_enabled) {
+        if (drbbdup_exit() != DRBBDUP_SUCCESS || !dr_raw_tls_cfree(case_tls_offs, 1))
+            DR_ASSERT(false);
+    }
+
     if (!drmgr_unregister_tls_field(tls_index) ||
     !drmgr_unregister_thread_init_event(event_thread_init) ||
     !drmgr_unregister_thread_exit_event(event_thread_exit) ||
-    !drmgr_unregister_bb_insertion_event(event_bb_insert) ||
+    (!bbdup_enabled && !drmgr_unregister_bb_insertion_event(event_bb_insert)) ||
     drreg_exit() != DRREG_SUCCESS)
     DR_ASSERT(false);
 
     dr_mutex_destroy(mutex);
-
-    /* Destroy instruction count mutex */
-    if (instr_count_mutex) {
-        dr_mutex_destroy(instr_count_mutex);
-        instr_count_mutex = NULL;
+    dr_mutex_destroy(hll_mutex);
+    hllpp_destroy(&global_hll);
+    if (global_lines) {
+        line_union_destroy(global_lines);
+        global_lines = NULL;
+    }
+    for (int g = 0; page_tracking && g < WSS_GRANS; g++) {
+        if (global_gran_lines[g]) {
+            line_union_destroy(global_gran_lines[g]);
+            global_gran_lines[g] = NULL;
+        }
+        if (config.wss_hll_tracking)
+            hllpp_destroy(&global_gran_hll[g]);
+    }
+    if (global_rd) {
+        rd_destroy(global_rd);
+        global_rd = NULL;
+        dr_mutex_destroy(rd_mutex);
+    }
+    if (global_pcs) {
+        pc_table_destroy(global_pcs);
+        global_pcs = NULL;
+        dr_mutex_destroy(pc_mutex);
+    }
+    if (cache_sim_levels > 0) {
+        cache_level_destroy(shared_llc);
+        shared_llc = NULL;
+        dr_mutex_destroy(cache_mutex);
+    }
+    if (drsyms_ready) {
+        drsym_exit();
+        drsyms_ready = false;
     }
 
     drutil_exit();
@@ -735,13 +2226,34 @@ event_thread_init(void *drcontext)
 {
     per_thread_t *data;
 
-    /* allocate thread private data */
-    data = dr_thread_alloc(drcontext, sizeof(per_thread_t));
+    /* allocate thread private data; global, as a stalled analysis worker
+       can keep it on its list past the thread's exit */
+    data = dr_global_alloc(sizeof(per_thread_t));
     drmgr_set_tls_field(drcontext, tls_index, data);
-    data->buf_base = dr_thread_alloc(drcontext, mem_buf_size);
+    data->seq = (uint32_t)dr_atomic_add32_return_sum(&thread_seq, 1);
+    data->pool = NULL;
+    if (offload_workers) {
+        /* buffers come from the pool and travel to the analysis worker,
+           with room after the references for their regions */
+        data->pool = buf_pool_create(config.offload_buffers,
+                                     mem_buf_size + (regions ? config.max_mem_refs : 0));
+        data->full_ring = spsc_ring_create(config.offload_buffers);
+        DR_ASSERT(data->pool != NULL && data->full_ring != NULL);
+        data->cur_buf = buf_pool_get(data->pool);
+        data->buf_base = (char *)data->cur_buf->data;
+        data->offload_lock = dr_mutex_create();
+        data->handed_off = 0;
+        data->analyzed = 0;
+        data->offload_stalls = 0;
+        data->offload_stall_us = 0;
+        data->offload_max_depth = 0;
+    } else {
+        data->buf_base = dr_thread_alloc(drcontext, mem_buf_size);
+    }
     data->buf_ptr = data->buf_base;
     /* set buf_end to be negative of address of buffer end for the lea later */
     data->buf_end = -(ptr_int_t)(data->buf_base + mem_buf_size);
+    data->num_instrs = 0;
     data->num_refs = 0;
     data->num_reads = 0;
     data->num_writes = 0;
@@ -752,70 +2264,163 @@ event_thread_init(void *drcontext)
         data->ws = NULL;
     }
     if (config.wss_hll_tracking) {
-        DR_ASSERT(hll_init(&data->hll, config.hll_bits) == 0);
+        DR_ASSERT(hllpp_init(&data->hll, config.hll_bits) == 0);
+    }
+    if (config.enable_reuse_distance) {
+        data->rd = rd_create(config.rd_sample_rate, config.rd_max_keys);
+        DR_ASSERT(data->rd != NULL);
+    } else {
+        data->rd = NULL;
+    }
+    if (config.enable_pc_tracking) {
+        data->pcs = pc_table_create(config.pc_table_size, (uint8_t)config.pc_hll_bits);
+        DR_ASSERT(data->pcs != NULL);
+    } else {
+        data->pcs = NULL;
+    }
+    if (cache_sim_levels > 0) {
+        data->caches = shared_llc != NULL
+            ? cache_hier_create(cache_cfg, CACHE_LEVELS - 1, shared_llc)
+            : cache_hier_create(cache_cfg, CACHE_LEVELS, NULL);
+        DR_ASSERT(data->caches != NULL);
+        data->cache_served = dr_thread_alloc(drcontext, sizeof(uint8_t) * config.max_mem_refs);
+    } else {
+        data->caches = NULL;
+        data->cache_served = NULL;
+    }
+    memset(data->region_run, 0, sizeof(data->region_run));
+    memset(data->region_win, 0, sizeof(data->region_win));
+    if (regions != NULL) {
+        data->ref_regions = dr_thread_alloc(drcontext, sizeof(uint8_t) * config.max_mem_refs);
+        data->region_keys = dr_thread_alloc(drcontext, sizeof(uint64_t) * config.max_mem_refs);
+        for (int r = 0; r < MEM_REGION_COUNT; r++) {
+            DR_ASSERT(hllpp_init(&data->region_hll[r], config.hll_bits) == 0);
+            DR_ASSERT(hllpp_init(&data->region_sample_hll[r], config.sample_hll_bits) == 0);
+        }
+        region_add_stack(drcontext);
+    } else {
+        data->ref_regions = NULL;
+        data->region_keys = NULL;
+    }
+    if (config.wss_exact_tracking || config.wss_hll_tracking || config.enable_reuse_distance ||
+        regions != NULL) {
+        data->line_keys = dr_thread_alloc(drcontext, sizeof(uint64_t) * config.max_mem_refs);
+    } else {
+        data->line_keys = NULL;
+    }
+    memset(data->gran, 0, sizeof(data->gran));
+    for (int g = 0; page_tracking && g < WSS_GRANS; g++) {
+        wss_gran_t *gran = &data->gran[g];
+        gran->keys = dr_thread_alloc(drcontext, sizeof(uint64_t) * config.max_mem_refs);
+        if (config.wss_exact_tracking) {
+            gran->ws = ws_create();
+            gran->sample_ws = ws_window_create(NULL, 1, NULL, NULL);
+        }
+        if (config.wss_hll_tracking) {
+            DR_ASSERT(hllpp_init(&gran->hll, config.hll_bits) == 0);
+            DR_ASSERT(hllpp_init(&gran->sample_hll, config.sample_hll_bits) == 0);
+        }
+    }
+    data->thread_id = (uint32_t)dr_get_thread_id(drcontext);
+    data->trace_last_us = get_timestamp();
+    memset(data->burst_stat, 0, sizeof(data->burst_stat));
+    data->burst_refs0 = data->burst_reads0 = data->burst_writes0 = 0;
+    burst_sched_init(&data->burst, config.burst_on_units, config.burst_off_units,
+                     data->thread_id);
+    data->burst_len = (int64)burst_sched_first(&data->burst);
+    data->burst_left = data->burst_len;
+    data->roi_left = 0;        /* check the ROI window at the first block */
+    data->threshold_left = 0;
+    data->next_thread = data->prev_thread = NULL;
+    if (bbdup_enabled) {
+        data->case_slot = (uintptr_t *)(dr_get_dr_segment_base(case_tls_seg) + case_tls_offs);
+        if (roi_enabled) {
+            dr_mutex_lock(roi_mutex);
+            data->next_thread = thread_list;
+            if (thread_list != NULL)
+                ((per_thread_t *)thread_list)->prev_thread = data;
+            thread_list = data;
+            update_thread_case(data);
+            dr_mutex_unlock(roi_mutex);
+        } else {
+            update_thread_case(data);
+        }
+    }
+    data->trace_writer = NULL;
+    data->timeseries_writer = NULL;
+    if (config.per_thread_streams) {
+        char filename[MAXIMUM_PATH];
+        if (config.enable_trace) {
+            /* two buffers on the shared thread: one fills while one is written */
+            aw_config_t io = { THREAD_TRACE_IO_BUFFER, thread_stream_io ? 2 : 1,
+                               AW_BACKEND_WRITE, NULL, thread_stream_io == NULL,
+                               thread_stream_io };
+            /* numbered by seq, not tid: a reused tid would truncate an
+               exited thread's file */
+            dr_snprintf(filename, sizeof(filename), "%s_%d.t%u.pb",
+                        config.pb_trace_output, dr_get_process_id(), data->seq);
+            NULL_TERMINATE_BUFFER(filename);
+            data->trace_writer = pb_trace_writer_create_io(filename, 0, &io);
+            if (data->trace_writer)
+                register_stream_file(&trace_stream_files, filename);
+            else
+                dr_fprintf(STDERR, "Warning: Failed to create protobuf trace writer %s\n", filename);
+        }
+        if (config.wss_stat_tracking) {
+            aw_config_t io = { THREAD_TIMESERIES_IO_BUFFER, thread_stream_io ? 2 : 1,
+                               AW_BACKEND_WRITE, NULL, thread_stream_io == NULL,
+                               thread_stream_io };
+            const char *command = dr_get_application_name();
+            dr_snprintf(filename, sizeof(filename), "%s_%d.t%u.pb",
+                        config.pb_timeseries_output, dr_get_process_id(), data->seq);
+            NULL_TERMINATE_BUFFER(filename);
+            data->timeseries_writer = pb_timeseries_writer_create_io(
+                filename, "dynamorio", dr_get_process_id(),
+                command ? command : "unknown",
+                config.sample_window_refs, config.cache_line_size, &io);
+            if (data->timeseries_writer)
+                register_stream_file(&timeseries_stream_files, filename);
+            else
+                dr_fprintf(STDERR, "Warning: Failed to create protobuf time-series writer %s\n", filename);
+        }
+    }
+    if (global_trace_writer || data->trace_writer) {
+        data->trace_buf = dr_thread_alloc(drcontext,
+                                          sizeof(pb_trace_event_t) * config.max_mem_refs);
+    } else {
+        data->trace_buf = NULL;
     }
 
     /* Initialize size-specific counters */
-    data->read_size_1 = 0;
-    data->read_size_2 = 0;
-    data->read_size_4 = 0;
-    data->read_size_8 = 0;
-    data->read_size_16 = 0;
-    data->read_size_32 = 0;
-    data->read_size_64 = 0;
-    data->read_size_other = 0;
-    data->write_size_1 = 0;
-    data->write_size_2 = 0;
-    data->write_size_4 = 0;
-    data->write_size_8 = 0;
-    data->write_size_16 = 0;
-    data->write_size_32 = 0;
-    data->write_size_64 = 0;
-    data->write_size_other = 0;
+    memset(&data->size_hist, 0, sizeof(data->size_hist));
+    memset(&data->ref_counts, 0, sizeof(data->ref_counts));
 
     /* per-window sampling structures (independent of wss_stat_tracking) */
+    memset(data->win_stat, 0, sizeof(data->win_stat));
     if (config.wss_exact_tracking) {
-        data->sample_ws = ws_create();
+        /* the time-series window, closed explicitly by finalize_sample_window(),
+           then one level per wss_window_sizes entry closing on its own */
+        uint64_t levels[1 + WSS_WINDOW_SIZES] = {0};
+        for (uint w = 0; w < config.wss_window_count; w++)
+            levels[wss_window_base + w] = config.wss_window_sizes[w];
+        data->sample_ws = ws_window_create(levels, wss_window_base + config.wss_window_count,
+                                           config.wss_window_count > 0 ? wss_window_closed : NULL,
+                                           data);
+        DR_ASSERT(data->sample_ws != NULL);
     } else {
         data->sample_ws = NULL;
     }
 
     if (config.wss_hll_tracking) {
-        DR_ASSERT(hll_init(&data->sample_hll, config.sample_hll_bits) == 0);
-    }
-
-    /* per-window sampling counters (only needed if stat tracking is enabled) */
-    if (config.wss_stat_tracking) {
-        data->sample_ref_count = 0;
-        data->sample_read_count = 0;
-        data->sample_write_count = 0;
-        data->sample_idx = 0;
-
-        /* Initialize per-window size counters */
-        data->sample_read_size_1 = 0;
-        data->sample_read_size_2 = 0;
-        data->sample_read_size_4 = 0;
-        data->sample_read_size_8 = 0;
-        data->sample_read_size_16 = 0;
-        data->sample_read_size_32 = 0;
-        data->sample_read_size_64 = 0;
-        data->sample_read_size_other = 0;
-        data->sample_write_size_1 = 0;
-        data->sample_write_size_2 = 0;
-        data->sample_write_size_4 = 0;
-        data->sample_write_size_8 = 0;
-        data->sample_write_size_16 = 0;
-        data->sample_write_size_32 = 0;
-        data->sample_write_size_64 = 0;
-        data->sample_write_size_other = 0;
-    } else {
-        /* If stat tracking is disabled, still need to initialize counters */
-        data->sample_ref_count = 0;
-        data->sample_read_count = 0;
-        data->sample_write_count = 0;
-        data->sample_idx = 0;
+        DR_ASSERT(hllpp_init(&data->sample_hll, config.sample_hll_bits) == 0);
     }
 
+    /* per-window sampling counters */
+    data->sample_ref_count = 0;
+    data->sample_idx = 0;
+    memset(&data->sample_hist, 0, sizeof(data->sample_hist));
+    memset(data->sample_served, 0, sizeof(data->sample_served));
+
     /* Track total thread count for protobuf metadata */
     if (config.wss_stat_tracking && global_timeseries_writer) {
         dr_mutex_lock(thread_count_mutex);
@@ -823,28 +2428,122 @@ event_thread_init(void *drcontext)
         dr_mutex_unlock(thread_count_mutex);
     }
 
+    /* Hand the thread to its analysis worker once its state is set up */
+    if (offload_workers) {
+        offload_worker_t *w = &offload_workers[data->seq % config.offload_threads];
+        data->worker = w;
+        dr_mutex_lock(w->mutex);
+        data->prev_offload = NULL;
+        data->next_offload = w->threads;
+        if (w->threads != NULL)
+            ((per_thread_t *)w->threads)->prev_offload = data;
+        w->threads = data;
+        dr_mutex_unlock(w->mutex);
+    }
+
     dr_log(drcontext, DR_LOG_ALL, 1, "memcount: set up for thread " TIDFMT "\n",
            dr_get_thread_id(drcontext));
 }
 
+/* Add a thread's exact line set to a union. Lines the set could not list,
+   or the union could not take, make the union a lower bound: warn, and
+   flag it for the exit report. */
+static void merge_thread_lines(line_union_t *u, ws_ctx_t *ws, per_thread_t *data) {
+    size_t n;
+    const uint64_t *keys = ws_keys(ws, &n);
+    uint64_t lost = ws_keys_lost(ws);
+
+    if (lost > 0) {
+        dr_fprintf(STDERR, "Warning: out of memory listing thread %u's working set: "
+                   "%llu lines not merged\n", data->thread_id, (unsigned long long)lost);
+        lines_inexact = 1;
+    }
+    if (line_union_add(u, data->seq, keys, n) != 0) {
+        dr_fprintf(STDERR, "Warning: out of memory merging thread %u's working set\n",
+                   data->thread_id);
+        lines_inexact = 1;
+    }
+}
+
 static void 
 event_thread_exit(void *drcontext) 
 {
     per_thread_t *data;
+    bool listed = false;       /* still on a stalled worker's list */
+    bool lost = false;
 
-    memtrace(drcontext);
     data = drmgr_get_tls_field(drcontext, tls_index);
+    if (data->pool) {
+        /* leave the worker, analyze what is still queued, then keep the
+           analysis state to ourselves for the teardown below. A worker
+           stalled mid-sweep (suspended at process exit) keeps the thread
+           on its list; if it stalled inside this thread's analysis, the
+           state stays with it. */
+        offload_buffer(data, false);
+        listed = !offload_leave(data);
+        offload_drain(data);
+        if (!listed)
+            dr_mutex_lock(data->offload_lock);
+        else
+            lost = !dr_mutex_trylock(data->offload_lock);
+        if (!lost)
+            offload_analyze_locked(data, config.offload_buffers);   /* the whole ring */
+    } else {
+        memtrace(drcontext);
+    }
+    if (config.enable_instruction_threshold || roi_window)
+        flush_instruction_count(data);
+    if (roi_enabled) {
+        dr_mutex_lock(roi_mutex);
+        if (data->prev_thread != NULL)
+            ((per_thread_t *)data->prev_thread)->next_thread = data->next_thread;
+        else
+            thread_list = data->next_thread;
+        if (data->next_thread != NULL)
+            ((per_thread_t *)data->next_thread)->prev_thread = data->prev_thread;
+        dr_mutex_unlock(roi_mutex);
+    }
+    if (lost) {
+        /* leak the state rather than free it under the worker */
+        dr_fprintf(STDERR, "Warning: analysis of thread %u stalled, its counts are lost\n",
+                   data->thread_id);
+        return;
+    }
+    if (burst_enabled) {
+        burst_close_period(drcontext, data, true);
+        dr_mutex_lock(mutex);
+        for (int m = 0; m < BURST_NUM_METRICS; m++)
+            burst_stat_merge(&global_burst_stat[m], &data->burst_stat[m]);
+        global_burst_units += burst_sched_units(&data->burst);
+        global_burst_units_on += data->burst.units_on;
+        global_burst_periods += data->burst.periods;
+        dr_mutex_unlock(mutex);
+    }
+
+    if (data->trace_buf) {
+        dr_thread_free(drcontext, data->trace_buf,
+                       sizeof(pb_trace_event_t) * config.max_mem_refs);
+    }
+    if (data->trace_writer) {
+        pb_trace_writer_close(data->trace_writer);
+        data->trace_writer = NULL;
+    }
 
     /* flush last partial window (if any) */
     if (config.wss_stat_tracking && data->sample_ref_count > 0)
     	finalize_sample_window(data);
+    if (data->timeseries_writer) {
+        pb_timeseries_set_num_threads(data->timeseries_writer, 1);
+        pb_timeseries_writer_close(data->timeseries_writer);
+        data->timeseries_writer = NULL;
+    }
 
     /* destroy windowed structures (independent of wss_stat_tracking) */
     if (config.wss_exact_tracking && data->sample_ws) {
-        ws_destroy(data->sample_ws);
+        ws_window_destroy(data->sample_ws);
     }
     if (config.wss_hll_tracking) {
-        hll_destroy(&data->sample_hll);
+        hllpp_destroy(&data->sample_hll);
     }
 
     ws_stats_t s = {0};
@@ -853,52 +2552,123 @@ event_thread_exit(void *drcontext)
         data->working_set = s.distinct;    /* #lines seen exactly once */
     } else if (config.wss_hll_tracking) {
         /* Use HLL estimate if exact tracking is disabled but HLL is enabled */
-        data->working_set = (uint64)hll_count(&data->hll);
+        data->working_set = (uint64)hllpp_count(&data->hll);
     } else {
         /* Both tracking methods disabled */
         data->working_set = 0;
     }
     if (data->ws) {
+        /* line_union_add() locks per shard, so exiting threads merge in parallel */
+        merge_thread_lines(global_lines, data->ws, data);
         ws_destroy(data->ws);
         data->ws = NULL;
     }
+    for (int g = 0; page_tracking && g < WSS_GRANS; g++) {
+        wss_gran_t *gran = &data->gran[g];
+        if (gran->ws) {
+            merge_thread_lines(global_gran_lines[g], gran->ws, data);
+            ws_destroy(gran->ws);
+            ws_window_destroy(gran->sample_ws);
+        }
+        if (config.wss_hll_tracking) {
+            dr_mutex_lock(hll_mutex);
+            hllpp_merge(&global_gran_hll[g], &gran->hll);
+            dr_mutex_unlock(hll_mutex);
+            hllpp_destroy(&gran->hll);
+            hllpp_destroy(&gran->sample_hll);
+        }
+        dr_thread_free(drcontext, gran->keys, sizeof(uint64_t) * config.max_mem_refs);
+    }
 
+    fold_ref_counts(data);
     dr_mutex_lock(mutex);
     global_num_refs += data->num_refs;
     global_num_reads += data->num_reads;
     global_num_writes += data->num_writes;
-    global_working_set += data->working_set;
 
     /* Aggregate size-specific counters */
-    global_read_size_1 += data->read_size_1;
-    global_read_size_2 += data->read_size_2;
-    global_read_size_4 += data->read_size_4;
-    global_read_size_8 += data->read_size_8;
-    global_read_size_16 += data->read_size_16;
-    global_read_size_32 += data->read_size_32;
-    global_read_size_64 += data->read_size_64;
-    global_read_size_other += data->read_size_other;
-
-    global_write_size_1 += data->write_size_1;
-    global_write_size_2 += data->write_size_2;
-    global_write_size_4 += data->write_size_4;
-    global_write_size_8 += data->write_size_8;
-    global_write_size_16 += data->write_size_16;
-    global_write_size_32 += data->write_size_32;
-    global_write_size_64 += data->write_size_64;
-    global_write_size_other += data->write_size_other;
+    memref_hist_add(&global_size_hist, &data->size_hist);
+
+    for (uint w = 0; w < config.wss_window_count; w++) {
+        global_win_stat[w].windows += data->win_stat[w].windows;
+        global_win_stat[w].sum += data->win_stat[w].sum;
+        if (data->win_stat[w].max > global_win_stat[w].max)
+            global_win_stat[w].max = data->win_stat[w].max;
+    }
+
+    if (data->pool) {
+        global_offload_buffers += data->handed_off;
+        global_offload_stalls += data->offload_stalls;
+        global_offload_stall_us += data->offload_stall_us;
+        if (data->offload_max_depth > global_offload_max_depth)
+            global_offload_max_depth = data->offload_max_depth;
+    }
 
     dr_mutex_unlock(mutex);
 
     if (config.wss_hll_tracking) {
         dr_mutex_lock(hll_mutex);
-        hll_merge(&global_hll, &data->hll);
+        hllpp_merge(&global_hll, &data->hll);
         dr_mutex_unlock(hll_mutex);
-        hll_destroy(&data->hll);
+        hllpp_destroy(&data->hll);
+    }
+
+    if (data->rd) {
+        dr_mutex_lock(rd_mutex);
+        rd_merge(global_rd, data->rd);
+        dr_mutex_unlock(rd_mutex);
+        rd_destroy(data->rd);
+    }
+
+    if (data->pcs) {
+        dr_mutex_lock(pc_mutex);
+        pc_table_merge(global_pcs, data->pcs);
+        dr_mutex_unlock(pc_mutex);
+        pc_table_destroy(data->pcs);
+    }
+
+    if (data->ref_regions) {
+        dr_mutex_lock(region_mutex);
+        for (int r = 0; r < MEM_REGION_COUNT; r++) {
+            global_region[r].reads += data->region_run[r].reads;
+            global_region[r].writes += data->region_run[r].writes;
+            global_region[r].bytes += data->region_run[r].bytes;
+            hllpp_merge(&global_region_hll[r], &data->region_hll[r]);
+            hllpp_destroy(&data->region_hll[r]);
+            hllpp_destroy(&data->region_sample_hll[r]);
+        }
+        dr_mutex_unlock(region_mutex);
+        dr_thread_free(drcontext, data->ref_regions, sizeof(uint8_t) * config.max_mem_refs);
+        dr_thread_free(drcontext, data->region_keys, sizeof(uint64_t) * config.max_mem_refs);
+    }
+
+    if (data->caches) {
+        cache_hier_stats_t cst;
+        cache_hier_get_stats(data->caches, &cst);
+        dr_mutex_lock(cache_mutex);
+        cache_hier_stats_add(&global_cache_stats, &cst);
+        dr_mutex_unlock(cache_mutex);
+        cache_hier_destroy(data->caches);
+        dr_thread_free(drcontext, data->cache_served, sizeof(uint8_t) * config.max_mem_refs);
     }
 
-    dr_thread_free(drcontext, data->buf_base, mem_buf_size);
-    dr_thread_free(drcontext, data, sizeof(per_thread_t));
+    if (data->line_keys) {
+        dr_thread_free(drcontext, data->line_keys, sizeof(uint64_t) * config.max_mem_refs);
+    }
+    if (data->pool == NULL) {
+        dr_thread_free(drcontext, data->buf_base, mem_buf_size);
+    } else {
+        buf_pool_destroy(data->pool);
+        spsc_ring_destroy(data->full_ring);
+        if (listed) {
+            /* the stalled worker can still reach the thread and try its
+               lock: keep both */
+            return;
+        }
+        dr_mutex_unlock(data->offload_lock);
+        dr_mutex_destroy(data->offload_lock);
+    }
+    dr_global_free(data, sizeof(per_thread_t));
 }
 
 /* we transform string loops into regular loops so we can more easily
@@ -928,15 +2698,13 @@ event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb, bool for_trace,
     return DR_EMIT_DEFAULT;
 }
 
-/* event_bb_insert calls instrument_mem to instrument every
- * application memory reference.
+/* instrument_app_instr calls instrument_mem for every memory reference
+ * of the application instruction being instrumented.
  */
-static dr_emit_flags_t
-event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *where,
-                bool for_trace, bool translating, void *user_data)
+static void
+instrument_app_instr(void *drcontext, instrlist_t *bb, instr_t *where, instru_data_t *data)
 {
     int i;
-    instru_data_t *data = (instru_data_t *)user_data;
     /* Use the drmgr_orig_app_instr_* interface to properly handle our own use
      * of drutil_expand_rep_string() and drx_expand_scatter_gather() (as well
      * as another client/library emulating the instruction stream).
@@ -946,52 +2714,17 @@ event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *where,
         data->last_pc = instr_get_app_pc(instr_fetch);
     app_pc last_pc = data->last_pc;
 
-    /* Count instructions for threshold checking (do this once at the start of BB) */
-    if (config.enable_instruction_threshold && !threshold_reached &&
-        drmgr_is_first_instr(drcontext, where)) {
-        /* Count number of app instructions in this basic block */
-        uint64 bb_instr_count = 0;
-        for (instr_t *instr = instrlist_first_app(bb); instr != NULL;
-             instr = instr_get_next_app(instr)) {
-            bb_instr_count++;
-        }
-        /* Insert clean call to check threshold at start of BB */
-        dr_insert_clean_call(drcontext, bb, where,
-                            (void *)check_instruction_threshold,
-                            false, 1,
-                            OPND_CREATE_INT64(bb_instr_count));
-    }
-
-    if (drmgr_is_last_instr(drcontext, where))
-        dr_thread_free(drcontext, data, sizeof(*data));
-
     instr_t *instr_operands = drmgr_orig_app_instr_for_operands(drcontext);
     if (instr_operands == NULL ||
         (!instr_writes_memory(instr_operands) && !instr_reads_memory(instr_operands)))
-        return DR_EMIT_DEFAULT;
+        return;
     DR_ASSERT(instr_is_app(instr_operands));
     DR_ASSERT(last_pc != NULL);
 
-    /* Use direct trace instrumentation for tracing, buffer-based for stats */
-    if (config.enable_trace) {
-        if (instr_reads_memory(instr_operands)) {
-            for (i = 0; i < instr_num_srcs(instr_operands); i++) {
-                if (opnd_is_memory_reference(instr_get_src(instr_operands, i))) {
-                    instrument_mem_direct(drcontext, bb, where, last_pc, instr_operands, i, false);
-                }
-            }
-        }
-        if (instr_writes_memory(instr_operands)) {
-            for (i = 0; i < instr_num_dsts(instr_operands); i++) {
-                if (opnd_is_memory_reference(instr_get_dst(instr_operands, i))) {
-                    instrument_mem_direct(drcontext, bb, where, last_pc, instr_operands, i, true);
-                }
-            }
-        }
-    }
-    
-    /* Use buffer-based instrumentation for WSS tracking */
-    if (config.wss_exact_tracking || config.wss_hll_tracking || config.wss_stat_tracking) {
+    /* Stats and trace events both come from the inline per-thread buffer,
+       drained by memtrace() when it fills */
+    if (config.enable_trace || config.wss_exact_tracking || config.wss_hll_tracking ||
+        config.wss_stat_tracking) {
         if (instr_reads_memory(instr_operands)) {
             for (i = 0; i < instr_num_srcs(instr_operands); i++) {
                 if (opnd_is_memory_reference(instr_get_src(instr_operands, i))) {
@@ -1007,147 +2740,568 @@ event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *where,
             }
         }
     }
+}
+
+/* Number of application instructions in a block */
+static uint
+bb_num_instrs(instrlist_t *bb)
+{
+    uint n = 0;
+    for (instr_t *instr = instrlist_first_app(bb); instr != NULL;
+         instr = instr_get_next_app(instr)) {
+        n++;
+    }
+    return n;
+}
+
+/* event_bb_insert calls instrument_app_instr to instrument every
+ * application memory reference.
+ */
+static dr_emit_flags_t
+event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *where,
+                bool for_trace, bool translating, void *user_data)
+{
+    instru_data_t *data = (instru_data_t *)user_data;
+
+    /* Count instructions for threshold checking (do this once at the start of BB) */
+    if (config.enable_instruction_threshold && !threshold_reached &&
+        drmgr_is_first_instr(drcontext, where)) {
+        /* Bump the thread's counter inline; the threshold itself is
+           checked when the thread's countdown runs out */
+        uint num_instrs = bb_num_instrs(bb);
+        instrument_instr_count(drcontext, bb, where, num_instrs);
+        instrument_countdown(drcontext, bb, where, offsetof(per_thread_t, threshold_left),
+                             num_instrs, (void *)threshold_check);
+    }
+
+    instrument_app_instr(drcontext, bb, where, data);
+
+    if (drmgr_is_last_instr(drcontext, where))
+        dr_thread_free(drcontext, data, sizeof(*data));
     return DR_EMIT_DEFAULT;
 }
 
-static void 
-memtrace(void *drcontext)
+/* Per-block counts shared by all block copies under drbbdup */
+typedef struct {
+    uint num_instrs;
+    uint num_refs;          /* memory operands, as instrument_app_instr records them */
+} bbdup_info_t;
+
+static uintptr_t
+bbdup_set_up(void *drbbdup_ctx, void *drcontext, void *tag, instrlist_t *bb,
+             bool *enable_dups, bool *enable_dynamic_handling, void *user_data)
 {
-    per_thread_t *data;
-    int num_refs;
-    int num_reads = 0;
-    int num_writes = 0;
-    int working_set = 0;
-    mem_ref_t *mem_ref;
+    if (burst_enabled &&
+        drbbdup_register_case_encoding(drbbdup_ctx, INSTRU_CASE_BURST_OFF) != DRBBDUP_SUCCESS)
+        DR_ASSERT(false);
+    if (roi_enabled &&
+        drbbdup_register_case_encoding(drbbdup_ctx, INSTRU_CASE_OUT_OF_ROI) != DRBBDUP_SUCCESS)
+        DR_ASSERT(false);
+    *enable_dups = true;
+    *enable_dynamic_handling = false;
+    return INSTRU_CASE_ON;
+}
 
-    data = drmgr_get_tls_field(drcontext, tls_index);
-    mem_ref = (mem_ref_t *)data->buf_base;
-    num_refs = (int)((mem_ref_t *)data->buf_ptr - mem_ref);
+static void
+bbdup_analyze_orig(void *drcontext, void *tag, instrlist_t *bb, void *user_data,
+                   void **orig_analysis_data)
+{
+    bbdup_info_t *info = dr_thread_alloc(drcontext, sizeof(*info));
+    info->num_instrs = bb_num_instrs(bb);
+    info->num_refs = 0;
+    for (instr_t *instr = instrlist_first_app(bb); instr != NULL;
+         instr = instr_get_next_app(instr)) {
+        for (int i = 0; i < instr_num_srcs(instr); i++)
+            info->num_refs += opnd_is_memory_reference(instr_get_src(instr, i));
+        for (int i = 0; i < instr_num_dsts(instr); i++)
+            info->num_refs += opnd_is_memory_reference(instr_get_dst(instr, i));
+    }
+    *orig_analysis_data = info;
+}
 
-    for(int i = 0; i < num_refs; i++) {
-        /* Note: Per-reference timestamps removed for performance.
-         * Timestamps are captured at sampling window boundaries (finalize_sample_window)
-         * and during trace events (direct_trace_write) if tracing is enabled. */
+static void
+bbdup_destroy_orig_analysis(void *drcontext, void *user_data, void *orig_analysis_data)
+{
+    dr_thread_free(drcontext, orig_analysis_data, sizeof(bbdup_info_t));
+}
 
-	uintptr_t key = ((uintptr_t)mem_ref->addr) & cache_line_mask;
-        
-	if (config.wss_exact_tracking) {
-		ws_record(data->ws, key);
-	}
-	if (config.wss_hll_tracking) {
-		hll_add(&data->hll, &key, sizeof(key));
-	}
-
-	/* WSS sampling only if enabled */
-	if (config.wss_stat_tracking) {
-		if (config.wss_exact_tracking && data->sample_ws) {
-			ws_record(data->sample_ws, key);
-		}
-		if (config.wss_hll_tracking) {
-			hll_add(&data->sample_hll, &key, sizeof key);
-		}
-	}
-
-        /* Trace output is now handled directly via instrument_mem_direct() */
-
-        if(mem_ref->write) {
-            num_writes++;
-            /* Track per-window write count for protobuf */
-            if (config.wss_stat_tracking) {
-                data->sample_write_count++;
+static void
+bbdup_analyze_case(void *drcontext, void *tag, instrlist_t *bb, uintptr_t encoding,
+                   void *user_data, void *orig_analysis_data, void **case_analysis_data)
+{
+    instru_data_t *data = dr_thread_alloc(drcontext, sizeof(*data));
+    data->last_pc = NULL;
+    *case_analysis_data = data;
+}
+
+static void
+bbdup_destroy_case_analysis(void *drcontext, uintptr_t encoding, void *user_data,
+                            void *orig_analysis_data, void *case_analysis_data)
+{
+    dr_thread_free(drcontext, case_analysis_data, sizeof(instru_data_t));
+}
+
+/* At block entry every copy counts instructions for the threshold and the
+ * ROI window, and the copies inside the ROI count down the burst period;
+ * only the on copy records memory references.
+ */
+static void
+bbdup_instrument_instr(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
+                       instr_t *where, uintptr_t encoding, void *user_data,
+                       void *orig_analysis_data, void *case_analysis_data)
+{
+    bbdup_info_t *info = (bbdup_info_t *)orig_analysis_data;
+    bool is_first = false;
+
+    if (drbbdup_is_first_instr(drcontext, instr, &is_first) != DRBBDUP_SUCCESS)
+        DR_ASSERT(false);
+    if (is_first) {
+        uint units = config.burst_unit_refs ? info->num_refs : info->num_instrs;
+        if (burst_enabled && encoding != INSTRU_CASE_OUT_OF_ROI && units > 0) {
+            instrument_countdown(drcontext, bb, where, offsetof(per_thread_t, burst_left),
+                                 units, (void *)burst_period_end);
+        }
+        if ((config.enable_instruction_threshold && !threshold_reached) || roi_window)
+            instrument_instr_count(drcontext, bb, where, info->num_instrs);
+        if (roi_window) {
+            /* checks the threshold too */
+            instrument_countdown(drcontext, bb, where, offsetof(per_thread_t, roi_left),
+                                 info->num_instrs, (void *)roi_window_check);
+        } else if (config.enable_instruction_threshold && !threshold_reached) {
+            instrument_countdown(drcontext, bb, where, offsetof(per_thread_t, threshold_left),
+                                 info->num_instrs, (void *)threshold_check);
+        }
+    }
+
+    if (encoding == INSTRU_CASE_ON)
+        instrument_app_instr(drcontext, bb, where, (instru_data_t *)case_analysis_data);
+}
+
+static bool
+bbdup_init(void)
+{
+    drbbdup_options_t opts;
+
+    if (!dr_raw_tls_calloc(&case_tls_seg, &case_tls_offs, 1, 0))
+        return false;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.struct_size = sizeof(opts);
+    opts.set_up_bb_dups = bbdup_set_up;
+    opts.analyze_orig = bbdup_analyze_orig;
+    opts.destroy_orig_analysis = bbdup_destroy_orig_analysis;
+    opts.analyze_case = bbdup_analyze_case;
+    opts.destroy_case_analysis = bbdup_destroy_case_analysis;
+    opts.instrument_instr = bbdup_instrument_instr;
+    opts.runtime_case_opnd = opnd_create_far_base_disp_ex(
+        case_tls_seg, DR_REG_NULL, DR_REG_NULL, 1, case_tls_offs, OPSZ_PTR,
+        false, true, false);
+    /* ROI changes write other threads' slots */
+    opts.atomic_load_encoding = roi_enabled;
+    opts.non_default_case_limit = 2;
+    opts.max_case_encoding = INSTRU_CASE_OUT_OF_ROI;
+    return drbbdup_init(&opts) == DRBBDUP_SUCCESS;
+}
+
+/* Coarsen one segment's line keys to page keys, and those to huge-page
+ * keys, and record them in the whole-run and window structures of each
+ */
+static void
+record_gran_keys(per_thread_t *data, const uint64_t *line_keys, size_t n)
+{
+    const uint64_t *src = line_keys;
+    size_t i;
+
+    for (int g = 0; g < WSS_GRANS; g++) {
+        wss_gran_t *gran = &data->gran[g];
+        n = memref_coarsen(src, n, wss_gran_mask[g], gran->keys);
+        if (gran->ws) {
+            ws_record_batch(gran->ws, gran->keys, n);
+        }
+        if (config.wss_hll_tracking) {
+            hllpp_add_u64_batch(&gran->hll, gran->keys, n);
+        }
+        if (config.wss_stat_tracking) {
+            if (gran->sample_ws) {
+                for (i = 0; i < n; i++)
+                    ws_window_record(gran->sample_ws, gran->keys[i]);
             }
-            /* Track size-specific write counts (global) */
-            switch(mem_ref->size) {
-                case 1:
-                    data->write_size_1++;
-                    if (config.wss_stat_tracking) data->sample_write_size_1++;
-                    break;
-                case 2:
-                    data->write_size_2++;
-                    if (config.wss_stat_tracking) data->sample_write_size_2++;
-                    break;
-                case 4:
-                    data->write_size_4++;
-                    if (config.wss_stat_tracking) data->sample_write_size_4++;
-                    break;
-                case 8:
-                    data->write_size_8++;
-                    if (config.wss_stat_tracking) data->sample_write_size_8++;
-                    break;
-                case 16:
-                    data->write_size_16++;
-                    if (config.wss_stat_tracking) data->sample_write_size_16++;
-                    break;
-                case 32:
-                    data->write_size_32++;
-                    if (config.wss_stat_tracking) data->sample_write_size_32++;
-                    break;
-                case 64:
-                    data->write_size_64++;
-                    if (config.wss_stat_tracking) data->sample_write_size_64++;
-                    break;
-                default:
-                    data->write_size_other++;
-                    if (config.wss_stat_tracking) data->sample_write_size_other++;
-                    break;
+            if (config.wss_hll_tracking) {
+                hllpp_add_u64_batch(&gran->sample_hll, gran->keys, n);
             }
-        } else {
-            num_reads++;
-            /* Track per-window read count for protobuf */
-            if (config.wss_stat_tracking) {
-                data->sample_read_count++;
+        }
+        src = gran->keys;
+    }
+}
+
+/* Count one segment's references per region, and add each region's line
+ * keys, grouped with a counting sort, to its whole-run and window sketches
+ */
+static void
+record_regions(per_thread_t *data, const memref_t *refs, const uint64_t *line_keys,
+               const uint8_t *region, size_t n)
+{
+    region_count_t seg[MEM_REGION_COUNT];
+    size_t start[MEM_REGION_COUNT], pos[MEM_REGION_COUNT];
+    size_t i, at = 0;
+    int r;
+
+    memset(seg, 0, sizeof(seg));
+    for (i = 0; i < n; i++) {
+        region_count_t *c = &seg[region[i]];
+        if (MEMREF_IS_WRITE(&refs[i]))
+            c->writes++;
+        else
+            c->reads++;
+        c->bytes += MEMREF_SIZE(&refs[i]);
+    }
+    for (r = 0; r < MEM_REGION_COUNT; r++) {
+        start[r] = pos[r] = at;
+        at += seg[r].reads + seg[r].writes;
+    }
+    for (i = 0; i < n; i++)
+        data->region_keys[pos[region[i]]++] = line_keys[i];
+
+    for (r = 0; r < MEM_REGION_COUNT; r++) {
+        size_t m = pos[r] - start[r];
+        if (m == 0)
+            continue;
+        data->region_run[r].reads += seg[r].reads;
+        data->region_run[r].writes += seg[r].writes;
+        data->region_run[r].bytes += seg[r].bytes;
+        hllpp_add_u64_batch(&data->region_hll[r], data->region_keys + start[r], m);
+        if (config.wss_stat_tracking) {
+            data->region_win[r].reads += seg[r].reads;
+            data->region_win[r].writes += seg[r].writes;
+            data->region_win[r].bytes += seg[r].bytes;
+            hllpp_add_u64_batch(&data->region_sample_hll[r], data->region_keys + start[r], m);
+        }
+    }
+}
+
+/* Run every analysis over num_refs references of a buffer flushed at
+ * time now, on the application thread or on its analysis worker. With
+ * region tracking, ref_regions holds the references' regions as looked up
+ * at the flush (offload_buffer); NULL looks them up now.
+ */
+static void
+analyze_buffer(per_thread_t *data, const memref_t *refs, size_t num_refs, uint64 now,
+               const uint8_t *ref_regions)
+{
+    uint64_t *keys;
+    size_t done, seg, i;
+
+    keys = data->line_keys;
+    data->buf_time_us = now;
+    if (data->ref_regions && ref_regions == NULL) {
+        region_map_lookup_batch(regions, refs, num_refs, data->ref_regions);
+        ref_regions = data->ref_regions;
+    }
+
+    /* The buffer is digested one segment at a time, a segment ending where
+     * the current sample window fills up (the whole buffer is one segment
+     * without window tracking): memref_count_batch() extracts the line keys
+     * and counts reads and writes by size class, left unfolded until the
+     * counts are needed (fold_ref_counts), then every analysis takes the
+     * segment's keys in bulk. Per-reference timestamps are not kept; the
+     * windows closed in the buffer (finalize_sample_window) take its flush
+     * time, and its trace events are spread up to it (emit_thread_trace).
+     */
+    for (done = 0; done < num_refs; done += seg) {
+        seg = num_refs - done;
+        if (config.wss_stat_tracking && config.sample_window_refs > 0 &&
+            seg > config.sample_window_refs - data->sample_ref_count)
+            seg = config.sample_window_refs - data->sample_ref_count;
+
+        memref_count_batch(refs + done, seg, cache_line_mask, keys ? keys + done : NULL,
+                           &data->ref_counts);
+
+        if (config.wss_exact_tracking) {
+            ws_record_batch(data->ws, keys + done, seg);
+        }
+        if (page_tracking) {
+            record_gran_keys(data, keys + done, seg);
+        }
+        if (data->caches) {
+            cache_hier_access_batch(data->caches, refs + done, seg, data->cache_served + done);
+        }
+        if (ref_regions) {
+            record_regions(data, refs + done, keys + done, ref_regions + done, seg);
+        }
+        if (data->sample_ws && (config.wss_stat_tracking || config.wss_window_count > 0)) {
+            for (i = done; i < done + seg; i++)
+                ws_window_record(data->sample_ws, keys[i]);
+        }
+
+        /* Sample window tracking only if WSS stats enabled */
+        if (config.wss_stat_tracking) {
+            if (data->caches) {
+                for (i = done; i < done + seg; i++)
+                    data->sample_served[data->cache_served[i]]++;
             }
-            /* Track size-specific read counts (global) */
-            switch(mem_ref->size) {
-                case 1:
-                    data->read_size_1++;
-                    if (config.wss_stat_tracking) data->sample_read_size_1++;
-                    break;
-                case 2:
-                    data->read_size_2++;
-                    if (config.wss_stat_tracking) data->sample_read_size_2++;
-                    break;
-                case 4:
-                    data->read_size_4++;
-                    if (config.wss_stat_tracking) data->sample_read_size_4++;
-                    break;
-                case 8:
-                    data->read_size_8++;
-                    if (config.wss_stat_tracking) data->sample_read_size_8++;
-                    break;
-                case 16:
-                    data->read_size_16++;
-                    if (config.wss_stat_tracking) data->sample_read_size_16++;
-                    break;
-                case 32:
-                    data->read_size_32++;
-                    if (config.wss_stat_tracking) data->sample_read_size_32++;
-                    break;
-                case 64:
-                    data->read_size_64++;
-                    if (config.wss_stat_tracking) data->sample_read_size_64++;
-                    break;
-                default:
-                    data->read_size_other++;
-                    if (config.wss_stat_tracking) data->sample_read_size_other++;
-                    break;
+            if (config.wss_hll_tracking) {
+                hllpp_add_u64_batch(&data->sample_hll, keys + done, seg);
+            }
+            data->sample_ref_count += seg;
+            if (data->sample_ref_count == config.sample_window_refs) {
+                finalize_sample_window(data);   /* resets sample_ref_count to 0 */
             }
         }
-        ++mem_ref;
-
-	/* Sample window tracking only if WSS stats enabled */
-	if (config.wss_stat_tracking) {
-		data->sample_ref_count++;
-		if (data->sample_ref_count == config.sample_window_refs) {
-			finalize_sample_window(data);   // this should reset sample_ref_count to 0
-		}
-	}
     }
 
-    memset(data->buf_base, 0, mem_buf_size);
+    if (config.wss_hll_tracking) {
+        hllpp_add_u64_batch(&data->hll, keys, num_refs);
+    }
+    if (data->rd) {
+        rd_record_batch(data->rd, keys, num_refs);
+    }
+    if (data->pcs) {
+        pc_table_record_batch(data->pcs, refs, num_refs, cache_line_mask);
+    }
+    if (data->trace_buf) {
+        emit_thread_trace(data, refs, (int)num_refs);
+    }
     data->num_refs += num_refs;
-    data->num_reads += num_reads;
-    data->num_writes += num_writes;
+}
+
+/* Analyze up to max of the buffers queued by thread t, whose offload_lock
+ * the caller holds; returns how many were analyzed.
+ */
+static uint
+offload_analyze_locked(per_thread_t *t, uint max)
+{
+    pool_buf_t *b;
+    uint n = 0;
+
+    while (n < max && (b = (pool_buf_t *)spsc_ring_pop(t->full_ring)) != NULL) {
+        analyze_buffer(t, (const memref_t *)b->data, b->len, b->stamp,
+                       t->ref_regions ? (const uint8_t *)b->data + mem_buf_size : NULL);
+        buf_pool_put(t->pool, b);
+        __atomic_add_fetch(&t->analyzed, 1, __ATOMIC_RELEASE);
+        n++;
+    }
+    return n;
+}
+
+/* Analyze the buffers queued by thread t unless another consumer holds
+ * it, at most one pool's worth so that a busy thread does not starve the
+ * worker's other threads; returns how many were analyzed.
+ */
+static uint
+offload_analyze(per_thread_t *t)
+{
+    uint n;
+
+    if (!dr_mutex_trylock(t->offload_lock))
+        return 0;
+    n = offload_analyze_locked(t, config.offload_buffers);
+    dr_mutex_unlock(t->offload_lock);
+    return n;
+}
+
+/* Give up on a worker that held a thread for OFFLOAD_DRAIN_TIMEOUT_US
+ * without progress (suspended at process exit): later threads no longer
+ * wait for it, and analyze their own buffers as they queue them.
+ */
+static void
+offload_worker_stalled(offload_worker_t *w)
+{
+    if (__atomic_exchange_n(&w->dead, 1, __ATOMIC_ACQ_REL) == 0) {
+        dr_fprintf(STDERR, "Warning: analysis thread %u stalled, its threads analyze their "
+                   "own buffers\n", (uint)(w - offload_workers));
+    }
+}
+
+static uint
+offload_sweep(offload_worker_t *w)
+{
+    uint n = 0;
+
+    dr_mutex_lock(w->mutex);
+    for (per_thread_t *t = w->threads; t != NULL; t = t->next_offload)
+        n += offload_analyze(t);
+    dr_mutex_unlock(w->mutex);
+    return n;
+}
+
+/* Analysis thread: sweep the served threads' rings until told to stop */
+static void
+offload_worker_main(void *arg)
+{
+    offload_worker_t *w = (offload_worker_t *)arg;
+
+    while (!__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) {
+        if (offload_sweep(w) > 0)
+            continue;
+        /* Producers check sleeping after queueing, so a buffer queued
+           after the sweep below either is seen by it or wakes us */
+        dr_event_reset(w->wake);
+        __atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (offload_sweep(w) == 0 && !__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE))
+            dr_event_wait(w->wake);
+        __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&w->done, 1, __ATOMIC_RELEASE);
+}
+
+/* Stop the analysis threads and free them once they have finished. A
+ * worker suspended by the process exit never does; it is left as is.
+ */
+static void
+offload_stop_workers(void)
+{
+    uint64 t0 = get_timestamp();
+    bool all_done;
+
+    for (uint i = 0; i < config.offload_threads; i++) {
+        __atomic_store_n(&offload_workers[i].stop, 1, __ATOMIC_RELEASE);
+        dr_event_signal(offload_workers[i].wake);
+    }
+    do {
+        all_done = true;
+        for (uint i = 0; i < config.offload_threads; i++)
+            all_done = all_done && __atomic_load_n(&offload_workers[i].done, __ATOMIC_ACQUIRE);
+        if (!all_done)
+            dr_sleep(1);
+    } while (!all_done && get_timestamp() - t0 < OFFLOAD_DRAIN_TIMEOUT_US);
+    if (!all_done)
+        return;
+
+    for (uint i = 0; i < config.offload_threads; i++) {
+        dr_mutex_destroy(offload_workers[i].mutex);
+        dr_event_destroy(offload_workers[i].wake);
+    }
+    dr_global_free(offload_workers, sizeof(offload_worker_t) * config.offload_threads);
+    offload_workers = NULL;
+}
+
+/* Queue the thread's filled buffer for its worker and, with refill, go on
+ * in a free one, waiting for one to be returned if all are queued
+ * (backpressure). Without refill (thread exit) no buffer is left to fill.
+ */
+static void
+offload_buffer(per_thread_t *data, bool refill)
+{
+    offload_worker_t *w = (offload_worker_t *)data->worker;
+    pool_buf_t *b = data->cur_buf;
+    size_t n = (size_t)((memref_t *)data->buf_ptr - (memref_t *)data->buf_base);
+
+    if (n == 0)
+        return;
+    b->len = n;
+    b->stamp = get_timestamp();
+    /* classify now: by the time the worker gets to the buffer, its ranges
+       may have been unmapped or reused */
+    if (data->ref_regions) {
+        region_map_lookup_batch(regions, (const memref_t *)b->data, n,
+                                (uint8_t *)b->data + mem_buf_size);
+    }
+    /* never full: the ring has a slot for every buffer of the pool */
+    spsc_ring_push(data->full_ring, b);
+    data->handed_off++;
+    uint64 depth = spsc_ring_size(data->full_ring);
+    if (depth > data->offload_max_depth)
+        data->offload_max_depth = depth;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->dead, __ATOMIC_ACQUIRE))
+        offload_analyze(data);      /* nobody else will */
+    else if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED))
+        dr_event_signal(w->wake);
+
+    b = NULL;
+    if (refill && (b = buf_pool_get(data->pool)) == NULL) {
+        uint64 t0 = get_timestamp();
+        data->offload_stalls++;
+        while ((b = buf_pool_get(data->pool)) == NULL) {
+            /* help out when the worker is busy with other threads */
+            if (offload_analyze(data) == 0)
+                dr_thread_yield();
+        }
+        data->offload_stall_us += get_timestamp() - t0;
+    }
+    data->cur_buf = b;
+    if (b != NULL) {
+        data->buf_base = (char *)b->data;
+        data->buf_end = -(ptr_int_t)(data->buf_base + mem_buf_size);
+    }
+    data->buf_ptr = data->buf_base;
+}
+
+/* Wait until every buffer the thread queued is analyzed, analyzing them
+ * itself when its worker is busy elsewhere. Returns false, with buffers
+ * still queued, if the worker holds the thread without progress: after
+ * OFFLOAD_DRAIN_TIMEOUT_US, which marks it stalled, or at once once it is.
+ */
+static bool
+offload_drain(per_thread_t *data)
+{
+    offload_worker_t *w = (offload_worker_t *)data->worker;
+    uint64 last = __atomic_load_n(&data->analyzed, __ATOMIC_ACQUIRE);
+    uint64 since = get_timestamp();
+
+    for (;;) {
+        offload_analyze(data);
+        uint64 done = __atomic_load_n(&data->analyzed, __ATOMIC_ACQUIRE);
+        if (done == data->handed_off)
+            return true;
+        if (done != last) {
+            last = done;
+            since = get_timestamp();
+        } else if (__atomic_load_n(&w->dead, __ATOMIC_ACQUIRE)) {
+            return false;
+        } else if (get_timestamp() - since > OFFLOAD_DRAIN_TIMEOUT_US) {
+            offload_worker_stalled(w);
+            return false;
+        }
+        dr_thread_yield();
+    }
+}
+
+/* Take the thread off its worker's list. Sweeps only reach a thread under
+ * the worker's mutex, so once this returns true no worker touches the
+ * thread again and its queue is left to the thread. A worker suspended
+ * mid-sweep (process exit) holds the mutex for good: returns false after
+ * OFFLOAD_DRAIN_TIMEOUT_US, which marks it stalled, or at once once it is.
+ */
+static bool
+offload_leave(per_thread_t *data)
+{
+    offload_worker_t *w = (offload_worker_t *)data->worker;
+    uint64 t0 = get_timestamp();
+
+    while (!dr_mutex_trylock(w->mutex)) {
+        if (__atomic_load_n(&w->dead, __ATOMIC_ACQUIRE))
+            return false;
+        if (get_timestamp() - t0 > OFFLOAD_DRAIN_TIMEOUT_US) {
+            offload_worker_stalled(w);
+            return false;
+        }
+        dr_thread_yield();
+    }
+    if (data->prev_offload != NULL)
+        ((per_thread_t *)data->prev_offload)->next_offload = data->next_offload;
+    else
+        w->threads = data->next_offload;
+    if (data->next_offload != NULL)
+        ((per_thread_t *)data->next_offload)->prev_offload = data->prev_offload;
+    dr_mutex_unlock(w->mutex);
+    return true;
+}
+
+static void 
+memtrace(void *drcontext)
+{
+    per_thread_t *data = drmgr_get_tls_field(drcontext, tls_index);
+
+    if (data->pool) {
+        offload_buffer(data, true);
+        return;
+    }
+    analyze_buffer(data, (const memref_t *)data->buf_base,
+                   (size_t)((memref_t *)data->buf_ptr - (memref_t *)data->buf_base),
+                   get_timestamp(), NULL);
+    /* Only [buf_base, buf_ptr) is ever read, so the buffer is reused as is */
     data->buf_ptr = data->buf_base;
 }
 
@@ -1192,6 +3346,69 @@ code_cache_exit(void)
     dr_nonheap_free(code_cache, page_size);
 }
 
+/*
+ * instrument_instr_count adds a block's instruction count to the thread's
+ * num_instrs with one add to memory:
+ *   tls->num_instrs += num_instrs;
+ */
+static void
+instrument_instr_count(void *drcontext, instrlist_t *ilist, instr_t *where, uint num_instrs)
+{
+    reg_id_t reg;
+
+    if (drreg_reserve_aflags(drcontext, ilist, where) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, ilist, where, NULL, &reg) != DRREG_SUCCESS) {
+        DR_ASSERT(false); /* cannot recover */
+        return;
+    }
+
+    drmgr_insert_read_tls_field(drcontext, tls_index, ilist, where, reg);
+    instrlist_meta_preinsert(ilist, where,
+        INSTR_CREATE_add(drcontext,
+                         OPND_CREATE_MEM64(reg, offsetof(per_thread_t, num_instrs)),
+                         OPND_CREATE_INT32(num_instrs)));
+
+    if (drreg_unreserve_register(drcontext, ilist, where, reg) != DRREG_SUCCESS ||
+        drreg_unreserve_aflags(drcontext, ilist, where) != DRREG_SUCCESS)
+        DR_ASSERT(false);
+}
+
+/*
+ * instrument_countdown charges a block's units to a per-thread countdown
+ * (the burst period, the ROI window check) and calls callee when they run
+ * out:
+ *   *(int64 *)((byte *)tls + offset) -= units;
+ *   if (*(int64 *)((byte *)tls + offset) <= 0)
+ *      callee();
+ */
+static void
+instrument_countdown(void *drcontext, instrlist_t *ilist, instr_t *where, int offset,
+                     uint units, void *callee)
+{
+    instr_t *skip = INSTR_CREATE_label(drcontext);
+    reg_id_t reg;
+
+    if (drreg_reserve_aflags(drcontext, ilist, where) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, ilist, where, NULL, &reg) != DRREG_SUCCESS) {
+        DR_ASSERT(false); /* cannot recover */
+        instr_destroy(drcontext, skip);
+        return;
+    }
+
+    drmgr_insert_read_tls_field(drcontext, tls_index, ilist, where, reg);
+    instrlist_meta_preinsert(ilist, where,
+        INSTR_CREATE_sub(drcontext, OPND_CREATE_MEM64(reg, offset),
+                         OPND_CREATE_INT32(units)));
+    instrlist_meta_preinsert(ilist, where,
+        INSTR_CREATE_jcc(drcontext, OP_jg, opnd_create_instr(skip)));
+    dr_insert_clean_call(drcontext, ilist, where, callee, false, 0);
+    instrlist_meta_preinsert(ilist, where, skip);
+
+    if (drreg_unreserve_register(drcontext, ilist, where, reg) != DRREG_SUCCESS ||
+        drreg_unreserve_aflags(drcontext, ilist, where) != DRREG_SUCCESS)
+        DR_ASSERT(false);
+}
+
 /*
  * instrument_mem is called whenever a memory reference is identified.
  * It inserts code before the memory reference to to fill the memory buffer
@@ -1205,6 +3422,8 @@ instrument_mem(void *drcontext, instrlist_t *ilist, instr_t *where, app_pc pc,
     opnd_t ref, opnd1, opnd2;
     reg_id_t reg1, reg2;
     drvector_t allowed;
+    uint size;
+    uint64 info;
 
     /* Steal two scratch registers.
      * reg2 must be ECX or RCX for jecxz.
@@ -1229,10 +3448,8 @@ instrument_mem(void *drcontext, instrlist_t *ilist, instr_t *where, app_pc pc,
     drutil_insert_get_mem_addr(drcontext, ilist, where, ref, reg1, reg2);
 
     /* The following assembly performs the following instructions
-     * buf_ptr->write = write;
      * buf_ptr->addr  = addr;
-     * buf_ptr->size  = size;
-     * buf_ptr->pc    = pc;
+     * buf_ptr->info  = write | size | pc;   (an immediate)
      * buf_ptr++;
      * if (buf_ptr >= buf_end_ptr)
      *    clean_call();
@@ -1243,37 +3460,27 @@ instrument_mem(void *drcontext, instrlist_t *ilist, instr_t *where, app_pc pc,
     instr = INSTR_CREATE_mov_ld(drcontext, opnd1, opnd2);
     instrlist_meta_preinsert(ilist, where, instr);
 
-    /* Move write/read to write field */
-    opnd1 = OPND_CREATE_MEM32(reg2, offsetof(mem_ref_t, write));
-    opnd2 = OPND_CREATE_INT32(write);
-    instr = INSTR_CREATE_mov_imm(drcontext, opnd1, opnd2);
-    instrlist_meta_preinsert(ilist, where, instr);
-
     /* Store address in memory ref */
-    opnd1 = OPND_CREATE_MEMPTR(reg2, offsetof(mem_ref_t, addr));
+    opnd1 = OPND_CREATE_MEMPTR(reg2, offsetof(memref_t, addr));
     opnd2 = opnd_create_reg(reg1);
     instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
     instrlist_meta_preinsert(ilist, where, instr);
 
-    /* Store size in memory ref */
-    opnd1 = OPND_CREATE_MEMPTR(reg2, offsetof(mem_ref_t, size));
+    /* Store pc, size and type in memory ref */
     /* drutil_opnd_mem_size_in_bytes handles OP_enter */
-    opnd2 = OPND_CREATE_INT32(drutil_opnd_mem_size_in_bytes(ref, memref_instr));
-    instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
-    instrlist_meta_preinsert(ilist, where, instr);
-
-    /* Store pc in memory ref */
-    /* For 64-bit, we can't use a 64-bit immediate so we split pc into two halves.
+    size = drutil_opnd_mem_size_in_bytes(ref, memref_instr);
+    info = memref_info((uint64)(ptr_uint_t)pc, size, write);
+    /* For 64-bit, we can't use a 64-bit immediate so we split info into two halves.
      * We could alternatively load it into reg1 and then store reg1.
      * We use a convenience routine that does the two-step store for us.
      */
-    opnd1 = OPND_CREATE_MEMPTR(reg2, offsetof(mem_ref_t, pc));
-    instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t)pc, opnd1, ilist, where, NULL,
+    opnd1 = OPND_CREATE_MEMPTR(reg2, offsetof(memref_t, info));
+    instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t)info, opnd1, ilist, where, NULL,
                                      NULL);
 
     /* Increment reg value by pointer size using lea instr */
     opnd1 = opnd_create_reg(reg2);
-    opnd2 = opnd_create_base_disp(reg2, DR_REG_NULL, 0, sizeof(mem_ref_t), OPSZ_lea);
+    opnd2 = opnd_create_base_disp(reg2, DR_REG_NULL, 0, sizeof(memref_t), OPSZ_lea);
     instr = INSTR_CREATE_lea(drcontext, opnd1, opnd2);
     instrlist_meta_preinsert(ilist, where, instr);
 
@@ -1334,87 +3541,3 @@ instrument_mem(void *drcontext, instrlist_t *ilist, instr_t *where, app_pc pc,
         drreg_unreserve_register(drcontext, ilist, where, reg2) != DRREG_SUCCESS)
         DR_ASSERT(false);
 }
-
-/* 
- * Direct instrumentation that calls our trace function immediately
- * instead of using the buffer system - much simpler and avoids buffer overflow
- */
-
-static void
-instrument_mem_direct(void *drcontext, instrlist_t *ilist, instr_t *where,
-                      app_pc pc, instr_t *memref_instr, int pos, bool write)
-{
-    reg_id_t reg_addr, reg_tmp;
-    opnd_t ref;
-
-    if (write)
-        ref = instr_get_dst(memref_instr, pos);
-    else
-        ref = instr_get_src(memref_instr, pos);
-
-    /* Reserve TWO registers */
-    if (drreg_reserve_register(drcontext, ilist, where, NULL, &reg_addr) != DRREG_SUCCESS ||
-        drreg_reserve_register(drcontext, ilist, where, NULL, &reg_tmp) != DRREG_SUCCESS) {
-        DR_ASSERT(false);
-        return;
-    }
-
-    /* Use both registers */
-    if (!drutil_insert_get_mem_addr(drcontext, ilist, where, ref,
-                                    reg_addr, reg_tmp)) {
-        DR_ASSERT(false);
-        drreg_unreserve_register(drcontext, ilist, where, reg_tmp);
-        drreg_unreserve_register(drcontext, ilist, where, reg_addr);
-        return;
-    }
-
-    dr_insert_clean_call(drcontext, ilist, where,
-                         (void *)direct_trace_write,
-                         false, 4,
-                         opnd_create_reg(reg_addr),
-                         OPND_CREATE_INT32(write),
-                         OPND_CREATE_INT32(
-                             drutil_opnd_mem_size_in_bytes(ref, memref_instr)),
-                         OPND_CREATE_INTPTR(pc));
-
-    drreg_unreserve_register(drcontext, ilist, where, reg_tmp);
-    drreg_unreserve_register(drcontext, ilist, where, reg_addr);
-}
-
-// static void
-// instrument_mem_direct(void *drcontext, instrlist_t *ilist, instr_t *where, app_pc pc,
-//                      instr_t *memref_instr, int pos, bool write)
-// {
-//     reg_id_t reg1;
-//     opnd_t ref;
-    
-//     if (write)
-//         ref = instr_get_dst(memref_instr, pos);
-//     else
-//         ref = instr_get_src(memref_instr, pos);
-
-//     /* Reserve a register for address computation */
-//     if (drreg_reserve_register(drcontext, ilist, where, NULL, &reg1) != DRREG_SUCCESS) {
-//         DR_ASSERT(false);
-//         return;
-//     }
-
-//     /* Get memory address into register */
-//     if (!drutil_insert_get_mem_addr(drcontext, ilist, where, ref, reg1, DR_REG_NULL)) {
-//         DR_ASSERT(false);
-//         drreg_unreserve_register(drcontext, ilist, where, reg1);
-//         return;
-//     }
-
-//     /* Insert a clean call to our direct trace function */
-//     dr_insert_clean_call(drcontext, ilist, where, (void *)direct_trace_write, 
-//                         false, 4,
-//                         opnd_create_reg(reg1),                 /* addr in register */
-//                         OPND_CREATE_INT32(write),              /* write flag */
-//                         OPND_CREATE_INT32(drutil_opnd_mem_size_in_bytes(ref, memref_instr)), /* size */
-//                         OPND_CREATE_INTPTR(pc));               /* pc */
-
-//     /* Restore register */
-//     if (drreg_unreserve_register(drcontext, ilist, where, reg1) != DRREG_SUCCESS)
-//         DR_ASSERT(false);
-// }
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef MEMCOUNT_ROI_H
+#define MEMCOUNT_ROI_H
+
+/*
+ * Region-of-interest markers for the memcount client.
+ *
+ * With roi_annotations=true in memcount_config.txt, memcount instruments
+ * only the code run between a call to memcount_roi_begin() and the next
+ * call to memcount_roi_end(), in any thread. Outside memcount the calls do
+ * nothing. memcount finds the markers by name, so keep the symbol table
+ * (do not strip the binary) or export them (-rdynamic).
+ *
+ *   #include "memcount_roi.h"
+ *   ...
+ *   setup();
+ *   memcount_roi_begin();
+ *   kernel();
+ *   memcount_roi_end();
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Weak, so that every translation unit may include this header; never
+   inlined, so that the calls stay in the binary for memcount to see */
+__attribute__((weak, noinline, used)) void memcount_roi_begin(void) {
+    __asm__ __volatile__("" ::: "memory");
+}
+
+__attribute__((weak, noinline, used)) void memcount_roi_end(void) {
+    __asm__ __volatile__("" ::: "memory");
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEMCOUNT_ROI_H */
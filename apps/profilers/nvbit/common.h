@@ -38,6 +38,7 @@
 extern "C" {
 #include "ws_tsearch.h"
 }
+#include "hllpp.h"
 
 /* Cache line size for WSS calculation (64 bytes) */
 #define CACHE_LINE_SIZE 64
@@ -54,6 +55,11 @@ static int access_word_size = -1;
 static ws_ctx_t *global_ws_ctx = NULL;
 static pthread_mutex_t ws_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* Approximate WSS (HLL++), updated a warp of addresses at a time under ws_mutex */
+#define WSS_HLL_BITS 14
+static hllpp_t global_hll;
+static bool global_hll_ok = false;
+
 /* information collected in the instrumentation function and passed
  * on the channel from the GPU to the CPU */
 typedef struct {
@@ -53,6 +53,9 @@
 /* contains definition of the mem_access_t structure */
 #include "common.h"
 
+/* trace file output off the receiver thread */
+#include "async_writer.h"
+
 #define HEX(x)                                                            \
     "0x" << std::setfill('0') << std::setw(16) << std::hex << (uint64_t)x \
          << std::dec
@@ -135,6 +138,7 @@ void nvbit_at_init() {
     if (!global_ws_ctx) {
         fprintf(stderr, "Error: Failed to create working set context\n");
     }
+    global_hll_ok = (hllpp_init(&global_hll, WSS_HLL_BITS) == 0);
 }
 
 /* Set used to avoid re-instrumenting the same functions multiple times */
@@ -494,10 +498,12 @@ void* recv_thread_fun(void* args) {
     pthread_mutex_unlock(&mutex);
     char* recv_buffer = (char*)malloc(CHANNEL_SIZE);
 
-    /* Open a file to write the memory traces if enabled */
-    FILE* trace_file = NULL;
+    /* Open a file to write the memory traces if enabled; lines are formatted
+     * here and written by the async writer's I/O thread, so the receiver
+     * keeps draining the channel while the disk catches up */
+    async_writer_t* trace_file = NULL;
     if (trace_enable) {
-        trace_file = fopen("traces.txt", "w");
+        trace_file = aw_open("traces.txt", NULL);
         if (!trace_file) {
             fprintf(stderr, "Error opening traces.txt for writing!\n");
         }
@@ -521,43 +527,55 @@ void* recv_thread_fun(void* args) {
                 }
 
                 // Record address data using ws_tsearch for exact WSS
+                uint64_t line_keys[32];
+                int num_keys = 0;
                 for (int i = 0; i < 32; i++) {
                     uint64_t addr = ma->addrs[i];
                     if (addr != 0) {
                         /* Align address to cache line for WSS calculation */
-                        uintptr_t cache_line_key = addr & CACHE_LINE_MASK;
-
-                        /* Thread-safe recording of unique cache lines */
-                        pthread_mutex_lock(&ws_mutex);
-                        ws_record(global_ws_ctx, cache_line_key);
-                        pthread_mutex_unlock(&ws_mutex);
+                        line_keys[num_keys++] = addr & CACHE_LINE_MASK;
 
                         if (ma->load_count > 0) global_read_freq[addr]++;
                         if (ma->store_count > 0) global_write_freq[addr]++;
                     }
                 }
 
+                /* Thread-safe recording of unique cache lines, one lock per warp */
+                if (num_keys > 0) {
+                    pthread_mutex_lock(&ws_mutex);
+                    for (int i = 0; i < num_keys; i++) {
+                        ws_record(global_ws_ctx, line_keys[i]);
+                    }
+                    if (global_hll_ok) {
+                        hllpp_add_u64_batch(&global_hll, line_keys, num_keys);
+                    }
+                    pthread_mutex_unlock(&ws_mutex);
+                }
+
                 /* Write trace data to file if enabled */
                 if (trace_file) {
-                    fprintf(trace_file, "CTX 0x%lx - grid_launch_id %ld - CTA %d,%d,%d - warp %d - %s - ",
+                    char line[1024];
+                    int len = snprintf(line, sizeof(line),
+                            "CTX 0x%lx - grid_launch_id %ld - CTA %d,%d,%d - warp %d - %s - ",
                             (uint64_t)ctx, ma->grid_launch_id, ma->cta_id_x, ma->cta_id_y, ma->cta_id_z,
                             ma->warp_id, id_to_opcode_map[ma->opcode_id].c_str());
+                    if (len < 0 || len > (int)sizeof(line) - 32 * 19 - 2) {
+                        len = 0;    /* opcode name too long to fit: skip the prefix */
+                    }
                     for (int i = 0; i < 32; i++) {
-                        fprintf(trace_file, "0x%016lx ", ma->addrs[i]);
+                        len += snprintf(line + len, sizeof(line) - len, "0x%016lx ", ma->addrs[i]);
                     }
-                    fprintf(trace_file, "\n");
+                    line[len++] = '\n';
+                    aw_write(trace_file, line, len);
                 }
 
                 num_processed_bytes += sizeof(mem_access_t);
             }
-            if (trace_file) {
-                fflush(trace_file);
-            }
         }
     }
 
     if (trace_file) {
-        fclose(trace_file);
+        aw_close(trace_file);
     }
     free(recv_buffer);
     ctx_state->recv_thread_done = RecvThreadState::FINISHED;
@@ -649,6 +667,9 @@ void nvbit_at_ctx_term(CUcontext ctx) {
 	fprintf(stat_file, "Access Word Size (bytes):    %d\n", access_word_size);
 	fprintf(stat_file, "Total Address Events:        %lu\n", ws_stats.total);
 	fprintf(stat_file, "Single-Access Lines:         %lu\n", ws_stats.singles);
+	if (global_hll_ok) {
+	    fprintf(stat_file, "HLL WSS Estimate (lines):    %.0f\n", hllpp_count(&global_hll));
+	}
 	fclose(stat_file);
     }
 
@@ -657,6 +678,10 @@ void nvbit_at_ctx_term(CUcontext ctx) {
         ws_destroy(global_ws_ctx);
         global_ws_ctx = NULL;
     }
+    if (global_hll_ok) {
+        hllpp_destroy(&global_hll);
+        global_hll_ok = false;
+    }
 
 }
 
@@ -24,8 +24,14 @@ import os
 import argparse
 import json
 import csv
+import struct
 from pathlib import Path
 
+try:
+    import numpy as np
+except ImportError:
+    np = None
+
 # Add the common/proto directory to path to import generated protobuf code
 SCRIPT_DIR = Path(__file__).parent
 PROTO_DIR = SCRIPT_DIR.parent / "profilers" / "common" / "proto"
@@ -40,6 +46,26 @@ except ImportError as e:
     print(f"Please run: cd {PROTO_DIR} && protoc --python_out=. timeseries_metrics.proto", file=sys.stderr)
     sys.exit(1)
 
+# File magic of the header-once format (format_version 2)
+TS_MAGIC = b"MSTS"
+
+# Size bin labels of the legacy per-bin SampleWindow fields
+LEGACY_SIZE_BINS = ('1', '2', '4', '8', '16', '32', '64', 'other')
+
+SCALAR_FIELDS = ('window_number', 'thread_id', 'read_count', 'write_count', 'total_refs',
+                 'wss_exact', 'wss_approx', 'timestamp',
+                 'wss_page_exact', 'wss_page_approx', 'wss_huge_page_exact', 'wss_huge_page_approx',
+                 'l1_hits', 'l1_misses', 'l2_hits', 'l2_misses', 'llc_hits', 'llc_misses')
+
+# Simulated cache levels, as '<level>_hits' / '<level>_misses' fields
+CACHE_LEVELS = ('l1', 'l2', 'llc')
+
+# Per-region repeated fields, one entry per header regions label
+REGION_FIELDS = ('reads', 'writes', 'bytes', 'wss')
+
+# Scalar fields holding estimates rather than counts
+APPROX_FIELDS = ('wss_approx', 'wss_page_approx', 'wss_huge_page_approx', 'region_wss')
+
 
 class TimeSeriesParser:
     """Parser for protobuf time-series data files"""
@@ -53,14 +79,18 @@ class TimeSeriesParser:
         """
         self.pb_file = pb_file
         self.data = None
+        self.size_bins = list(LEGACY_SIZE_BINS)
+        self.regions = []
         self._load()
 
     def _load(self):
-        """Load and parse the protobuf file (supports both single-message and length-delimited formats)"""
+        """Load and parse the protobuf file (header/batch format, or legacy length-delimited / single-message)"""
         if not os.path.exists(self.pb_file):
             raise FileNotFoundError(f"Protobuf file not found: {self.pb_file}")
 
         self.data = ts_pb.TimeSeriesData()
+        self.size_bins = list(LEGACY_SIZE_BINS)
+        self.regions = []
 
         try:
             with open(self.pb_file, 'rb') as f:
@@ -70,7 +100,12 @@ class TimeSeriesParser:
                 if len(file_content) == 0:
                     raise ValueError("File is empty (0 bytes)")
 
-                # Try parsing as length-delimited format first (new format with periodic flushing)
+                # Header-once format: magic, header, sample batches, trailer
+                if file_content[:len(TS_MAGIC)] == TS_MAGIC:
+                    self._parse_records(file_content, len(TS_MAGIC))
+                    return
+
+                # Try parsing as length-delimited format (periodic TimeSeriesData flushes)
                 if self._try_parse_length_delimited(file_content):
                     return
 
@@ -80,39 +115,57 @@ class TimeSeriesParser:
         except Exception as e:
             raise ValueError(f"Failed to parse protobuf file: {e}")
 
+    @staticmethod
+    def _iter_length_delimited(content, offset=0):
+        """Yield the payloads of 4-byte length-prefixed messages starting at offset"""
+        end = len(content)
+        while offset < end:
+            if offset + 4 > end:
+                raise ValueError(f"Truncated length prefix at offset {offset}")
+            msg_size = struct.unpack_from('<I', content, offset)[0]
+            offset += 4
+            if offset + msg_size > end:
+                raise ValueError(f"Truncated message at offset {offset}")
+            yield content[offset:offset + msg_size]
+            offset += msg_size
+
+    def _parse_records(self, content, offset):
+        """Parse a header-once file of TimeSeriesRecord messages"""
+        record = ts_pb.TimeSeriesRecord()
+        trailer = None
+
+        for msg_data in self._iter_length_delimited(content, offset):
+            record.ParseFromString(msg_data)
+            kind = record.WhichOneof('record')
+            if kind == 'batch':
+                self.data.samples.extend(record.batch.samples)
+            elif kind == 'header':
+                self.data.metadata.CopyFrom(record.header.metadata)
+                if record.header.size_bins:
+                    self.size_bins = list(record.header.size_bins)
+                self.regions = list(record.header.regions)
+            elif kind == 'trailer':
+                trailer = ts_pb.TimeSeriesTrailer()
+                trailer.CopyFrom(record.trailer)
+
+        # The trailer is missing if the profiler did not exit cleanly
+        if trailer is not None:
+            self.data.metadata.num_threads = trailer.num_threads
+
     def _try_parse_length_delimited(self, content):
         """
         Try to parse length-delimited format where each message is prefixed with 4-byte length.
         Returns True if successful, False otherwise.
         """
-        import struct
-
         try:
-            offset = 0
-            all_samples = []
             metadata = None
+            samples = ts_pb.TimeSeriesData().samples
 
-            while offset < len(content):
-                # Read 4-byte message length
-                if offset + 4 > len(content):
-                    # Not enough bytes for length prefix
-                    return False
-
-                msg_size = struct.unpack('<I', content[offset:offset+4])[0]
-                offset += 4
-
+            for msg_data in self._iter_length_delimited(content):
                 # Check if message size is reasonable (< 1GB)
-                if msg_size == 0 or msg_size > 1024*1024*1024:
+                if len(msg_data) == 0 or len(msg_data) > 1024*1024*1024:
                     return False
 
-                # Read the message
-                if offset + msg_size > len(content):
-                    # Not enough bytes for message
-                    return False
-
-                msg_data = content[offset:offset+msg_size]
-                offset += msg_size
-
                 # Parse this chunk
                 chunk = ts_pb.TimeSeriesData()
                 chunk.ParseFromString(msg_data)
@@ -122,16 +175,12 @@ class TimeSeriesParser:
                     metadata = chunk.metadata
 
                 # Collect all samples
-                all_samples.extend(chunk.samples)
+                samples.extend(chunk.samples)
 
             # If we successfully parsed all chunks, reconstruct the data
             if metadata:
                 self.data.metadata.CopyFrom(metadata)
-
-            # Add all collected samples
-            for sample in all_samples:
-                new_sample = self.data.samples.add()
-                new_sample.CopyFrom(sample)
+            self.data.samples.extend(samples)
 
             return True
 
@@ -139,6 +188,29 @@ class TimeSeriesParser:
             # If anything fails, return False to try single-message format
             return False
 
+    def _size_histograms(self, sample):
+        """Return (read, write) size histograms as {bin label: count}"""
+        if len(sample.read_size_hist) or len(sample.write_size_hist):
+            reads = dict(zip(self.size_bins, sample.read_size_hist))
+            writes = dict(zip(self.size_bins, sample.write_size_hist))
+        else:
+            # Legacy per-bin fields
+            reads = {b: getattr(sample, f'read_size_{b}') for b in LEGACY_SIZE_BINS}
+            writes = {b: getattr(sample, f'write_size_{b}') for b in LEGACY_SIZE_BINS}
+        return reads, writes
+
+    def _regions(self, sample):
+        """Return {region label: {'reads', 'writes', 'bytes', 'wss'}}, empty when not classified"""
+        if not len(sample.region_reads):
+            return {}
+        columns = [getattr(sample, 'region_' + f) for f in REGION_FIELDS]
+        return {name: dict(zip(REGION_FIELDS, values))
+                for name, *values in zip(self.regions, *columns)}
+
+    def _classified(self, samples):
+        """Whether any sample carries per-region counts"""
+        return bool(self.regions) and any(len(s.region_reads) for s in samples)
+
     def to_dict(self):
         """
         Convert protobuf data to Python dictionary
@@ -154,12 +226,15 @@ class TimeSeriesParser:
                 'command': self.data.metadata.command,
                 'sample_window_refs': self.data.metadata.sample_window_refs,
                 'cache_line_size': self.data.metadata.cache_line_size,
-                'num_threads': self.data.metadata.num_threads
+                'num_threads': self.data.metadata.num_threads,
+                'page_size': self.data.metadata.page_size,
+                'huge_page_size': self.data.metadata.huge_page_size
             },
             'samples': []
         }
 
         for sample in self.data.samples:
+            reads, writes = self._size_histograms(sample)
             result['samples'].append({
                 'window_number': sample.window_number,
                 'thread_id': sample.thread_id,
@@ -169,30 +244,50 @@ class TimeSeriesParser:
                 'wss_exact': sample.wss_exact,
                 'wss_approx': sample.wss_approx,
                 'timestamp': sample.timestamp,
-                'read_size_histogram': {
-                    '1': sample.read_size_1,
-                    '2': sample.read_size_2,
-                    '4': sample.read_size_4,
-                    '8': sample.read_size_8,
-                    '16': sample.read_size_16,
-                    '32': sample.read_size_32,
-                    '64': sample.read_size_64,
-                    'other': sample.read_size_other
-                },
-                'write_size_histogram': {
-                    '1': sample.write_size_1,
-                    '2': sample.write_size_2,
-                    '4': sample.write_size_4,
-                    '8': sample.write_size_8,
-                    '16': sample.write_size_16,
-                    '32': sample.write_size_32,
-                    '64': sample.write_size_64,
-                    'other': sample.write_size_other
-                }
+                'wss_page_exact': sample.wss_page_exact,
+                'wss_page_approx': sample.wss_page_approx,
+                'wss_huge_page_exact': sample.wss_huge_page_exact,
+                'wss_huge_page_approx': sample.wss_huge_page_approx,
+                'l1_hits': sample.l1_hits,
+                'l1_misses': sample.l1_misses,
+                'l2_hits': sample.l2_hits,
+                'l2_misses': sample.l2_misses,
+                'llc_hits': sample.llc_hits,
+                'llc_misses': sample.llc_misses,
+                'read_size_histogram': reads,
+                'write_size_histogram': writes,
+                'regions': self._regions(sample)
             })
 
         return result
 
+    def to_columns(self):
+        """
+        Convert samples to columns, one array per field
+
+        Cheaper than to_dict() for plotting large runs. Histograms are
+        2-D (samples x size bins) with bins ordered as in self.size_bins,
+        and so are the region_* columns (samples x self.regions) when the
+        run classified references by memory region.
+
+        Returns:
+            dict: field name -> numpy array (or list if numpy is unavailable)
+        """
+        samples = self.data.samples
+        columns = {name: [getattr(s, name) for s in samples] for name in SCALAR_FIELDS}
+        hists = [self._size_histograms(s) for s in samples]
+        columns['read_size_hist'] = [[r.get(b, 0) for b in self.size_bins] for r, _ in hists]
+        columns['write_size_hist'] = [[w.get(b, 0) for b in self.size_bins] for _, w in hists]
+        if self._classified(samples):
+            zeros = [0] * len(self.regions)
+            for f in REGION_FIELDS:
+                columns['region_' + f] = [list(getattr(s, 'region_' + f)) or zeros for s in samples]
+
+        if np is None:
+            return columns
+        return {name: np.asarray(col, dtype=np.float64 if name in APPROX_FIELDS else np.uint64)
+                for name, col in columns.items()}
+
     def to_json(self, indent=2):
         """
         Convert to JSON string
@@ -222,25 +317,27 @@ class TimeSeriesParser:
         if filter_thread is not None:
             samples = [s for s in samples if s.thread_id == filter_thread]
 
-        # CSV header
-        fieldnames = ['window_number', 'thread_id', 'read_count', 'write_count', 'total_refs',
-                     'wss_exact', 'wss_approx', 'timestamp']
+        # CSV header, with <region>_<field> columns when classified
+        fieldnames = list(SCALAR_FIELDS)
+        classified = self._classified(samples)
+        if classified:
+            fieldnames += [f'{r}_{f}' for r in self.regions for f in REGION_FIELDS]
+
+        def row(sample):
+            values = {name: getattr(sample, name) for name in SCALAR_FIELDS}
+            if classified:
+                regions = self._regions(sample)
+                for r in self.regions:
+                    for f in REGION_FIELDS:
+                        values[f'{r}_{f}'] = regions.get(r, {}).get(f, 0)
+            return values
 
         if output_file:
             with open(output_file, 'w', newline='') as csvfile:
                 writer = csv.DictWriter(csvfile, fieldnames=fieldnames)
                 writer.writeheader()
                 for sample in samples:
-                    writer.writerow({
-                        'window_number': sample.window_number,
-                        'thread_id': sample.thread_id,
-                        'read_count': sample.read_count,
-                        'write_count': sample.write_count,
-                        'total_refs': sample.total_refs,
-                        'wss_exact': sample.wss_exact,
-                        'wss_approx': sample.wss_approx,
-                        'timestamp': sample.timestamp
-                    })
+                    writer.writerow(row(sample))
         else:
             # Return as string
             import io
@@ -248,16 +345,7 @@ class TimeSeriesParser:
             writer = csv.DictWriter(output, fieldnames=fieldnames)
             writer.writeheader()
             for sample in samples:
-                writer.writerow({
-                    'window_number': sample.window_number,
-                    'thread_id': sample.thread_id,
-                    'read_count': sample.read_count,
-                    'write_count': sample.write_count,
-                    'total_refs': sample.total_refs,
-                    'wss_exact': sample.wss_exact,
-                    'wss_approx': sample.wss_approx,
-                    'timestamp': sample.timestamp
-                })
+                writer.writerow(row(sample))
             return output.getvalue()
 
     def get_summary(self):
@@ -274,6 +362,23 @@ class TimeSeriesParser:
         total_writes = sum(s.write_count for s in self.data.samples)
         threads = set(s.thread_id for s in self.data.samples)
 
+        # Miss ratio per simulated cache level, None when not simulated
+        miss_ratios = {}
+        for level in CACHE_LEVELS:
+            hits = sum(getattr(s, level + '_hits') for s in self.data.samples)
+            misses = sum(getattr(s, level + '_misses') for s in self.data.samples)
+            miss_ratios[level + '_miss_ratio'] = misses / (hits + misses) if hits + misses else None
+
+        # Totals per memory region and its largest window WSS, empty when not classified
+        regions = {}
+        for sample in self.data.samples:
+            for name, v in self._regions(sample).items():
+                t = regions.setdefault(name, {'reads': 0, 'writes': 0, 'bytes': 0, 'max_wss': 0.0})
+                t['reads'] += v['reads']
+                t['writes'] += v['writes']
+                t['bytes'] += v['bytes']
+                t['max_wss'] = max(t['max_wss'], v['wss'])
+
         return {
             'profiler': self.data.metadata.profiler,
             'pid': self.data.metadata.pid,
@@ -288,7 +393,11 @@ class TimeSeriesParser:
             'avg_wss_exact': sum(s.wss_exact for s in self.data.samples) / len(self.data.samples),
             'avg_wss_approx': sum(s.wss_approx for s in self.data.samples) / len(self.data.samples),
             'max_wss_exact': max(s.wss_exact for s in self.data.samples),
-            'max_wss_approx': max(s.wss_approx for s in self.data.samples)
+            'max_wss_approx': max(s.wss_approx for s in self.data.samples),
+            'max_wss_page_exact': max(s.wss_page_exact for s in self.data.samples),
+            'max_wss_huge_page_exact': max(s.wss_huge_page_exact for s in self.data.samples),
+            **miss_ratios,
+            'regions': regions
         }
 
     def filter_by_thread(self, thread_id):
@@ -43,6 +43,33 @@ except ImportError as e:
     sys.exit(1)
 
 
+def iter_trace_chunks(pb_file):
+    """
+    Stream a length-delimited trace file one MemoryTrace chunk at a time,
+    without loading the whole file.
+
+    Args:
+        pb_file (str): Path to .pb file
+
+    Yields:
+        MemoryTrace: One chunk (a batch of events) per message
+    """
+    import struct
+
+    with open(pb_file, 'rb') as f:
+        while True:
+            header = f.read(4)
+            if len(header) < 4:
+                return
+            msg_size = struct.unpack('<I', header)[0]
+            msg_data = f.read(msg_size)
+            if len(msg_data) < msg_size:
+                return  # truncated tail (writer still running or killed)
+            chunk = trace_pb.MemoryTrace()
+            chunk.ParseFromString(msg_data)
+            yield chunk
+
+
 class MemoryTraceParser:
     """Parser for protobuf memory trace files"""
 
@@ -91,7 +118,7 @@ class MemoryTraceParser:
 
         try:
             offset = 0
-            all_events = []
+            all_chunks = []
 
             while offset < len(content):
                 # Read 4-byte message length
@@ -119,12 +146,11 @@ class MemoryTraceParser:
                 chunk.ParseFromString(msg_data)
 
                 # Collect all events
-                all_events.extend(chunk.events)
+                all_chunks.append(chunk.events)
 
             # Add all collected events to the trace
-            for event in all_events:
-                new_event = self.trace.events.add()
-                new_event.CopyFrom(event)
+            for events in all_chunks:
+                self.trace.events.extend(events)
 
             return True
 
@@ -164,7 +190,9 @@ class MemoryTraceParser:
                 'thread_id': event.thread_id,
                 'address': hex(event.address),
                 'mem_op': 'WRITE' if event.mem_op == trace_pb.WRITE else 'READ',
-                'hit_miss': 'MISS' if event.hit_miss == trace_pb.MISS else 'HIT'
+                'hit_miss': 'MISS' if event.hit_miss == trace_pb.MISS else 'HIT',
+                'size': event.size,
+                'hit_level': event.hit_level
             })
 
         return result
@@ -206,7 +234,7 @@ class MemoryTraceParser:
             events = events[:limit]
 
         # CSV header
-        fieldnames = ['timestamp', 'thread_id', 'address', 'mem_op', 'hit_miss']
+        fieldnames = ['timestamp', 'thread_id', 'address', 'mem_op', 'hit_miss', 'size', 'hit_level']
 
         if output_file:
             with open(output_file, 'w', newline='') as csvfile:
@@ -218,7 +246,9 @@ class MemoryTraceParser:
                         'thread_id': event.thread_id,
                         'address': hex(event.address),
                         'mem_op': 'WRITE' if event.mem_op == trace_pb.WRITE else 'READ',
-                        'hit_miss': 'MISS' if event.hit_miss == trace_pb.MISS else 'HIT'
+                        'hit_miss': 'MISS' if event.hit_miss == trace_pb.MISS else 'HIT',
+                        'size': event.size,
+                        'hit_level': event.hit_level
                     })
         else:
             # Return as string
@@ -232,7 +262,9 @@ class MemoryTraceParser:
                     'thread_id': event.thread_id,
                     'address': hex(event.address),
                     'mem_op': 'WRITE' if event.mem_op == trace_pb.WRITE else 'READ',
-                    'hit_miss': 'MISS' if event.hit_miss == trace_pb.MISS else 'HIT'
+                    'hit_miss': 'MISS' if event.hit_miss == trace_pb.MISS else 'HIT',
+                    'size': event.size,
+                    'hit_level': event.hit_level
                 })
             return output.getvalue()
 
@@ -0,0 +1,306 @@
+#!/usr/bin/env python3
+"""
+Fast NumPy reader for protobuf memory traces
+
+Python bindings for the memory-mapped trace reader in profiler_common
+(libtrace_reader.so). Chunks are decoded in C++ straight into NumPy arrays,
+so no per-event Python objects are created, and whole traces can be decoded
+on several threads.
+
+Usage:
+    from trace_reader import TraceReader
+
+    with TraceReader('memtrace_12345.pb') as trace:
+        cols = trace.to_columns(['address', 'is_write'])
+        print(trace.num_events, cols['address'][:10])
+
+        for first_event, chunk in trace.iter_chunks(['address']):
+            ...
+
+    python trace_reader.py memtrace_12345.pb [--threads N] [--lib path]
+
+The library is looked up in $MSE_TRACE_READER_LIB, then in the common
+library's build directories. If it is not found, it is compiled from
+source into a temporary file (needs g++).
+"""
+
+import argparse
+import ctypes
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+try:
+    import numpy as np
+except ImportError:
+    print("Error: trace_reader.py requires numpy", file=sys.stderr)
+    sys.exit(1)
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+COMMON_DIR = os.path.join(SCRIPT_DIR, '..', 'profilers', 'common')
+
+TRACE_READER_NO_INDEX_FILE = 0x1
+
+# Column name -> dtype, in trace_columns_t order
+COLUMNS = (
+    ('timestamp', np.uint64),
+    ('address', np.uint64),
+    ('thread_id', np.uint32),
+    ('size', np.uint32),
+    ('is_write', np.uint8),
+    ('is_miss', np.uint8),
+)
+COLUMN_NAMES = tuple(name for name, _ in COLUMNS)
+
+
+class _Columns(ctypes.Structure):
+    _fields_ = [
+        ('timestamp', ctypes.c_void_p),
+        ('address', ctypes.c_void_p),
+        ('thread_id', ctypes.c_void_p),
+        ('size', ctypes.c_void_p),
+        ('is_write', ctypes.c_void_p),
+        ('is_miss', ctypes.c_void_p),
+    ]
+
+
+class ChunkInfo(ctypes.Structure):
+    _fields_ = [
+        ('offset', ctypes.c_uint64),
+        ('length', ctypes.c_uint32),
+        ('n_events', ctypes.c_uint32),
+        ('first_event', ctypes.c_uint64),
+    ]
+
+
+_lib = None
+
+
+def _build_shared_library():
+    """Compile libtrace_reader.so from source into a temporary file"""
+    src = os.path.join(COMMON_DIR, 'src', 'trace_reader.cpp')
+    inc = os.path.join(COMMON_DIR, 'include')
+    if not os.path.exists(src):
+        return None
+    with tempfile.NamedTemporaryFile(suffix='.so', delete=False) as tmp:
+        cmd = ['g++', '-std=c++11', '-O2', '-shared', '-fPIC', '-pthread',
+               f'-I{inc}', src, '-o', tmp.name]
+        try:
+            subprocess.run(cmd, check=True, capture_output=True)
+        except (subprocess.CalledProcessError, OSError):
+            return None
+        return tmp.name
+
+
+def _load_library(lib_path=None):
+    global _lib
+    if _lib is not None and lib_path is None:
+        return _lib
+
+    candidates = [lib_path] if lib_path else [
+        os.environ.get('MSE_TRACE_READER_LIB'),
+        os.path.join(COMMON_DIR, 'build', 'libtrace_reader.so'),
+        os.path.join(COMMON_DIR, '_build', 'libtrace_reader.so'),
+    ]
+    lib = None
+    for path in candidates:
+        if path and os.path.exists(path):
+            lib = ctypes.CDLL(path)
+            break
+    if lib is None and not lib_path:
+        built = _build_shared_library()
+        if built:
+            lib = ctypes.CDLL(built)
+    if lib is None:
+        raise RuntimeError("Could not load libtrace_reader.so; build profilers/common "
+                           "or set MSE_TRACE_READER_LIB")
+
+    lib.trace_reader_open.argtypes = [ctypes.c_char_p, ctypes.c_uint]
+    lib.trace_reader_open.restype = ctypes.c_void_p
+    lib.trace_reader_close.argtypes = [ctypes.c_void_p]
+    lib.trace_reader_close.restype = None
+    lib.trace_reader_num_chunks.argtypes = [ctypes.c_void_p]
+    lib.trace_reader_num_chunks.restype = ctypes.c_size_t
+    lib.trace_reader_num_events.argtypes = [ctypes.c_void_p]
+    lib.trace_reader_num_events.restype = ctypes.c_uint64
+    lib.trace_reader_max_chunk_events.argtypes = [ctypes.c_void_p]
+    lib.trace_reader_max_chunk_events.restype = ctypes.c_uint32
+    lib.trace_reader_chunk_info.argtypes = [ctypes.c_void_p, ctypes.c_size_t,
+                                            ctypes.POINTER(ChunkInfo)]
+    lib.trace_reader_chunk_info.restype = ctypes.c_int
+    lib.trace_reader_decode_chunk.argtypes = [ctypes.c_void_p, ctypes.c_size_t,
+                                              ctypes.POINTER(_Columns)]
+    lib.trace_reader_decode_chunk.restype = ctypes.c_int64
+    lib.trace_reader_decode_chunks.argtypes = [ctypes.c_void_p, ctypes.c_size_t,
+                                               ctypes.c_size_t, ctypes.POINTER(_Columns),
+                                               ctypes.c_uint]
+    lib.trace_reader_decode_chunks.restype = ctypes.c_int64
+
+    if lib_path is None:
+        _lib = lib
+    return lib
+
+
+def _columns_struct(arrays):
+    cols = _Columns()
+    for name, arr in arrays.items():
+        setattr(cols, name, arr.ctypes.data)
+    return cols
+
+
+def _check_columns(columns):
+    columns = list(COLUMN_NAMES if columns is None else columns)
+    unknown = [c for c in columns if c not in COLUMN_NAMES]
+    if unknown:
+        raise ValueError(f"Unknown columns {unknown}; expected {list(COLUMN_NAMES)}")
+    return columns
+
+
+class TraceReader:
+    """Memory-mapped random-access reader for .pb memory traces"""
+
+    def __init__(self, pb_file, use_index_file=True, lib_path=None):
+        """
+        Args:
+            pb_file: Trace file (chunked or single-message layout)
+            use_index_file: Load/save the chunk index in <pb_file>.idx
+            lib_path: Explicit path to libtrace_reader.so
+        """
+        self._lib = _load_library(lib_path)
+        flags = 0 if use_index_file else TRACE_READER_NO_INDEX_FILE
+        self._reader = self._lib.trace_reader_open(os.fsencode(pb_file), flags)
+        if not self._reader:
+            raise ValueError(f"Not a readable memory trace: {pb_file}")
+        self.pb_file = pb_file
+
+    def close(self):
+        if self._reader:
+            self._lib.trace_reader_close(self._reader)
+            self._reader = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    @property
+    def num_chunks(self):
+        return self._lib.trace_reader_num_chunks(self._reader)
+
+    @property
+    def num_events(self):
+        return self._lib.trace_reader_num_events(self._reader)
+
+    def chunk_info(self, chunk):
+        info = ChunkInfo()
+        if self._lib.trace_reader_chunk_info(self._reader, chunk, ctypes.byref(info)) != 0:
+            raise IndexError(chunk)
+        return info
+
+    def to_columns(self, columns=None, first_chunk=0, num_chunks=None, threads=0):
+        """
+        Decode a range of chunks into NumPy arrays
+
+        Args:
+            columns: Column names to decode (default: all of COLUMN_NAMES)
+            first_chunk: First chunk of the range
+            num_chunks: Number of chunks (default: through the last chunk)
+            threads: Decoder threads (0 = one per CPU)
+
+        Returns:
+            dict: column name -> NumPy array with one element per event
+        """
+        columns = _check_columns(columns)
+        total_chunks = self.num_chunks
+        if num_chunks is None:
+            num_chunks = max(total_chunks - first_chunk, 0)
+        if first_chunk < 0 or first_chunk + num_chunks > total_chunks:
+            raise IndexError(f"chunks [{first_chunk}, {first_chunk + num_chunks}) "
+                             f"out of range (trace has {total_chunks})")
+
+        n = 0
+        if num_chunks:
+            first = self.chunk_info(first_chunk)
+            last = self.chunk_info(first_chunk + num_chunks - 1)
+            n = last.first_event + last.n_events - first.first_event
+
+        dtypes = dict(COLUMNS)
+        arrays = {name: np.empty(n, dtype=dtypes[name]) for name in columns}
+        if n:
+            cols = _columns_struct(arrays)
+            got = self._lib.trace_reader_decode_chunks(self._reader, first_chunk, num_chunks,
+                                                       ctypes.byref(cols), threads)
+            if got != n:
+                raise ValueError(f"Malformed chunk in {self.pb_file}")
+        for name in ('is_write', 'is_miss'):
+            if name in arrays:
+                arrays[name] = arrays[name].view(np.bool_)
+        return arrays
+
+    def iter_chunks(self, columns=None):
+        """
+        Yield (first_event, columns) for every chunk in file order
+
+        The arrays are reused between chunks; copy them to keep a chunk.
+        """
+        columns = _check_columns(columns)
+        cap = self._lib.trace_reader_max_chunk_events(self._reader)
+        dtypes = dict(COLUMNS)
+        buffers = {name: np.empty(cap, dtype=dtypes[name]) for name in columns}
+        cols = _columns_struct(buffers)
+
+        for chunk in range(self.num_chunks):
+            n = self._lib.trace_reader_decode_chunk(self._reader, chunk, ctypes.byref(cols))
+            if n < 0:
+                raise ValueError(f"Malformed chunk {chunk} in {self.pb_file}")
+            out = {}
+            for name, buf in buffers.items():
+                view = buf[:n]
+                out[name] = view.view(np.bool_) if name in ('is_write', 'is_miss') else view
+            yield self.chunk_info(chunk).first_event, out
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Decode a protobuf memory trace with the mmap reader and print a summary')
+    parser.add_argument('input', help='Input .pb trace file')
+    parser.add_argument('--threads', type=int, default=0,
+                        help='Decoder threads (default: one per CPU)')
+    parser.add_argument('--no-index-file', action='store_true',
+                        help='Do not load or save <input>.idx')
+    parser.add_argument('--lib', help='Path to libtrace_reader.so')
+    args = parser.parse_args()
+
+    try:
+        start = time.perf_counter()
+        with TraceReader(args.input, use_index_file=not args.no_index_file,
+                         lib_path=args.lib) as trace:
+            cols = trace.to_columns(threads=args.threads)
+            elapsed = time.perf_counter() - start
+
+            n = trace.num_events
+            print(f"Trace:   {args.input}")
+            print(f"Chunks:  {trace.num_chunks}")
+            print(f"Events:  {n}")
+            if n:
+                writes = int(cols['is_write'].sum())
+                misses = int(cols['is_miss'].sum())
+                print(f"Reads:   {n - writes}")
+                print(f"Writes:  {writes}")
+                print(f"Misses:  {misses} ({100.0 * misses / n:.2f}%)")
+                print(f"Threads: {len(np.unique(cols['thread_id']))}")
+                print(f"Time:    {int(cols['timestamp'].min())} - {int(cols['timestamp'].max())}")
+            print(f"Decoded in {elapsed:.3f}s")
+    except (RuntimeError, ValueError) as e:
+        print(f"Error: {e}", file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()